@@ -135,12 +135,252 @@ inline void doAssetLoadTests(size_t &passCounter, size_t &failCounter)
     EXPOP_TEST_VALUE(std::string(data, length), FileSystem::loadFileString("README.org"));
 }
 
+// The old per-letter, substr()-per-chunk base64 functions, kept here
+// to check the table-driven versions against and to benchmark them.
+inline uint32_t referenceBase64DecodeLetter(char c)
+{
+    if(c >= 'A' && c <= 'Z') return c - 'A';
+    if(c >= 'a' && c <= 'z') return (c - 'a') + 26;
+    if(c >= '0' && c <= '9') return (c - '0') + 52;
+    if(c == '+') return 62;
+    if(c == '/') return 63;
+    return 0;
+}
+
+inline uint32_t referenceBase64DecodeChunk(const std::string &chunk)
+{
+    return
+        (referenceBase64DecodeLetter(chunk[0]) << 18) |
+        (referenceBase64DecodeLetter(chunk[1]) << 12) |
+        (referenceBase64DecodeLetter(chunk[2]) << 6) |
+        (referenceBase64DecodeLetter(chunk[3]));
+}
+
+inline std::string referenceBase64Decode(const std::string &str)
+{
+    if(str.size() % 4) {
+        return "";
+    }
+
+    size_t bufSize = (str.size() / 4) * 3;
+    if(str.size() >= 3) {
+        if(str[str.size() - 1] == '=') bufSize--;
+        if(str[str.size() - 2] == '=') bufSize--;
+    }
+
+    std::string buffer(bufSize, 0);
+    size_t dataPtr = 0;
+    for(size_t i = 0; i < str.size(); i += 4) {
+        uint32_t t = referenceBase64DecodeChunk(str.substr(i, 4));
+        for(size_t k = 0; k < 3; k++) {
+            if(dataPtr < bufSize) {
+                buffer[dataPtr] = (t >> ((2 - k) * 8)) & 0xff;
+                dataPtr++;
+            }
+        }
+    }
+
+    return buffer;
+}
+
+inline std::string referenceBase64Encode(const void *buffer, size_t length)
+{
+    static const char strBase64Lookup[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        "abcdefghijklmnopqrstuvwxyz"
+        "0123456789"
+        "+/";
+
+    const unsigned char *ptr = (const unsigned char*)buffer;
+    std::ostringstream ostr;
+    size_t tmpLength = length;
+
+    while(tmpLength) {
+
+        std::ostringstream currentChunkStr;
+        uint32_t nextChunk = 0;
+        for(size_t i = 0; i < 3; i++) {
+            nextChunk |= (uint32_t(*ptr)) << ((2 - i) * 8);
+            ptr++;
+            tmpLength--;
+            if(!tmpLength) break;
+        }
+
+        for(size_t i = 0; i < 4; i++) {
+            currentChunkStr << strBase64Lookup[(nextChunk >> (6 * (3 - i))) & 63];
+        }
+
+        ostr << currentChunkStr.str();
+    }
+
+    std::string ret = ostr.str();
+    if(length % 3 == 1) {
+        ret[ret.size() - 1] = '=';
+        ret[ret.size() - 2] = '=';
+    } else if(length % 3 == 2) {
+        ret[ret.size() - 1] = '=';
+    }
+
+    return ret;
+}
+
+// Deterministic junk for the base64 tests and benchmarks.
+inline std::string makeBase64TestData(size_t length, uint32_t seed)
+{
+    std::string data(length, 0);
+    uint32_t state = seed * 2654435761u + 1;
+    for(size_t i = 0; i < length; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        data[i] = char(state >> 24);
+    }
+    return data;
+}
+
+// Break base64 text into lines, like MIME does.
+inline std::string wrapBase64TestText(const std::string &text, size_t columns)
+{
+    std::string ret;
+    for(size_t i = 0; i < text.size(); i += columns) {
+        ret += text.substr(i, columns);
+        ret += "\r\n";
+    }
+    return ret;
+}
+
 inline void doBase64Tests(size_t &passCounter, size_t &failCounter)
 {
     EXPOP_TEST_VALUE(stringBase64EncodeString("butts"), "YnV0dHM=");
     EXPOP_TEST_VALUE(stringBase64EncodeString("ASDFGBC"), "QVNERkdCQw==");
     EXPOP_TEST_VALUE(stringBase64EncodeString(std::string("\0\0\0\0\0\0\0\0", 8)), "AAAAAAAAAAA=");
     EXPOP_TEST_VALUE(stringBase64EncodeString(std::string("herpy derpy derp")), "aGVycHkgZGVycHkgZGVycA==");
+
+    // Every length up to a few SIMD blocks' worth, at a few
+    // alignments, against the old versions.
+    bool encodeMatches = true;
+    bool decodeMatches = true;
+    bool lengthsExact = true;
+    bool buffersMatch = true;
+    for(size_t length = 0; length < 300; length++) {
+        for(size_t offset = 0; offset < 3; offset++) {
+
+            std::string padded = makeBase64TestData(length + offset, uint32_t(length));
+            const char *data = padded.data() + offset;
+            std::string expected = referenceBase64Encode(data, length);
+
+            std::string encoded = stringBase64Encode(data, length);
+            encodeMatches = encodeMatches && encoded == expected;
+
+            std::string decoded = stringBase64DecodeString(encoded);
+            decodeMatches = decodeMatches &&
+                decoded == std::string(data, length) &&
+                decoded == referenceBase64Decode(encoded);
+
+            lengthsExact = lengthsExact &&
+                stringBase64EncodedLength(length) == encoded.size() &&
+                stringBase64DecodedLength(encoded.data(), encoded.size()) == length;
+
+            // Buffer versions shouldn't touch anything past the end.
+            std::string buffer(encoded.size() + 1, '#');
+            size_t written = stringBase64EncodeToBuffer(data, length, &buffer[0]);
+            buffersMatch = buffersMatch && written == encoded.size() &&
+                buffer == encoded + "#";
+
+            std::string decodeBuffer(length + 1, '#');
+            size_t decodedLength = 0;
+            bool ok = stringBase64DecodeToBuffer(encoded.data(), encoded.size(), &decodeBuffer[0], decodedLength);
+            buffersMatch = buffersMatch && ok && decodedLength == length &&
+                decodeBuffer == std::string(data, length) + "#";
+        }
+    }
+    EXPOP_TEST_VALUE(encodeMatches, true);
+    EXPOP_TEST_VALUE(decodeMatches, true);
+    EXPOP_TEST_VALUE(lengthsExact, true);
+    EXPOP_TEST_VALUE(buffersMatch, true);
+
+    // Streaming, split into pieces of every size.
+    std::string data = makeBase64TestData(1000, 1234);
+    std::string encoded = stringBase64Encode(data.data(), data.size());
+    bool streamMatches = true;
+    for(size_t pieceSize = 1; pieceSize < 80; pieceSize++) {
+
+        StringBase64Encoder encoder;
+        std::string streamEncoded;
+        for(size_t i = 0; i < data.size(); i += pieceSize) {
+            size_t n = std::min(pieceSize, data.size() - i);
+            std::string chunk(StringBase64Encoder::getMaxOutputLength(n), 0);
+            chunk.resize(encoder.update(data.data() + i, n, &chunk[0]));
+            streamEncoded += chunk;
+        }
+        char tail[4];
+        streamEncoded.append(tail, encoder.finish(tail));
+        streamMatches = streamMatches && streamEncoded == encoded;
+
+        StringBase64Decoder decoder;
+        std::string streamDecoded;
+        for(size_t i = 0; i < encoded.size(); i += pieceSize) {
+            size_t n = std::min(pieceSize, encoded.size() - i);
+            std::string chunk(StringBase64Decoder::getMaxOutputLength(n), 0);
+            size_t written = 0;
+            streamMatches = streamMatches && decoder.update(encoded.data() + i, n, &chunk[0], written);
+            chunk.resize(written);
+            streamDecoded += chunk;
+        }
+        streamMatches = streamMatches && decoder.finish() && streamDecoded == data;
+    }
+    EXPOP_TEST_VALUE(streamMatches, true);
+
+    // Whitespace only gets through when it's asked for.
+    std::string wrapped = wrapBase64TestText(encoded, 76);
+    std::string decoded;
+    EXPOP_TEST_VALUE(stringBase64DecodeAppend(wrapped.data(), wrapped.size(), decoded), false);
+    EXPOP_TEST_VALUE(decoded.size(), size_t(0));
+    EXPOP_TEST_VALUE(
+        stringBase64DecodeAppend(wrapped.data(), wrapped.size(), decoded, BASE64WHITESPACE_SKIP), true);
+    EXPOP_TEST_VALUE(decoded == data, true);
+    EXPOP_TEST_VALUE(
+        stringBase64DecodedLength(wrapped.data(), wrapped.size(), BASE64WHITESPACE_SKIP), data.size());
+
+    std::string spaced = " YnV0\tdHM =\n";
+    decoded.clear();
+    EXPOP_TEST_VALUE(stringBase64DecodeAppend(spaced.data(), spaced.size(), decoded, BASE64WHITESPACE_SKIP), true);
+    EXPOP_TEST_VALUE(decoded, "butts");
+    EXPOP_TEST_VALUE(stringBase64DecodedLength(spaced.data(), spaced.size(), BASE64WHITESPACE_SKIP), size_t(5));
+
+    // Broken input.
+    const char *invalid[] = {
+        "A", "AB", "ABC", "AB=C", "A===", "=AAA", "AAAA=", "AA==AA==",
+        "AAA*", "AAA\xc3", "AAAA AAA", "AB==C", "AAA=A"
+    };
+    bool allRejected = true;
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        std::string str = invalid[i];
+        unsigned int length = 123;
+        unsigned char *buf = stringBase64Decode(str, &length);
+        allRejected = allRejected && !buf && !length;
+        delete[] buf;
+        allRejected = allRejected && stringBase64DecodeString(str) == "";
+    }
+    EXPOP_TEST_VALUE(allRejected, true);
+
+    // Every character, in every spot of a group.
+    bool lettersMatch = true;
+    for(size_t c = 0; c < 256; c++) {
+        const bool isLetter = isalnum(int(c)) || c == '+' || c == '/';
+        for(size_t pos = 0; pos < 4; pos++) {
+            std::string str = "QUJD";
+            str[pos] = char(c);
+            std::string out;
+            bool ok = stringBase64DecodeAppend(str.data(), str.size(), out);
+            bool expectOk = isLetter || (c == '=' && pos == 3);
+            lettersMatch = lettersMatch && ok == expectOk;
+            if(ok && isLetter) {
+                lettersMatch = lettersMatch && out == referenceBase64Decode(str);
+            }
+        }
+    }
+    EXPOP_TEST_VALUE(lettersMatch, true);
 }
 
 inline void doHttpTests(size_t &passCounter, size_t &failCounter)
@@ -169,293 +409,4861 @@ inline void doStringTests(size_t &passCounter, size_t &failCounter)
     EXPOP_TEST_VALUE(stringReplace<char>("DICKBUTTASDF", "BOOBS", "DICKBUTT"), "DICKBUTT");
 }
 
-inline void doRC4Tests(size_t &passCounter, size_t &failCounter)
+// The old strchr() and std::string versions of stringTokenize() and
+// fixFileName(), kept here to check the StringView versions against
+// and to benchmark them.
+inline void referenceStringTokenize(
+    const std::string &str, const std::string &delims,
+    std::vector<std::string> &tokens, bool allowEmpty)
 {
-    {
-        // This is a small example from the CipherSaber page, but
-        // split up so we have the initialization vector already as
-        // part of the key.
-        static const unsigned char cstest1[] = {
-            'a', 's', 'd', 'f', 'g',
-            0x6f, 0x6d, 0x0b, 0xab, 0xf3, 0xaa, 0x67, 0x19, 0x03, 0x15,
-        };
+    size_t i = 0;
+    while(i < str.size()) {
 
-        // And the actual ciphertext.
-        unsigned char cstest2[] = {
-            0x30, 0xed, 0xb6, 0x77, 0xca, 0x74, 0xe0, 0x08, 0x9d, 0xd0,
-            0xe7, 0xb8, 0x85, 0x43, 0x56, 0xbb, 0x14, 0x48, 0xe3, 0x7c,
-            0xdb, 0xef, 0xe7, 0xf3, 0xa8, 0x4f, 0x4f, 0x5f, 0xb3, 0xfd, 0
-        };
+        bool firstDelim = true;
 
-        ExPop::CryptoRC4 rc4;
-        rc4.setKey(cstest1, 15);
-        rc4.encrypt(cstest2, sizeof(cstest2) - 1);
-        EXPOP_TEST_VALUE(std::string((char*)cstest2), std::string("This is a test of CipherSaber."));
+        // Skip over delimeters.
+        while(i < str.size() && strchr(delims.c_str(), str[i])) {
+            i++;
+
+            if(!firstDelim && allowEmpty) {
+                tokens.push_back("");
+            }
+
+            firstDelim = false;
+        }
+
+        // Mark the start of a token.
+        int tokStart = i;
+
+        // Skip to the next delimeter.
+        while(i < str.size() && !strchr(delims.c_str(), str[i])) {
+            i++;
+        }
+
+        // Mark the end.
+        int tokEnd = i;
+
+        // Copy the token.
+        if(tokStart != tokEnd) {
+            std::string token = str.substr(tokStart, (tokEnd - tokStart));
+            tokens.push_back(token);
+        }
     }
+}
 
-    {
-        ExPop::CryptoRC4 rc4;
-        rc4.setKey("dickbutt");
+inline std::string referenceFixFileName(const std::string &str)
+{
+    // Split the path into directories and the filename.
+    std::vector<std::string> fileNameParts;
+    referenceStringTokenize(str, "\\/", fileNameParts, false);
 
-        std::string base = "herpy derpy derp";
-        std::string encrypted = stringBase64EncodeString(rc4.encrypt(base));
+    std::ostringstream outStr;
 
-        rc4 = CryptoRC4();
-        rc4.setKey("dickbutt");
-        std::string decrypted = rc4.encrypt(stringBase64DecodeString(encrypted));
+    // For ".." going above the current directory.
+    int numHigherDirectories = 0;
 
-        EXPOP_TEST_VALUE(decrypted, base);
-        EXPOP_TEST_VALUE(encrypted, "ZlX9S9jQTFeMnmaTshss4Q==");
+    for(unsigned int i = 0; i < fileNameParts.size(); i++) {
+
+        if(fileNameParts[i] == ".") {
+
+            // "." for the current directory. Just drop these from
+            // the list. They're redundant.
+
+            fileNameParts.erase(fileNameParts.begin() + i);
+            i--;
+
+        } else if(fileNameParts[i] == "..") {
+
+            // ".." for previous directory. Remove this one and the one
+            // before it, UNLESS it's the first one, in which case it's
+            // a directory above the current one.
+
+            if(i == 0) {
+
+                // Top level. Remove this directory and count how
+                // far we've gone above the current directory.
+                numHigherDirectories++;
+                fileNameParts.erase(fileNameParts.begin());
+
+                // I know this will cause the unsigned int to wrap
+                // around, but it'll wrap back when it increments
+                // again. Please don't kill me.
+                i--;
+
+            } else {
+
+                // Remove the previous directory.
+                fileNameParts.erase(fileNameParts.begin() + (i-1));
+
+                // Remove THIS directory.
+                fileNameParts.erase(fileNameParts.begin() + (i-1));
+
+                // Unsigned weirdness: We're at at least 1 here, so
+                // the most this can do is wrap around for -1. The
+                // next iteration of the for loop will bring it back
+                // to zero.
+                i -= 2;
+            }
+        }
+    }
+
+    for(int i = 0; i < numHigherDirectories; i++) {
+        // Add "../" for as many directories we ended up going
+        // above the current one.
+        outStr << "../";
+    }
+
+    for(unsigned int i = 0; i < fileNameParts.size(); i++) {
+        // Add the current name.
+        outStr << fileNameParts[i];
+
+        // If this isn't the last one, then it's not at the file
+        // name yet.
+        if(i != fileNameParts.size() - 1) {
+            outStr << "/";
+        }
+    }
+
+    std::string ret = outStr.str();
+
+    // Little hack to restore the root slash that we may have
+    // dropped in the tokenization stage.
+    if(str.size() && str[0] == '/') {
+        ret = "/" + ret;
     }
+
+    return ret;
 }
 
-struct ThreadTestData
+inline void doStringTokenizerTests(size_t &passCounter, size_t &failCounter)
 {
-    ExPop::Threads::ThreadId id;
-    size_t *passCounter;
-    size_t *failCounter;
-    bool goAhead;
-};
+    // Every short string made of a few delimiters and letters, with
+    // and without empty tokens, against the old version.
+    const char alphabet[] = { 'a', '.', '/', '\\', ',' };
+    const char *delimSets[] = { "/", "/\\", ",/", "", "//" };
+    bool matchesOld = true;
+    for(size_t length = 0; length <= 5; length++) {
+
+        size_t combinations = 1;
+        for(size_t i = 0; i < length; i++) {
+            combinations *= sizeof(alphabet);
+        }
 
-void sleepWrapper(uint32_t time)
+        for(size_t n = 0; n < combinations; n++) {
+
+            std::string str;
+            size_t digits = n;
+            for(size_t i = 0; i < length; i++) {
+                str += alphabet[digits % sizeof(alphabet)];
+                digits /= sizeof(alphabet);
+            }
+
+            for(size_t d = 0; d < sizeof(delimSets) / sizeof(delimSets[0]); d++) {
+                for(int allowEmpty = 0; allowEmpty < 2; allowEmpty++) {
+
+                    std::vector<std::string> expected;
+                    std::vector<std::string> tokens;
+                    std::vector<StringView> views;
+                    referenceStringTokenize(str, delimSets[d], expected, allowEmpty);
+                    stringTokenize(str, delimSets[d], tokens, allowEmpty);
+                    stringTokenize(StringView(str), StringDelimiterSet(delimSets[d]), views, allowEmpty);
+
+                    matchesOld = matchesOld && tokens == expected && views.size() == expected.size();
+                    for(size_t i = 0; matchesOld && i < views.size(); i++) {
+                        matchesOld = views[i] == expected[i];
+                    }
+                }
+            }
+
+            matchesOld = matchesOld && FileSystem::fixFileName(str) == referenceFixFileName(str);
+        }
+    }
+    EXPOP_TEST_VALUE(matchesOld, true);
+
+    // Views point into the original string.
+    std::string path = "/usr//local/bin";
+    std::vector<StringView> parts;
+    stringTokenize(path, "/", parts);
+    EXPOP_TEST_VALUE(parts.size(), size_t(3));
+    EXPOP_TEST_VALUE(parts[1], StringView("local"));
+    EXPOP_TEST_VALUE(parts[1].data(), path.data() + 6);
+
+    // Pulling tokens one at a time.
+    StringTokenizer tokenizer("a,b,,c", ",", true);
+    StringView token;
+    std::string joined;
+    while(tokenizer.next(token)) {
+        joined += "[" + token.str() + "]";
+    }
+    EXPOP_TEST_VALUE(joined, "[a][b][][c]");
+
+    // View version of stringSplit().
+    StringView left, right;
+    stringSplit(StringView("key=value=more"), StringView("="), left, right);
+    EXPOP_TEST_VALUE(left, StringView("key"));
+    EXPOP_TEST_VALUE(right, StringView("value=more"));
+    stringSplit(StringView("key=value=more"), StringView("="), left, right, true);
+    EXPOP_TEST_VALUE(left, StringView("key=value"));
+    EXPOP_TEST_VALUE(right, StringView("more"));
+    stringSplit(StringView("key"), StringView("=="), left, right);
+    EXPOP_TEST_VALUE(left, StringView("key"));
+    EXPOP_TEST_VALUE(right.empty(), true);
+    stringSplit(StringView("key"), StringView("=="), left, right, true);
+    EXPOP_TEST_VALUE(left.empty(), true);
+    EXPOP_TEST_VALUE(right, StringView("key"));
+
+    // Path functions.
+    EXPOP_TEST_VALUE(FileSystem::fixFileName("/a/./b/../c//d\\e"), "/a/c/d/e");
+    EXPOP_TEST_VALUE(FileSystem::fixFileName("../a/../../b"), "../../b");
+    EXPOP_TEST_VALUE(FileSystem::makeRelativePath(FileSystem::getCwd() + "/foo/bar"), "foo/bar");
+    EXPOP_TEST_VALUE(FileSystem::makeRelativePath(FileSystem::getCwd()), "");
+
+    std::vector<std::string> files = { "a.png", "b.jpg", "c.txt", "png", ".png", "d.jpeg" };
+    std::vector<std::string> filtered;
+    FileSystem::filterFileListByType("png, jpg", files, filtered);
+    EXPOP_TEST_VALUE(filtered.size(), size_t(3));
+    EXPOP_TEST_VALUE(filtered[0], "a.png");
+    EXPOP_TEST_VALUE(filtered[1], "b.jpg");
+    EXPOP_TEST_VALUE(filtered[2], ".png");
+}
+
+// The old ostringstream and append-per-character versions of the
+// escaping and replacement functions, kept here to check the
+// preallocating versions against and to benchmark them.
+template<typename T>
+inline std::basic_string<T> referenceStringEscape(
+    const std::basic_string<T> &str,
+    bool replaceNewlines)
 {
-  #if _WIN32
-    Sleep(time / 1000);
-  #else
-    usleep(time);
-  #endif
+    std::basic_ostringstream<T> outStr;
+
+    for(size_t i = 0; i < str.size(); i++) {
+
+        switch(str[i]) {
+
+            case '"':
+                outStr << '\\' << '\"';
+                break;
+
+            case '\\':
+                outStr << '\\' << '\\';
+                break;
+
+            case '\n':
+                if(replaceNewlines) {
+                    outStr << '\\' << 'n';
+                } else {
+                    outStr << str[i];
+                }
+                break;
+
+            case '\r':
+                outStr << '\\' << 'r';
+                break;
+
+            case '\e':
+                outStr << '\\' << 'e';
+                break;
+
+            default:
+                outStr << str[i];
+                break;
+        }
+
+    }
+
+    return outStr.str();
 }
 
-void doThreadTests_thread(void *data)
+inline std::string referenceStringXmlEscape(const std::string &str)
 {
-    ThreadTestData *testData = (ThreadTestData*)data;
+    std::ostringstream outStr;
 
-    ExPop::Threads::ThreadId thisId = ExPop::Threads::getMyId();
-    size_t &passCounter = *testData->passCounter;
-    size_t &failCounter = *testData->failCounter;
+    for(size_t i = 0; i < str.size(); i++) {
+
+        switch(str[i]) {
+
+            case '"':
+                outStr << "&quot;";
+                break;
+
+            case '<':
+                outStr << "&lt;";
+                break;
+
+            case '>':
+                outStr << "&gt;";
+                break;
+
+            case '&':
+                outStr << "&amp;";
+                break;
+
+            default:
+                outStr << str[i];
+                break;
+        }
+    }
+
+    return outStr.str();
+}
+
+inline void referenceStrEncodeHex(const void *buf, int length, std::string &str, int columns)
+{
+    str.resize((length * 2) + ((length * 2) / columns), 0);
+
+    int strPos = 0;
+    int lineCounter = 0;
+    const char *cbuf = (const char *)buf;
+
+    for(int i = 0; i < length; i++) {
+        str[strPos++] = stringNibbleToHex((cbuf[i] & 0xf0) >> 4);
+        str[strPos++] = stringNibbleToHex((cbuf[i] & 0x0f));
+
+        lineCounter += 2;
+
+        if(lineCounter > columns) {
+            str[strPos++] = '\n';
+            lineCounter = 0;
+        }
+    }
+
+    str.resize(strPos);
+}
+
+template<typename T>
+inline std::basic_string<T> referenceStringReplace(
+    const std::basic_string<T> &stringToReplace,
+    const std::basic_string<T> &replacement,
+    const std::basic_string<T> &sourceText)
+{
+    if(stringToReplace.size() > sourceText.size()) {
+        return sourceText;
+    }
+
+    std::basic_string<T> output;
+    for(size_t i = 0; i < sourceText.size(); i++) {
+        if(stringCompareOffset(stringToReplace, sourceText, i)) {
+            output = output + replacement;
+            i += stringToReplace.size() - 1;
+        } else {
+            output = output + sourceText.substr(i, 1);
+        }
+    }
+
+    return output;
+}
+
+inline std::string referenceUrlEncode(const std::string &data)
+{
+    const char *hexTable = "0123456789ABCDEF";
+    std::ostringstream ostr;
+    for(size_t i = 0; i < data.size(); i++) {
+
+        if(data[i] == '-' || data[i] == '.' || data[i] == '_' ||
+            (data[i] >= 'A' && data[i] <= 'Z') ||
+            (data[i] >= 'a' && data[i] <= 'z') ||
+            (data[i] >= '0' && data[i] <= '9'))
+        {
+            ostr << data[i];
+        } else {
+            ostr << "%" << hexTable[uint8_t(data[i]) >> 4] << hexTable[uint8_t(data[i]) & 0xf];
+        }
+
+    }
+
+    return ostr.str();
+}
+
+inline void doStringTransformTests(size_t &passCounter, size_t &failCounter)
+{
+    // Every short string made of characters that get escaped, some
+    // that don't, and some high bytes, against the old versions.
+    const char alphabet[] = { 'a', '"', '\\', '\n', '\r', '\e', '<', '&', '%', ' ', '\xe9' };
+    bool escapeMatches = true;
+    bool xmlMatches = true;
+    bool urlMatches = true;
+    bool hexMatches = true;
+    bool replaceMatches = true;
+    const char *needles[] = { "a", "aa", "\"a", "a\\a", " " };
+    const char *replacements[] = { "", "b", "<<>>" };
+
+    for(size_t length = 0; length <= 4; length++) {
+
+        size_t combinations = 1;
+        for(size_t i = 0; i < length; i++) {
+            combinations *= sizeof(alphabet);
+        }
+
+        for(size_t n = 0; n < combinations; n++) {
+
+            std::string str;
+            size_t digits = n;
+            for(size_t i = 0; i < length; i++) {
+                str += alphabet[digits % sizeof(alphabet)];
+                digits /= sizeof(alphabet);
+            }
+
+            escapeMatches = escapeMatches &&
+                stringEscape(str, true) == referenceStringEscape(str, true) &&
+                stringEscape(str, false) == referenceStringEscape(str, false);
+
+            xmlMatches = xmlMatches && stringXmlEscape(str) == referenceStringXmlEscape(str);
+            urlMatches = urlMatches && urlEncode(str) == referenceUrlEncode(str);
+
+            for(int columns = 1; columns <= 5; columns++) {
+                std::string hex;
+                std::string expected;
+                strEncodeHex(str.data(), int(str.size()), hex, columns);
+                referenceStrEncodeHex(str.data(), int(str.size()), expected, columns);
+                hexMatches = hexMatches && hex == expected;
+            }
+
+            for(size_t r = 0; r < sizeof(needles) / sizeof(needles[0]); r++) {
+                for(size_t p = 0; p < sizeof(replacements) / sizeof(replacements[0]); p++) {
+                    replaceMatches = replaceMatches &&
+                        stringReplace<char>(needles[r], replacements[p], str) ==
+                        referenceStringReplace<char>(needles[r], replacements[p], str);
+                }
+            }
+        }
+    }
+
+    EXPOP_TEST_VALUE(escapeMatches, true);
+    EXPOP_TEST_VALUE(xmlMatches, true);
+    EXPOP_TEST_VALUE(urlMatches, true);
+    EXPOP_TEST_VALUE(hexMatches, true);
+    EXPOP_TEST_VALUE(replaceMatches, true);
+
+    // Wide strings go through the same template.
+    const std::string narrow = "\"caf\xc3\xa9\"\n\xf0\x9f\x98\x80";
+    std::basic_string<uint32_t> wide = stringUTF8ToUTF32(narrow);
+    EXPOP_TEST_VALUE(stringEscape(wide) == stringUTF8ToUTF32(referenceStringEscape(narrow, true)), true);
+    EXPOP_TEST_VALUE(
+        stringReplace(stringUTF8ToUTF32("\xc3\xa9"), stringUTF8ToUTF32("e"), wide) ==
+        referenceStringReplace(stringUTF8ToUTF32("\xc3\xa9"), stringUTF8ToUTF32("e"), wide), true);
+
+    // Hex with the default column count, across line breaks.
+    std::string bytes;
+    for(size_t i = 0; i < 300; i++) {
+        bytes += char(i * 7);
+    }
+    std::string hex;
+    std::string expectedHex;
+    strEncodeHex(bytes.data(), int(bytes.size()), hex);
+    referenceStrEncodeHex(bytes.data(), int(bytes.size()), expectedHex, 80);
+    EXPOP_TEST_VALUE(hex, expectedHex);
+
+    // The append versions leave what's already there alone.
+    std::string out = "prefix:";
+    stringEscapeAppend(std::string("a\"b"), out);
+    stringXmlEscapeAppend("<x>", out);
+    urlEncodeAppend("a b", out);
+    strEncodeHexAppend("\x01\xff", 2, out);
+    stringReplaceAppend<char>("o", "0", "foo", out);
+    EXPOP_TEST_VALUE(out, "prefix:a\\\"b&lt;x&gt;a%20b01fff00");
+
+    out = "unchanged";
+    stringXmlEscapeAppend("", out);
+    urlEncodeAppend("", out);
+    strEncodeHexAppend("", 0, out);
+    stringReplaceAppend<char>("long needle", "x", "short", out);
+    EXPOP_TEST_VALUE(out, "unchangedshort");
+}
+
+// The old tokenize-then-ostringstream versions of stringWordWrap(),
+// stringIndent() and stringPrefixLines(), kept here to check the new
+// ones against and to benchmark them.
+inline std::string referenceStringWordWrap(
+    const std::string &str,
+    unsigned int columns,
+    unsigned int columnsAfterFirstLine)
+{
+    std::vector<std::string> words;
+    std::ostringstream outStr;
+    unsigned int thisLineLength = 0;
+    bool firstLine = true;
+    bool firstWordOnLine = true;
+
+    if(!columnsAfterFirstLine) columnsAfterFirstLine = columns;
+
+    referenceStringTokenize(str, " \t\r\n", words, false);
+
+    for(unsigned int i = 0; i < words.size(); i++) {
+
+        std::string strippedWord = stripVT100(words[i]);
+
+        if(thisLineLength != 0 && strippedWord.size() +
+            thisLineLength >= (firstLine ? columns : columnsAfterFirstLine))
+        {
+            outStr << std::endl;
+            thisLineLength = 0;
+            firstLine = false;
+            firstWordOnLine = true;
+        }
+
+        if(!firstWordOnLine) {
+            outStr << " ";
+            thisLineLength++;
+        } else {
+            firstWordOnLine = false;
+        }
+
+        outStr << words[i];
+        thisLineLength += strippedWord.size();
+    }
+
+    return outStr.str();
+}
+
+inline std::string referenceStringIndent(
+    const std::string &str,
+    unsigned int firstRow,
+    unsigned int afterFirstRow)
+{
+    std::vector<std::string> lines;
+    std::ostringstream outStr;
+
+    referenceStringTokenize(str, "\n", lines, false);
+
+    for(size_t i = 0; i < lines.size(); i++) {
+
+        unsigned int j = 0;
+        while(j < lines[i].size() && isWhiteSpace(lines[i][j])) {
+            j++;
+        }
+
+        if(i != 0) outStr << std::endl;
+
+        if(j < lines[i].size()) {
+            unsigned int dstLen = (i == 0) ? firstRow : afterFirstRow;
+            for(unsigned int k = 0; k < dstLen; k++) {
+                outStr << " ";
+            }
+            outStr << lines[i].substr(j);
+        }
+    }
+
+    return outStr.str();
+}
+
+inline std::string referenceStringPrefixLines(
+    const std::string &str,
+    const std::string &prefix)
+{
+    std::ostringstream outStr;
+    std::vector<std::string> lines;
+
+    referenceStringTokenize(str, "\n", lines, true);
+
+    for(unsigned int i = 0; i < lines.size(); i++) {
+        outStr << prefix << lines[i];
+        if(i != lines.size() - 1) {
+            outStr << std::endl;
+        }
+    }
+
+    return outStr.str();
+}
+
+// Join wrapped lines back up with newlines, to compare against
+// expected output.
+template<typename T>
+inline std::basic_string<T> joinWrappedLines(
+    const std::basic_string<T> &text,
+    const std::vector<StringWrappedLine> &lines)
+{
+    std::basic_string<T> ret;
+    for(size_t i = 0; i < lines.size(); i++) {
+        if(i) ret.append(1, '\n');
+        ret.append(text, lines[i].begin, lines[i].end - lines[i].begin);
+    }
+    return ret;
+}
+
+inline void doWordWrapTests(size_t &passCounter, size_t &failCounter)
+{
+    // Every short string of words, spaces, newlines and color codes,
+    // against the old versions. The wrapper gives the same lines as
+    // stringWordWrap() when words are separated by single spaces.
+    const char *alphabet[] = { "a", "bbb", " ", "  ", "\n", "\t", "\x1b[31m" };
+    const size_t alphabetSize = sizeof(alphabet) / sizeof(alphabet[0]);
+    bool wrapMatches = true;
+    bool indentMatches = true;
+    bool prefixMatches = true;
+    bool wrapperMatches = true;
+    bool widthsInLimit = true;
+
+    for(size_t length = 0; length <= 5; length++) {
+
+        size_t combinations = 1;
+        for(size_t i = 0; i < length; i++) {
+            combinations *= alphabetSize;
+        }
+
+        for(size_t n = 0; n < combinations; n++) {
+
+            std::string str;
+            size_t digits = n;
+            for(size_t i = 0; i < length; i++) {
+                str += alphabet[digits % alphabetSize];
+                digits /= alphabetSize;
+            }
+
+            for(unsigned int columns = 1; columns <= 6; columns++) {
+
+                const std::string wrapped = stringWordWrap(str, columns, columns > 2 ? columns - 2 : 0);
+                wrapMatches = wrapMatches &&
+                    wrapped == referenceStringWordWrap(str, columns, columns > 2 ? columns - 2 : 0);
+
+                std::vector<StringWrappedLine> lines;
+                if(str.find('\x1b') == std::string::npos) {
+                    stringWordWrapLines(wrapped, columns, 0, lines);
+                    wrapperMatches = wrapperMatches && joinWrappedLines(wrapped, lines) == wrapped;
+                }
+
+                lines.clear();
+                stringWordWrapLines(str, columns, 0, lines);
+                for(size_t i = 0; i < lines.size(); i++) {
+
+                    // Lines only go over when there's one word on
+                    // them, maybe after some indentation.
+                    size_t wordStart = lines[i].begin;
+                    while(wordStart < lines[i].end && (str[wordStart] == ' ' || str[wordStart] == '\t')) {
+                        wordStart++;
+                    }
+                    size_t width = 0;
+                    stringWordWrap_measureWord(str.data(), lines[i].end, wordStart, true, width);
+                    bool oneWord = (wordStart - lines[i].begin) + width == lines[i].width;
+                    widthsInLimit = widthsInLimit && (lines[i].width <= columns || oneWord);
+                }
+            }
+
+            indentMatches = indentMatches &&
+                stringIndent(str, 1, 3) == referenceStringIndent(str, 1, 3);
+            prefixMatches = prefixMatches &&
+                stringPrefixLines(str, "> ") == referenceStringPrefixLines(str, "> ");
+        }
+    }
+
+    EXPOP_TEST_VALUE(wrapMatches, true);
+    EXPOP_TEST_VALUE(indentMatches, true);
+    EXPOP_TEST_VALUE(prefixMatches, true);
+    EXPOP_TEST_VALUE(wrapperMatches, true);
+    EXPOP_TEST_VALUE(widthsInLimit, true);
+
+    // Offsets and widths. Spacing inside a line stays, whitespace at
+    // wrap points goes, and color codes take no room.
+    std::string text = "one  two \x1b[1;31mthree\x1b[0m four\n\n  indented";
+    std::vector<StringWrappedLine> lines;
+    stringWordWrapLines(text, 14, 0, lines);
+    EXPOP_TEST_VALUE(lines.size(), size_t(4));
+    EXPOP_TEST_VALUE(text.substr(lines[0].begin, lines[0].end - lines[0].begin), "one  two \x1b[1;31mthree\x1b[0m");
+    EXPOP_TEST_VALUE(lines[0].width, size_t(14));
+    EXPOP_TEST_VALUE(text.substr(lines[1].begin, lines[1].end - lines[1].begin), "four");
+    EXPOP_TEST_VALUE(lines[2].begin == lines[2].end, true);
+    EXPOP_TEST_VALUE(text.substr(lines[3].begin, lines[3].end - lines[3].begin), "  indented");
+    EXPOP_TEST_VALUE(lines[3].width, size_t(10));
+
+    // Narrower lines after the first, and an over-long word.
+    lines.clear();
+    stringWordWrapLines(std::string("aa bb cc dddddddd e"), 5, 2, lines);
+    EXPOP_TEST_VALUE(joinWrappedLines(std::string("aa bb cc dddddddd e"), lines), "aa bb\ncc\ndddddddd\ne");
+
+    // UTF-8 counts code points, UTF-32 counts characters, and
+    // single-byte mode counts bytes.
+    std::string utf8 = "caf\xc3\xa9 na\xc3\xafve \xf0\x9f\x98\x80!";
+    lines.clear();
+    stringWordWrapLines(utf8, 10, 0, lines);
+    EXPOP_TEST_VALUE(lines.size(), size_t(2));
+    EXPOP_TEST_VALUE(lines[0].width, size_t(10));
+    EXPOP_TEST_VALUE(lines[1].width, size_t(2));
+
+    std::basic_string<uint32_t> utf32 = stringUTF8ToUTF32(utf8);
+    std::vector<StringWrappedLine> lines32;
+    stringWordWrapLines(utf32, 10, 0, lines32);
+    EXPOP_TEST_VALUE(joinWrappedLines(utf32, lines32) == stringUTF8ToUTF32("caf\xc3\xa9 na\xc3\xafve\n\xf0\x9f\x98\x80!"), true);
+
+    lines.clear();
+    stringWordWrapLines(utf8, 10, 0, lines, false);
+    EXPOP_TEST_VALUE(lines.size(), size_t(3));
+
+    // Pulling lines one at a time, with a trailing newline.
+    StringWordWrapper<char> wrapper("x y\n", 4, 80);
+    StringWrappedLine line;
+    size_t count = 0;
+    while(wrapper.next(line)) {
+        count++;
+    }
+    EXPOP_TEST_VALUE(count, size_t(2));
+
+    StringWordWrapper<char> emptyWrapper("", 0, 80);
+    EXPOP_TEST_VALUE(emptyWrapper.next(line), false);
+
+    // No limit.
+    lines.clear();
+    stringWordWrapLines(std::string("a b c"), 0, 0, lines);
+    EXPOP_TEST_VALUE(lines.size(), size_t(1));
+}
+
+inline void doUTF8Tests(size_t &passCounter, size_t &failCounter)
+{
+    // Round trips through every kind of code point, at offsets that
+    // put them inside and between the 16-byte ASCII blocks.
+    const uint32_t samples[] = { 'a', 0x7f, 0x80, 0xe9, 0x7ff, 0x800, 0x4e2d, 0xd7ff, 0xe000, 0xffff, 0x10000, 0x1f600, 0x10ffff };
+    bool roundTripOk = true;
+    bool matchesOld = true;
+    for(size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        for(size_t offset = 0; offset < 40; offset++) {
+
+            std::basic_string<uint32_t> utf32(offset, uint32_t('x'));
+            utf32 += samples[s];
+            utf32 += std::basic_string<uint32_t>(20, uint32_t('y'));
+
+            std::string utf8;
+            std::basic_string<uint32_t> back;
+            roundTripOk = roundTripOk && stringUTF32ToUTF8Checked(utf32, utf8);
+            roundTripOk = roundTripOk && stringValidateUTF8(utf8.data(), utf8.size());
+            roundTripOk = roundTripOk && stringUTF8CountCodePoints(utf8.data(), utf8.size()) == utf32.size();
+            roundTripOk = roundTripOk && stringUTF8ToUTF32Checked(utf8, back) && back == utf32;
+            roundTripOk = roundTripOk && stringUTF32ToUTF8(utf32) == utf8 && stringUTF8ToUTF32(utf8) == utf32;
+
+            // The old decoder was fine for valid input.
+            matchesOld = matchesOld && stringUTF8ToUTF32_lenient(utf8) == utf32;
+        }
+    }
+    EXPOP_TEST_VALUE(roundTripOk, true);
+    EXPOP_TEST_VALUE(matchesOld, true);
+
+    // Known encodings.
+    EXPOP_TEST_VALUE(stringUTF32ToUTF8(std::basic_string<uint32_t>(1, 0x4e2d)), "\xe4\xb8\xad");
+    EXPOP_TEST_VALUE(stringUTF32ToUTF8(std::basic_string<uint32_t>(1, 0x1f600)), "\xf0\x9f\x98\x80");
+
+    // Bad input, with the bad part after a full ASCII block.
+    struct BadUTF8 { const char *str; size_t errorPosition; };
+    const BadUTF8 badUTF8[] = {
+        { "\x80", 0 },                 // Stray continuation byte.
+        { "\xc0\x80", 0 },             // Overlong.
+        { "\xc2", 0 },                 // Cut off.
+        { "\xe0\x80\x80", 0 },         // Overlong.
+        { "\xe4\xb8", 0 },             // Cut off.
+        { "\xe4\x41\xad", 0 },         // Not a continuation byte.
+        { "\xed\xa0\x80", 0 },         // Surrogate.
+        { "\xf0\x80\x80\x80", 0 },     // Overlong.
+        { "\xf4\x90\x80\x80", 0 },     // Past U+10FFFF.
+        { "\xf5\x80\x80\x80", 0 },     // Past U+10FFFF.
+        { "\xc3\xa9\xa9", 2 },         // Extra continuation byte.
+    };
+    bool badUTF8Ok = true;
+    for(size_t i = 0; i < sizeof(badUTF8) / sizeof(badUTF8[0]); i++) {
+        std::string str = std::string(20, 'a') + badUTF8[i].str + "bb";
+        size_t validateError = 0;
+        size_t convertError = 0;
+        std::basic_string<uint32_t> out;
+        badUTF8Ok = badUTF8Ok &&
+            !stringValidateUTF8(str.data(), str.size(), &validateError) &&
+            validateError == 20 + badUTF8[i].errorPosition &&
+            !stringUTF8ToUTF32Checked(str, out, &convertError) &&
+            convertError == validateError &&
+            out.empty();
+
+        // The unchecked version still gives back something.
+        badUTF8Ok = badUTF8Ok && stringUTF8ToUTF32(str).size() > 20;
+    }
+    EXPOP_TEST_VALUE(badUTF8Ok, true);
+
+    // Bad UTF-32.
+    std::basic_string<uint32_t> badUTF32(30, uint32_t('a'));
+    badUTF32[17] = 0xdc00;
+    std::string out;
+    size_t errorPosition = 0;
+    size_t utf8Length = 0;
+    EXPOP_TEST_VALUE(stringUTF32MeasureUTF8(badUTF32.data(), badUTF32.size(), utf8Length, &errorPosition), false);
+    EXPOP_TEST_VALUE(errorPosition, size_t(17));
+    badUTF32[17] = 0x110000;
+    EXPOP_TEST_VALUE(stringUTF32ToUTF8Checked(badUTF32, out, &errorPosition), false);
+    EXPOP_TEST_VALUE(errorPosition, size_t(17));
+    EXPOP_TEST_VALUE(stringUTF32ToUTF8(badUTF32).size() > 30, true);
+}
+
+// The plain loops the generic Matrix code uses, so the SIMD
+// specialisations can be checked for bit-identical results.
+template<unsigned int ROWS, unsigned int SHARED, unsigned int COLS>
+inline Matrix<float, ROWS, COLS> referenceMatrixMultiply(
+    const Matrix<float, ROWS, SHARED> &a,
+    const Matrix<float, SHARED, COLS> &b)
+{
+    Matrix<float, ROWS, COLS> output(0.0f);
+    for(unsigned int col = 0; col < COLS; col++) {
+        for(unsigned int row = 0; row < ROWS; row++) {
+            for(unsigned int i = 0; i < SHARED; i++) {
+                output.data[row + col * ROWS] += a.data[row + i * ROWS] * b.data[i + col * SHARED];
+            }
+        }
+    }
+    return output;
+}
+
+template<typename MatrixType>
+inline void fillTestMatrix(MatrixType &m, unsigned int seed)
+{
+    for(size_t i = 0; i < sizeof(m.data) / sizeof(m.data[0]); i++) {
+        m.data[i] = float(int((seed * 7919 + i * 104729) % 2003) - 1001) / 97.0f;
+    }
+}
+
+template<typename MatrixType>
+inline bool matricesIdentical(const MatrixType &a, const MatrixType &b)
+{
+    return memcmp(a.data, b.data, sizeof(a.data)) == 0;
+}
+
+// The old Gauss-Jordan inverse, hack for singular matrices and all,
+// kept here to benchmark against.
+template<typename MatScalar, unsigned int SIZE>
+inline Matrix<MatScalar, SIZE, SIZE> referenceMatrixInverse(const Matrix<MatScalar, SIZE, SIZE> &in)
+{
+    Matrix<MatScalar, SIZE, SIZE> out;
+    Matrix<MatScalar, SIZE, SIZE * 2> workMatrix(in.data, SIZE, SIZE);
+    for(unsigned int row = 0; row < SIZE; row++) {
+        for(unsigned int col = 0; col < SIZE; col++) {
+            workMatrix(row, col + SIZE) = (row == col);
+        }
+    }
+    for(unsigned int workRow = 0; workRow < SIZE; workRow++) {
+        unsigned int swapRow = workRow;
+        while(swapRow < SIZE && workMatrix(swapRow, workRow) == 0) {
+            swapRow++;
+        }
+        if(swapRow == SIZE) {
+            swapRow = workRow;
+            workMatrix(workRow, workRow) = 0.00000001;
+        } else if(swapRow != workRow) {
+            workMatrix.swapRows(swapRow, workRow);
+        }
+        float val = workMatrix(workRow, workRow);
+        workMatrix.divideRow(workRow, val);
+        for(unsigned int subRow = 0; subRow < SIZE; subRow++) {
+            if(subRow != workRow) {
+                workMatrix.subtractRow(subRow, workRow, workMatrix(subRow, workRow));
+            }
+        }
+    }
+    for(unsigned int row = 0; row < SIZE; row++) {
+        for(unsigned int col = 0; col < SIZE; col++) {
+            out(row, col) = workMatrix(row, col + SIZE);
+        }
+    }
+    return out;
+}
+
+// Biggest difference between a * b and the identity matrix.
+template<typename MatScalar, unsigned int SIZE>
+inline double matrixIdentityError(
+    const Matrix<MatScalar, SIZE, SIZE> &a,
+    const Matrix<MatScalar, SIZE, SIZE> &b)
+{
+    Matrix<MatScalar, SIZE, SIZE> product = a * b;
+    double worst = 0.0;
+    for(unsigned int row = 0; row < SIZE; row++) {
+        for(unsigned int col = 0; col < SIZE; col++) {
+            worst = std::max(worst, std::fabs(double(product.getConst(row, col)) - (row == col)));
+        }
+    }
+    return worst;
+}
+
+template<typename MatScalar, unsigned int SIZE>
+inline bool matrixIsZero(const Matrix<MatScalar, SIZE, SIZE> &a)
+{
+    for(unsigned int i = 0; i < SIZE * SIZE; i++) {
+        if(a.data[i] != 0) return false;
+    }
+    return true;
+}
+
+// Well-conditioned test matrix. Filled in like fillTestMatrix, then
+// made diagonally dominant so nothing is close to singular.
+template<typename MatScalar, unsigned int SIZE>
+inline Matrix<MatScalar, SIZE, SIZE> makeInvertibleTestMatrix(unsigned int seed)
+{
+    Matrix<MatScalar, SIZE, SIZE> m;
+    fillTestMatrix(m, seed);
+    for(unsigned int i = 0; i < SIZE; i++) {
+        m(i, i) += MatScalar(SIZE * 12);
+    }
+    return m;
+}
+
+inline FMatrix4x4 makeAffineTestMatrix(unsigned int seed, bool rigid)
+{
+    FVec3 v;
+    fillTestMatrix(v, seed);
+    FMatrix4x4 m =
+        makeTranslationMatrix(v) *
+        makeRotationMatrix(FVec3(v.data[1], 1.0f, v.data[0]).normalize(), v.data[2]);
+    if(!rigid) {
+        m = m * makeScaleMatrix(FVec3(2.0f, 0.5f, 3.0f));
+    }
+    return m;
+}
+
+inline void doMatrixInverseTests(size_t &passCounter, size_t &failCounter)
+{
+    double worst2 = 0.0;
+    double worst3 = 0.0;
+    double worst4 = 0.0;
+    double worst4Double = 0.0;
+    double worst5 = 0.0;
+    double worstSimd = 0.0;
+    double worstAffine = 0.0;
+    double worstRigid = 0.0;
+    bool allInvertible = true;
+
+    for(unsigned int seed = 0; seed < 500; seed++) {
+
+        FMatrix4x4 inv4;
+
+        Matrix<float, 2, 2> m2 = makeInvertibleTestMatrix<float, 2>(seed);
+        FMatrix3x3 m3 = makeInvertibleTestMatrix<float, 3>(seed);
+        FMatrix4x4 m4 = makeInvertibleTestMatrix<float, 4>(seed);
+        Matrix<double, 4, 4> m4d = makeInvertibleTestMatrix<double, 4>(seed);
+        Matrix<double, 5, 5> m5 = makeInvertibleTestMatrix<double, 5>(seed);
+
+        worst2 = std::max(worst2, matrixIdentityError(m2, m2.inverse()));
+        worst3 = std::max(worst3, matrixIdentityError(m3, m3.inverse()));
+        worst4Double = std::max(worst4Double, matrixIdentityError(m4d, m4d.inverse()));
+        worst5 = std::max(worst5, matrixIdentityError(m5, m5.inverse()));
+
+        allInvertible = allInvertible && m4.tryInverse(inv4);
+        worst4 = std::max(worst4, matrixIdentityError(m4, inv4));
+
+        // SIMD version against the scalar closed form.
+        FMatrix4x4 scalarInv4;
+        matrixInverse_compute<float>(m4, scalarInv4);
+        for(unsigned int i = 0; i < 16; i++) {
+            worstSimd = std::max(worstSimd, double(std::fabs(inv4.data[i] - scalarInv4.data[i])));
+        }
+
+        FMatrix4x4 affine = makeAffineTestMatrix(seed, false);
+        FMatrix4x4 rigid = makeAffineTestMatrix(seed, true);
+        allInvertible = allInvertible && affine.tryInverseAffine(inv4);
+        worstAffine = std::max(worstAffine, matrixIdentityError(affine, inv4));
+        worstRigid = std::max(worstRigid, matrixIdentityError(rigid, rigid.inverseRigid()));
+
+        // The bottom row stays exact.
+        allInvertible = allInvertible &&
+            inv4.data[3] == 0.0f && inv4.data[7] == 0.0f &&
+            inv4.data[11] == 0.0f && inv4.data[15] == 1.0f;
+    }
+
+    EXPOP_TEST_VALUE(allInvertible, true);
+    EXPOP_TEST_VALUE(worst2 < 1e-5, true);
+    EXPOP_TEST_VALUE(worst3 < 1e-5, true);
+    EXPOP_TEST_VALUE(worst4 < 1e-5, true);
+    EXPOP_TEST_VALUE(worst4Double < 1e-12, true);
+    EXPOP_TEST_VALUE(worst5 < 1e-12, true);
+    EXPOP_TEST_VALUE(worstSimd < 1e-6, true);
+    EXPOP_TEST_VALUE(worstAffine < 1e-5, true);
+    EXPOP_TEST_VALUE(worstRigid < 1e-5, true);
+
+    // Affine inverse of a 3x3 (2D) transform.
+    {
+        FMatrix3x3 m = make2DRotationMatrix(0.5f);
+        m(0, 2) = 3.0f;
+        m(1, 2) = -2.0f;
+        EXPOP_TEST_VALUE(matrixIdentityError(m, m.inverseAffine()) < 1e-5, true);
+        EXPOP_TEST_VALUE(matrixIdentityError(m, m.inverseRigid()) < 1e-5, true);
+    }
+
+    // Singular matrices get reported, and give back zeros.
+    {
+        Matrix<float, 2, 2> m2(0.0f);
+        Matrix<float, 2, 2> inv2;
+        EXPOP_TEST_VALUE(m2.tryInverse(inv2), false);
+        EXPOP_TEST_VALUE(matrixIsZero(inv2), true);
+
+        // Two identical columns.
+        FMatrix3x3 m3 = makeInvertibleTestMatrix<float, 3>(1);
+        m3(0, 2) = m3(0, 1);
+        m3(1, 2) = m3(1, 1);
+        m3(2, 2) = m3(2, 1);
+        FMatrix3x3 inv3;
+        EXPOP_TEST_VALUE(m3.tryInverse(inv3), false);
+        EXPOP_TEST_VALUE(matrixIsZero(inv3), true);
+
+        FMatrix4x4 m4 = makeScaleMatrix(FVec3(1.0f, 0.0f, 1.0f));
+        FMatrix4x4 inv4;
+        EXPOP_TEST_VALUE(m4.tryInverse(inv4), false);
+        EXPOP_TEST_VALUE(matrixIsZero(inv4), true);
+        EXPOP_TEST_VALUE(matrixIsZero(m4.inverse()), true);
+        EXPOP_TEST_VALUE(m4.tryInverseAffine(inv4), false);
+        EXPOP_TEST_VALUE(matrixIsZero(inv4), true);
+
+        Matrix<double, 4, 4> m4d(1.0);
+        Matrix<double, 4, 4> inv4d;
+        EXPOP_TEST_VALUE(m4d.tryInverse(inv4d), false);
+
+        Matrix<double, 5, 5> m5;
+        m5(3, 3) = 0.0;
+        Matrix<double, 5, 5> inv5;
+        EXPOP_TEST_VALUE(m5.tryInverse(inv5), false);
+        EXPOP_TEST_VALUE(matrixIsZero(inv5), true);
+    }
+
+    // Gauss-Jordan needs to swap rows for this one.
+    {
+        Matrix<double, 5, 5> m(0.0);
+        for(unsigned int i = 0; i < 5; i++) {
+            m(i, (i + 1) % 5) = double(i + 1);
+        }
+        Matrix<double, 5, 5> inv;
+        EXPOP_TEST_VALUE(m.tryInverse(inv), true);
+        EXPOP_TEST_VALUE(matrixIdentityError(m, inv) < 1e-12, true);
+    }
+}
+
+inline void doMatrixBatchTests(size_t &passCounter, size_t &failCounter)
+{
+    FMatrix4x4 m;
+    fillTestMatrix(m, 7);
+    FVec3 from;
+    fillTestMatrix(from, 8);
+
+    // Odd sizes to hit the partial blocks at the end.
+    const size_t sizes[] = { 0, 1, 3, 4, 5, 17 };
+    for(size_t sizeIndex = 0; sizeIndex < sizeof(sizes) / sizeof(sizes[0]); sizeIndex++) {
+
+        size_t count = sizes[sizeIndex];
+        std::vector<FVec3> points(count + 1);
+        std::vector<FVec3> others(count + 1);
+        std::vector<FVec4> points4(count + 1);
+        for(size_t i = 0; i < count + 1; i++) {
+            fillTestMatrix(points[i], i);
+            fillTestMatrix(others[i], i + 100);
+            fillTestMatrix(points4[i], i + 200);
+        }
+
+        // One extra item on the end of each output to catch writes
+        // past the end.
+        std::vector<FVec3> out(count + 1, FVec3(0.0f));
+        std::vector<FVec4> out4(count + 1, FVec4(0.0f));
+        std::vector<float> xs(count + 1, -1.0f);
+        std::vector<float> ys(count + 1, -1.0f);
+        std::vector<float> zs(count + 1, -1.0f);
+        std::vector<float> dists(count + 1, -1.0f);
+        std::vector<float> dists2(count + 1, -1.0f);
+        std::vector<float> dots(count + 1, -1.0f);
+        std::vector<float> pairDots(count + 1, -1.0f);
+
+        matrixBatchTransformPointsSoA(m, &points[0], &xs[0], &ys[0], &zs[0], count);
+        matrixBatchTransform(m, &points4[0], &out4[0], count);
+        matrixBatchDistances(from, &points[0], &dists[0], count);
+        matrixBatchDistancesSquared(from, &points[0], &dists2[0], count);
+        matrixBatchDots(from, &points[0], &dots[0], count);
+        matrixBatchDots(&points[0], &others[0], &pairDots[0], count);
+
+        bool pointsOk = true;
+        bool soaOk = true;
+        bool directionsOk = true;
+        bool vec4Ok = true;
+        bool distancesOk = true;
+        bool dotsOk = true;
+
+        matrixBatchTransformPoints(m, &points[0], &out[0], count);
+        for(size_t i = 0; i < count; i++) {
+            FVec4 expected = m.multiply(FVec4(points[i].data[0], points[i].data[1], points[i].data[2], 1.0f));
+            pointsOk = pointsOk && memcmp(out[i].data, expected.data, sizeof(out[i].data)) == 0;
+            soaOk = soaOk &&
+                xs[i] == expected.data[0] &&
+                ys[i] == expected.data[1] &&
+                zs[i] == expected.data[2];
+        }
+        pointsOk = pointsOk && out[count].isZero();
+        soaOk = soaOk && xs[count] == -1.0f && ys[count] == -1.0f && zs[count] == -1.0f;
+
+        matrixBatchTransformDirections(m, &points[0], &out[0], count);
+        for(size_t i = 0; i < count; i++) {
+            FVec4 expected = m.multiply(FVec4(points[i].data[0], points[i].data[1], points[i].data[2], 0.0f));
+            directionsOk = directionsOk && memcmp(out[i].data, expected.data, sizeof(out[i].data)) == 0;
+        }
+        directionsOk = directionsOk && out[count].isZero();
+
+        for(size_t i = 0; i < count; i++) {
+            vec4Ok = vec4Ok && matricesIdentical(out4[i], m.multiply(points4[i]));
+            distancesOk = distancesOk &&
+                dists[i] == (points[i] - from).magnitude() &&
+                dists2[i] == (points[i] - from).magnitudeSquared();
+            dotsOk = dotsOk &&
+                dots[i] == from.dot(points[i]) &&
+                pairDots[i] == points[i].dot(others[i]);
+        }
+        vec4Ok = vec4Ok && out4[count].isZero();
+        distancesOk = distancesOk && dists[count] == -1.0f && dists2[count] == -1.0f;
+        dotsOk = dotsOk && dots[count] == -1.0f && pairDots[count] == -1.0f;
+
+        // In place.
+        std::vector<FVec3> inPlace = points;
+        matrixBatchTransformPoints(m, &inPlace[0], &inPlace[0], count);
+        matrixBatchTransformPoints(m, &points[0], &out[0], count);
+        for(size_t i = 0; i < count; i++) {
+            pointsOk = pointsOk && matricesIdentical(inPlace[i], out[i]);
+        }
+
+        EXPOP_TEST_VALUE(pointsOk, true);
+        EXPOP_TEST_VALUE(soaOk, true);
+        EXPOP_TEST_VALUE(directionsOk, true);
+        EXPOP_TEST_VALUE(vec4Ok, true);
+        EXPOP_TEST_VALUE(distancesOk, true);
+        EXPOP_TEST_VALUE(dotsOk, true);
+    }
+
+    // Arrays of matrices, and a little hierarchy.
+    {
+        FMatrix4x4 local[5];
+        for(size_t i = 0; i < 5; i++) {
+            local[i] = makeAffineTestMatrix(i, false);
+        }
+
+        FMatrix4x4 products[5];
+        matrixBatchMultiply(local, local, products, 5);
+        EXPOP_TEST_VALUE(matricesIdentical(products[3], local[3] * local[3]), true);
+
+        // 0 -> 1 -> 2, and 0 -> 3. 4 is its own root.
+        const int32_t parents[5] = { -1, 0, 1, 0, -1 };
+        FMatrix4x4 world[5];
+        matrixBatchWorldTransforms(local, parents, world, 5);
+        EXPOP_TEST_VALUE(matricesIdentical(world[0], local[0]), true);
+        EXPOP_TEST_VALUE(matricesIdentical(world[2], (local[0] * local[1]) * local[2]), true);
+        EXPOP_TEST_VALUE(matricesIdentical(world[3], local[0] * local[3]), true);
+        EXPOP_TEST_VALUE(matricesIdentical(world[4], local[4]), true);
+    }
+}
+
+inline void doMatrixTests(size_t &passCounter, size_t &failCounter)
+{
+    bool mul4Ok = true;
+    bool mul3Ok = true;
+    bool vec4Ok = true;
+    bool vec3Ok = true;
+    bool transposeOk = true;
+    bool normalizeOk = true;
+
+    for(unsigned int seed = 0; seed < 1000; seed++) {
+
+        FMatrix4x4 a4, b4;
+        FMatrix3x3 a3, b3;
+        FVec4 v4;
+        FVec3 v3;
+        fillTestMatrix(a4, seed);
+        fillTestMatrix(b4, seed + 5000);
+        fillTestMatrix(a3, seed + 10000);
+        fillTestMatrix(b3, seed + 15000);
+        fillTestMatrix(v4, seed + 20000);
+        fillTestMatrix(v3, seed + 25000);
+
+        mul4Ok = mul4Ok && matricesIdentical(a4 * b4, referenceMatrixMultiply(a4, b4));
+        mul4Ok = mul4Ok && matricesIdentical(a4.multiply(b4), referenceMatrixMultiply(a4, b4));
+        mul3Ok = mul3Ok && matricesIdentical(a3 * b3, referenceMatrixMultiply(a3, b3));
+        mul3Ok = mul3Ok && matricesIdentical(a3.multiply(b3), referenceMatrixMultiply(a3, b3));
+        vec4Ok = vec4Ok && matricesIdentical(a4.multiply(v4), referenceMatrixMultiply(a4, v4));
+        vec3Ok = vec3Ok && matricesIdentical(a3.multiply(v3), referenceMatrixMultiply(a3, v3));
+
+        FMatrix4x4 t = a4.transpose();
+        for(unsigned int row = 0; row < 4; row++) {
+            for(unsigned int col = 0; col < 4; col++) {
+                transposeOk = transposeOk && t.data[row + col * 4] == a4.data[col + row * 4];
+            }
+        }
+
+        FVec4 n = v4.normalize();
+        float len = v4.magnitude();
+        for(unsigned int i = 0; i < 4; i++) {
+            normalizeOk = normalizeOk && n.data[i] == v4.data[i] / len;
+        }
+    }
+
+    EXPOP_TEST_VALUE(mul4Ok, true);
+    EXPOP_TEST_VALUE(mul3Ok, true);
+    EXPOP_TEST_VALUE(vec4Ok, true);
+    EXPOP_TEST_VALUE(vec3Ok, true);
+    EXPOP_TEST_VALUE(transposeOk, true);
+    EXPOP_TEST_VALUE(normalizeOk, true);
+
+    // 3x3 results must not spill into whatever follows them.
+    {
+        struct { FMatrix3x3 m; FVec3 v; float guard; } padded;
+        padded.guard = 1234.0f;
+        FMatrix3x3 a, b;
+        fillTestMatrix(a, 1);
+        fillTestMatrix(b, 2);
+        padded.m = a * b;
+        padded.v = a.multiply(padded.v);
+        EXPOP_TEST_VALUE(padded.guard, 1234.0f);
+    }
+
+    // Simple known values.
+    FMatrix4x4 translate = makeTranslationMatrix(FVec3(1.0f, 2.0f, 3.0f));
+    FVec4 point(1.0f, 1.0f, 1.0f, 1.0f);
+    FVec4 moved = translate.multiply(point);
+    EXPOP_TEST_VALUE(moved.data[0], 2.0f);
+    EXPOP_TEST_VALUE(moved.data[1], 3.0f);
+    EXPOP_TEST_VALUE(moved.data[2], 4.0f);
+    EXPOP_TEST_VALUE(moved.data[3], 1.0f);
+    EXPOP_TEST_VALUE(matricesIdentical(translate * FMatrix4x4(), translate), true);
+
+    doMatrixInverseTests(passCounter, failCounter);
+    doMatrixBatchTests(passCounter, failCounter);
+}
+
+template<typename MatrixType>
+inline float matrixMaxDifference(const MatrixType &a, const MatrixType &b)
+{
+    float maxDifference = 0.0f;
+    for(size_t i = 0; i < sizeof(a.data) / sizeof(a.data[0]); i++) {
+        maxDifference = std::max(maxDifference, float(fabs(a.data[i] - b.data[i])));
+    }
+    return maxDifference;
+}
+
+inline FQuaternion makeTestQuaternion(unsigned int seed, FVec3 *axisOut = nullptr, float *angleOut = nullptr)
+{
+    FVec3 v;
+    fillTestMatrix(v, seed);
+    FVec3 axis = FVec3(v.data[1], 1.0f, v.data[0]).normalize();
+    if(axisOut) *axisOut = axis;
+    if(angleOut) *angleOut = v.data[2];
+    return makeRotationQuaternion(axis, v.data[2]);
+}
+
+inline void doQuaternionTests(size_t &passCounter, size_t &failCounter)
+{
+    bool toMatrixOk = true;
+    bool composeOk = true;
+    bool simdOk = true;
+    bool fromMatrixOk = true;
+    bool rotateOk = true;
+    bool dualOk = true;
+
+    for(unsigned int seed = 0; seed < 1000; seed++) {
+
+        FVec3 axis;
+        float angle;
+        FQuaternion a = makeTestQuaternion(seed, &axis, &angle);
+        FQuaternion b = makeTestQuaternion(seed + 5000);
+        FMatrix4x4 ma = makeRotationMatrix(axis, angle);
+        FMatrix4x4 mb = b.toMatrix4x4();
+
+        // Same rotation, same direction, same composition order as
+        // the matrices.
+        toMatrixOk = toMatrixOk && matrixMaxDifference(a.toMatrix4x4(), ma) < 1e-5f;
+        composeOk = composeOk && matrixMaxDifference((a * b).toMatrix4x4(), ma * mb) < 1e-5f;
+
+        // SIMD product has to match the plain version exactly.
+        Quaternion<double> ad(a.data[0], a.data[1], a.data[2], a.data[3]);
+        Quaternion<double> bd(b.data[0], b.data[1], b.data[2], b.data[3]);
+        Quaternion<double> productd = ad * bd;
+        FQuaternion product = a * b;
+        const float *p = a.data;
+        const float *q = b.data;
+        FQuaternion expected(
+            ((p[3] * q[0] + p[0] * q[3]) + p[1] * q[2]) + p[2] * -q[1],
+            ((p[3] * q[1] + p[0] * -q[2]) + p[1] * q[3]) + p[2] * q[0],
+            ((p[3] * q[2] + p[0] * q[1]) + p[1] * -q[0]) + p[2] * q[3],
+            ((p[3] * q[3] + p[0] * -q[0]) + p[1] * -q[1]) + p[2] * -q[2]);
+        simdOk = simdOk && matricesIdentical(product, expected);
+        for(size_t i = 0; i < 4; i++) {
+            simdOk = simdOk && fabs(productd.data[i] - product.data[i]) < 1e-6;
+        }
+
+        // Back from a matrix. Sign is arbitrary.
+        FQuaternion back = makeQuaternionFromMatrix(ma);
+        if(back.dot(a) < 0.0f) {
+            back = -back;
+        }
+        fromMatrixOk = fromMatrixOk && matrixMaxDifference(back, a) < 1e-5f;
+
+        FVec3 v;
+        fillTestMatrix(v, seed + 10000);
+        FVec4 mv = ma.multiply(FVec4(v.data[0], v.data[1], v.data[2], 1.0f));
+        rotateOk = rotateOk && matrixMaxDifference(a.rotate(v), FVec3(mv.data[0], mv.data[1], mv.data[2])) < 1e-4f;
+
+        // Dual quaternions against the matrix version of the same
+        // transform.
+        FMatrix4x4 rigidA = makeAffineTestMatrix(seed, true);
+        FMatrix4x4 rigidB = makeAffineTestMatrix(seed + 5000, true);
+        FDualQuaternion da = makeDualQuaternionFromMatrix(rigidA);
+        FDualQuaternion db = makeDualQuaternionFromMatrix(rigidB);
+        dualOk = dualOk && matrixMaxDifference(da.toMatrix4x4(), rigidA) < 1e-4f;
+        dualOk = dualOk && matrixMaxDifference((da * db).toMatrix4x4(), rigidA * rigidB) < 1e-3f;
+        FVec4 rv = rigidA.multiply(FVec4(v.data[0], v.data[1], v.data[2], 1.0f));
+        dualOk = dualOk && matrixMaxDifference(da.transformPoint(v), FVec3(rv.data[0], rv.data[1], rv.data[2])) < 1e-3f;
+        dualOk = dualOk && matrixMaxDifference((da.inverse() * da).toMatrix4x4(), FMatrix4x4()) < 1e-5f;
+    }
+
+    EXPOP_TEST_VALUE(toMatrixOk, true);
+    EXPOP_TEST_VALUE(composeOk, true);
+    EXPOP_TEST_VALUE(simdOk, true);
+    EXPOP_TEST_VALUE(fromMatrixOk, true);
+    EXPOP_TEST_VALUE(rotateOk, true);
+    EXPOP_TEST_VALUE(dualOk, true);
+
+    // Interpolation.
+    {
+        FVec3 up(0.0f, 0.0f, 1.0f);
+        FQuaternion a = makeRotationQuaternion(up, 0.0f);
+        FQuaternion b = makeRotationQuaternion(up, 2.0f);
+        FQuaternion half = makeRotationQuaternion(up, 1.0f);
+        EXPOP_TEST_VALUE(matrixMaxDifference(quaternionSlerp(a, b, 0.0f), a) < 1e-6f, true);
+        EXPOP_TEST_VALUE(matrixMaxDifference(quaternionSlerp(a, b, 1.0f), b) < 1e-6f, true);
+        EXPOP_TEST_VALUE(matrixMaxDifference(quaternionSlerp(a, b, 0.5f), half) < 1e-6f, true);
+        EXPOP_TEST_VALUE(matrixMaxDifference(quaternionNlerp(a, b, 0.5f), half) < 1e-6f, true);
+
+        // -b is the same rotation, and should still take the short way.
+        EXPOP_TEST_VALUE(matrixMaxDifference(quaternionSlerp(a, -b, 0.5f), half) < 1e-6f, true);
+
+        // Slerp keeps a constant speed, nlerp doesn't.
+        FQuaternion quarter = makeRotationQuaternion(up, 0.5f);
+        EXPOP_TEST_VALUE(matrixMaxDifference(quaternionSlerp(a, b, 0.25f), quarter) < 1e-6f, true);
+        EXPOP_TEST_VALUE(matrixMaxDifference(quaternionNlerp(a, b, 0.25f), quarter) > 1e-4f, true);
+    }
+
+    // Hierarchy and skinning palette.
+    {
+        FDualQuaternion local[5];
+        FMatrix4x4 localMatrices[5];
+        FDualQuaternion inverseBind[5];
+        for(size_t i = 0; i < 5; i++) {
+            localMatrices[i] = makeAffineTestMatrix(i, true);
+            local[i] = makeDualQuaternionFromMatrix(localMatrices[i]);
+            inverseBind[i] = makeDualQuaternionFromMatrix(makeAffineTestMatrix(i + 50, true)).inverse();
+        }
+
+        const int32_t parents[5] = { -1, 0, 1, 0, -1 };
+        FDualQuaternion world[5];
+        FMatrix4x4 worldMatrices[5];
+        dualQuaternionBatchWorldTransforms(local, parents, world, 5);
+        matrixBatchWorldTransforms(localMatrices, parents, worldMatrices, 5);
+
+        bool worldOk = true;
+        for(size_t i = 0; i < 5; i++) {
+            worldOk = worldOk && matrixMaxDifference(world[i].toMatrix4x4(), worldMatrices[i]) < 1e-3f;
+        }
+        EXPOP_TEST_VALUE(worldOk, true);
+
+        FDualQuaternion palette[5];
+        FMatrix4x4 paletteMatrices[5];
+        dualQuaternionBatchSkinningPalette(world, inverseBind, palette, 5);
+        dualQuaternionBatchSkinningPalette(world, inverseBind, paletteMatrices, 5);
+        bool paletteOk = true;
+        for(size_t i = 0; i < 5; i++) {
+            paletteOk = paletteOk && matricesIdentical(palette[i].real, (world[i] * inverseBind[i]).real);
+            paletteOk = paletteOk && matricesIdentical(paletteMatrices[i], palette[i].toMatrix4x4());
+        }
+        EXPOP_TEST_VALUE(paletteOk, true);
+
+        // Blending two copies of the same transform, one of them with
+        // the signs flipped, should give back that transform.
+        FDualQuaternion flipped = palette[1];
+        flipped.real = -flipped.real;
+        flipped.dual = -flipped.dual;
+        FDualQuaternion blendInput[2] = { palette[1], flipped };
+        float weights[2] = { 0.25f, 0.75f };
+        FDualQuaternion blended = dualQuaternionBlend(blendInput, weights, 2);
+        EXPOP_TEST_VALUE(matrixMaxDifference(blended.toMatrix4x4(), palette[1].toMatrix4x4()) < 1e-5f, true);
+    }
+}
+
+// Random-ish spheres and boxes scattered around a camera at the
+// origin, some in front, some behind and some off to the sides.
+struct FrustumTestObjects
+{
+    std::vector<float> x, y, z, radius;
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+    FrustumTestObjects(size_t count) :
+        x(count), y(count), z(count), radius(count),
+        minX(count), minY(count), minZ(count),
+        maxX(count), maxY(count), maxZ(count)
+    {
+        // fillTestMatrix() values all fall on a few lines, so use a
+        // little xorshift generator instead.
+        uint32_t state = 2463534242u;
+        auto next = [&state]() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return float(state % 20001) / 100.0f - 100.0f;
+        };
+
+        for(size_t i = 0; i < count; i++) {
+            x[i] = next();
+            y[i] = next();
+            z[i] = next();
+            radius[i] = fabs(next()) * 0.05f;
+            minX[i] = x[i] - radius[i];
+            minY[i] = y[i] - radius[i] * 0.5f;
+            minZ[i] = z[i] - radius[i] * 2.0f;
+            maxX[i] = x[i] + radius[i];
+            maxY[i] = y[i] + radius[i] * 0.5f;
+            maxZ[i] = z[i] + radius[i] * 2.0f;
+        }
+    }
+};
+
+inline FMatrix4x4 makeFrustumTestMatrix()
+{
+    return
+        makePerspectiveMatrix(70.0f, 1.5f, 0.5f, 80.0f) *
+        makeAffineTestMatrix(3, true);
+}
+
+inline void doFrustumTests(size_t &passCounter, size_t &failCounter)
+{
+    // Known values, looking down -z.
+    {
+        Frustum frustum = makeFrustumFromMatrix(makePerspectiveMatrix(90.0f, 1.0f, 1.0f, 100.0f));
+        EXPOP_TEST_VALUE(frustumTestSphere(frustum, FVec3(0.0f, 0.0f, -10.0f), 1.0f), true);
+        EXPOP_TEST_VALUE(frustumTestSphere(frustum, FVec3(0.0f, 0.0f, 10.0f), 1.0f), false);
+        EXPOP_TEST_VALUE(frustumTestSphere(frustum, FVec3(0.0f, 0.0f, -200.0f), 1.0f), false);
+        EXPOP_TEST_VALUE(frustumTestSphere(frustum, FVec3(-50.0f, 0.0f, -10.0f), 1.0f), false);
+        EXPOP_TEST_VALUE(frustumTestSphere(frustum, FVec3(-50.0f, 0.0f, -10.0f), 30.0f), true);
+        EXPOP_TEST_VALUE(frustumTestAabb(frustum, FVec3(-1.0f, -1.0f, -11.0f), FVec3(1.0f, 1.0f, -9.0f)), true);
+        EXPOP_TEST_VALUE(frustumTestAabb(frustum, FVec3(10.0f, -1.0f, -5.0f), FVec3(12.0f, 1.0f, -3.0f)), false);
+        EXPOP_TEST_VALUE(frustumTestAabb(frustum, FVec3(-100.0f, -1.0f, -5.0f), FVec3(100.0f, 1.0f, -3.0f)), true);
+
+        // Same frustum from makeFrustumMatrix().
+        Frustum other = makeFrustumFromMatrix(makeFrustumMatrix(-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 100.0f));
+        bool planesMatch = true;
+        for(size_t i = 0; i < Frustum::PLANE_COUNT; i++) {
+            planesMatch = planesMatch && matrixMaxDifference(frustum.planes[i], other.planes[i]) < 1e-4f;
+        }
+        EXPOP_TEST_VALUE(planesMatch, true);
+    }
+
+    // Points should be inside all the planes exactly when they're
+    // inside the clip volume.
+    {
+        FMatrix4x4 m = makeFrustumTestMatrix();
+        Frustum frustum = makeFrustumFromMatrix(m);
+        FrustumTestObjects objects(1000);
+        bool pointsOk = true;
+        for(size_t i = 0; i < 1000; i++) {
+            FVec4 clip = m.multiply(FVec4(objects.x[i], objects.y[i], objects.z[i], 1.0f));
+            float w = clip.data[3];
+            bool inside =
+                fabs(clip.data[0]) <= w &&
+                fabs(clip.data[1]) <= w &&
+                fabs(clip.data[2]) <= w;
+            float margin = 1e-3f * fabs(w);
+            bool nearEdge =
+                fabs(fabs(clip.data[0]) - w) < margin ||
+                fabs(fabs(clip.data[1]) - w) < margin ||
+                fabs(fabs(clip.data[2]) - w) < margin;
+            if(!nearEdge) {
+                pointsOk = pointsOk && frustumTestSphere(frustum, FVec3(objects.x[i], objects.y[i], objects.z[i]), 0.0f) == inside;
+            }
+        }
+        EXPOP_TEST_VALUE(pointsOk, true);
+    }
+
+    // Batches against one object at a time.
+    Frustum frustum = makeFrustumFromMatrix(makeFrustumTestMatrix());
+    const size_t sizes[] = { 0, 1, 3, 4, 5, 17, 1000 };
+    for(size_t sizeIndex = 0; sizeIndex < sizeof(sizes) / sizeof(sizes[0]); sizeIndex++) {
+
+        size_t count = sizes[sizeIndex];
+        FrustumTestObjects objects(count);
+
+        std::vector<uint32_t> expectedSpheres;
+        std::vector<uint32_t> expectedAabbs;
+        for(size_t i = 0; i < count; i++) {
+            if(frustumTestSphere(frustum, FVec3(objects.x[i], objects.y[i], objects.z[i]), objects.radius[i])) {
+                expectedSpheres.push_back(uint32_t(i));
+            }
+            if(frustumTestAabb(
+                    frustum,
+                    FVec3(objects.minX[i], objects.minY[i], objects.minZ[i]),
+                    FVec3(objects.maxX[i], objects.maxY[i], objects.maxZ[i])))
+            {
+                expectedAabbs.push_back(uint32_t(i));
+            }
+        }
+
+        // One extra on the end to catch writes past the end.
+        std::vector<uint32_t> visible(count + 1, 12345);
+        size_t visibleCount = frustumCullSpheres(
+            frustum, objects.x.data(), objects.y.data(), objects.z.data(), objects.radius.data(),
+            count, &visible[0]);
+        EXPOP_TEST_VALUE(visibleCount, expectedSpheres.size());
+        EXPOP_TEST_VALUE(std::equal(expectedSpheres.begin(), expectedSpheres.end(), visible.begin()), true);
+        EXPOP_TEST_VALUE(visible[count], 12345u);
+
+        visibleCount = frustumCullAabbs(
+            frustum,
+            objects.minX.data(), objects.minY.data(), objects.minZ.data(),
+            objects.maxX.data(), objects.maxY.data(), objects.maxZ.data(),
+            count, &visible[0]);
+        EXPOP_TEST_VALUE(visibleCount, expectedAabbs.size());
+        EXPOP_TEST_VALUE(std::equal(expectedAabbs.begin(), expectedAabbs.end(), visible.begin()), true);
+        EXPOP_TEST_VALUE(visible[count], 12345u);
+    }
+
+    // Enough objects to split across threads. Output has to come out
+    // the same, in the same order.
+    {
+        const size_t count = 100003;
+        FrustumTestObjects objects(count);
+        std::vector<uint32_t> single(count);
+        std::vector<uint32_t> threaded(count);
+
+        size_t singleCount = frustumCullSpheres(
+            frustum, objects.x.data(), objects.y.data(), objects.z.data(), objects.radius.data(),
+            count, &single[0]);
+        size_t threadedCount = frustumCullSpheres(
+            frustum, objects.x.data(), objects.y.data(), objects.z.data(), objects.radius.data(),
+            count, &threaded[0], 4);
+        EXPOP_TEST_VALUE(singleCount > 0 && singleCount < count, true);
+        EXPOP_TEST_VALUE(threadedCount, singleCount);
+        EXPOP_TEST_VALUE(std::equal(single.begin(), single.begin() + singleCount, threaded.begin()), true);
+
+        singleCount = frustumCullAabbs(
+            frustum,
+            objects.minX.data(), objects.minY.data(), objects.minZ.data(),
+            objects.maxX.data(), objects.maxY.data(), objects.maxZ.data(),
+            count, &single[0]);
+        threadedCount = frustumCullAabbs(
+            frustum,
+            objects.minX.data(), objects.minY.data(), objects.minZ.data(),
+            objects.maxX.data(), objects.maxY.data(), objects.maxZ.data(),
+            count, &threaded[0], 0);
+        EXPOP_TEST_VALUE(threadedCount, singleCount);
+        EXPOP_TEST_VALUE(std::equal(single.begin(), single.begin() + singleCount, threaded.begin()), true);
+    }
+}
+
+inline void doRC4Tests(size_t &passCounter, size_t &failCounter)
+{
+    {
+        // This is a small example from the CipherSaber page, but
+        // split up so we have the initialization vector already as
+        // part of the key.
+        static const unsigned char cstest1[] = {
+            'a', 's', 'd', 'f', 'g',
+            0x6f, 0x6d, 0x0b, 0xab, 0xf3, 0xaa, 0x67, 0x19, 0x03, 0x15,
+        };
+
+        // And the actual ciphertext.
+        unsigned char cstest2[] = {
+            0x30, 0xed, 0xb6, 0x77, 0xca, 0x74, 0xe0, 0x08, 0x9d, 0xd0,
+            0xe7, 0xb8, 0x85, 0x43, 0x56, 0xbb, 0x14, 0x48, 0xe3, 0x7c,
+            0xdb, 0xef, 0xe7, 0xf3, 0xa8, 0x4f, 0x4f, 0x5f, 0xb3, 0xfd, 0
+        };
+
+        ExPop::CryptoRC4 rc4;
+        rc4.setKey(cstest1, 15);
+        rc4.encrypt(cstest2, sizeof(cstest2) - 1);
+        EXPOP_TEST_VALUE(std::string((char*)cstest2), std::string("This is a test of CipherSaber."));
+    }
+
+    {
+        ExPop::CryptoRC4 rc4;
+        rc4.setKey("dickbutt");
+
+        std::string base = "herpy derpy derp";
+        std::string encrypted = stringBase64EncodeString(rc4.encrypt(base));
+
+        rc4 = CryptoRC4();
+        rc4.setKey("dickbutt");
+        std::string decrypted = rc4.encrypt(stringBase64DecodeString(encrypted));
+
+        EXPOP_TEST_VALUE(decrypted, base);
+        EXPOP_TEST_VALUE(encrypted, "ZlX9S9jQTFeMnmaTshss4Q==");
+    }
+}
+
+struct ThreadTestData
+{
+    ExPop::Threads::ThreadId id;
+    size_t *passCounter;
+    size_t *failCounter;
+    bool goAhead;
+};
+
+void sleepWrapper(uint32_t time)
+{
+  #if _WIN32
+    Sleep(time / 1000);
+  #else
+    usleep(time);
+  #endif
+}
+
+void doThreadTests_thread(void *data)
+{
+    ThreadTestData *testData = (ThreadTestData*)data;
+
+    ExPop::Threads::ThreadId thisId = ExPop::Threads::getMyId();
+    size_t &passCounter = *testData->passCounter;
+    size_t &failCounter = *testData->failCounter;
+
+    while(!testData->goAhead) {
+        sleepWrapper(10);
+    }
+
+  #if _WIN32
+    std::cout << "[Thread] Current thread ID: " << GetCurrentThreadId() << std::endl;
+  #endif
+
+    cout << "[Thread] This ID:  " << thisId << std::endl;
+    cout << "[Thread] Other ID: " << testData->id << std::endl;
+
+    EXPOP_TEST_VALUE(thisId != testData->id, true);
+}
+
+inline void doThreadTests(size_t &passCounter, size_t &failCounter)
+{
+    ExPop::Threads::ThreadId thisId = ExPop::Threads::getMyId();
+
+    ThreadTestData testData;
+    testData.id = thisId;
+    testData.passCounter = &passCounter;
+    testData.failCounter = &failCounter;
+    testData.goAhead = false;
+
+    ExPop::Threads::Thread t(doThreadTests_thread, &testData);
+    sleepWrapper(1000);
+
+    #if _WIN32
+    std::cout << "[Main  ] Current thread ID: " << GetCurrentThreadId() << std::endl;
+    #endif
+
+    cout << "[Main  ] This ID:  " << thisId << std::endl;
+    cout << "[Main  ] Other ID: " << t.getId() << std::endl;
+    EXPOP_TEST_VALUE(t.getId() != thisId, true);
+
+    testData.goAhead = true;
+    t.join();
+}
+
+struct RingQueueTestData
+{
+    MPMCRingQueue<size_t> *queue;
+    size_t start;
+    size_t count;
+};
+
+void doRingQueueTests_thread(void *data)
+{
+    RingQueueTestData *testData = (RingQueueTestData*)data;
+    for(size_t i = testData->start; i < testData->start + testData->count; i++) {
+        while(!testData->queue->push(i)) {
+            sleepWrapper(0);
+        }
+    }
+}
+
+inline void doRingQueueTests(size_t &passCounter, size_t &failCounter)
+{
+    {
+        SPSCRingQueue<int> queue(3);
+        EXPOP_TEST_VALUE(queue.getCapacity(), 4);
+        EXPOP_TEST_VALUE(queue.empty(), true);
+
+        // Go around the ring a few times to make sure wrapping works.
+        bool allGood = true;
+        for(int lap = 0; lap < 3; lap++) {
+            for(int i = 0; i < 4; i++) {
+                allGood = allGood && queue.push(i + lap * 10);
+            }
+            allGood = allGood && !queue.push(1234);
+            for(int i = 0; i < 4; i++) {
+                int value = -1;
+                allGood = allGood && queue.pop(value) && value == i + lap * 10;
+            }
+        }
+        EXPOP_TEST_VALUE(allGood, true);
+
+        int value = -1;
+        EXPOP_TEST_VALUE(queue.pop(value), false);
+    }
+
+    {
+        MPMCRingQueue<std::string> queue(4);
+        EXPOP_TEST_VALUE(queue.push("butt"), true);
+        EXPOP_TEST_VALUE(queue.push("dick"), true);
+        std::string value;
+        EXPOP_TEST_VALUE(queue.pop(value) && value == "butt", true);
+        EXPOP_TEST_VALUE(queue.pop(value) && value == "dick", true);
+        EXPOP_TEST_VALUE(queue.pop(value), false);
+    }
+
+    {
+        // Several threads pushing at once. Everything should come
+        // out exactly once.
+        const size_t threadCount = 4;
+        const size_t perThread = 10000;
+        MPMCRingQueue<size_t> queue(64);
+        RingQueueTestData testData[threadCount];
+        std::vector<ExPop::Threads::Thread> threads;
+        for(size_t i = 0; i < threadCount; i++) {
+            testData[i].queue = &queue;
+            testData[i].start = i * perThread;
+            testData[i].count = perThread;
+            threads.push_back(ExPop::Threads::Thread(doRingQueueTests_thread, &testData[i]));
+        }
+
+        std::vector<bool> seen(threadCount * perThread, false);
+        size_t received = 0;
+        bool noDuplicates = true;
+        while(received < threadCount * perThread) {
+            size_t value = 0;
+            if(queue.pop(value)) {
+                noDuplicates = noDuplicates && !seen[value];
+                seen[value] = true;
+                received++;
+            } else {
+                sleepWrapper(0);
+            }
+        }
+
+        for(size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+
+        EXPOP_TEST_VALUE(noDuplicates, true);
+        EXPOP_TEST_VALUE(queue.empty(), true);
+    }
+}
+
+inline void doCellArrayTests(size_t &passCounter, size_t &failCounter)
+{
+    {
+        CellArray<int> cells;
+        cells.set(5, 2, 3);
+        cells.set(7, -4, 10);
+        EXPOP_TEST_VALUE(cells.getMinX(), -4);
+        EXPOP_TEST_VALUE(cells.getMaxX(), 3);
+        EXPOP_TEST_VALUE(cells.getMinY(), 3);
+        EXPOP_TEST_VALUE(cells.getMaxY(), 11);
+        EXPOP_TEST_VALUE(*cells.getConst(2, 3), 5);
+        EXPOP_TEST_VALUE(*cells.getConst(-4, 10), 7);
+        EXPOP_TEST_VALUE(*cells.getConst(0, 5), 0);
+        EXPOP_TEST_VALUE(!cells.getConst(3, 3), true);
+    }
+
+    {
+        // Grow outwards in every direction with a non-trivial type,
+        // and make sure everything survives the moves.
+        CellArray<std::string> cells;
+        for(CAINDEXTYPE i = 0; i < 200; i++) {
+            cells.set(std::to_string(i), i, 0);
+            cells.set(std::to_string(-i), -i, 0);
+            cells.set(std::to_string(i * 1000), 0, i);
+            cells.set(std::to_string(-i * 1000), 0, -i);
+        }
+
+        bool allGood = true;
+        for(CAINDEXTYPE i = 1; i < 200; i++) {
+            allGood = allGood && *cells.getConst(i, 0) == std::to_string(i);
+            allGood = allGood && *cells.getConst(-i, 0) == std::to_string(-i);
+            allGood = allGood && *cells.getConst(0, i) == std::to_string(i * 1000);
+            allGood = allGood && *cells.getConst(0, -i) == std::to_string(-i * 1000);
+            allGood = allGood && *cells.getConst(i, i) == "";
+        }
+        EXPOP_TEST_VALUE(allGood, true);
+        EXPOP_TEST_VALUE(cells.getWidth(), 399);
+        EXPOP_TEST_VALUE(cells.getHeight(), 399);
+        EXPOP_TEST_VALUE(cells.getMinX(), -199);
+        EXPOP_TEST_VALUE(cells.getMaxY(), 200);
+
+        // Slack shouldn't ever be more than the doubling allows.
+        EXPOP_TEST_VALUE(cells.getCapacityWidth() < 399 * 3, true);
+    }
+
+    {
+        // Region API.
+        CellArray<int> cells;
+        cells.fillRect(1, -2, -2, 5, 5);
+        EXPOP_TEST_VALUE(cells.getMinX(), -2);
+        EXPOP_TEST_VALUE(cells.getMaxX(), 3);
+
+        int total = 0;
+        cells.forEachInRect(
+            -2, -2, 5, 5,
+            [&total](CAINDEXTYPE x, CAINDEXTYPE y, int &value) {
+                value = int(x + y * 10);
+                total++;
+            });
+        EXPOP_TEST_VALUE(total, 25);
+        EXPOP_TEST_VALUE(*cells.getConst(2, -1), -8);
+
+        const int *span = cells.getRowSpanConst(-2, 1, 5);
+        EXPOP_TEST_VALUE(span && span[0] == 8 && span[4] == 12, true);
+        EXPOP_TEST_VALUE(!cells.getRowSpanConst(-2, 1, 6), true);
+
+        int neighborhood[9];
+        cells.getNeighborhood(0, 0, 1, neighborhood, -100);
+        EXPOP_TEST_VALUE(neighborhood[0] == -11 && neighborhood[4] == 0 && neighborhood[8] == 11, true);
+        cells.getNeighborhood(2, 2, 1, neighborhood, -100);
+        EXPOP_TEST_VALUE(neighborhood[0] == 11 && neighborhood[1] == 12 && neighborhood[2] == -100, true);
+        EXPOP_TEST_VALUE(neighborhood[4] == 22 && neighborhood[8] == -100, true);
+
+        CellArray<int> other;
+        other.copyRect(cells, 1, 1, 10, 10, 100, 100);
+        EXPOP_TEST_VALUE(other.getWidth(), 2);
+        EXPOP_TEST_VALUE(*other.getConst(101, 101), 22);
+
+        // Overlapping copy onto ourselves, shifted down and right.
+        cells.copyRect(cells, -2, -2, 5, 5, -1, -1);
+        EXPOP_TEST_VALUE(*cells.getConst(3, 3), 22);
+        EXPOP_TEST_VALUE(*cells.getConst(-1, -1), -22);
+        EXPOP_TEST_VALUE(*cells.getConst(-2, -2), -22);
+    }
+
+    {
+        // Far apart writes should only allocate the two tiles they
+        // land in.
+        ChunkedCellArray<int> cells;
+        cells.set(1, 0, 0);
+        cells.set(2, 100000, 100000);
+        cells.set(3, -33, -1);
+        EXPOP_TEST_VALUE(cells.getPopulatedTileCount(), 3);
+        EXPOP_TEST_VALUE(cells.getMinX(), -33);
+        EXPOP_TEST_VALUE(cells.getMaxX(), 100001);
+        EXPOP_TEST_VALUE(cells.getMinY(), -1);
+        EXPOP_TEST_VALUE(cells.getMaxY(), 100001);
+        EXPOP_TEST_VALUE(*cells.getConst(0, 0), 1);
+        EXPOP_TEST_VALUE(*cells.getConst(100000, 100000), 2);
+        EXPOP_TEST_VALUE(*cells.getConst(-33, -1), 3);
+        EXPOP_TEST_VALUE(*cells.getConst(5000, 5000), 0);
+        EXPOP_TEST_VALUE(!cells.getConst(100001, 0), true);
+        EXPOP_TEST_VALUE(cells.getPopulatedTileCount(), 3);
+
+        int total = 0;
+        size_t visited = 0;
+        cells.forEachPopulatedCell(
+            [&total, &visited](CAINDEXTYPE x, CAINDEXTYPE y, int &value) {
+                total += value;
+                visited++;
+            });
+        EXPOP_TEST_VALUE(total, 6);
+
+        // Partially covered tiles are clipped to the bounds.
+        EXPOP_TEST_VALUE(visited < 3 * cells.tileSize * cells.tileSize, true);
+
+        cells.clear();
+        EXPOP_TEST_VALUE(cells.getPopulatedTileCount(), 0);
+        EXPOP_TEST_VALUE(!cells.getConst(0, 0), true);
+    }
+}
+
+// Fill an image with a pattern that's different for every channel
+// and doesn't line up nicely with anything.
+template<typename ImageType>
+inline void makePixelImageTestPattern(ImageType &img)
+{
+    for(PixelImage_Coordinate y = 0; y < img.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
+            for(PixelImage_Coordinate c = 0; c < img.getChannelCount(); c++) {
+                img.setDouble(x, y, c, double((x * 7 + y * 13 + c * 29) % 61) / 60.0);
+            }
+        }
+    }
+}
+
+inline bool pixelImagesMatch(const PixelImageBase &a, const PixelImageBase &b)
+{
+    if(a.getWidth() != b.getWidth() ||
+        a.getHeight() != b.getHeight() ||
+        a.getChannelCount() != b.getChannelCount())
+    {
+        return false;
+    }
+
+    for(PixelImage_Coordinate y = 0; y < a.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < a.getWidth(); x++) {
+            for(PixelImage_Coordinate c = 0; c < a.getChannelCount(); c++) {
+                if(a.getDouble(x, y, c) != b.getDouble(x, y, c)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+inline double pixelImageMaxDifference(const PixelImageBase &a, const PixelImageBase &b)
+{
+    double maxDiff = 0.0;
+    for(PixelImage_Coordinate y = 0; y < a.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < a.getWidth(); x++) {
+            for(PixelImage_Coordinate c = 0; c < a.getChannelCount(); c++) {
+                double diff = fabs(a.getDouble(x, y, c) - b.getDouble(x, y, c));
+                if(diff > maxDiff) maxDiff = diff;
+            }
+        }
+    }
+    return maxDiff;
+}
+
+inline void doPixelImageBlurTests(size_t &passCounter, size_t &failCounter)
+{
+    PixelImage<float> img(45, 31, 3);
+    makePixelImageTestPattern(img);
+
+    {
+        // The separable version matches a straightforward 2D
+        // convolution with the same kernel.
+        const float radius_x = 3.5f;
+        const float radius_y = 2.0f;
+        int intRadius_x = int(radius_x) + 1;
+        int intRadius_y = int(radius_y) + 1;
+
+        PixelImage<float> reference(img.getWidth(), img.getHeight(), img.getChannelCount());
+        for(PixelImage_Coordinate y = 0; y < img.getHeight(); y++) {
+            for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
+                for(PixelImage_Coordinate c = 0; c < img.getChannelCount(); c++) {
+                    double total = 0.0;
+                    double weightTotal = 0.0;
+                    for(int ky = -intRadius_y; ky < intRadius_y; ky++) {
+                        for(int kx = -intRadius_x; kx < intRadius_x; kx++) {
+                            double dx = (kx / radius_x) * 2.0;
+                            double dy = (ky / radius_y) * 2.0;
+                            double w = exp(-(dx * dx + dy * dy) / 2.0);
+                            total += img.getDouble(x + kx, y + ky, c, PixelImage_EdgeMode_Clamp) * w;
+                            weightTotal += w;
+                        }
+                    }
+                    reference.setDouble(x, y, c, total / weightTotal);
+                }
+            }
+        }
+
+        PixelImage<float> *blurred = pixelImageGaussianBlur<float, ScalingType_OneIsOne>(
+            img, radius_x, radius_y, PixelImage_EdgeMode_Clamp, PixelImage_BlurMode_Exact);
+        EXPOP_TEST_VALUE(pixelImageMaxDifference(*blurred, reference) < 0.00001, true);
+        delete blurred;
+    }
+
+    {
+        // The box approximation gets close to the real thing.
+        PixelImage<float> *exact = pixelImageGaussianBlur<float, ScalingType_OneIsOne>(
+            img, 20.0f, 12.0f, PixelImage_EdgeMode_Wrap, PixelImage_BlurMode_Exact);
+        PixelImage<float> *box = pixelImageGaussianBlur<float, ScalingType_OneIsOne>(
+            img, 20.0f, 12.0f, PixelImage_EdgeMode_Wrap, PixelImage_BlurMode_Box);
+        EXPOP_TEST_VALUE(pixelImageMaxDifference(*exact, *box) < 0.02, true);
+        delete exact;
+        delete box;
+    }
+
+    {
+        // Flat images stay flat, no matter the mode.
+        PixelImage<float> flat(70, 9, 4);
+        for(PixelImage_Coordinate y = 0; y < flat.getHeight(); y++) {
+            for(PixelImage_Coordinate x = 0; x < flat.getWidth(); x++) {
+                for(PixelImage_Coordinate c = 0; c < flat.getChannelCount(); c++) {
+                    flat.setDouble(x, y, c, 0.25);
+                }
+            }
+        }
+
+        PixelImage<float> *box = pixelImageGaussianBlur<float, ScalingType_OneIsOne>(
+            flat, 40.0f, 40.0f, PixelImage_EdgeMode_Clamp, PixelImage_BlurMode_Box);
+        PixelImage<float> *exact = pixelImageGaussianBlur<float, ScalingType_OneIsOne>(
+            flat, 40.0f, 40.0f, PixelImage_EdgeMode_Clamp, PixelImage_BlurMode_Exact);
+        EXPOP_TEST_VALUE(pixelImageMaxDifference(*box, flat) < 0.00001, true);
+        EXPOP_TEST_VALUE(pixelImageMaxDifference(*exact, flat) < 0.00001, true);
+        delete box;
+        delete exact;
+    }
+}
+
+inline void doPixelImageResampleTests(size_t &passCounter, size_t &failCounter)
+{
+    PixelImage_ResampleFilter filters[3] = {
+        PixelImage_ResampleFilter_Bilinear,
+        PixelImage_ResampleFilter_Bicubic,
+        PixelImage_ResampleFilter_Lanczos3
+    };
+
+    PixelImage<uint8_t> img(37, 23, 3);
+    makePixelImageTestPattern(img);
+
+    PixelImage<float> flat(19, 7, 2);
+    for(PixelImage_Coordinate y = 0; y < flat.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < flat.getWidth(); x++) {
+            flat.setDouble(x, y, 0, 0.75);
+            flat.setDouble(x, y, 1, 0.125);
+        }
+    }
+
+    for(size_t i = 0; i < 3; i++) {
+
+        // Same size in, same image out.
+        PixelImage<uint8_t> *same = pixelImageResample<uint8_t, ScalingType_OneIsMaxInt>(
+            img, img.getWidth(), img.getHeight(), filters[i]);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*same, img), true);
+        delete same;
+
+        // Flat images stay flat going up or down, on either axis.
+        PixelImage<float> *bigger = pixelImageResample<float, ScalingType_OneIsOne>(flat, 50, 5, filters[i]);
+        PixelImage<float> *smaller = pixelImageResample<float, ScalingType_OneIsOne>(flat, 6, 20, filters[i]);
+        EXPOP_TEST_VALUE(fabs(bigger->getDouble(17, 3, 0) - 0.75) < 0.00001, true);
+        EXPOP_TEST_VALUE(fabs(smaller->getDouble(2, 11, 1) - 0.125) < 0.00001, true);
+        delete bigger;
+        delete smaller;
+    }
+
+    {
+        // Bilinear upscale of a two pixel ramp.
+        PixelImage<float> ramp(2, 1, 1);
+        ramp.setDouble(1, 0, 0, 1.0);
+        PixelImage<float> *out = pixelImageResample<float, ScalingType_OneIsOne>(
+            ramp, 4, 1, PixelImage_ResampleFilter_Bilinear);
+        EXPOP_TEST_VALUE(out->getDouble(0, 0, 0), 0.0);
+        EXPOP_TEST_VALUE(out->getDouble(1, 0, 0), 0.25);
+        EXPOP_TEST_VALUE(out->getDouble(2, 0, 0), 0.75);
+        EXPOP_TEST_VALUE(out->getDouble(3, 0, 0), 1.0);
+        delete out;
+    }
+
+    {
+        // Four-channel images take a separate path.
+        PixelImage<uint8_t> rgba(29, 13, 4);
+        makePixelImageTestPattern(rgba);
+        PixelImage<uint8_t> *fast = pixelImageResample<uint8_t, ScalingType_OneIsMaxInt>(
+            rgba, 40, 9, PixelImage_ResampleFilter_Bicubic);
+        PixelImage<uint8_t> slow(40, 9, 4);
+        pixelImageResample_kernel(
+            PixelImageVirtualReader(rgba), slow,
+            PixelImage_ResampleFilter_Bicubic, PixelImage_EdgeMode_Clamp);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*fast, slow), true);
+        delete fast;
+    }
+}
+
+inline void doPixelImageThreadTests(size_t &passCounter, size_t &failCounter)
+{
+    // Everything has to come out exactly the same on any number of
+    // threads. Sizes are picked to make more than one chunk.
+    PixelImage<uint8_t> img(150, 140, 4);
+    makePixelImageTestPattern(img);
+    PixelImageTypedReader<PixelValue<uint8_t> > reader = pixelImageMakeReader(img);
+
+    {
+        PixelImage<uint8_t> serial(301, 290, 4);
+        PixelImage<uint8_t> parallel(301, 290, 4);
+        upScaleImageLinear_kernel(reader, serial, PixelImage_EdgeMode_Clamp, 1);
+        upScaleImageLinear_kernel(reader, parallel, PixelImage_EdgeMode_Clamp, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(serial, parallel), true);
+
+        serial.setSize(61, 53);
+        parallel.setSize(61, 53);
+        downScaleImageAveraged_kernel(reader, serial, 1);
+        downScaleImageAveraged_kernel(reader, parallel, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(serial, parallel), true);
+
+        serial.setSize(150, 70);
+        parallel.setSize(150, 70);
+        pixelImageHalfRes_kernel(reader, serial, true, 1);
+        pixelImageHalfRes_kernel(reader, parallel, true, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(serial, parallel), true);
+
+        serial.setSize(97, 211);
+        parallel.setSize(97, 211);
+        pixelImageResample_kernel(reader, serial, PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Wrap, 1);
+        pixelImageResample_kernel(reader, parallel, PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Wrap, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(serial, parallel), true);
+    }
+
+    for(int mode = PixelImage_BlurMode_Exact; mode <= PixelImage_BlurMode_Box; mode++) {
+        PixelImage<uint8_t> serial(150, 140, 4);
+        PixelImage<uint8_t> parallel(150, 140, 4);
+        pixelImageGaussianBlur_kernel(reader, serial, 6.0f, 3.0f, PixelImage_EdgeMode_Wrap, PixelImage_BlurMode(mode), 1);
+        pixelImageGaussianBlur_kernel(reader, parallel, 6.0f, 3.0f, PixelImage_EdgeMode_Wrap, PixelImage_BlurMode(mode), 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(serial, parallel), true);
+    }
+
+    {
+        PixelImage<float> dst1(90, 120, 4);
+        PixelImage<float> dst2(90, 120, 4);
+        makePixelImageTestPattern(dst1);
+        makePixelImageTestPattern(dst2);
+        pixelImageBlit(img, 3, 7, dst1, -5, 10, 140, 130, 3, 1.0, false, PixelImage_BlendMode_Straight, 1);
+        pixelImageBlit(img, 3, 7, dst2, -5, 10, 140, 130, 3, 1.0, false, PixelImage_BlendMode_Straight, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(dst1, dst2), true);
+    }
+
+    {
+        // The band-by-band pipeline in pixelImageScale() gets the
+        // same thing as doing every step on the whole image, with
+        // either kind of blur.
+        PixelImage<float> wide(700, 90, 3);
+        makePixelImageTestPattern(wide);
+
+        PixelImage_Dimension sizes[2][2] = { { 130, 37 }, { 20, 40 } };
+
+        for(size_t i = 0; i < 2; i++) {
+
+            PixelImage_Dimension width = sizes[i][0];
+            PixelImage_Dimension height = sizes[i][1];
+
+            PixelImage<float> *serial = pixelImageScale<float, ScalingType_OneIsOne>(wide, width, height, 1);
+            PixelImage<float> *parallel = pixelImageScale<float, ScalingType_OneIsOne>(wide, width, height, 3);
+            EXPOP_TEST_VALUE(serial->getWidth(), width);
+            EXPOP_TEST_VALUE(serial->getHeight(), height);
+            EXPOP_TEST_VALUE(pixelImagesMatch(*serial, *parallel), true);
+
+            PixelImage<float> *staged = pixelImageGaussianBlur<float, ScalingType_OneIsOne>(
+                wide,
+                width  < wide.getWidth()  ? 0.5f * float(wide.getWidth())  / float(width)  : 1.0f,
+                height < wide.getHeight() ? 0.5f * float(wide.getHeight()) / float(height) : 1.0f);
+            while(staged->getWidth() / 2 >= width) {
+                PixelImage<float> *half = pixelImageHalfRes<float, ScalingType_OneIsOne>(*staged, false);
+                delete staged;
+                staged = half;
+            }
+            while(staged->getHeight() / 2 >= height) {
+                PixelImage<float> *half = pixelImageHalfRes<float, ScalingType_OneIsOne>(*staged, true);
+                delete staged;
+                staged = half;
+            }
+            PixelImage<float> *reference = pixelImageScale_lanczos<float, ScalingType_OneIsOne>(*staged, width, height);
+            EXPOP_TEST_VALUE(pixelImageMaxDifference(*serial, *reference) < 0.0001, true);
+
+            delete staged;
+            delete reference;
+            delete serial;
+            delete parallel;
+        }
+    }
+}
+
+inline void doPixelImageBlitTests(size_t &passCounter, size_t &failCounter)
+{
+    // Fast blit paths against the generic path through virtual
+    // readers and writers, for every blend mode and alpha source,
+    // clipped and wrapped.
+    PixelImage<uint8_t> src8(37, 29, 4);
+    PixelImage<float> srcf(37, 29, 4);
+    makePixelImageTestPattern(src8);
+    makePixelImageTestPattern(srcf);
+
+    const PixelImage_Coordinate alphaChannels[] = { 3, -1 };
+
+    for(int wrap = 0; wrap < 2; wrap++) {
+        for(int mode = PixelImage_BlendMode_Straight; mode <= PixelImage_BlendMode_Premultiplied; mode++) {
+            for(PixelImage_Coordinate alphaChannel : alphaChannels) {
+
+                // 0.4 * 255 is a whole number, so this stays on the
+                // 8-bit fast path.
+                {
+                    PixelImage<uint8_t> fast(31, 23, 4);
+                    PixelImage<uint8_t> generic(31, 23, 4);
+                    makePixelImageTestPattern(fast);
+                    makePixelImageTestPattern(generic);
+
+                    pixelImageBlit(
+                        src8, 30, 2, fast, -3, 6, 45, 40, alphaChannel, 0.4, wrap,
+                        PixelImage_BlendMode(mode));
+                    pixelImageBlit_kernel(
+                        PixelImageVirtualReader(src8), 30, 2,
+                        PixelImageVirtualWriter(generic), -3, 6, 45, 40, alphaChannel, 0.4, wrap,
+                        PixelImage_BlendMode(mode));
+
+                    EXPOP_TEST_VALUE(pixelImagesMatch(fast, generic), true);
+                }
+
+                {
+                    PixelImage<float> fast(31, 23, 4);
+                    PixelImage<float> generic(31, 23, 4);
+                    makePixelImageTestPattern(fast);
+                    makePixelImageTestPattern(generic);
+
+                    pixelImageBlit(
+                        srcf, 30, 2, fast, -3, 6, 45, 40, alphaChannel, 0.3, wrap,
+                        PixelImage_BlendMode(mode));
+                    pixelImageBlit_kernel(
+                        PixelImageVirtualReader(srcf), 30, 2,
+                        PixelImageVirtualWriter(generic), -3, 6, 45, 40, alphaChannel, 0.3, wrap,
+                        PixelImage_BlendMode(mode));
+
+                    EXPOP_TEST_VALUE(pixelImageMaxDifference(fast, generic) < 1e-6, true);
+                }
+            }
+        }
+    }
+
+    {
+        // Opaque copies of other formats and channel counts.
+        PixelImage<uint16_t> src(20, 15, 3);
+        PixelImage<uint16_t> fast(12, 9, 3);
+        PixelImage<uint16_t> generic(12, 9, 3);
+        makePixelImageTestPattern(src);
+        makePixelImageTestPattern(fast);
+        makePixelImageTestPattern(generic);
+
+        pixelImageBlit(src, 15, 4, fast, 2, -1, 20, 20, -1, 1.0, true);
+        pixelImageBlit_kernel(
+            PixelImageVirtualReader(src), 15, 4,
+            PixelImageVirtualWriter(generic), 2, -1, 20, 20, -1, 1.0, true);
+
+        EXPOP_TEST_VALUE(pixelImagesMatch(fast, generic), true);
+    }
+
+    {
+        // A fast path split across threads.
+        PixelImage<uint8_t> src(150, 140, 4);
+        PixelImage<uint8_t> dst1(120, 130, 4);
+        PixelImage<uint8_t> dst2(120, 130, 4);
+        makePixelImageTestPattern(src);
+        makePixelImageTestPattern(dst1);
+        makePixelImageTestPattern(dst2);
+
+        pixelImageBlit(src, 3, 7, dst1, -5, 10, 140, 130, 3, 1.0, false, PixelImage_BlendMode_Premultiplied, 1);
+        pixelImageBlit(src, 3, 7, dst2, -5, 10, 140, 130, 3, 1.0, false, PixelImage_BlendMode_Premultiplied, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(dst1, dst2), true);
+    }
+
+    {
+        // Premultiplied "over" on a single pixel.
+        PixelImage<uint8_t> src(1, 1, 4);
+        PixelImage<uint8_t> dst(1, 1, 4);
+        src.setDouble(0, 0, 0, 0.5);
+        src.setDouble(0, 0, 3, 0.5);
+        dst.setDouble(0, 0, 0, 1.0);
+        dst.setDouble(0, 0, 3, 1.0);
+        pixelImageBlit(src, 0, 0, dst, 0, 0, 1, 1, 3, 1.0, false, PixelImage_BlendMode_Premultiplied);
+        EXPOP_TEST_VALUE(int(dst.getData(0, 0, 0).value), 255);
+        EXPOP_TEST_VALUE(int(dst.getData(0, 0, 3).value), 255);
+    }
+}
+
+/// Test image with flat areas for RLE to find, and noisy areas it
+/// can't do anything with.
+inline void makePixelImageAtlasPattern(PixelImage<uint8_t> &img)
+{
+    for(PixelImage_Coordinate y = 0; y < img.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
+            const bool flat = ((x / 64) + (y / 64)) % 3 != 0;
+            for(PixelImage_Coordinate c = 0; c < img.getChannelCount(); c++) {
+                img.getData(x, y, c).value = flat ?
+                    uint8_t((x / 64) * 40 + c * 17) :
+                    uint8_t((x * 7 + y * 13 + c * 29) * 2654435761u >> 24);
+            }
+        }
+    }
+}
+
+inline void doPixelImageTGATests(size_t &passCounter, size_t &failCounter)
+{
+    // Every channel count round trips, with and without RLE.
+    for(PixelImage_Dimension channelCount = 1; channelCount <= 4; channelCount++) {
+        for(int rle = 0; rle < 2; rle++) {
+
+            PixelImage<uint8_t> img(301, 77, channelCount);
+            makePixelImageAtlasPattern(img);
+
+            std::vector<uint8_t> scratch(pixelImageGetTGAEncodeScratchSize(img.getWidth(), channelCount));
+            std::vector<uint8_t> file;
+            bool encoded = pixelImageEncodeTGA(
+                img.getWidth(), img.getHeight(), channelCount, channelCount, rle, &scratch[0],
+                [&img](PixelImage_Coordinate y) { return (const uint8_t*)&img.getData(0, y, 0).value; },
+                [&file](const uint8_t *data, size_t length) { file.insert(file.end(), data, data + length); });
+            EXPOP_TEST_VALUE(encoded, true);
+            EXPOP_TEST_VALUE(file.size() <= pixelImageGetTGAMaxEncodedSize(img.getWidth(), img.getHeight(), channelCount, rle), true);
+
+            PixelImage<uint8_t> decoded(img.getWidth(), img.getHeight(), channelCount);
+            EXPOP_TEST_VALUE(pixelImageDecodeTGA(&file[0], file.size(), decoded), true);
+            EXPOP_TEST_VALUE(pixelImagesMatch(img, decoded), true);
+
+            // Cut off anywhere, it has to fail instead of reading
+            // past the end.
+            EXPOP_TEST_VALUE(pixelImageDecodeTGA(&file[0], file.size() - 1, decoded), false);
+        }
+    }
+
+    {
+        // RLE finds the flat areas.
+        PixelImage<uint8_t> img(512, 512, 4);
+        makePixelImageAtlasPattern(img);
+        size_t rawLength = 0;
+        size_t rleLength = 0;
+        delete[] pixelImageSaveTGA(img, &rawLength, false);
+        uint8_t *rleData = pixelImageSaveTGA(img, &rleLength, true);
+        EXPOP_TEST_VALUE(rawLength, size_t(18 + 512 * 512 * 4));
+        EXPOP_TEST_VALUE(rleLength < rawLength / 2, true);
+
+        PixelImage<uint8_t> *loaded = pixelImageLoadTGA(rleData, rleLength);
+        EXPOP_TEST_VALUE(loaded && pixelImagesMatch(img, *loaded), true);
+        delete loaded;
+        delete[] rleData;
+    }
+
+    {
+        // Noise in greyscale can't get any bigger than raw plus
+        // packet headers.
+        PixelImage<uint8_t> img(1000, 3, 1);
+        for(PixelImage_Coordinate x = 0; x < 1000; x++) {
+            // Pairs of equal values, which aren't worth a run.
+            for(PixelImage_Coordinate y = 0; y < 3; y++) {
+                img.getData(x, y, 0).value = uint8_t((x / 2) * 37 + y);
+            }
+        }
+        size_t length = 0;
+        std::vector<uint8_t> scratch(pixelImageGetTGAEncodeScratchSize(1000, 1));
+        pixelImageEncodeTGA(
+            1000, 3, 1, 1, true, &scratch[0],
+            [&img](PixelImage_Coordinate y) { return (const uint8_t*)&img.getData(0, y, 0).value; },
+            [&length](const uint8_t *, size_t n) { length += n; });
+        EXPOP_TEST_VALUE(length <= pixelImageGetTGAMaxEncodedSize(1000, 3, 1, true), true);
+    }
+
+    {
+        // Hand-made bottom-to-top 2x2 BGR file, with an ID field.
+        const uint8_t file[] = {
+            2, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0, 24, 0,
+            99, 99,
+            // Bottom row.
+            1, 2, 3,  4, 5, 6,
+            // Top row.
+            7, 8, 9,  10, 11, 12
+        };
+        uint8_t out[2 * 2 * 4];
+        EXPOP_TEST_VALUE(pixelImageDecodeTGA(file, sizeof(file), out, 4, 8), true);
+        EXPOP_TEST_VALUE(int(out[0]), 9);
+        EXPOP_TEST_VALUE(int(out[2]), 7);
+        EXPOP_TEST_VALUE(int(out[3]), 255);
+        EXPOP_TEST_VALUE(int(out[8 + 4]), 6);
+
+        // Rows come in file order, with their image positions.
+        uint8_t row[2 * 3];
+        std::vector<PixelImage_Coordinate> rowOrder;
+        std::vector<int> firstRed;
+        pixelImageDecodeTGARows(
+            file, sizeof(file), 3, row,
+            [&](PixelImage_Coordinate y, const uint8_t *data) {
+                rowOrder.push_back(y);
+                firstRed.push_back(data[0]);
+            });
+        EXPOP_TEST_VALUE(rowOrder.size(), size_t(2));
+        EXPOP_TEST_VALUE(rowOrder[0], 1);
+        EXPOP_TEST_VALUE(firstRed[0], 3);
+    }
+
+    {
+        // Greyscale RLE with one run packet covering both rows, and a
+        // grey to RGBA expansion.
+        const uint8_t file[] = {
+            0, 0, 11, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 2, 0, 8, 1 << 5,
+            0x80 | 5, 42
+        };
+        uint8_t out[3 * 2 * 4];
+        EXPOP_TEST_VALUE(pixelImageDecodeTGA(file, sizeof(file), out, 4, 12), true);
+        EXPOP_TEST_VALUE(int(out[5 * 4 + 1]), 42);
+        EXPOP_TEST_VALUE(int(out[5 * 4 + 3]), 255);
+    }
+
+    {
+        // Unsupported formats and nonsense.
+        const uint8_t colorMapped[] = { 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 8, 0, 0 };
+        EXPOP_TEST_VALUE(pixelImageLoadTGA(colorMapped, sizeof(colorMapped)) == nullptr, true);
+        EXPOP_TEST_VALUE(pixelImageLoadTGA(colorMapped, 10) == nullptr, true);
+    }
+}
+
+/// Squared error between two uint8_t images, over the first
+/// channelCount channels.
+inline uint64_t pixelImageSquaredError(
+    const PixelImage<uint8_t> &a,
+    const PixelImage<uint8_t> &b,
+    PixelImage_Dimension channelCount)
+{
+    uint64_t total = 0;
+    for(PixelImage_Coordinate y = 0; y < a.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < a.getWidth(); x++) {
+            for(PixelImage_Coordinate c = 0; c < channelCount; c++) {
+                const int64_t d = int64_t(a.getData(x, y, c).value) - int64_t(b.getData(x, y, c).value);
+                total += d * d;
+            }
+        }
+    }
+    return total;
+}
+
+inline void doPixelImageBCTests(size_t &passCounter, size_t &failCounter)
+{
+    {
+        // Four-color BC1 block. Red and blue endpoints, then the
+        // first four pixels use indices 0 to 3.
+        const uint8_t block[8] = { 0x00, 0xf8, 0x1f, 0x00, 0xe4, 0, 0, 0 };
+        uint8_t rgba[16 * 4];
+        pixelImageDecodeBCBlock(PixelImage_BCFormat_BC1, block, rgba);
+        EXPOP_TEST_VALUE(int(rgba[0]), 255);
+        EXPOP_TEST_VALUE(int(rgba[4 + 2]), 255);
+        EXPOP_TEST_VALUE(int(rgba[8 + 0]), 170);
+        EXPOP_TEST_VALUE(int(rgba[8 + 2]), 85);
+        EXPOP_TEST_VALUE(int(rgba[12 + 0]), 85);
+        EXPOP_TEST_VALUE(int(rgba[12 + 3]), 255);
+    }
+
+    {
+        // Three-color BC1 block, with the endpoints the other way
+        // around. Index 3 is transparent black.
+        const uint8_t block[8] = { 0x1f, 0x00, 0x00, 0xf8, 0xe4, 0, 0, 0 };
+        uint8_t rgba[16 * 4];
+        pixelImageDecodeBCBlock(PixelImage_BCFormat_BC1, block, rgba);
+        EXPOP_TEST_VALUE(int(rgba[8 + 0]), 128);
+        EXPOP_TEST_VALUE(int(rgba[8 + 2]), 128);
+        EXPOP_TEST_VALUE(int(rgba[12 + 0]), 0);
+        EXPOP_TEST_VALUE(int(rgba[12 + 3]), 0);
+    }
+
+    {
+        // BC4 with both interpolation modes.
+        const uint8_t eightValues[8] = { 255, 0, 2, 0, 0, 0, 0, 0 };
+        const uint8_t sixValues[8] = { 0, 100, 6 | (7 << 3), 0, 0, 0, 0, 0 };
+        uint8_t rgba[16 * 4];
+        pixelImageDecodeBCBlock(PixelImage_BCFormat_BC4, eightValues, rgba);
+        EXPOP_TEST_VALUE(int(rgba[0]), 219);
+        EXPOP_TEST_VALUE(int(rgba[1]), 0);
+        EXPOP_TEST_VALUE(int(rgba[3]), 255);
+        pixelImageDecodeBCBlock(PixelImage_BCFormat_BC4, sixValues, rgba);
+        EXPOP_TEST_VALUE(int(rgba[0]), 0);
+        EXPOP_TEST_VALUE(int(rgba[4]), 255);
+    }
+
+    // Round trips of a smooth image with partial blocks at the
+    // edges, for every format. Cluster fit is never worse.
+    PixelImage<uint8_t> img(37, 21, 4);
+    for(PixelImage_Coordinate y = 0; y < img.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
+            img.getData(x, y, 0).value = uint8_t(x * 6);
+            img.getData(x, y, 1).value = uint8_t(y * 10 + 20);
+            img.getData(x, y, 2).value = uint8_t((x + y) * 4);
+            img.getData(x, y, 3).value = uint8_t(255 - x * 3);
+        }
+    }
+
+    const PixelImage_BCFormat formats[5] = {
+        PixelImage_BCFormat_BC1, PixelImage_BCFormat_BC2, PixelImage_BCFormat_BC3,
+        PixelImage_BCFormat_BC4, PixelImage_BCFormat_BC5 };
+    const PixelImage_Dimension checkedChannels[5] = { 3, 4, 4, 1, 2 };
+
+    for(size_t f = 0; f < 5; f++) {
+
+        uint64_t errors[2];
+
+        for(int quality = 0; quality < 2; quality++) {
+
+            size_t length = 0;
+            uint8_t *data = pixelImageSaveBC(img, formats[f], &length, PixelImage_BCQuality(quality));
+            EXPOP_TEST_VALUE(length, pixelImageGetBCDataSize(formats[f], 37, 21));
+
+            PixelImage<uint8_t> *decoded = pixelImageLoadBC(formats[f], data, length, 37, 21);
+            errors[quality] = decoded ? pixelImageSquaredError(img, *decoded, checkedChannels[f]) : ~uint64_t(0);
+            delete decoded;
+
+            EXPOP_TEST_VALUE(pixelImageLoadBC(formats[f], data, length - 1, 37, 21) == nullptr, true);
+            delete[] data;
+        }
+
+        // Root mean square error under 8. Alpha never goes under
+        // 128, so BC1 stays opaque, and has no alpha to check.
+        const uint64_t valueCount = 37 * 21 * checkedChannels[f];
+        EXPOP_TEST_VALUE(errors[0] < 64 * valueCount, true);
+        EXPOP_TEST_VALUE(errors[1] <= errors[0], true);
+    }
+
+    {
+        // BC1 punch-through alpha.
+        PixelImage<uint8_t> cutout(8, 4, 4);
+        for(PixelImage_Coordinate x = 0; x < 8; x++) {
+            for(PixelImage_Coordinate y = 0; y < 4; y++) {
+                cutout.getData(x, y, 0).value = uint8_t(x * 30);
+                cutout.getData(x, y, 1).value = 100;
+                cutout.getData(x, y, 2).value = 50;
+                cutout.getData(x, y, 3).value = x < 3 ? 0 : 255;
+            }
+        }
+        size_t length = 0;
+        uint8_t *data = pixelImageSaveBC(cutout, PixelImage_BCFormat_BC1, &length, PixelImage_BCQuality_ClusterFit);
+        PixelImage<uint8_t> *decoded = pixelImageLoadBC(PixelImage_BCFormat_BC1, data, length, 8, 4);
+        EXPOP_TEST_VALUE(int(decoded->getData(2, 1, 3).value), 0);
+        EXPOP_TEST_VALUE(int(decoded->getData(3, 1, 3).value), 255);
+        EXPOP_TEST_VALUE(int(decoded->getData(6, 2, 3).value), 255);
+        delete decoded;
+        delete[] data;
+    }
+
+    {
+        // Red and green checkerboard. The colors differ at right
+        // angles to grey, and both are exact in 5:6:5, so both fits
+        // should find them.
+        PixelImage<uint8_t> checker(4, 4, 4);
+        for(PixelImage_Coordinate y = 0; y < 4; y++) {
+            for(PixelImage_Coordinate x = 0; x < 4; x++) {
+                const bool red = (x + y) % 2 == 0;
+                checker.getData(x, y, 0).value = red ? 255 : 0;
+                checker.getData(x, y, 1).value = red ? 0 : 255;
+                checker.getData(x, y, 2).value = 0;
+                checker.getData(x, y, 3).value = 255;
+            }
+        }
+
+        for(int quality = 0; quality < 2; quality++) {
+            size_t length = 0;
+            uint8_t *data = pixelImageSaveBC(checker, PixelImage_BCFormat_BC1, &length, PixelImage_BCQuality(quality));
+            PixelImage<uint8_t> *decoded = pixelImageLoadBC(PixelImage_BCFormat_BC1, data, length, 4, 4);
+            EXPOP_TEST_VALUE(pixelImageSquaredError(checker, *decoded, 3), uint64_t(0));
+            delete decoded;
+            delete[] data;
+        }
+    }
+
+    {
+        // Same results on any number of threads.
+        PixelImage<uint8_t> big(130, 70, 4);
+        makePixelImageAtlasPattern(big);
+        std::vector<uint8_t> serial(pixelImageGetBCDataSize(PixelImage_BCFormat_BC3, 130, 70));
+        std::vector<uint8_t> parallel(serial.size());
+        pixelImageEncodeBC(big, PixelImage_BCFormat_BC3, &serial[0], PixelImage_BCQuality_ClusterFit, 1);
+        pixelImageEncodeBC(big, PixelImage_BCFormat_BC3, &parallel[0], PixelImage_BCQuality_ClusterFit, 4);
+        EXPOP_TEST_VALUE(serial == parallel, true);
+
+        PixelImage<uint8_t> decoded1(130, 70, 4);
+        PixelImage<uint8_t> decoded2(130, 70, 4);
+        pixelImageDecodeBC(PixelImage_BCFormat_BC3, &serial[0], serial.size(), decoded1, 1);
+        pixelImageDecodeBC(PixelImage_BCFormat_BC3, &serial[0], serial.size(), decoded2, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(decoded1, decoded2), true);
+    }
+}
+
+// Every value that matters for converting from each type. Integers
+// get every value. Floats get the rounding
+// boundaries for both integer types, the values right next to them,
+// and things out of range.
+template<typename ValueType>
+inline void makePixelImageConvertSource(std::vector<ValueType> &values, std::true_type isIntegral)
+{
+    for(size_t i = 0; i <= std::numeric_limits<ValueType>::max(); i++) {
+        values.push_back(ValueType(i));
+    }
+}
+
+template<typename ValueType>
+inline void makePixelImageConvertSource(std::vector<ValueType> &values, std::false_type isIntegral)
+{
+    const ValueType extras[] = {
+        -1, -0.0001, 0, 0.0000001, 0.5, 0.9999999, 1, 1.5, 1000,
+        std::numeric_limits<float>::max() };
+    values.insert(values.end(), extras, extras + sizeof(extras) / sizeof(extras[0]));
+
+    const double scales[2] = { 255.0, 65535.0 };
+    for(size_t s = 0; s < 2; s++) {
+        for(double k = 0; k < scales[s]; k += (s ? 37 : 1)) {
+            ValueType half = ValueType((k + 0.5) / scales[s]);
+            values.push_back(half);
+            values.push_back(std::nextafter(half, ValueType(0)));
+            values.push_back(std::nextafter(half, ValueType(1)));
+        }
+    }
+}
+
+// Convert with pixelImageConvert() and compare every value against
+// setScaledValue(getScaledValue()), bit for bit.
+template<typename SrcValueType, ScalingType srcScalingType, typename DstValueType>
+inline size_t countPixelImageConvertMismatches(size_t threadCount)
+{
+    std::vector<SrcValueType> values;
+    makePixelImageConvertSource(values, std::is_integral<SrcValueType>());
+
+    // Three channels, so the rows don't line up with anything.
+    const size_t width = 97;
+    PixelImage<SrcValueType, srcScalingType> src(width, (values.size() + width * 3 - 1) / (width * 3), 3);
+    for(size_t i = 0; i < src.getRawDataLength() / sizeof(SrcValueType); i++) {
+        src.getRow(0)[i].value = values[i % values.size()];
+    }
+
+    PixelImage<DstValueType> dst;
+    pixelImageConvert(src, dst, 0, threadCount);
+
+    size_t mismatches = 0;
+    for(PixelImage_Coordinate y = 0; y < src.getHeight(); y++) {
+        for(PixelImage_Coordinate x = 0; x < src.getWidth(); x++) {
+            for(PixelImage_Coordinate c = 0; c < 3; c++) {
+                PixelValue<DstValueType> expected;
+                expected.template setScaledValue<double>(src.getDouble(x, y, c));
+                if(memcmp(&expected.value, &dst.getData(x, y, c).value, sizeof(DstValueType))) {
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+inline void doPixelImageConvertTests(size_t &passCounter, size_t &failCounter)
+{
+    {
+        // Every pair of common types.
+      #define EXPOP_TEST_CONVERT_SRC(srcType)                                 \
+        EXPOP_TEST_VALUE((countPixelImageConvertMismatches<srcType, pixelValueGetDefaultScalingType<srcType>(), uint8_t>(1)), size_t(0)); \
+        EXPOP_TEST_VALUE((countPixelImageConvertMismatches<srcType, pixelValueGetDefaultScalingType<srcType>(), uint16_t>(1)), size_t(0)); \
+        EXPOP_TEST_VALUE((countPixelImageConvertMismatches<srcType, pixelValueGetDefaultScalingType<srcType>(), float>(1)), size_t(0)); \
+        EXPOP_TEST_VALUE((countPixelImageConvertMismatches<srcType, pixelValueGetDefaultScalingType<srcType>(), double>(1)), size_t(0));
+
+        EXPOP_TEST_CONVERT_SRC(uint8_t)
+        EXPOP_TEST_CONVERT_SRC(uint16_t)
+        EXPOP_TEST_CONVERT_SRC(float)
+        EXPOP_TEST_CONVERT_SRC(double)
+
+      #undef EXPOP_TEST_CONVERT_SRC
+
+        // Threaded, and something that isn't in the dispatch list.
+        EXPOP_TEST_VALUE((countPixelImageConvertMismatches<float, ScalingType_OneIsOne, uint8_t>(0)), size_t(0));
+        EXPOP_TEST_VALUE((countPixelImageConvertMismatches<uint8_t, ScalingType_OneIs255, float>(1)), size_t(0));
+    }
+
+    {
+        // Channel expansion fills in opaque alpha, and contraction
+        // drops the extra channels.
+        PixelImage<float> grey(3, 2, 1);
+        grey.getData(1, 1, 0).value = 0.5f;
+
+        PixelImage<uint8_t> rgba;
+        pixelImageConvert(grey, rgba, 4);
+        EXPOP_TEST_VALUE(rgba.getChannelCount(), PixelImage_Dimension(4));
+        EXPOP_TEST_VALUE(int(rgba.getData(1, 1, 0).value), 128);
+        EXPOP_TEST_VALUE(int(rgba.getData(1, 1, 1).value), 0);
+        EXPOP_TEST_VALUE(int(rgba.getData(1, 1, 3).value), 255);
+
+        PixelImage<uint8_t> ra(3, 2, 2);
+        ra.getData(2, 0, 1).value = 77;
+        PixelImage<float> rgb;
+        pixelImageConvert(ra, rgb, 3);
+        EXPOP_TEST_VALUE(rgb.getData(2, 0, 1).value, 77.0f / 255.0f);
+        EXPOP_TEST_VALUE(rgb.getData(2, 0, 2).value, 0.0f);
+
+        PixelImage<uint8_t> r;
+        pixelImageConvert(rgba, r, 1);
+        EXPOP_TEST_VALUE(r.getChannelCount(), PixelImage_Dimension(1));
+        EXPOP_TEST_VALUE(int(r.getData(1, 1, 0).value), 128);
+    }
+
+    {
+        // Round trip through the old image type.
+        PixelImage<uint8_t> img(37, 23, 4);
+        makePixelImageTestPattern(img);
+        PixelImage<double> asDouble(img);
+
+        Gfx::Image *old = pixelImageToOldImage(asDouble);
+        PixelImage<uint8_t> *back = pixelImageFromOldImage(*old);
+        EXPOP_TEST_VALUE(memcmp(back->getRawData(), img.getRawData(), img.getRawDataLength()), 0);
+        EXPOP_TEST_VALUE(old->getPixel(5, 7)->rgba.g, img.getData(5, 7, 1).value);
+
+        PixelImage<uint16_t> rgb(4, 4, 3);
+        Gfx::Image *oldRgb = pixelImageToOldImage(rgb);
+        EXPOP_TEST_VALUE(int(oldRgb->getPixel(3, 3)->rgba.a), 255);
+
+        delete oldRgb;
+        delete back;
+        delete old;
+    }
+}
+
+inline void doPixelImagePoolTests(size_t &passCounter, size_t &failCounter)
+{
+    {
+        // Moving hands over the storage.
+        PixelImage<uint8_t> img(37, 23, 4);
+        makePixelImageTestPattern(img);
+        const PixelValue<uint8_t> *storage = img.getRow(0);
+        const uint8_t value = img.getData(3, 5, 2).value;
+
+        PixelImage<uint8_t> moved(std::move(img));
+        EXPOP_TEST_VALUE(moved.getRow(0), storage);
+        EXPOP_TEST_VALUE(moved.getWidth(), PixelImage_Dimension(37));
+        EXPOP_TEST_VALUE(img.getWidth(), PixelImage_Dimension(0));
+        EXPOP_TEST_VALUE(img.getRawDataLength(), size_t(0));
+
+        img = std::move(moved);
+        EXPOP_TEST_VALUE(img.getRow(0), storage);
+        EXPOP_TEST_VALUE(int(img.getData(3, 5, 2).value), int(value));
+
+        // Copying over a same-sized image keeps its storage.
+        PixelImage<uint8_t> copy(37, 23, 4);
+        const PixelValue<uint8_t> *copyStorage = copy.getRow(0);
+        copy = img;
+        EXPOP_TEST_VALUE(copy.getRow(0), copyStorage);
+        EXPOP_TEST_VALUE(memcmp(copy.getRawData(), img.getRawData(), img.getRawDataLength()), 0);
+
+        // So does resizing to the same size.
+        copy.setSizeAndChannels(37, 23, 4);
+        EXPOP_TEST_VALUE(copy.getRow(0), copyStorage);
+    }
+
+    {
+        // Into versions match the ones that allocate, and don't
+        // reallocate when the output is already the right size.
+        PixelImage<float> img(64, 48, 3);
+        makePixelImageTestPattern(img);
+
+        PixelImage<float> *scaled = pixelImageScale<float>(img, 23, 17);
+        PixelImage<float> *blurred = pixelImageGaussianBlur<float, ScalingType_OneIsOne>(img, 3.0f, 2.0f);
+        PixelImage<float> *resampled = pixelImageResample<float, ScalingType_OneIsOne>(img, 70, 30);
+        PixelImage<float> *half = pixelImageHalfRes<float, ScalingType_OneIsOne>(img, true);
+
+        PixelImage<float> out;
+        for(int pass = 0; pass < 2; pass++) {
+
+            pixelImageScaleInto(img, out, 23, 17);
+            const PixelValue<float> *storage = out.getRow(0);
+            EXPOP_TEST_VALUE(memcmp(out.getRawData(), scaled->getRawData(), scaled->getRawDataLength()), 0);
+            pixelImageScaleInto(img, out, 23, 17);
+            EXPOP_TEST_VALUE(out.getRow(0), storage);
+
+            pixelImageGaussianBlurInto(img, out, 3.0f, 2.0f);
+            EXPOP_TEST_VALUE(memcmp(out.getRawData(), blurred->getRawData(), blurred->getRawDataLength()), 0);
+
+            pixelImageResampleInto(img, out, 70, 30);
+            EXPOP_TEST_VALUE(memcmp(out.getRawData(), resampled->getRawData(), resampled->getRawDataLength()), 0);
+
+            pixelImageHalfResInto(img, out, true);
+            EXPOP_TEST_VALUE(out.getHeight(), PixelImage_Dimension(24));
+            EXPOP_TEST_VALUE(memcmp(out.getRawData(), half->getRawData(), half->getRawDataLength()), 0);
+        }
+
+        EXPOP_TEST_VALUE(pixelImageScaleInto(img, out, 1, 17), false);
+
+        delete half;
+        delete resampled;
+        delete blurred;
+        delete scaled;
+    }
+
+    {
+        // Same-sized images come back out of the pool.
+        pixelImagePoolSetLimit(16 * 1024 * 1024);
+        const PixelImagePoolStats before = pixelImagePoolGetStats();
+
+        const void *storage = nullptr;
+        {
+            PixelImage<float> img(300, 200, 4);
+            storage = img.getRawData();
+        }
+        EXPOP_TEST_VALUE(pixelImagePoolGetStats().cachedBytes >= 300 * 200 * 4 * sizeof(float), true);
+
+        {
+            // Slightly smaller still fits in the same size class.
+            PixelImage<float> img(299, 200, 4);
+            EXPOP_TEST_VALUE((const void*)img.getRawData(), storage);
+            EXPOP_TEST_VALUE(img.getData(298, 199, 3).value, 0.0f);
+        }
+
+        const PixelImagePoolStats after = pixelImagePoolGetStats();
+        EXPOP_TEST_VALUE(after.hits > before.hits, true);
+
+        // Nothing bigger than the limit gets kept.
+        {
+            PixelImage<float> img(2048, 2048, 4);
+        }
+        EXPOP_TEST_VALUE(pixelImagePoolGetStats().cachedBytes <= 16 * 1024 * 1024, true);
+
+        pixelImagePoolSetLimit(0);
+        EXPOP_TEST_VALUE(pixelImagePoolGetStats().cachedBytes, size_t(0));
+    }
+}
+
+/// Copy a rectangle out of an image into a new one.
+template<typename ValueType>
+inline PixelImage<ValueType> cropPixelImage(
+    const PixelImage<ValueType> &img,
+    PixelImage_Coordinate x,
+    PixelImage_Coordinate y,
+    PixelImage_Dimension width,
+    PixelImage_Dimension height)
+{
+    PixelImage<ValueType> ret(width, height, img.getChannelCount());
+    pixelImageBlit(img, x, y, ret, 0, 0, width, height, -1);
+    return ret;
+}
+
+inline void doPixelImageViewTests(size_t &passCounter, size_t &failCounter)
+{
+    PixelImage<float> atlas(64, 48, 3);
+    makePixelImageTestPattern(atlas);
+
+    {
+        // Clipping.
+        PixelImageView<float> inside(atlas, 10, 7, 20, 15);
+        EXPOP_TEST_VALUE(inside.getWidth(), PixelImage_Dimension(20));
+        EXPOP_TEST_VALUE(inside.getHeight(), PixelImage_Dimension(15));
+        EXPOP_TEST_VALUE(inside.getRow(0), atlas.getRow(7) + 10 * 3);
+        EXPOP_TEST_VALUE(inside.getRowStride(), atlas.getRowStride());
+
+        PixelImageView<float> edge(atlas, -5, 40, 20, 20);
+        EXPOP_TEST_VALUE(edge.getWidth(), PixelImage_Dimension(15));
+        EXPOP_TEST_VALUE(edge.getHeight(), PixelImage_Dimension(8));
+        EXPOP_TEST_VALUE(edge.getRow(0), atlas.getRow(40));
+
+        PixelImageView<float> outside(atlas, 64, 0, 10, 10);
+        EXPOP_TEST_VALUE(outside.isEmpty(), true);
+
+        PixelImageView<float> sub = inside.getSubView(15, 10, 10, 10);
+        EXPOP_TEST_VALUE(sub.getWidth(), PixelImage_Dimension(5));
+        EXPOP_TEST_VALUE(sub.getHeight(), PixelImage_Dimension(5));
+        EXPOP_TEST_VALUE(sub.getRow(0), atlas.getRow(17) + 25 * 3);
+        EXPOP_TEST_VALUE(sub.get(1, 2, 1), atlas.getDouble(26, 19, 1));
+
+        PixelImageConstView<float> constSub(sub);
+        EXPOP_TEST_VALUE(constSub.getSubView(-3, -3, 2, 2).isEmpty(), true);
+    }
+
+    {
+        // Blurring one region of an atlas into a region of another
+        // is the same as cropping, blurring and pasting.
+        PixelImage<float> cropped = cropPixelImage(atlas, 10, 7, 20, 15);
+        PixelImage<float> expected;
+        pixelImageGaussianBlurInto(cropped, expected, 3.0f, 2.0f);
+
+        PixelImage<float> outAtlas(40, 30, 3);
+        makePixelImageTestPattern(outAtlas);
+        PixelImage<float> untouched = outAtlas;
+
+        pixelImageGaussianBlur_kernel(
+            PixelImageConstView<float>(atlas, 10, 7, 20, 15),
+            PixelImageView<float>(outAtlas, 5, 3, 20, 15),
+            3.0f, 2.0f, PixelImage_EdgeMode_Clamp);
+
+        EXPOP_TEST_VALUE(pixelImagesMatch(cropPixelImage(outAtlas, 5, 3, 20, 15), expected), true);
+
+        // Everything around the region is left alone.
+        pixelImageBlit(expected, 0, 0, untouched, 5, 3, 20, 15, -1);
+        EXPOP_TEST_VALUE(pixelImagesMatch(outAtlas, untouched), true);
+    }
+
+    {
+        // Resampling and scaling views.
+        PixelImage<float> cropped = cropPixelImage(atlas, 30, 20, 30, 24);
+
+        PixelImage<float> expected;
+        pixelImageResampleInto(cropped, expected, 17, 11, PixelImage_ResampleFilter_Bicubic);
+        PixelImage<float> outAtlas(32, 32, 3);
+        pixelImageResample_kernel(
+            PixelImageConstView<float>(atlas, 30, 20, 30, 24),
+            PixelImageView<float>(outAtlas, 8, 8, 17, 11),
+            PixelImage_ResampleFilter_Bicubic, PixelImage_EdgeMode_Clamp);
+        EXPOP_TEST_VALUE(pixelImagesMatch(cropPixelImage(outAtlas, 8, 8, 17, 11), expected), true);
+
+        pixelImageScaleInto(cropped, expected, 13, 9);
+        pixelImageScale_kernel(
+            PixelImageConstView<float>(atlas, 30, 20, 30, 24),
+            PixelImageView<float>(outAtlas, 1, 2, 13, 9));
+        EXPOP_TEST_VALUE(pixelImagesMatch(cropPixelImage(outAtlas, 1, 2, 13, 9), expected), true);
+    }
+
+    {
+        // Blitting between views, with wrapping, against blitting
+        // between crops.
+        PixelImage<uint8_t> src(40, 30, 4);
+        PixelImage<uint8_t> dst(50, 40, 4);
+        makePixelImageTestPattern(src);
+        makePixelImageTestPattern(dst);
+
+        PixelImage<uint8_t> srcCrop = cropPixelImage(src, 5, 5, 20, 16);
+        PixelImage<uint8_t> dstCrop = cropPixelImage(dst, 12, 9, 25, 18);
+
+        pixelImageBlit(srcCrop, 7, 3, dstCrop, -4, 10, 30, 12, 3, 1.0, true);
+        pixelImageBlit(
+            PixelImageConstView<uint8_t>(src, 5, 5, 20, 16), 7, 3,
+            PixelImageView<uint8_t>(dst, 12, 9, 25, 18), -4, 10, 30, 12, 3, 1.0, true);
+
+        EXPOP_TEST_VALUE(pixelImagesMatch(cropPixelImage(dst, 12, 9, 25, 18), dstCrop), true);
+
+        // Views of the same image that overlap go in order, just
+        // like blitting the image onto itself.
+        PixelImage<uint8_t> self1 = src;
+        PixelImage<uint8_t> self2 = src;
+        pixelImageBlit(self1, 2, 1, self1, 5, 4, 30, 20, -1, 1.0, false, PixelImage_BlendMode_Straight, 4);
+        pixelImageBlit(
+            PixelImageConstView<uint8_t>(self2), 2, 1,
+            PixelImageView<uint8_t>(self2), 5, 4, 30, 20, -1, 1.0, false, PixelImage_BlendMode_Straight, 4);
+        EXPOP_TEST_VALUE(pixelImagesMatch(self1, self2), true);
+    }
+
+    {
+        // Memory that isn't a PixelImage, with padding on each row.
+        const PixelImage_Dimension width = 9;
+        const PixelImage_Dimension height = 6;
+        const size_t stride = 40;
+        std::vector<uint8_t> buffer(stride * height, 0xcd);
+
+        PixelImage<uint8_t> src(16, 16, 4);
+        makePixelImageTestPattern(src);
+
+        PixelImageView<uint8_t> external(&buffer[0], width, height, 4, stride);
+        pixelImageBlit(PixelImageConstView<uint8_t>(src), 3, 4, external, 0, 0, width, height, -1);
+
+        bool valuesMatch = true;
+        bool paddingKept = true;
+        for(PixelImage_Coordinate y = 0; y < height; y++) {
+            for(size_t i = 0; i < stride; i++) {
+                const uint8_t value = buffer[y * stride + i];
+                if(i < size_t(width) * 4) {
+                    valuesMatch = valuesMatch && value == src.getData(3 + i / 4, 4 + y, i % 4).value;
+                } else {
+                    paddingKept = paddingKept && value == 0xcd;
+                }
+            }
+        }
+        EXPOP_TEST_VALUE(valuesMatch, true);
+        EXPOP_TEST_VALUE(paddingKept, true);
+
+        // Packed rows by default.
+        PixelImageConstView<uint8_t> packed(&buffer[0], 10, 4, 4);
+        EXPOP_TEST_VALUE(packed.getRowStride(), size_t(40));
+    }
+}
+
+inline void doPixelImageMipTests(size_t &passCounter, size_t &failCounter)
+{
+    {
+        // Non-power-of-two sizes round down, and everything is
+        // packed in order.
+        PixelImage<uint8_t> img(37, 23, 4);
+        makePixelImageTestPattern(img);
+        PixelImageMipChain<uint8_t> *chain = pixelImageMakeMipChain<uint8_t, ScalingType_OneIsMaxInt>(img);
+
+        EXPOP_TEST_VALUE(chain->getLevelCount(), size_t(6));
+        EXPOP_TEST_VALUE(chain->getLevel(1).width, 18);
+        EXPOP_TEST_VALUE(chain->getLevel(1).height, 11);
+        EXPOP_TEST_VALUE(chain->getLevel(4).width, 2);
+        EXPOP_TEST_VALUE(chain->getLevel(4).height, 1);
+        EXPOP_TEST_VALUE(chain->getLevel(5).width, 1);
+        EXPOP_TEST_VALUE(chain->getLevel(5).height, 1);
+        EXPOP_TEST_VALUE(chain->getLevel(2).offset, size_t((37 * 23 + 18 * 11) * 4));
+        EXPOP_TEST_VALUE(chain->getDataSize(), chain->getLevel(5).offset + 4);
+
+        // The first level is just the image.
+        PixelImage<uint8_t> *level0 = chain->makeLevelImage(0);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*level0, img), true);
+        delete level0;
+
+        delete chain;
+    }
+
+    {
+        // Box filtering a power-of-two image averages 2x2 blocks.
+        PixelImage<float> img(16, 8, 2);
+        makePixelImageTestPattern(img);
+        PixelImageMipChain<float> *chain = pixelImageMakeMipChain<float, ScalingType_OneIsOne>(img);
+
+        PixelImageTypedReader<PixelValue<float> > level1 = chain->getLevelReader(1);
+        double expected =
+            (img.getDouble(6, 2, 1) + img.getDouble(7, 2, 1) +
+                img.getDouble(6, 3, 1) + img.getDouble(7, 3, 1)) / 4.0;
+        EXPOP_TEST_VALUE(fabs(level1.get(3, 1, 1) - expected) < 0.00001, true);
+
+        delete chain;
+    }
+
+    {
+        // Every level matches resampling the level before it on its
+        // own, with either edge mode.
+        PixelImage<float> img(45, 30, 3);
+        makePixelImageTestPattern(img);
+
+        PixelImage_ResampleFilter filters[3] = {
+            PixelImage_ResampleFilter_Box,
+            PixelImage_ResampleFilter_Kaiser,
+            PixelImage_ResampleFilter_Lanczos3
+        };
+        PixelImage_EdgeMode edgeModes[2] = {
+            PixelImage_EdgeMode_Clamp,
+            PixelImage_EdgeMode_Wrap
+        };
+
+        for(size_t f = 0; f < 3; f++) {
+            for(size_t e = 0; e < 2; e++) {
+
+                PixelImageMipChain<float> *chain = pixelImageMakeMipChain<float, ScalingType_OneIsOne>(
+                    img, filters[f], false, -1, edgeModes[e]);
+
+                double maxDiff = 0.0;
+                PixelImage<float> *previous = new PixelImage<float>(img);
+                for(size_t i = 1; i < chain->getLevelCount(); i++) {
+                    PixelImage<float> *expected = pixelImageResample<float, ScalingType_OneIsOne>(
+                        *previous, chain->getLevel(i).width, chain->getLevel(i).height,
+                        filters[f], edgeModes[e]);
+                    PixelImage<float> *level = chain->makeLevelImage(i);
+                    double diff = pixelImageMaxDifference(*expected, *level);
+                    if(diff > maxDiff) maxDiff = diff;
+                    delete level;
+                    delete previous;
+                    previous = expected;
+                }
+                delete previous;
+                delete chain;
+
+                EXPOP_TEST_VALUE(maxDiff < 0.00001, true);
+            }
+        }
+    }
+
+    {
+        // sRGB averaging happens in linear space. Alpha doesn't get
+        // converted.
+        PixelImage<uint8_t> img(2, 1, 2);
+        img.setDouble(0, 0, 0, 0.0);
+        img.setDouble(1, 0, 0, 1.0);
+        img.setDouble(0, 0, 1, 0.0);
+        img.setDouble(1, 0, 1, 1.0);
+
+        PixelImageMipChain<uint8_t> *chain = pixelImageMakeMipChain<uint8_t, ScalingType_OneIsMaxInt>(
+            img, PixelImage_ResampleFilter_Box, true, 1);
+        EXPOP_TEST_VALUE(chain->getLevelData(1)[0].value, 188);
+        EXPOP_TEST_VALUE(chain->getLevelData(1)[1].value, 128);
+        delete chain;
+    }
+}
+
+inline void doPixelImageTests(size_t &passCounter, size_t &failCounter)
+{
+    PixelImage<uint8_t> img(37, 23, 4);
+    makePixelImageTestPattern(img);
+
+    {
+        // Row access lines up with getData().
+        EXPOP_TEST_VALUE(img.getRowStride(), size_t(37 * 4));
+        EXPOP_TEST_VALUE(img.getRow(5) + 3 * 4 + 2, &img.getData(3, 5, 2));
+        EXPOP_TEST_VALUE(&img.getRowSpan<4>(5)(3, 2), &img.getData(3, 5, 2));
+        EXPOP_TEST_VALUE(&img.getRowSpan<0>(5)(3, 2), &img.getData(3, 5, 2));
+
+        PixelImageTypedReader<PixelValue<uint8_t> > reader = pixelImageMakeReader(img);
+        EXPOP_TEST_VALUE(reader.get(3, 5, 2), img.getDouble(3, 5, 2));
+    }
+
+    {
+        // Typed kernels have to produce exactly what the virtual
+        // getDouble() path does.
+        PixelImageVirtualReader virtualReader(img);
+
+        PixelImage<uint8_t> *typed = upScaleImageLinear<uint8_t>(img, 80, 50);
+        PixelImage<uint8_t> slow(80, 50, 4);
+        upScaleImageLinear_kernel(virtualReader, slow, PixelImage_EdgeMode_Clamp);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*typed, slow), true);
+        delete typed;
+
+        typed = downScaleImageAveraged<uint8_t>(img, 15, 9);
+        slow.setSize(15, 9);
+        downScaleImageAveraged_kernel(virtualReader, slow);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*typed, slow), true);
+        delete typed;
+
+        typed = pixelImageScale_lanczos<uint8_t, ScalingType_OneIsMaxInt>(img, 50, 30);
+        slow.setSize(50, 30);
+        pixelImageResample_kernel(
+            virtualReader, slow,
+            PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Wrap);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*typed, slow), true);
+        delete typed;
+
+        typed = pixelImageGaussianBlur<uint8_t, ScalingType_OneIsMaxInt>(img, 2.5f, 1.5f);
+        slow.setSize(37, 23);
+        pixelImageGaussianBlur_kernel(virtualReader, slow, 2.5f, 1.5f, PixelImage_EdgeMode_Clamp);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*typed, slow), true);
+        delete typed;
+
+        typed = pixelImageGaussianBlur<uint8_t, ScalingType_OneIsMaxInt>(img, 2.5f, 1.5f, PixelImage_EdgeMode_Wrap);
+        pixelImageGaussianBlur_kernel(virtualReader, slow, 2.5f, 1.5f, PixelImage_EdgeMode_Wrap);
+        EXPOP_TEST_VALUE(pixelImagesMatch(*typed, slow), true);
+        delete typed;
+    }
+
+    {
+        // Half-res averages pairs of pixels on either axis.
+        PixelImage<float> small(2, 2, 1);
+        small.setDouble(0, 0, 0, 0.0);
+        small.setDouble(1, 0, 0, 1.0);
+        small.setDouble(0, 1, 0, 0.5);
+        small.setDouble(1, 1, 0, 0.5);
+
+        PixelImage<float> *half = pixelImageHalfRes<float, ScalingType_OneIsOne>(small, false);
+        EXPOP_TEST_VALUE(half->getWidth(), 1);
+        EXPOP_TEST_VALUE(half->getDouble(0, 0, 0), 0.5);
+        delete half;
+
+        half = pixelImageHalfRes<float, ScalingType_OneIsOne>(small, true);
+        EXPOP_TEST_VALUE(half->getHeight(), 1);
+        EXPOP_TEST_VALUE(half->getDouble(0, 0, 0), 0.25);
+        EXPOP_TEST_VALUE(half->getDouble(1, 0, 0), 0.75);
+        delete half;
+
+        // One pixel wide or tall images stay one pixel on the halved
+        // axis, without reading past the edge.
+        PixelImage<float> column(1, 4, 1);
+        PixelImage<float> row(4, 1, 1);
+        for(PixelImage_Coordinate i = 0; i < 4; i++) {
+            column.setDouble(0, i, 0, 0.25 * i);
+            row.setDouble(i, 0, 0, 0.25 * i);
+        }
+
+        half = pixelImageHalfRes<float, ScalingType_OneIsOne>(column, false);
+        EXPOP_TEST_VALUE(half->getWidth(), 1);
+        EXPOP_TEST_VALUE(half->getHeight(), 4);
+        EXPOP_TEST_VALUE(half->getDouble(0, 3, 0), 0.75);
+        delete half;
+
+        half = pixelImageHalfRes<float, ScalingType_OneIsOne>(row, true);
+        EXPOP_TEST_VALUE(half->getWidth(), 4);
+        EXPOP_TEST_VALUE(half->getHeight(), 1);
+        EXPOP_TEST_VALUE(half->getDouble(2, 0, 0), 0.5);
+        delete half;
+
+        PixelImage<float> out;
+        pixelImageHalfResInto(row, out, false);
+        EXPOP_TEST_VALUE(out.getWidth(), 2);
+        EXPOP_TEST_VALUE(out.getDouble(1, 0, 0), 0.625);
+        pixelImageHalfResInto(column, out, true);
+        EXPOP_TEST_VALUE(out.getHeight(), 2);
+        EXPOP_TEST_VALUE(out.getDouble(0, 0, 0), 0.125);
+    }
+
+    {
+        // Blits through typed and virtual writers agree, with and
+        // without wrapping.
+        for(int wrap = 0; wrap < 2; wrap++) {
+
+            PixelImage<float> dst1(30, 20, 4);
+            PixelImage<float> dst2(30, 20, 4);
+            makePixelImageTestPattern(dst1);
+            makePixelImageTestPattern(dst2);
+
+            pixelImageBlit(img, 5, 3, dst1, 20, -4, 17, 19, 3, 1.0, wrap);
+            pixelImageBlit_kernel(
+                PixelImageVirtualReader(img), 5, 3,
+                PixelImageVirtualWriter(dst2), 20, -4, 17, 19, 3, 1.0, wrap);
+
+            EXPOP_TEST_VALUE(pixelImagesMatch(dst1, dst2), true);
+        }
+
+        // Unusual formats fall back to the virtual path.
+        PixelImage<uint8_t, ScalingType_OneIs255> dst(4, 4, 3);
+        pixelImageBlit(img, 0, 0, dst, 0, 0, 4, 4, -1, 1.0);
+        EXPOP_TEST_VALUE(dst.getDouble(2, 1, 1), img.getDouble(2, 1, 1));
+    }
+
+    doPixelImageBlurTests(passCounter, failCounter);
+    doPixelImageResampleTests(passCounter, failCounter);
+    doPixelImageThreadTests(passCounter, failCounter);
+    doPixelImageBlitTests(passCounter, failCounter);
+    doPixelImageTGATests(passCounter, failCounter);
+    doPixelImageBCTests(passCounter, failCounter);
+    doPixelImageConvertTests(passCounter, failCounter);
+    doPixelImagePoolTests(passCounter, failCounter);
+    doPixelImageViewTests(passCounter, failCounter);
+    doPixelImageMipTests(passCounter, failCounter);
+}
+
+inline void doCompressTests(size_t &passCounter, size_t &failCounter)
+{
+    std::string fileData = FileSystem::loadFileString("README.org");
+    unsigned int len = 0;
+    char *compressedData = compressRLE(&fileData[0], fileData.size(), &len, 1);
+
+    std::cout << "Original size:   " << fileData.size() << std::endl;
+    std::cout << "Compressed size: " << len << std::endl;
+    EXPOP_TEST_VALUE(len < fileData.size(), true);
+
+    unsigned int len2 = 0;
+    char *uncompressedData = decompressRLE(compressedData, len, &len2, 1);
+    EXPOP_TEST_VALUE(len2, fileData.size());
+
+    EXPOP_TEST_VALUE(strncmp(&fileData[0], uncompressedData, ExPop::min(fileData.size(), (size_t)len2)), 0);
+
+    delete[] uncompressedData;
+    delete[] compressedData;
+}
+
+inline void doPreprocessorTests(size_t &passCounter, size_t &failCounter)
+{
+    PreprocessorState state;
+    state.definedSymbols["DICK"] = "1";
+    state.definedSymbols["BUTT"] = "0";
+
+    EXPOP_TEST_VALUE(
+        preprocess(
+            "faketest.txt",
+            "#if DICK\ndick\n#else\nbutt\n#endif\n#if BUTT\nbutt\n#else\ndick\n#endif\n",
+            state),
+        "dick\ndick\n");
+    EXPOP_TEST_VALUE(state.hadError, false);
+
+    EXPOP_TEST_VALUE(
+        preprocess(
+            "faketest.txt",
+            "#endif",
+            state), "");
+
+    EXPOP_TEST_VALUE(state.hadError, true);
+}
+
+// inline void doArchiveTests(size_t &passCounter, size_t &failCounter)
+// {
+//     {
+//         FileSystem::Archive testArchive("lilylibtest.poop", true);
+//         std::string fileData = FileSystem::loadFileString("README.org");
+//         EXPOP_TEST_VALUE(testArchive.getFailed(), false);
+//         bool addFileSucceed = testArchive.addFile("Stuff_Only_For_Archive_Test", fileData.c_str(), fileData.size());
+//         EXPOP_TEST_VALUE(addFileSucceed, true);
+//         EXPOP_TEST_VALUE(testArchive.getFailed(), false);
+//         bool addFileFail = testArchive.addFile("Stuff_Only_For_Archive_Test", fileData.c_str(), fileData.size());
+//         EXPOP_TEST_VALUE(addFileFail, false);
+//     }
+//     EXPOP_TEST_VALUE(FileSystem::fileExists("lilylibtest.poop"), true);
+//     EXPOP_TEST_VALUE(FileSystem::fileExists("Stuff_Only_For_Archive_Test"), false);
+//     FileSystem::addArchiveForSearch("lilylibtest.poop");
+//     EXPOP_TEST_VALUE(FileSystem::fileExists("Stuff_Only_For_Archive_Test"), true);
+//     FileSystem::removeArchiveForSearch("lilylibtest.poop");
+//     EXPOP_TEST_VALUE(FileSystem::fileExists("Stuff_Only_For_Archive_Test"), false);
+//     FileSystem::deleteFile("lilylibtest.poop");
+//     EXPOP_TEST_VALUE(FileSystem::fileExists("lilylibtest.poop"), false);
+// }
+
+inline void doParserTests(size_t &passCounter, size_t &failCounter)
+{
+    ParserNode *node = new ParserNode();
+    node->setStringValue("dick", "butt");
+    node->setBinaryValue("foo", "bar", 3);
+
+    ParserNode *child = new ParserNode();
+    child->setName("thingy");
+    child->setStringValue("Whatever", "Arghblargh");
+
+    node->addChildToEnd(child);
+
+    node->addChildToEnd(parseXmlString("<junk><blagh>HERPDERP</blagh>Whatever</junk>"));
+
+    {
+        std::string badXmlError;
+        ParserNode *badXml = parseXmlString("<bad_xml<", &badXmlError);
+        EXPOP_TEST_VALUE(!badXmlError.size(), 0);
+        delete badXml;
+    }
+
+    {
+        std::string badJsonError;
+        ParserNode *badJson = parseJsonString("This is obviously not valid JSON", &badJsonError);
+        EXPOP_TEST_VALUE(!badJsonError.size(), 0);
+        delete badJson;
+    }
+
+    cout << *node << endl;
+    node->outputXml(cout, 0);
+    cout << endl;
+    node->outputJson(cout, 0);
+    cout << endl;
+
+    {
+        ostringstream ostr;
+        ostr << *node;
+        ParserNode *readBack = parseString(ostr.str());
+        EXPOP_TEST_VALUE(readBack->getChild(0)->getStringValueDirty("Whatever"), "Arghblargh");
+        delete readBack;
+    }
+
+    {
+        ostringstream ostr;
+        node->outputXml(ostr, 0);
+        ParserNode *readBack = parseXmlString(ostr.str());
+        EXPOP_TEST_VALUE(readBack->getChild(0)->getChild(0)->getStringValueDirty("Whatever"), "Arghblargh");
+        delete readBack;
+    }
+
+    {
+        ostringstream ostr;
+        node->outputJson(ostr, 0);
+        ParserNode *readBack = parseJsonString(ostr.str());
+        EXPOP_TEST_VALUE(readBack->getChild(0)->getStringValueDirty("Whatever"), "Arghblargh");
+        delete readBack;
+    }
+
+    delete node;
+}
+
+inline void doFilesystemTests(const char *argv0, size_t &passCounter, size_t &failCounter)
+{
+    EXPOP_TEST_VALUE(system(("\"" + FileSystem::getExecutablePath(argv0) + "\" --quit").c_str()), 0);
+
+    EXPOP_TEST_VALUE(
+        FileSystem::loadFileString("tests/normal_file.txt"),
+        "This file is outside a zip.\n");
+
+    FileSystem::mountZipFile("tests/zip_test.zip");
+
+    EXPOP_TEST_VALUE(
+        FileSystem::fileExists("tests/zip_test.txt"), true);
+
+    EXPOP_TEST_VALUE(
+        FileSystem::getFileSize("tests/zip_test.txt"), 27);
+
+    EXPOP_TEST_VALUE(
+        FileSystem::loadFileString("tests/zip_test.txt"),
+        "This file is inside a zip.\n");
+
+    FileSystem::unmountAll();
+
+    EXPOP_TEST_VALUE(
+        FileSystem::fileExists("tests/zip_test.txt"), false);
+
+    EXPOP_TEST_VALUE(
+        FileSystem::getFileSize("tests/zip_test.txt"), -1);
+
+    EXPOP_TEST_VALUE(
+        FileSystem::loadFileString("tests/zip_test.txt"),
+        "");
+}
+
+// ----------------------------------------------------------------------
+
+class TimerBlock
+{
+public:
+    TimerBlock(const char *inName)
+    {
+        startTime = std::chrono::high_resolution_clock::now();
+        name = inName;
+    }
+
+    ~TimerBlock()
+    {
+        std::chrono::time_point<std::chrono::high_resolution_clock> endTime = std::chrono::high_resolution_clock::now();
+        std::chrono::nanoseconds t = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime);
+        std::cout << name << ": " << t.count() << std::endl;
+    }
+
+private:
+    std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
+    const char *name;
+};
+
+#define TIME_SECTION(name) TimerBlock timerBlock(name)
+
+// ----------------------------------------------------------------------
+// Benchmarks
+// ----------------------------------------------------------------------
+
+inline void doStringBenchmarks()
+{
+    std::vector<std::string> paths;
+    for(size_t i = 0; i < 10000; i++) {
+        std::ostringstream str;
+        str << "/home/user/projects/game/../game/data/./textures/level" << (i % 37)
+            << "/tile_" << i << ".png";
+        paths.push_back(str.str());
+    }
+
+    size_t totalSize = 0;
+    {
+        TIME_SECTION("fixFileName 10k paths x10, old version");
+        for(size_t n = 0; n < 10; n++) {
+            for(size_t i = 0; i < paths.size(); i++) {
+                totalSize += referenceFixFileName(paths[i]).size();
+            }
+        }
+    }
+    {
+        TIME_SECTION("fixFileName 10k paths x10");
+        for(size_t n = 0; n < 10; n++) {
+            for(size_t i = 0; i < paths.size(); i++) {
+                totalSize += FileSystem::fixFileName(paths[i]).size();
+            }
+        }
+    }
+
+    // A big text file, split into lines like the preprocessor does.
+    std::string text;
+    for(size_t i = 0; i < 100000; i++) {
+        text += "    int someVariable = someFunction(argument, otherArgument);\n";
+        if(i % 10 == 0) {
+            text += "\n";
+        }
+    }
+
+    {
+        TIME_SECTION("Tokenize 100k lines, old version");
+        std::vector<std::string> lines;
+        referenceStringTokenize(text, "\n", lines, true);
+        totalSize += lines.size();
+    }
+    {
+        TIME_SECTION("Tokenize 100k lines, stringTokenize");
+        std::vector<std::string> lines;
+        stringTokenize(text, "\n", lines, true);
+        totalSize += lines.size();
+    }
+    {
+        TIME_SECTION("Tokenize 100k lines, StringView stringTokenize");
+        std::vector<StringView> lines;
+        stringTokenize(text, "\n", lines, true);
+        totalSize += lines.size();
+    }
+    {
+        TIME_SECTION("Tokenize 100k lines into words, old version");
+        std::vector<std::string> words;
+        referenceStringTokenize(text, " \t\r\n(),;=", words, false);
+        totalSize += words.size();
+    }
+    {
+        TIME_SECTION("Tokenize 100k lines into words, StringTokenizer");
+        StringTokenizer tokenizer(text, " \t\r\n(),;=");
+        StringView word;
+        while(tokenizer.next(word)) {
+            totalSize += word.size();
+        }
+    }
+
+    // Keep the results from getting optimized away.
+    if(!totalSize) {
+        std::cout << totalSize << std::endl;
+    }
+}
+
+inline void doStringTransformBenchmarks()
+{
+    // Config-file-ish text, with a few characters that need escaping
+    // on every line.
+    std::string text;
+    for(size_t i = 0; i < 15000; i++) {
+        text += "name = \"Tile <" + std::to_string(i) + "> & friends\" path = C:\\data\\tiles\n";
+    }
+
+    size_t totalSize = 0;
+    std::string out;
+
+    {
+        TIME_SECTION("stringEscape 1MB, old version");
+        totalSize += referenceStringEscape(text, true).size();
+    }
+    {
+        TIME_SECTION("stringEscape 1MB");
+        totalSize += stringEscape(text).size();
+    }
+    {
+        TIME_SECTION("stringEscapeAppend 1MB, reused buffer");
+        out.clear();
+        stringEscapeAppend(text, out);
+        totalSize += out.size();
+    }
+    {
+        TIME_SECTION("stringXmlEscape 1MB, old version");
+        totalSize += referenceStringXmlEscape(text).size();
+    }
+    {
+        TIME_SECTION("stringXmlEscape 1MB");
+        totalSize += stringXmlEscape(text).size();
+    }
+    {
+        TIME_SECTION("stringXmlEscapeAppend 1MB, reused buffer");
+        out.clear();
+        stringXmlEscapeAppend(text, out);
+        totalSize += out.size();
+    }
+    {
+        TIME_SECTION("urlEncode 1MB, old version");
+        totalSize += referenceUrlEncode(text).size();
+    }
+    {
+        TIME_SECTION("urlEncode 1MB");
+        totalSize += urlEncode(text).size();
+    }
+    {
+        TIME_SECTION("urlEncodeAppend 1MB, reused buffer");
+        out.clear();
+        urlEncodeAppend(text, out);
+        totalSize += out.size();
+    }
+    {
+        TIME_SECTION("strEncodeHex 1MB, old version");
+        referenceStrEncodeHex(text.data(), int(text.size()), out, 80);
+        totalSize += out.size();
+    }
+    {
+        TIME_SECTION("strEncodeHex 1MB");
+        strEncodeHex(text.data(), int(text.size()), out);
+        totalSize += out.size();
+    }
+
+    // The old stringReplace() copies the whole output for every
+    // character, so it only gets a small piece of the text.
+    const std::string smallText = text.substr(0, 64 * 1024);
+    {
+        TIME_SECTION("stringReplace 64k, old version");
+        totalSize += referenceStringReplace<char>("tiles", "textures", smallText).size();
+    }
+    {
+        TIME_SECTION("stringReplace 64k");
+        totalSize += stringReplace<char>("tiles", "textures", smallText).size();
+    }
+    {
+        TIME_SECTION("stringReplace 1MB");
+        totalSize += stringReplace<char>("tiles", "textures", text).size();
+    }
+    {
+        TIME_SECTION("stringReplaceAppend 1MB, reused buffer");
+        out.clear();
+        stringReplaceAppend<char>("tiles", "textures", text, out);
+        totalSize += out.size();
+    }
+
+    // Keep the results from getting optimized away.
+    if(!totalSize) {
+        std::cout << totalSize << std::endl;
+    }
+}
+
+inline void doWordWrapBenchmarks()
+{
+    // A console's worth of long, colored scrollback lines, wrapped
+    // the way a redraw would.
+    std::vector<std::string> scrollback;
+    for(size_t i = 0; i < 1024; i++) {
+        std::ostringstream str;
+        str << "\x1b[1;32m[" << i << "]\x1b[0m ";
+        for(size_t w = 0; w < 40; w++) {
+            str << "word" << (w * i % 97) << ((w % 9) ? " " : "  ");
+        }
+        scrollback.push_back(str.str());
+    }
+
+    size_t totalSize = 0;
+    {
+        TIME_SECTION("Wrap and indent 1024 lines x10, old version");
+        for(size_t n = 0; n < 10; n++) {
+            for(size_t i = 0; i < scrollback.size(); i++) {
+                totalSize += referenceStringIndent(
+                    referenceStringWordWrap(scrollback[i], 80, 76), 0, 4).size();
+            }
+        }
+    }
+    {
+        TIME_SECTION("Wrap and indent 1024 lines x10");
+        for(size_t n = 0; n < 10; n++) {
+            for(size_t i = 0; i < scrollback.size(); i++) {
+                totalSize += stringIndent(stringWordWrap(scrollback[i], 80, 76), 0, 4).size();
+            }
+        }
+    }
+    {
+        TIME_SECTION("Wrap 1024 lines x10, StringWordWrapper");
+        StringWrappedLine line;
+        for(size_t n = 0; n < 10; n++) {
+            for(size_t i = 0; i < scrollback.size(); i++) {
+                StringWordWrapper<char> wrapper(scrollback[i], 80, 76);
+                while(wrapper.next(line)) {
+                    totalSize += line.width;
+                }
+            }
+        }
+    }
+
+    // One big block of text.
+    std::string text;
+    for(size_t i = 0; i < scrollback.size(); i++) {
+        text += scrollback[i];
+        text += "\n";
+    }
+    {
+        TIME_SECTION("stringPrefixLines 1024 lines x10, old version");
+        for(size_t n = 0; n < 10; n++) {
+            totalSize += referenceStringPrefixLines(text, "> ").size();
+        }
+    }
+    {
+        TIME_SECTION("stringPrefixLines 1024 lines x10");
+        for(size_t n = 0; n < 10; n++) {
+            totalSize += stringPrefixLines(text, "> ").size();
+        }
+    }
+    {
+        TIME_SECTION("Wrap 1024 lines as one text x10, stringWordWrapLines");
+        std::vector<StringWrappedLine> lines;
+        for(size_t n = 0; n < 10; n++) {
+            lines.clear();
+            stringWordWrapLines(text, 80, 0, lines);
+            totalSize += lines.size();
+        }
+    }
+
+    // Keep the results from getting optimized away.
+    if(!totalSize) {
+        std::cout << totalSize << std::endl;
+    }
+}
+
+inline void doBase64Benchmarks()
+{
+    // A few megabytes of binary, like a blob embedded in a config
+    // file.
+    const std::string data = makeBase64TestData(4 * 1024 * 1024, 99);
+    const std::string encoded = stringBase64Encode(data.data(), data.size());
+    const std::string wrapped = wrapBase64TestText(encoded, 76);
+
+    size_t totalSize = 0;
+    {
+        TIME_SECTION("Encode 4MB, old version");
+        totalSize += referenceBase64Encode(data.data(), data.size()).size();
+    }
+    {
+        TIME_SECTION("Encode 4MB, stringBase64Encode");
+        totalSize += stringBase64Encode(data.data(), data.size()).size();
+    }
+    {
+        std::vector<char> out(stringBase64EncodedLength(data.size()));
+        TIME_SECTION("Encode 4MB, stringBase64EncodeToBuffer");
+        totalSize += stringBase64EncodeToBuffer(data.data(), data.size(), &out[0]);
+    }
+    {
+        TIME_SECTION("Decode 4MB, old version");
+        totalSize += referenceBase64Decode(encoded).size();
+    }
+    {
+        TIME_SECTION("Decode 4MB, stringBase64DecodeString");
+        totalSize += stringBase64DecodeString(encoded).size();
+    }
+    {
+        std::vector<uint8_t> out(data.size());
+        TIME_SECTION("Decode 4MB, stringBase64DecodeToBuffer");
+        size_t outLength = 0;
+        stringBase64DecodeToBuffer(encoded.data(), encoded.size(), &out[0], outLength);
+        totalSize += outLength;
+    }
+    {
+        std::vector<uint8_t> out(data.size());
+        TIME_SECTION("Decode 4MB in 76-column lines, skipping whitespace");
+        size_t outLength = 0;
+        stringBase64DecodeToBuffer(
+            wrapped.data(), wrapped.size(), &out[0], outLength, BASE64WHITESPACE_SKIP);
+        totalSize += outLength;
+    }
+    {
+        std::vector<uint8_t> out(StringBase64Decoder::getMaxOutputLength(4096));
+        TIME_SECTION("Decode 4MB in 76-column lines, streamed 4k at a time");
+        StringBase64Decoder decoder(BASE64WHITESPACE_SKIP);
+        for(size_t i = 0; i < wrapped.size(); i += 4096) {
+            size_t outLength = 0;
+            decoder.update(wrapped.data() + i, std::min(size_t(4096), wrapped.size() - i), &out[0], outLength);
+            totalSize += outLength;
+        }
+        totalSize += decoder.finish();
+    }
+
+    // Keep the results from getting optimized away.
+    if(!totalSize) {
+        std::cout << totalSize << std::endl;
+    }
+}
+
+inline void doUTF8Benchmarks()
+{
+    // Mostly ASCII, like source code or console commands.
+    std::basic_string<uint32_t> asciiHeavy;
+    for(size_t i = 0; i < 100000; i++) {
+        const char *line = "set r_windowTitle \"Caf\xc3\xa9\" ; echo done\n";
+        std::basic_string<uint32_t> decoded = stringUTF8ToUTF32_lenient(line);
+        asciiHeavy += decoded;
+    }
+
+    // Mostly three-byte characters.
+    std::basic_string<uint32_t> cjkHeavy;
+    for(size_t i = 0; i < 400000; i++) {
+        cjkHeavy += uint32_t(0x4e00 + (i * 7919) % 0x5000);
+        if(i % 10 == 0) {
+            cjkHeavy += uint32_t(' ');
+        }
+    }
+
+    const std::basic_string<uint32_t> *inputs[2] = { &asciiHeavy, &cjkHeavy };
+    const char *names[2] = { "ASCII-heavy", "CJK-heavy" };
+
+    for(size_t n = 0; n < 2; n++) {
+
+        std::string utf8;
+        std::basic_string<uint32_t> utf32;
+        stringUTF32ToUTF8Checked(*inputs[n], utf8);
+
+        std::ostringstream sizeStr;
+        sizeStr << " " << utf8.size() / 1024 << "k";
+
+        {
+            std::string name = std::string("UTF-32 to UTF-8, old, ") + names[n] + sizeStr.str();
+            TIME_SECTION(name.c_str());
+            utf8 = stringUTF32ToUTF8_lenient(*inputs[n]);
+        }
+        {
+            std::string name = std::string("UTF-32 to UTF-8, checked, ") + names[n] + sizeStr.str();
+            TIME_SECTION(name.c_str());
+            stringUTF32ToUTF8Checked(*inputs[n], utf8);
+        }
+        {
+            std::string name = std::string("UTF-8 to UTF-32, old, ") + names[n] + sizeStr.str();
+            TIME_SECTION(name.c_str());
+            utf32 = stringUTF8ToUTF32_lenient(utf8);
+        }
+        {
+            std::string name = std::string("UTF-8 to UTF-32, checked, ") + names[n] + sizeStr.str();
+            TIME_SECTION(name.c_str());
+            stringUTF8ToUTF32Checked(utf8, utf32);
+        }
+        {
+            std::string name = std::string("UTF-8 validate, ") + names[n] + sizeStr.str();
+            TIME_SECTION(name.c_str());
+            if(!stringValidateUTF8(utf8.data(), utf8.size())) {
+                std::cout << "Invalid UTF-8?" << std::endl;
+            }
+        }
+    }
+}
+
+// These only run with --benchmark. Times are in nanoseconds.
+
+struct RingQueueBenchmarkData
+{
+    MPMCRingQueue<size_t> *queue;
+    ExPop::Threads::Mutex *mutex;
+    std::vector<size_t> *lockedVector;
+    size_t count;
+};
+
+void ringQueueBenchmark_mpmcProducer(void *data)
+{
+    RingQueueBenchmarkData *benchData = (RingQueueBenchmarkData*)data;
+    for(size_t i = 0; i < benchData->count; i++) {
+        while(!benchData->queue->push(i)) {
+            sleepWrapper(0);
+        }
+    }
+}
+
+void ringQueueBenchmark_mutexProducer(void *data)
+{
+    RingQueueBenchmarkData *benchData = (RingQueueBenchmarkData*)data;
+    for(size_t i = 0; i < benchData->count; i++) {
+        benchData->mutex->lock();
+        benchData->lockedVector->push_back(i);
+        benchData->mutex->unlock();
+    }
+}
+
+inline void doMatrixBenchmarks_batch()
+{
+    const size_t count = 1000000;
+    FMatrix4x4 m = makeAffineTestMatrix(1, false);
+    FVec3 from(1.0f, 2.0f, 3.0f);
+
+    std::vector<FVec3> points(count);
+    std::vector<FVec4> points4(count);
+    for(size_t i = 0; i < count; i++) {
+        fillTestMatrix(points[i], i);
+        fillTestMatrix(points4[i], i);
+    }
+
+    std::vector<FVec3> out(count);
+    std::vector<FVec4> out4(count);
+    std::vector<float> xs(count), ys(count), zs(count);
+    std::vector<float> results(count);
+
+    {
+        TIME_SECTION("Transform 1M points, multiply() per point");
+        for(size_t i = 0; i < count; i++) {
+            FVec4 p = m.multiply(FVec4(points[i].data[0], points[i].data[1], points[i].data[2], 1.0f));
+            out[i] = FVec3(p.data[0], p.data[1], p.data[2]);
+        }
+    }
+    {
+        TIME_SECTION("Transform 1M points, matrixBatchTransformPoints");
+        matrixBatchTransformPoints(m, &points[0], &out[0], count);
+    }
+    {
+        TIME_SECTION("Transform 1M points, matrixBatchTransformPointsSoA");
+        matrixBatchTransformPointsSoA(m, &points[0], &xs[0], &ys[0], &zs[0], count);
+    }
+    {
+        TIME_SECTION("Transform 1M FVec4s, multiply() per vector");
+        for(size_t i = 0; i < count; i++) {
+            out4[i] = m.multiply(points4[i]);
+        }
+    }
+    {
+        TIME_SECTION("Transform 1M FVec4s, matrixBatchTransform");
+        matrixBatchTransform(m, &points4[0], &out4[0], count);
+    }
+    {
+        TIME_SECTION("Distances to 1M points, magnitude() per point");
+        for(size_t i = 0; i < count; i++) {
+            results[i] = (points[i] - from).magnitude();
+        }
+    }
+    {
+        TIME_SECTION("Distances to 1M points, matrixBatchDistances");
+        matrixBatchDistances(from, &points[0], &results[0], count);
+    }
+    {
+        TIME_SECTION("Dot with 1M points, dot() per point");
+        for(size_t i = 0; i < count; i++) {
+            results[i] = from.dot(points[i]);
+        }
+    }
+    {
+        TIME_SECTION("Dot with 1M points, matrixBatchDots");
+        matrixBatchDots(from, &points[0], &results[0], count);
+    }
+
+    // A wide, shallow hierarchy, like a crowd of skeletons.
+    const size_t nodeCount = 100000;
+    std::vector<FMatrix4x4> local(nodeCount);
+    std::vector<FMatrix4x4> world(nodeCount);
+    std::vector<int32_t> parents(nodeCount);
+    for(size_t i = 0; i < nodeCount; i++) {
+        local[i] = makeAffineTestMatrix(i, true);
+        parents[i] = (i % 20) ? int32_t(i - 1) : -1;
+    }
+    {
+        TIME_SECTION("World transforms for 100k nodes, matrixBatchWorldTransforms");
+        matrixBatchWorldTransforms(&local[0], &parents[0], &world[0], nodeCount);
+    }
+}
+
+inline void doMatrixBenchmarks()
+{
+    const size_t count = 100000;
+    std::vector<FMatrix4x4> a4(count), b4(count);
+    std::vector<FMatrix3x3> a3(count), b3(count);
+    std::vector<FVec4> v4(count);
+    for(size_t i = 0; i < count; i++) {
+        fillTestMatrix(a4[i], i);
+        fillTestMatrix(b4[i], i + count);
+        fillTestMatrix(a3[i], i + count * 2);
+        fillTestMatrix(b3[i], i + count * 3);
+        fillTestMatrix(v4[i], i + count * 4);
+    }
+
+    // Something for the results to go into so nothing gets
+    // optimised away.
+    volatile float sink = 0.0f;
+
+    {
+        TIME_SECTION("FMatrix4x4 multiply x100000, generic loops");
+        for(size_t i = 0; i < count; i++) sink = sink + referenceMatrixMultiply(a4[i], b4[i]).data[5];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 multiply x100000, SIMD");
+        for(size_t i = 0; i < count; i++) sink = sink + (a4[i] * b4[i]).data[5];
+    }
+    {
+        TIME_SECTION("FMatrix3x3 multiply x100000, generic loops");
+        for(size_t i = 0; i < count; i++) sink = sink + referenceMatrixMultiply(a3[i], b3[i]).data[5];
+    }
+    {
+        TIME_SECTION("FMatrix3x3 multiply x100000, SIMD");
+        for(size_t i = 0; i < count; i++) sink = sink + (a3[i] * b3[i]).data[5];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 * FVec4 x100000, generic loops");
+        for(size_t i = 0; i < count; i++) sink = sink + referenceMatrixMultiply(a4[i], v4[i]).data[1];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 * FVec4 x100000, SIMD");
+        for(size_t i = 0; i < count; i++) sink = sink + a4[i].multiply(v4[i]).data[1];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 transpose x100000, SIMD");
+        for(size_t i = 0; i < count; i++) sink = sink + a4[i].transpose().data[1];
+    }
+
+    std::vector<FMatrix4x4> affine(count);
+    for(size_t i = 0; i < count; i++) {
+        affine[i] = makeAffineTestMatrix(i, false);
+        a3[i] = makeInvertibleTestMatrix<float, 3>(i);
+        a4[i] = makeInvertibleTestMatrix<float, 4>(i);
+    }
+
+    {
+        TIME_SECTION("FMatrix3x3 inverse x100000, old Gauss-Jordan");
+        for(size_t i = 0; i < count; i++) sink = sink + referenceMatrixInverse(a3[i]).data[1];
+    }
+    {
+        TIME_SECTION("FMatrix3x3 inverse x100000, closed form");
+        for(size_t i = 0; i < count; i++) sink = sink + a3[i].inverse().data[1];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 inverse x100000, old Gauss-Jordan");
+        for(size_t i = 0; i < count; i++) sink = sink + referenceMatrixInverse(a4[i]).data[1];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 inverse x100000, scalar closed form");
+        for(size_t i = 0; i < count; i++) {
+            FMatrix4x4 out;
+            matrixInverse_compute<float>(a4[i], out);
+            sink = sink + out.data[1];
+        }
+    }
+    {
+        TIME_SECTION("FMatrix4x4 inverse x100000, SIMD closed form");
+        for(size_t i = 0; i < count; i++) sink = sink + a4[i].inverse().data[1];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 inverse of affine x100000, SIMD closed form");
+        for(size_t i = 0; i < count; i++) sink = sink + affine[i].inverse().data[1];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 inverse of affine x100000, inverseAffine");
+        for(size_t i = 0; i < count; i++) sink = sink + affine[i].inverseAffine().data[1];
+    }
+    {
+        TIME_SECTION("FMatrix4x4 inverse of rigid x100000, inverseRigid");
+        for(size_t i = 0; i < count; i++) sink = sink + affine[i].inverseRigid().data[1];
+    }
+
+    doMatrixBenchmarks_batch();
+}
+
+inline void doQuaternionBenchmarks()
+{
+    const size_t count = 100000;
+    std::vector<FMatrix4x4> matricesA(count), matricesB(count), matricesOut(count);
+    std::vector<FQuaternion> quatsA(count), quatsB(count), quatsOut(count);
+    std::vector<FDualQuaternion> dualsA(count), dualsB(count), dualsOut(count);
+    for(size_t i = 0; i < count; i++) {
+        matricesA[i] = makeAffineTestMatrix(i, true);
+        matricesB[i] = makeAffineTestMatrix(i + count, true);
+        quatsA[i] = makeQuaternionFromMatrix(matricesA[i]);
+        quatsB[i] = makeQuaternionFromMatrix(matricesB[i]);
+        dualsA[i] = makeDualQuaternionFromMatrix(matricesA[i]);
+        dualsB[i] = makeDualQuaternionFromMatrix(matricesB[i]);
+    }
+
+    {
+        TIME_SECTION("Compose 100k rotations, FMatrix4x4");
+        for(size_t i = 0; i < count; i++) {
+            matricesOut[i] = matricesA[i] * matricesB[i];
+        }
+    }
+    {
+        TIME_SECTION("Compose 100k rotations, FQuaternion");
+        for(size_t i = 0; i < count; i++) {
+            quatsOut[i] = quatsA[i] * quatsB[i];
+        }
+    }
+    {
+        TIME_SECTION("Compose 100k rigid transforms, FDualQuaternion");
+        for(size_t i = 0; i < count; i++) {
+            dualsOut[i] = dualsA[i] * dualsB[i];
+        }
+    }
+    {
+        TIME_SECTION("Skinning palette 100k, FMatrix4x4");
+        matrixBatchMultiply(&matricesA[0], &matricesB[0], &matricesOut[0], count);
+    }
+    {
+        TIME_SECTION("Skinning palette 100k, FDualQuaternion");
+        dualQuaternionBatchSkinningPalette(&dualsA[0], &dualsB[0], &dualsOut[0], count);
+    }
+    {
+        TIME_SECTION("Skinning palette 100k, FDualQuaternion to FMatrix4x4");
+        dualQuaternionBatchSkinningPalette(&dualsA[0], &dualsB[0], &matricesOut[0], count);
+    }
+    {
+        TIME_SECTION("Interpolate 100k rotations, decompose matrices and slerp");
+        for(size_t i = 0; i < count; i++) {
+            quatsOut[i] = quaternionSlerp(
+                makeQuaternionFromMatrix(matricesA[i]),
+                makeQuaternionFromMatrix(matricesB[i]), 0.3f);
+        }
+    }
+    {
+        TIME_SECTION("Interpolate 100k rotations, slerp");
+        for(size_t i = 0; i < count; i++) {
+            quatsOut[i] = quaternionSlerp(quatsA[i], quatsB[i], 0.3f);
+        }
+    }
+    {
+        TIME_SECTION("Interpolate 100k rotations, nlerp");
+        for(size_t i = 0; i < count; i++) {
+            quatsOut[i] = quaternionNlerp(quatsA[i], quatsB[i], 0.3f);
+        }
+    }
+}
+
+inline void doFrustumBenchmarks()
+{
+    const size_t count = 1000000;
+    Frustum frustum = makeFrustumFromMatrix(makeFrustumTestMatrix());
+    FrustumTestObjects objects(count);
+    std::vector<uint32_t> visible(count);
+    size_t visibleCount = 0;
+
+    {
+        TIME_SECTION("Cull 1M spheres, frustumTestSphere() per sphere");
+        visibleCount = 0;
+        for(size_t i = 0; i < count; i++) {
+            if(frustumTestSphere(frustum, FVec3(objects.x[i], objects.y[i], objects.z[i]), objects.radius[i])) {
+                visible[visibleCount++] = uint32_t(i);
+            }
+        }
+    }
+    {
+        TIME_SECTION("Cull 1M spheres, frustumCullSpheres");
+        frustumCullSpheres(
+            frustum, objects.x.data(), objects.y.data(), objects.z.data(), objects.radius.data(),
+            count, &visible[0]);
+    }
+    {
+        TIME_SECTION("Cull 1M spheres, frustumCullSpheres, all threads");
+        frustumCullSpheres(
+            frustum, objects.x.data(), objects.y.data(), objects.z.data(), objects.radius.data(),
+            count, &visible[0], 0);
+    }
+    {
+        TIME_SECTION("Cull 1M boxes, frustumTestAabb() per box");
+        visibleCount = 0;
+        for(size_t i = 0; i < count; i++) {
+            if(frustumTestAabb(
+                    frustum,
+                    FVec3(objects.minX[i], objects.minY[i], objects.minZ[i]),
+                    FVec3(objects.maxX[i], objects.maxY[i], objects.maxZ[i])))
+            {
+                visible[visibleCount++] = uint32_t(i);
+            }
+        }
+    }
+    {
+        TIME_SECTION("Cull 1M boxes, frustumCullAabbs");
+        frustumCullAabbs(
+            frustum,
+            objects.minX.data(), objects.minY.data(), objects.minZ.data(),
+            objects.maxX.data(), objects.maxY.data(), objects.maxZ.data(),
+            count, &visible[0]);
+    }
+    {
+        TIME_SECTION("Cull 1M boxes, frustumCullAabbs, all threads");
+        frustumCullAabbs(
+            frustum,
+            objects.minX.data(), objects.minY.data(), objects.minZ.data(),
+            objects.maxX.data(), objects.maxY.data(), objects.maxZ.data(),
+            count, &visible[0], 0);
+    }
+}
+
+template<typename CellArrayType>
+inline void doCellArrayBenchmarks_fill(const char *typeName)
+{
+    const CAINDEXTYPE size = 4096;
+
+    {
+        std::string name = std::string(typeName) + ", row-major from origin";
+        TIME_SECTION(name.c_str());
+        CellArrayType cells;
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                cells.set(1, x, y);
+            }
+        }
+    }
+
+    {
+        std::string name = std::string(typeName) + ", column-major from origin";
+        TIME_SECTION(name.c_str());
+        CellArrayType cells;
+        for(CAINDEXTYPE x = 0; x < size; x++) {
+            for(CAINDEXTYPE y = 0; y < size; y++) {
+                cells.set(1, x, y);
+            }
+        }
+    }
+
+    {
+        std::string name = std::string(typeName) + ", row-major towards negative";
+        TIME_SECTION(name.c_str());
+        CellArrayType cells;
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                cells.set(1, -x, -y);
+            }
+        }
+    }
+
+    {
+        // Square rings, growing outwards in all four directions.
+        std::string name = std::string(typeName) + ", rings outward from origin";
+        TIME_SECTION(name.c_str());
+        CellArrayType cells;
+        cells.set(1, 0, 0);
+        for(CAINDEXTYPE r = 1; r < size / 2; r++) {
+            for(CAINDEXTYPE i = -r; i <= r; i++) {
+                cells.set(1, i, -r);
+                cells.set(1, i, r);
+                cells.set(1, -r, i);
+                cells.set(1, r, i);
+            }
+        }
+    }
+}
+
+inline void doCellArrayBenchmarks_regions()
+{
+    const CAINDEXTYPE size = 2048;
+    CellArray<int> cells;
+    CellArray<int> cells2;
+    cells.fillRect(0, 0, 0, size, size);
+    cells2.fillRect(0, 0, 0, size, size);
+    int sink = 0;
+
+    {
+        TIME_SECTION("CellArray fill, per-cell set()");
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                cells.set(1, x, y);
+            }
+        }
+    }
+
+    {
+        TIME_SECTION("CellArray fill, fillRect()");
+        cells.fillRect(2, 0, 0, size, size);
+    }
+
+    {
+        TIME_SECTION("CellArray visit, per-cell get()");
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                sink += cells.get(x, y);
+            }
+        }
+    }
+
+    {
+        TIME_SECTION("CellArray visit, forEachInRect()");
+        cells.forEachInRect(
+            0, 0, size, size,
+            [&sink](CAINDEXTYPE x, CAINDEXTYPE y, int &value) {
+                sink += value;
+            });
+    }
+
+    {
+        TIME_SECTION("CellArray visit, getRowSpan()");
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            const int *row = cells.getRowSpan(0, y, size);
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                sink += row[x];
+            }
+        }
+    }
+
+    {
+        TIME_SECTION("CellArray copy, per-cell get()/set()");
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                cells2.set(cells.get(x, y), x, y);
+            }
+        }
+    }
+
+    {
+        TIME_SECTION("CellArray copy, copyRect()");
+        cells2.copyRect(cells, 0, 0, size, size, 0, 0);
+    }
+
+    {
+        TIME_SECTION("CellArray 3x3 neighborhood, per-cell getConst()");
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                for(CAINDEXTYPE ny = -1; ny <= 1; ny++) {
+                    for(CAINDEXTYPE nx = -1; nx <= 1; nx++) {
+                        const int *value = cells.getConst(x + nx, y + ny);
+                        sink += value ? *value : 0;
+                    }
+                }
+            }
+        }
+    }
+
+    {
+        TIME_SECTION("CellArray 3x3 neighborhood, getNeighborhood()");
+        int neighborhood[9];
+        for(CAINDEXTYPE y = 0; y < size; y++) {
+            for(CAINDEXTYPE x = 0; x < size; x++) {
+                cells.getNeighborhood(x, y, 1, neighborhood, 0);
+                for(size_t i = 0; i < 9; i++) {
+                    sink += neighborhood[i];
+                }
+            }
+        }
+    }
+
+    // Just so none of that gets optimized out.
+    std::cout << "(Checksum: " << sink << ")" << std::endl;
+}
+
+inline void doCellArrayBenchmarks()
+{
+    doCellArrayBenchmarks_fill<CellArray<uint8_t> >("CellArray");
+    doCellArrayBenchmarks_fill<ChunkedCellArray<uint8_t> >("ChunkedCellArray");
+    doCellArrayBenchmarks_regions();
+}
+
+inline void doPixelImageBenchmarks_blur()
+{
+    PixelImage<uint8_t> img(256, 256, 4);
+    makePixelImageTestPattern(img);
+    PixelImageTypedReader<PixelValue<uint8_t> > reader = pixelImageMakeReader(img);
+    PixelImage<uint8_t> out(256, 256, 4);
+
+    for(int radius = 1; radius <= 64; radius *= 2) {
+        std::string exactName = "pixelImageGaussianBlur r=" + std::to_string(radius) + ", exact";
+        std::string boxName = "pixelImageGaussianBlur r=" + std::to_string(radius) + ", box";
+        {
+            TIME_SECTION(exactName.c_str());
+            pixelImageGaussianBlur_kernel(
+                reader, out, float(radius), float(radius),
+                PixelImage_EdgeMode_Clamp, PixelImage_BlurMode_Exact);
+        }
+        {
+            TIME_SECTION(boxName.c_str());
+            pixelImageGaussianBlur_kernel(
+                reader, out, float(radius), float(radius),
+                PixelImage_EdgeMode_Clamp, PixelImage_BlurMode_Box);
+        }
+    }
+}
+
+inline void doPixelImageBenchmarks_resample()
+{
+    PixelImage<uint8_t> img(512, 512, 4);
+    makePixelImageTestPattern(img);
+    PixelImageTypedReader<PixelValue<uint8_t> > reader = pixelImageMakeReader(img);
+
+    const char *filterNames[3] = { "bilinear", "bicubic", "lanczos3" };
+    PixelImage_ResampleFilter filters[3] = {
+        PixelImage_ResampleFilter_Bilinear,
+        PixelImage_ResampleFilter_Bicubic,
+        PixelImage_ResampleFilter_Lanczos3
+    };
+    PixelImage_Dimension sizes[3] = { 1024, 384, 128 };
+
+    for(size_t f = 0; f < 3; f++) {
+        for(size_t s = 0; s < 3; s++) {
+            PixelImage<uint8_t> out(sizes[s], sizes[s], 4);
+            std::string name =
+                std::string("pixelImageResample ") + filterNames[f] +
+                " 512->" + std::to_string(sizes[s]);
+            TIME_SECTION(name.c_str());
+            pixelImageResample_kernel(reader, out, filters[f], PixelImage_EdgeMode_Clamp);
+        }
+    }
+}
+
+inline void doPixelImageBenchmarks_blit()
+{
+    // Every blit path on a 2048x2048 RGBA image.
+    PixelImage<uint8_t> src8(2048, 2048, 4);
+    PixelImage<uint8_t> dst8(2048, 2048, 4);
+    PixelImage<float> srcf(2048, 2048, 4);
+    PixelImage<float> dstf(2048, 2048, 4);
+    makePixelImageTestPattern(src8);
+    makePixelImageTestPattern(dst8);
+    makePixelImageTestPattern(srcf);
+    makePixelImageTestPattern(dstf);
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 rgba8, generic virtual path");
+        pixelImageBlit_kernel(
+            PixelImageVirtualReader(src8), 0, 0,
+            PixelImageVirtualWriter(dst8), 0, 0,
+            2048, 2048, 3, 1.0, false);
+    }
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 rgba8, generic typed path");
+        pixelImageBlit_kernel(
+            pixelImageMakeReader(src8), 0, 0,
+            pixelImageMakeWriter(dst8), 0, 0,
+            2048, 2048, 3, 1.0, false);
+    }
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 rgba8, straight");
+        pixelImageBlit(src8, 0, 0, dst8, 0, 0, 2048, 2048);
+    }
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 rgba8, premultiplied");
+        pixelImageBlit(src8, 0, 0, dst8, 0, 0, 2048, 2048, 3, 1.0, false, PixelImage_BlendMode_Premultiplied);
+    }
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 rgba8, opaque copy");
+        pixelImageBlit(src8, 0, 0, dst8, 0, 0, 2048, 2048, -1);
+    }
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 float, straight");
+        pixelImageBlit(srcf, 0, 0, dstf, 0, 0, 2048, 2048);
+    }
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 float, premultiplied");
+        pixelImageBlit(srcf, 0, 0, dstf, 0, 0, 2048, 2048, 3, 1.0, false, PixelImage_BlendMode_Premultiplied);
+    }
+
+    {
+        TIME_SECTION("pixelImageBlit 2048 float, opaque copy");
+        pixelImageBlit(srcf, 0, 0, dstf, 0, 0, 2048, 2048, -1);
+    }
+}
+
+inline void doPixelImageBenchmarks_tga()
+{
+    // A 4096x4096 RGBA atlas, which is too big for
+    // pixelImageLoadTGA().
+    PixelImage<uint8_t> img(4096, 4096, 4);
+    makePixelImageAtlasPattern(img);
+
+    std::vector<uint8_t> scratch(pixelImageGetTGAEncodeScratchSize(4096, 4));
+    std::vector<uint8_t> files[2];
+
+    for(int rle = 0; rle < 2; rle++) {
+
+        files[rle].resize(pixelImageGetTGAMaxEncodedSize(4096, 4096, 4, rle));
+        uint8_t *p = &files[rle][0];
+
+        std::string name = std::string("pixelImageEncodeTGA 4096 rgba8, ") + (rle ? "RLE" : "raw");
+        TIME_SECTION(name.c_str());
+        pixelImageEncodeTGA(
+            4096, 4096, 4, 4, rle, &scratch[0],
+            [&img](PixelImage_Coordinate y) { return (const uint8_t*)&img.getData(0, y, 0).value; },
+            [&p](const uint8_t *data, size_t length) { memcpy(p, data, length); p += length; });
+        files[rle].resize(p - &files[rle][0]);
+    }
+
+    PixelImage<uint8_t> out(4096, 4096, 4);
+    for(int rle = 0; rle < 2; rle++) {
+
+        {
+            std::string name = std::string("pixelImageDecodeTGA 4096 rgba8, ") + (rle ? "RLE" : "raw");
+            TIME_SECTION(name.c_str());
+            pixelImageDecodeTGA(&files[rle][0], files[rle].size(), out);
+        }
+
+        {
+            std::string name = std::string("pixelImageDecodeTGARows 4096 rgba8 -> rgb8, ") + (rle ? "RLE" : "raw");
+            uint8_t row[4096 * 3];
+            size_t checksum = 0;
+            {
+                TIME_SECTION(name.c_str());
+                pixelImageDecodeTGARows(
+                    &files[rle][0], files[rle].size(), 3, row,
+                    [&checksum](PixelImage_Coordinate, const uint8_t *data) { checksum += data[0]; });
+            }
+            std::cout << "  (checksum " << checksum << ")" << std::endl;
+        }
+    }
+
+    {
+        PixelImage<uint8_t> small(2048, 2048, 4);
+        makePixelImageAtlasPattern(small);
+        size_t length = 0;
+        uint8_t *data = pixelImageSaveTGA(small, &length);
+        {
+            TIME_SECTION("pixelImageLoadTGA 2048 rgba8");
+            delete pixelImageLoadTGA(data, length);
+        }
+        delete[] data;
+    }
+}
+
+inline void doPixelImageBenchmarks_bc()
+{
+    PixelImage<uint8_t> img(2048, 2048, 4);
+    makePixelImageAtlasPattern(img);
+
+    const char *formatNames[2] = { "BC1", "BC3" };
+    const PixelImage_BCFormat formats[2] = { PixelImage_BCFormat_BC1, PixelImage_BCFormat_BC3 };
+    const size_t threadCounts[2] = { 1, 0 };
+
+    for(size_t f = 0; f < 2; f++) {
+
+        std::vector<uint8_t> data(pixelImageGetBCDataSize(formats[f], 2048, 2048));
+
+        for(int quality = 0; quality < 2; quality++) {
+            for(size_t t = 0; t < 2; t++) {
+                std::string name =
+                    std::string("pixelImageEncodeBC 2048 ") + formatNames[f] +
+                    (quality ? ", cluster fit" : ", range fit") +
+                    (threadCounts[t] ? ", 1 thread" : ", all threads");
+                TIME_SECTION(name.c_str());
+                pixelImageEncodeBC(img, formats[f], &data[0], PixelImage_BCQuality(quality), threadCounts[t]);
+            }
+        }
+
+        PixelImage<uint8_t> out(2048, 2048, 4);
+        {
+            std::string name = std::string("pixelImageDecodeBC 2048 ") + formatNames[f];
+            TIME_SECTION(name.c_str());
+            pixelImageDecodeBC(formats[f], &data[0], data.size(), out);
+        }
+
+        {
+            // What there was before.
+            Gfx::Image legacy(2048, 2048);
+            std::string name = std::string("Gfx::Image::decompressDXT 2048 ") + formatNames[f];
+            TIME_SECTION(name.c_str());
+            legacy.decompressDXT(&data[0], data.size(), f ? 5 : 1);
+        }
+    }
+}
+
+inline void doPixelImageBenchmarks_convert()
+{
+    PixelImage<uint8_t> img(2048, 2048, 4);
+    makePixelImageAtlasPattern(img);
+
+    {
+        // What there was before.
+        PixelImage<float> out(2048, 2048, 4);
+        const PixelImageBase &in = img;
+        TIME_SECTION("getDouble/setDouble 2048 uint8_t to float");
+        for(PixelImage_Coordinate y = 0; y < out.getHeight(); y++) {
+            for(PixelImage_Coordinate x = 0; x < out.getWidth(); x++) {
+                for(PixelImage_Coordinate c = 0; c < 4; c++) {
+                    out.setDouble(x, y, c, in.getDouble(x, y, c));
+                }
+            }
+        }
+    }
+
+    PixelImage<float> asFloat;
+    {
+        TIME_SECTION("pixelImageConvert 2048 uint8_t to float");
+        pixelImageConvert(img, asFloat);
+    }
 
-    while(!testData->goAhead) {
-        sleepWrapper(10);
+    {
+        PixelImage<uint8_t> out;
+        TIME_SECTION("pixelImageConvert 2048 float to uint8_t");
+        pixelImageConvert(asFloat, out);
     }
 
-  #if _WIN32
-    std::cout << "[Thread] Current thread ID: " << GetCurrentThreadId() << std::endl;
-  #endif
+    {
+        PixelImage<double> out;
+        TIME_SECTION("pixelImageConvert 2048 uint8_t to double");
+        pixelImageConvert(img, out);
+    }
 
-    cout << "[Thread] This ID:  " << thisId << std::endl;
-    cout << "[Thread] Other ID: " << testData->id << std::endl;
+    PixelImage<uint16_t> asShort;
+    pixelImageConvert(img, asShort);
+    {
+        PixelImage<float> out;
+        TIME_SECTION("pixelImageConvert 2048 uint16_t to float");
+        pixelImageConvert(asShort, out);
+    }
 
-    EXPOP_TEST_VALUE(thisId != testData->id, true);
+    {
+        PixelImage<uint8_t> rgb;
+        pixelImageConvert(img, rgb, 3);
+        PixelImage<uint8_t> out;
+        TIME_SECTION("pixelImageConvert 2048 uint8_t RGB to RGBA");
+        pixelImageConvert(rgb, out, 4);
+    }
+
+    {
+        Gfx::Image *old = nullptr;
+        {
+            TIME_SECTION("pixelImageToOldImage 2048 float");
+            old = pixelImageToOldImage(asFloat);
+        }
+        delete old;
+    }
 }
 
-inline void doThreadTests(size_t &passCounter, size_t &failCounter)
+inline void doPixelImageBenchmarks_pool()
 {
-    ExPop::Threads::ThreadId thisId = ExPop::Threads::getMyId();
-
-    ThreadTestData testData;
-    testData.id = thisId;
-    testData.passCounter = &passCounter;
-    testData.failCounter = &failCounter;
-    testData.goAhead = false;
+    for(int pooled = 0; pooled < 2; pooled++) {
+        pixelImagePoolSetLimit(pooled ? 256 * 1024 * 1024 : 0);
+        TIME_SECTION(pooled ? "PixelImage 2048 rgba float x10, pooled" : "PixelImage 2048 rgba float x10, not pooled");
+        for(int i = 0; i < 10; i++) {
+            PixelImage<float> img(2048, 2048, 4);
+            img.getData(i, i, 0).value = 1.0f;
+        }
+    }
 
-    ExPop::Threads::Thread t(doThreadTests_thread, &testData);
-    sleepWrapper(1000);
+    PixelImage<uint8_t> img(2048, 2048, 4);
+    makePixelImageAtlasPattern(img);
 
-    #if _WIN32
-    std::cout << "[Main  ] Current thread ID: " << GetCurrentThreadId() << std::endl;
-    #endif
+    {
+        pixelImagePoolSetLimit(0);
+        TIME_SECTION("pixelImageScale 2048 to 1000 x4, not pooled");
+        for(int i = 0; i < 4; i++) {
+            delete pixelImageScale<uint8_t>(img, 1000, 1000);
+        }
+    }
 
-    cout << "[Main  ] This ID:  " << thisId << std::endl;
-    cout << "[Main  ] Other ID: " << t.getId() << std::endl;
-    EXPOP_TEST_VALUE(t.getId() != thisId, true);
+    {
+        pixelImagePoolSetLimit(256 * 1024 * 1024);
+        PixelImage<uint8_t> out;
+        TIME_SECTION("pixelImageScaleInto 2048 to 1000 x4, pooled");
+        for(int i = 0; i < 4; i++) {
+            pixelImageScaleInto(img, out, 1000, 1000);
+        }
+    }
 
-    testData.goAhead = true;
-    t.join();
+    pixelImagePoolSetLimit(0);
 }
 
-inline void doCompressTests(size_t &passCounter, size_t &failCounter)
+inline void doPixelImageBenchmarks_view()
 {
-    std::string fileData = FileSystem::loadFileString("README.org");
-    unsigned int len = 0;
-    char *compressedData = compressRLE(&fileData[0], fileData.size(), &len, 1);
+    // Blurring every 256x256 tile of a 2048x2048 atlas on its own,
+    // by cropping each tile out and pasting it back, and through
+    // views.
+    const PixelImage_Dimension tileSize = 256;
+    PixelImage<uint8_t> atlas(2048, 2048, 4);
+    makePixelImageAtlasPattern(atlas);
+    PixelImage<uint8_t> out(2048, 2048, 4);
 
-    std::cout << "Original size:   " << fileData.size() << std::endl;
-    std::cout << "Compressed size: " << len << std::endl;
-    EXPOP_TEST_VALUE(len < fileData.size(), true);
+    {
+        TIME_SECTION("Blur 2048 atlas tile by tile, cropped");
+        PixelImage<uint8_t> tile;
+        PixelImage<uint8_t> blurred;
+        for(PixelImage_Coordinate y = 0; y < atlas.getHeight(); y += tileSize) {
+            for(PixelImage_Coordinate x = 0; x < atlas.getWidth(); x += tileSize) {
+                tile = cropPixelImage(atlas, x, y, tileSize, tileSize);
+                pixelImageGaussianBlurInto(tile, blurred, 2.0f, 2.0f);
+                pixelImageBlit(blurred, 0, 0, out, x, y, tileSize, tileSize, -1);
+            }
+        }
+    }
 
-    unsigned int len2 = 0;
-    char *uncompressedData = decompressRLE(compressedData, len, &len2, 1);
-    EXPOP_TEST_VALUE(len2, fileData.size());
+    {
+        TIME_SECTION("Blur 2048 atlas tile by tile, views");
+        for(PixelImage_Coordinate y = 0; y < atlas.getHeight(); y += tileSize) {
+            for(PixelImage_Coordinate x = 0; x < atlas.getWidth(); x += tileSize) {
+                pixelImageGaussianBlur_kernel(
+                    PixelImageConstView<uint8_t>(atlas, x, y, tileSize, tileSize),
+                    PixelImageView<uint8_t>(out, x, y, tileSize, tileSize),
+                    2.0f, 2.0f, PixelImage_EdgeMode_Clamp);
+            }
+        }
+    }
 
-    EXPOP_TEST_VALUE(strncmp(&fileData[0], uncompressedData, ExPop::min(fileData.size(), (size_t)len2)), 0);
+    {
+        TIME_SECTION("Copy 2048 atlas tile by tile x10, cropped");
+        for(int i = 0; i < 10; i++) {
+            for(PixelImage_Coordinate y = 0; y < atlas.getHeight(); y += tileSize) {
+                for(PixelImage_Coordinate x = 0; x < atlas.getWidth(); x += tileSize) {
+                    PixelImage<uint8_t> tile = cropPixelImage(atlas, x, y, tileSize, tileSize);
+                    pixelImageBlit(tile, 0, 0, out, x, y, tileSize, tileSize, -1);
+                }
+            }
+        }
+    }
 
-    delete[] uncompressedData;
-    delete[] compressedData;
+    {
+        TIME_SECTION("Copy 2048 atlas tile by tile x10, views");
+        for(int i = 0; i < 10; i++) {
+            for(PixelImage_Coordinate y = 0; y < atlas.getHeight(); y += tileSize) {
+                for(PixelImage_Coordinate x = 0; x < atlas.getWidth(); x += tileSize) {
+                    pixelImageBlit(
+                        PixelImageConstView<uint8_t>(atlas, x, y, tileSize, tileSize), 0, 0,
+                        PixelImageView<uint8_t>(out, x, y, tileSize, tileSize), 0, 0,
+                        tileSize, tileSize, -1);
+                }
+            }
+        }
+    }
 }
 
-inline void doPreprocessorTests(size_t &passCounter, size_t &failCounter)
+inline void doPixelImageBenchmarks_threads()
 {
-    PreprocessorState state;
-    state.definedSymbols["DICK"] = "1";
-    state.definedSymbols["BUTT"] = "0";
+    // Scaling across threads, on an 8K image.
+    PixelImage<uint8_t> img(8192, 8192, 4);
+    makePixelImageTestPattern(img);
+    PixelImageTypedReader<PixelValue<uint8_t> > reader = pixelImageMakeReader(img);
+
+    std::vector<size_t> threadCounts;
+    for(size_t threads = 1; threads < parallelGetDefaultThreadCount(); threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(parallelGetDefaultThreadCount());
 
-    EXPOP_TEST_VALUE(
-        preprocess(
-            "faketest.txt",
-            "#if DICK\ndick\n#else\nbutt\n#endif\n#if BUTT\nbutt\n#else\ndick\n#endif\n",
-            state),
-        "dick\ndick\n");
-    EXPOP_TEST_VALUE(state.hadError, false);
+    for(size_t i = 0; i < threadCounts.size(); i++) {
 
-    EXPOP_TEST_VALUE(
-        preprocess(
-            "faketest.txt",
-            "#endif",
-            state), "");
+        std::string suffix = ", 8192, " + std::to_string(threadCounts[i]) + " thread(s)";
 
-    EXPOP_TEST_VALUE(state.hadError, true);
-}
+        {
+            PixelImage<uint8_t> out(8192, 8192, 4);
+            std::string name = "pixelImageGaussianBlur r=4" + suffix;
+            TIME_SECTION(name.c_str());
+            pixelImageGaussianBlur_kernel(
+                reader, out, 4.0f, 4.0f,
+                PixelImage_EdgeMode_Clamp, PixelImage_BlurMode_Auto, threadCounts[i]);
+        }
 
-// inline void doArchiveTests(size_t &passCounter, size_t &failCounter)
-// {
-//     {
-//         FileSystem::Archive testArchive("lilylibtest.poop", true);
-//         std::string fileData = FileSystem::loadFileString("README.org");
-//         EXPOP_TEST_VALUE(testArchive.getFailed(), false);
-//         bool addFileSucceed = testArchive.addFile("Stuff_Only_For_Archive_Test", fileData.c_str(), fileData.size());
-//         EXPOP_TEST_VALUE(addFileSucceed, true);
-//         EXPOP_TEST_VALUE(testArchive.getFailed(), false);
-//         bool addFileFail = testArchive.addFile("Stuff_Only_For_Archive_Test", fileData.c_str(), fileData.size());
-//         EXPOP_TEST_VALUE(addFileFail, false);
-//     }
-//     EXPOP_TEST_VALUE(FileSystem::fileExists("lilylibtest.poop"), true);
-//     EXPOP_TEST_VALUE(FileSystem::fileExists("Stuff_Only_For_Archive_Test"), false);
-//     FileSystem::addArchiveForSearch("lilylibtest.poop");
-//     EXPOP_TEST_VALUE(FileSystem::fileExists("Stuff_Only_For_Archive_Test"), true);
-//     FileSystem::removeArchiveForSearch("lilylibtest.poop");
-//     EXPOP_TEST_VALUE(FileSystem::fileExists("Stuff_Only_For_Archive_Test"), false);
-//     FileSystem::deleteFile("lilylibtest.poop");
-//     EXPOP_TEST_VALUE(FileSystem::fileExists("lilylibtest.poop"), false);
-// }
+        {
+            PixelImage<uint8_t> out(3000, 3000, 4);
+            std::string name = "pixelImageResample lanczos3 ->3000" + suffix;
+            TIME_SECTION(name.c_str());
+            pixelImageResample_kernel(
+                reader, out,
+                PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Clamp, threadCounts[i]);
+        }
 
-inline void doParserTests(size_t &passCounter, size_t &failCounter)
+        {
+            std::string name = "pixelImageScale ->1000" + suffix;
+            TIME_SECTION(name.c_str());
+            delete pixelImageScale<uint8_t, ScalingType_OneIsMaxInt>(img, 1000, 1000, threadCounts[i]);
+        }
+    }
+}
+
+inline void doPixelImageBenchmarks_mip()
 {
-    ParserNode *node = new ParserNode();
-    node->setStringValue("dick", "butt");
-    node->setBinaryValue("foo", "bar", 3);
+    PixelImage<uint8_t> img(2048, 2048, 4);
+    makePixelImageTestPattern(img);
 
-    ParserNode *child = new ParserNode();
-    child->setName("thingy");
-    child->setStringValue("Whatever", "Arghblargh");
+    {
+        // What it took before: halving one axis at a time, with a
+        // new image for every step.
+        TIME_SECTION("mip chain 2048, pixelImageHalfRes per level");
+        PixelImage<uint8_t> *level = new PixelImage<uint8_t>(img);
+        while(level->getWidth() > 1 || level->getHeight() > 1) {
+            if(level->getWidth() > 1) {
+                PixelImage<uint8_t> *half = pixelImageHalfRes<uint8_t, ScalingType_OneIsMaxInt>(*level, false);
+                delete level;
+                level = half;
+            }
+            if(level->getHeight() > 1) {
+                PixelImage<uint8_t> *half = pixelImageHalfRes<uint8_t, ScalingType_OneIsMaxInt>(*level, true);
+                delete level;
+                level = half;
+            }
+        }
+        delete level;
+    }
 
-    node->addChildToEnd(child);
+    const char *filterNames[3] = { "box", "kaiser", "lanczos3" };
+    PixelImage_ResampleFilter filters[3] = {
+        PixelImage_ResampleFilter_Box,
+        PixelImage_ResampleFilter_Kaiser,
+        PixelImage_ResampleFilter_Lanczos3
+    };
+
+    for(size_t f = 0; f < 3; f++) {
+        for(int srgb = 0; srgb < 2; srgb++) {
+            std::string name =
+                std::string("pixelImageMakeMipChain 2048, ") + filterNames[f] +
+                (srgb ? ", sRGB" : ", linear");
+            TIME_SECTION(name.c_str());
+            delete pixelImageMakeMipChain<uint8_t, ScalingType_OneIsMaxInt>(img, filters[f], srgb);
+        }
+    }
+}
 
-    node->addChildToEnd(parseXmlString("<junk><blagh>HERPDERP</blagh>Whatever</junk>"));
+inline void doPixelImageBenchmarks()
+{
+    // Every operation runs once through the virtual getDouble()
+    // path and once through the typed path for a PixelImage<uint8_t>.
+    PixelImage<uint8_t> img(256, 256, 4);
+    makePixelImageTestPattern(img);
+    PixelImageVirtualReader virtualReader(img);
+    PixelImageTypedReader<PixelValue<uint8_t> > typedReader = pixelImageMakeReader(img);
 
     {
-        std::string badXmlError;
-        ParserNode *badXml = parseXmlString("<bad_xml<", &badXmlError);
-        EXPOP_TEST_VALUE(!badXmlError.size(), 0);
-        delete badXml;
+        PixelImage<uint8_t> out(512, 512, 4);
+        {
+            TIME_SECTION("upScaleImageLinear 256->512, virtual");
+            upScaleImageLinear_kernel(virtualReader, out, PixelImage_EdgeMode_Clamp);
+        }
+        {
+            TIME_SECTION("upScaleImageLinear 256->512, typed");
+            upScaleImageLinear_kernel(typedReader, out, PixelImage_EdgeMode_Clamp);
+        }
     }
 
     {
-        std::string badJsonError;
-        ParserNode *badJson = parseJsonString("This is obviously not valid JSON", &badJsonError);
-        EXPOP_TEST_VALUE(!badJsonError.size(), 0);
-        delete badJson;
+        PixelImage<uint8_t> out(100, 100, 4);
+        {
+            TIME_SECTION("downScaleImageAveraged 256->100, virtual");
+            downScaleImageAveraged_kernel(virtualReader, out);
+        }
+        {
+            TIME_SECTION("downScaleImageAveraged 256->100, typed");
+            downScaleImageAveraged_kernel(typedReader, out);
+        }
     }
 
-    cout << *node << endl;
-    node->outputXml(cout, 0);
-    cout << endl;
-    node->outputJson(cout, 0);
-    cout << endl;
+    {
+        PixelImage<uint8_t> out(128, 256, 4);
+        {
+            TIME_SECTION("pixelImageHalfRes, virtual");
+            pixelImageHalfRes_kernel(virtualReader, out, false);
+        }
+        {
+            TIME_SECTION("pixelImageHalfRes, typed");
+            pixelImageHalfRes_kernel(typedReader, out, false);
+        }
+    }
 
     {
-        ostringstream ostr;
-        ostr << *node;
-        ParserNode *readBack = parseString(ostr.str());
-        EXPOP_TEST_VALUE(readBack->getChild(0)->getStringValueDirty("Whatever"), "Arghblargh");
-        delete readBack;
+        PixelImage<uint8_t> out(200, 200, 4);
+        {
+            TIME_SECTION("pixelImageResample lanczos3 256->200, virtual");
+            pixelImageResample_kernel(
+                virtualReader, out,
+                PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Wrap);
+        }
+        {
+            TIME_SECTION("pixelImageResample lanczos3 256->200, typed");
+            pixelImageResample_kernel(
+                typedReader, out,
+                PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Wrap);
+        }
     }
 
     {
-        ostringstream ostr;
-        node->outputXml(ostr, 0);
-        ParserNode *readBack = parseXmlString(ostr.str());
-        EXPOP_TEST_VALUE(readBack->getChild(0)->getChild(0)->getStringValueDirty("Whatever"), "Arghblargh");
-        delete readBack;
+        PixelImage<uint8_t> out(256, 256, 4);
+        {
+            TIME_SECTION("pixelImageGaussianBlur r=2, virtual");
+            pixelImageGaussianBlur_kernel(virtualReader, out, 2.0f, 2.0f, PixelImage_EdgeMode_Clamp);
+        }
+        {
+            TIME_SECTION("pixelImageGaussianBlur r=2, typed");
+            pixelImageGaussianBlur_kernel(typedReader, out, 2.0f, 2.0f, PixelImage_EdgeMode_Clamp);
+        }
     }
 
     {
-        ostringstream ostr;
-        node->outputJson(ostr, 0);
-        ParserNode *readBack = parseJsonString(ostr.str());
-        EXPOP_TEST_VALUE(readBack->getChild(0)->getStringValueDirty("Whatever"), "Arghblargh");
-        delete readBack;
+        PixelImage<uint8_t> dst(256, 256, 4);
+        {
+            TIME_SECTION("pixelImageBlit, virtual");
+            pixelImageBlit_kernel(
+                virtualReader, 0, 0,
+                PixelImageVirtualWriter(dst), 0, 0,
+                256, 256, 3, 1.0, false);
+        }
+        {
+            TIME_SECTION("pixelImageBlit, typed");
+            pixelImageBlit(img, 0, 0, dst, 0, 0, 256, 256);
+        }
     }
 
-    delete node;
+    {
+        TIME_SECTION("pixelImageScale 256->100");
+        delete pixelImageScale<uint8_t, ScalingType_OneIsMaxInt>(img, 100, 100);
+    }
+
+    doPixelImageBenchmarks_blur();
+    doPixelImageBenchmarks_resample();
+    doPixelImageBenchmarks_mip();
+    doPixelImageBenchmarks_blit();
+    doPixelImageBenchmarks_tga();
+    doPixelImageBenchmarks_bc();
+    doPixelImageBenchmarks_convert();
+    doPixelImageBenchmarks_pool();
+    doPixelImageBenchmarks_view();
+    doPixelImageBenchmarks_threads();
 }
 
-inline void doFilesystemTests(const char *argv0, size_t &passCounter, size_t &failCounter)
+inline void doRingQueueBenchmarks()
 {
-    EXPOP_TEST_VALUE(system(("\"" + FileSystem::getExecutablePath(argv0) + "\" --quit").c_str()), 0);
-
-    EXPOP_TEST_VALUE(
-        FileSystem::loadFileString("tests/normal_file.txt"),
-        "This file is outside a zip.\n");
-
-    FileSystem::mountZipFile("tests/zip_test.zip");
-
-    EXPOP_TEST_VALUE(
-        FileSystem::fileExists("tests/zip_test.txt"), true);
-
-    EXPOP_TEST_VALUE(
-        FileSystem::getFileSize("tests/zip_test.txt"), 27);
+    const size_t totalItems = 1 << 18;
+
+    for(size_t producerCount = 1; producerCount <= 32; producerCount *= 2) {
+
+        std::vector<RingQueueBenchmarkData> benchData(producerCount);
+        size_t perProducer = totalItems / producerCount;
+
+        // Mutex around a vector, which is what AssetLoader and
+        // GraphicalConsole used to do.
+        {
+            ExPop::Threads::Mutex mutex;
+            std::vector<size_t> lockedVector;
+            std::vector<size_t> consumerVector;
+
+            std::ostringstream name;
+            name << "Mutex+vector, " << producerCount << " producers";
+            std::string nameStr = name.str();
+            TIME_SECTION(nameStr.c_str());
+
+            std::vector<ExPop::Threads::Thread> threads;
+            for(size_t i = 0; i < producerCount; i++) {
+                benchData[i].mutex = &mutex;
+                benchData[i].lockedVector = &lockedVector;
+                benchData[i].count = perProducer;
+                threads.push_back(ExPop::Threads::Thread(ringQueueBenchmark_mutexProducer, &benchData[i]));
+            }
 
-    EXPOP_TEST_VALUE(
-        FileSystem::loadFileString("tests/zip_test.txt"),
-        "This file is inside a zip.\n");
+            size_t received = 0;
+            while(received < perProducer * producerCount) {
+                mutex.lock();
+                consumerVector.swap(lockedVector);
+                mutex.unlock();
+                received += consumerVector.size();
+                consumerVector.clear();
+            }
 
-    FileSystem::unmountAll();
+            for(size_t i = 0; i < threads.size(); i++) {
+                threads[i].join();
+            }
+        }
 
-    EXPOP_TEST_VALUE(
-        FileSystem::fileExists("tests/zip_test.txt"), false);
+        // Lock-free MPMC queue.
+        {
+            MPMCRingQueue<size_t> queue(1024);
 
-    EXPOP_TEST_VALUE(
-        FileSystem::getFileSize("tests/zip_test.txt"), -1);
+            std::ostringstream name;
+            name << "MPMCRingQueue, " << producerCount << " producers";
+            std::string nameStr = name.str();
+            TIME_SECTION(nameStr.c_str());
 
-    EXPOP_TEST_VALUE(
-        FileSystem::loadFileString("tests/zip_test.txt"),
-        "");
-}
+            std::vector<ExPop::Threads::Thread> threads;
+            for(size_t i = 0; i < producerCount; i++) {
+                benchData[i].queue = &queue;
+                benchData[i].count = perProducer;
+                threads.push_back(ExPop::Threads::Thread(ringQueueBenchmark_mpmcProducer, &benchData[i]));
+            }
 
-// ----------------------------------------------------------------------
+            size_t received = 0;
+            size_t value = 0;
+            while(received < perProducer * producerCount) {
+                if(queue.pop(value)) {
+                    received++;
+                } else {
+                    sleepWrapper(0);
+                }
+            }
 
-class TimerBlock
-{
-public:
-    TimerBlock(const char *inName)
-    {
-        startTime = std::chrono::high_resolution_clock::now();
-        name = inName;
+            for(size_t i = 0; i < threads.size(); i++) {
+                threads[i].join();
+            }
+        }
     }
 
-    ~TimerBlock()
+    // Uncontended baseline for the single-producer case.
     {
-        std::chrono::time_point<std::chrono::high_resolution_clock> endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::nanoseconds t = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime);
-        std::cout << name << ": " << t.count() << std::endl;
+        SPSCRingQueue<size_t> queue(1024);
+        TIME_SECTION("SPSCRingQueue, same thread, push+pop");
+        size_t value = 0;
+        for(size_t i = 0; i < totalItems; i++) {
+            queue.push(i);
+            queue.pop(value);
+        }
     }
-
-private:
-    std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
-    const char *name;
-};
-
-#define TIME_SECTION(name) TimerBlock timerBlock(name)
+}
 
 // ----------------------------------------------------------------------
 // Image loader test
@@ -624,6 +5432,36 @@ void showSectionHeader(const std::string &name)
     std::cout << std::endl;
 }
 
+void runBenchmarks()
+{
+    showSectionHeader("Benchmark: Strings");
+    doStringBenchmarks();
+    doUTF8Benchmarks();
+    doStringTransformBenchmarks();
+    doWordWrapBenchmarks();
+
+    showSectionHeader("Benchmark: Base64");
+    doBase64Benchmarks();
+
+    showSectionHeader("Benchmark: Ring queues");
+    doRingQueueBenchmarks();
+
+    showSectionHeader("Benchmark: Matrix");
+    doMatrixBenchmarks();
+
+    showSectionHeader("Benchmark: Quaternion");
+    doQuaternionBenchmarks();
+
+    showSectionHeader("Benchmark: Frustum");
+    doFrustumBenchmarks();
+
+    showSectionHeader("Benchmark: CellArray");
+    doCellArrayBenchmarks();
+
+    showSectionHeader("Benchmark: PixelImage");
+    doPixelImageBenchmarks();
+}
+
 int main(int argc, char *argv[])
 {
     std::vector<std::string> paramNames = { };
@@ -644,6 +5482,9 @@ int main(int argc, char *argv[])
             runImgTest(cin);
             ranSpecificTest = true;
             return 0;
+        } else if(params[i].name == "benchmark") {
+            runBenchmarks();
+            ranSpecificTest = true;
         } else {
             cerr << "Unrecognized parameter: " << params[i].name << endl;
             return 1;
@@ -663,6 +5504,10 @@ int main(int argc, char *argv[])
 
     showSectionHeader("Strings");
     doStringTests(passCounter, failCounter);
+    doStringTokenizerTests(passCounter, failCounter);
+    doUTF8Tests(passCounter, failCounter);
+    doStringTransformTests(passCounter, failCounter);
+    doWordWrapTests(passCounter, failCounter);
 
     showSectionHeader("Base64");
     doBase64Tests(passCounter, failCounter);
@@ -676,12 +5521,30 @@ int main(int argc, char *argv[])
     showSectionHeader("Angle");
     doAngleTests(passCounter, failCounter);
 
+    showSectionHeader("Matrix");
+    doMatrixTests(passCounter, failCounter);
+
+    showSectionHeader("Quaternion");
+    doQuaternionTests(passCounter, failCounter);
+
+    showSectionHeader("Frustum");
+    doFrustumTests(passCounter, failCounter);
+
     showSectionHeader("RC4");
     doRC4Tests(passCounter, failCounter);
 
     showSectionHeader("Thread");
     doThreadTests(passCounter, failCounter);
 
+    showSectionHeader("RingQueue");
+    doRingQueueTests(passCounter, failCounter);
+
+    showSectionHeader("CellArray");
+    doCellArrayTests(passCounter, failCounter);
+
+    showSectionHeader("PixelImage");
+    doPixelImageTests(passCounter, failCounter);
+
     showSectionHeader("Compression");
     doCompressTests(passCounter, failCounter);
 
@@ -1,4 +1,4 @@
-const unsigned int usageText_len = 301;
+const unsigned int usageText_len = 466;
 const char usageText[] = {
     0x55, 0x73, 0x61, 0x67, 0x65, 0x3a, 0x20, 0x24, 0x30, 0x0a, 0x0a, 0x4c, 0x69, 0x6c, 0x79, 0x20, 0x45, 0x6e, 0x67, 0x69,
     0x6e, 0x65, 0x20, 0x55, 0x74, 0x69, 0x6c, 0x73, 0x20, 0x54, 0x65, 0x73, 0x74, 0x20, 0x53, 0x75, 0x69, 0x74, 0x65, 0x20,
@@ -12,8 +12,16 @@ const char usageText[] = {
     0x72, 0x65, 0x20, 0x73, 0x69, 0x74, 0x74, 0x69, 0x6e, 0x67, 0x20, 0x69, 0x6e, 0x20, 0x69, 0x74, 0x2e, 0x0a, 0x20, 0x20,
     0x2d, 0x2d, 0x71, 0x75, 0x69, 0x74, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x45, 0x78,
     0x69, 0x74, 0x20, 0x69, 0x6d, 0x6d, 0x65, 0x64, 0x69, 0x61, 0x74, 0x65, 0x6c, 0x79, 0x20, 0x77, 0x69, 0x74, 0x68, 0x6f,
-    0x75, 0x74, 0x20, 0x64, 0x6f, 0x69, 0x6e, 0x67, 0x20, 0x61, 0x6e, 0x79, 0x74, 0x68, 0x69, 0x6e, 0x67, 0x2e, 0x0a, 0x0a,
-    0x52, 0x65, 0x70, 0x6f, 0x72, 0x74, 0x20, 0x62, 0x75, 0x67, 0x73, 0x20, 0x74, 0x6f, 0x20, 0x65, 0x78, 0x70, 0x69, 0x72,
-    0x65, 0x64, 0x70, 0x6f, 0x70, 0x73, 0x69, 0x63, 0x6c, 0x65, 0x40, 0x67, 0x6d, 0x61, 0x69, 0x6c, 0x2e, 0x63, 0x6f, 0x6d,
-    0x0a,
+    0x75, 0x74, 0x20, 0x64, 0x6f, 0x69, 0x6e, 0x67, 0x20, 0x61, 0x6e, 0x79, 0x74, 0x68, 0x69, 0x6e, 0x67, 0x2e, 0x0a, 0x20,
+    0x20, 0x2d, 0x2d, 0x69, 0x6d, 0x67, 0x6c, 0x6f, 0x61, 0x64, 0x65, 0x72, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x41,
+    0x74, 0x74, 0x65, 0x6d, 0x70, 0x74, 0x20, 0x74, 0x6f, 0x20, 0x6c, 0x6f, 0x61, 0x64, 0x20, 0x61, 0x6e, 0x20, 0x69, 0x6d,
+    0x61, 0x67, 0x65, 0x20, 0x66, 0x72, 0x6f, 0x6d, 0x20, 0x73, 0x74, 0x61, 0x6e, 0x64, 0x61, 0x72, 0x64, 0x20, 0x69, 0x6e,
+    0x70, 0x75, 0x74, 0x2e, 0x0a, 0x20, 0x20, 0x2d, 0x2d, 0x62, 0x65, 0x6e, 0x63, 0x68, 0x6d, 0x61, 0x72, 0x6b, 0x20, 0x20,
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x52, 0x75, 0x6e, 0x20, 0x62, 0x65, 0x6e, 0x63, 0x68, 0x6d, 0x61, 0x72, 0x6b, 0x73, 0x20,
+    0x69, 0x6e, 0x73, 0x74, 0x65, 0x61, 0x64, 0x20, 0x6f, 0x66, 0x20, 0x74, 0x65, 0x73, 0x74, 0x73, 0x2e, 0x20, 0x54, 0x69,
+    0x6d, 0x65, 0x73, 0x20, 0x61, 0x72, 0x65, 0x20, 0x69, 0x6e, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x61, 0x6e, 0x6f, 0x73, 0x65, 0x63, 0x6f, 0x6e,
+    0x64, 0x73, 0x2e, 0x0a, 0x0a, 0x52, 0x65, 0x70, 0x6f, 0x72, 0x74, 0x20, 0x62, 0x75, 0x67, 0x73, 0x20, 0x74, 0x6f, 0x20,
+    0x65, 0x78, 0x70, 0x69, 0x72, 0x65, 0x64, 0x70, 0x6f, 0x70, 0x73, 0x69, 0x63, 0x6c, 0x65, 0x40, 0x67, 0x6d, 0x61, 0x69,
+    0x6c, 0x2e, 0x63, 0x6f, 0x6d, 0x0a,
 };
@@ -53,20 +53,18 @@ void copyRect(
     int width,
     int height)
 {
-    for(int x = 0; x < width; x++) {
-        for(int y = 0; y < height; y++) {
-
-            int wrapped_src_x = wrapValue(x + src_left, src->getWidth());
-            int wrapped_src_y = wrapValue(y + src_top,  src->getHeight());
-            int wrapped_dst_x = wrapValue(x + dst_left, dst->getWidth());
-            int wrapped_dst_y = wrapValue(y + dst_top,  dst->getHeight());
-
-            const ExPop::Gfx::Pixel *src_p = src->getPixel(wrapped_src_x, wrapped_src_y);
-            ExPop::Gfx::Pixel *dst_p = dst->getPixel(wrapped_dst_x, wrapped_dst_y);
-
-            *dst_p = *src_p;
-        }
-    }
+    // Gfx::Pixel is just four bytes of RGBA, so both images can be
+    // viewed in place.
+    ExPop::PixelImageConstView<uint8_t> srcView(
+        src->getPixelFast(0)->colorsAsArray, src->getWidth(), src->getHeight(), 4);
+    ExPop::PixelImageView<uint8_t> dstView(
+        dst->getPixelFast(0)->colorsAsArray, dst->getWidth(), dst->getHeight(), 4);
+
+    ExPop::pixelImageBlit(
+        srcView, src_left, src_top,
+        dstView, dst_left, dst_top,
+        width, height,
+        -1, 1.0, true);
 }
 
 void clearRect(
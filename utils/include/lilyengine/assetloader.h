@@ -45,6 +45,7 @@
 #include <vector>
 #include <iostream>
 #include <unordered_map>
+#include <atomic>
 
 #if !_WIN32
 #include <unistd.h>
@@ -52,6 +53,7 @@
 
 #include "thread.h"
 #include "filesystem.h"
+#include "ringqueue.h"
 
 #endif
 
@@ -197,6 +199,12 @@ namespace ExPop
         /// False otherwise.
         bool processLoadRequest(void);
 
+        /// Move everything out of finishedLoadQueue and into
+        /// finishedLoads. loadListMutex must be locked first, because
+        /// that's what keeps this on the consumer side of the queue
+        /// to one thread at a time.
+        void collectFinishedLoads(void);
+
         /// Lock this mutex before touching any list or hash table of
         /// LoadRequests for reading or writing.
         Threads::Mutex loadListMutex;
@@ -210,10 +218,18 @@ namespace ExPop
         /// they are not accessed and eventually be freed.
         std::vector<LoadRequest*> finishedLoads;
 
-        /// What the loader thread is working on right now. It's
-        /// allowed to mess with this as much as it wants, so don't
-        /// change it outside of the loader thread.
-        LoadRequest *currentLoad;
+        /// Completed loads go here first, so the loader thread
+        /// doesn't have to fight for loadListMutex every time it
+        /// finishes something. The loader thread is the only
+        /// producer. Whoever holds loadListMutex is the consumer.
+        SPSCRingQueue<LoadRequest*> finishedLoadQueue;
+
+        /// What the loader thread is working on right now. Only the
+        /// loader thread changes it, but loading() reads it from
+        /// other threads. It gets cleared after the finished load
+        /// goes into finishedLoadQueue, without taking
+        /// loadListMutex, so it has to be atomic.
+        std::atomic<LoadRequest*> currentLoad;
 
         struct LoadRequestHash
         {
@@ -282,7 +298,8 @@ namespace ExPop
 
     }
 
-    inline AssetLoader::AssetLoader(void)
+    inline AssetLoader::AssetLoader(void) :
+        finishedLoadQueue(256)
     {
         hasBeenLoading = false;
         currentLoad = NULL;
@@ -297,6 +314,10 @@ namespace ExPop
         loaderThread->join();
         delete loaderThread;
 
+        // Anything the loader thread finished since the last
+        // ageData() is still sitting in the queue.
+        collectFinishedLoads();
+
         // Clean up buffers.
         for(unsigned int i = 0; i < pendingLoads.size(); i++) {
             delete pendingLoads[i];
@@ -306,13 +327,13 @@ namespace ExPop
             delete finishedLoads[i];
         }
 
-        if(currentLoad) {
-            delete currentLoad;
-        }
+        delete currentLoad.load();
     }
 
     inline bool AssetLoader::processLoadRequest(void)
     {
+        LoadRequest *request = NULL;
+
         loadListMutex.lock(); {
 
             if(pendingLoads.size()) {
@@ -328,7 +349,8 @@ namespace ExPop
                 }
 
                 // Take the highest priority thing out of the list.
-                currentLoad = pendingLoads[highestPriorityIndex];
+                request = pendingLoads[highestPriorityIndex];
+                currentLoad = request;
                 pendingLoads[highestPriorityIndex] = pendingLoads[pendingLoads.size() - 1];
                 pendingLoads.erase(pendingLoads.end() - 1);
 
@@ -337,57 +359,72 @@ namespace ExPop
         } loadListMutex.unlock();
 
 
-        if(!currentLoad) {
+        if(!request) {
             // Nothing to load.
             hasBeenLoading = false;
             return false;
         }
 
-        // out("AssetLoader_thread") << "Loading file: " << currentLoad->fileName << endl;
+        // out("AssetLoader_thread") << "Loading file: " << request->fileName << endl;
 
         hasBeenLoading = true;
-        currentLoad->started = true;
+        request->started = true;
 
         // Actually load the file now.
 
-        if(currentLoad->start == -1 || currentLoad->length == -1) {
+        if(request->start == -1 || request->length == -1) {
 
             // Load the whole file.
-            currentLoad->loadedBuffer = FileSystem::loadFile(
-                currentLoad->fileName,
-                &currentLoad->loadedBufferLength);
+            request->loadedBuffer = FileSystem::loadFile(
+                request->fileName,
+                &request->loadedBufferLength);
 
         } else {
 
-            // out("AssetLoader_thread") << "Loading a slice: " << currentLoad->start << " " << currentLoad->length << endl;
+            // out("AssetLoader_thread") << "Loading a slice: " << request->start << " " << request->length << endl;
 
             // Load a slice of the file.
-            currentLoad->loadedBuffer = FileSystem::loadFilePart(
-                currentLoad->fileName,
-                currentLoad->length,
-                currentLoad->start);
+            request->loadedBuffer = FileSystem::loadFilePart(
+                request->fileName,
+                request->length,
+                request->start);
 
-            currentLoad->loadedBufferLength = currentLoad->length;
+            request->loadedBufferLength = request->length;
 
         }
 
         // out("AssetLoader_thread") <<
-        //     "Done loading: " << currentLoad->fileName <<
-        //     " (" << (currentLoad->loadedBuffer ? "SUCCESS" : "FAIL") << ")" << endl;
+        //     "Done loading: " << request->fileName <<
+        //     " (" << (request->loadedBuffer ? "SUCCESS" : "FAIL") << ")" << endl;
 
-        currentLoad->done = true;
+        request->done = true;
 
-        // Add it to the list of finished stuff.
-        loadListMutex.lock(); {
+        // Add it to the list of finished stuff. If the queue is full
+        // because nobody has called ageData() in a while, then we'll
+        // have to take the lock and empty it ourselves.
+        if(!finishedLoadQueue.push(request)) {
 
-            finishedLoads.push_back(currentLoad);
-            currentLoad = NULL;
+            loadListMutex.lock(); {
 
-        } loadListMutex.unlock();
+                collectFinishedLoads();
+                finishedLoads.push_back(request);
+
+            } loadListMutex.unlock();
+        }
+
+        currentLoad = NULL;
 
         return true;
     }
 
+    inline void AssetLoader::collectFinishedLoads(void)
+    {
+        LoadRequest *request = NULL;
+        while(finishedLoadQueue.pop(request)) {
+            finishedLoads.push_back(request);
+        }
+    }
+
     inline bool AssetLoader::loading(void)
     {
         if(hasBeenLoading) {
@@ -501,6 +538,8 @@ namespace ExPop
     {
         loadListMutex.lock(); {
 
+            collectFinishedLoads();
+
             for(unsigned int i = 0; i < finishedLoads.size(); i++) {
 
                 finishedLoads[i]->age += ageAmount;
@@ -30,6 +30,16 @@
 // -------------------------- END HEADER -------------------------------------
 
 // Simple base64 conversions.
+//
+// Encoding and decoding both go through lookup tables, a whole
+// three-byte group at a time. On NEON, long runs of input go through
+// SIMD versions that do sixteen groups at once, using the
+// interleaving loads and stores to split groups up and put them back
+// together. SSE2 has nothing like those or a byte shuffle to fake
+// them with, and the tables beat everything we tried with it, so x86
+// just uses the tables. The decoder only takes the fast paths for
+// runs of plain base64 letters. Padding, whitespace and errors go
+// through one character at a time.
 
 // ----------------------------------------------------------------------
 // Needed headers
@@ -38,6 +48,11 @@
 #pragma once
 
 #include <string>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+
+#include "simd.h"
 
 // ----------------------------------------------------------------------
 // Declarations and documentation
@@ -48,12 +63,13 @@ namespace ExPop
     /// Decode a buffer from a base64 string as specified in RFC 2045.
     /// Returns a pointer to a buffer allocated with new.
     /// Responsibility for freeing this buffer with delete[] is up to
-    /// the caller.
+    /// the caller. Returns NULL, with a length of zero, if the string
+    /// isn't valid base64.
     inline unsigned char *stringBase64Decode(
         const std::string &str, unsigned int *length);
 
     /// Decode a string from a base64 string. Convenience function for
-    /// text data.
+    /// text data. Returns an empty string if str isn't valid base64.
     inline std::string stringBase64DecodeString(const std::string &str);
 
     /// Encode a buffer to a base64 string.
@@ -62,6 +78,121 @@ namespace ExPop
     /// Encode a string to a base64 string. Convenience function for
     /// text data.
     inline std::string stringBase64EncodeString(const std::string &str);
+
+    /// What the decoder does with whitespace.
+    enum Base64Whitespace
+    {
+        /// Whitespace is invalid, like any other character that isn't
+        /// part of base64.
+        BASE64WHITESPACE_STRICT,
+
+        /// Spaces, tabs, CRs and LFs get skipped anywhere in the
+        /// input, for line-wrapped or pretty-printed data.
+        BASE64WHITESPACE_SKIP
+    };
+
+    /// Exact length of the base64 encoding of length bytes, with
+    /// padding.
+    inline size_t stringBase64EncodedLength(size_t length);
+
+    /// Encode a buffer into out, which needs room for
+    /// stringBase64EncodedLength(length) characters. Doesn't add a
+    /// null terminator. Returns the number of characters written.
+    inline size_t stringBase64EncodeToBuffer(
+        const void *buffer, size_t length, char *out);
+
+    /// Encode a buffer, appending to the end of out.
+    inline void stringBase64EncodeAppend(
+        const void *buffer, size_t length, std::string &out);
+
+    /// Exact number of bytes str decodes to, if it's valid. Only looks
+    /// at the end of the string in strict mode. Has to look at all of
+    /// it to count whitespace otherwise.
+    inline size_t stringBase64DecodedLength(
+        const char *str, size_t length,
+        Base64Whitespace whitespace = BASE64WHITESPACE_STRICT);
+
+    /// Decode a base64 string into out, which needs room for
+    /// stringBase64DecodedLength() bytes. outLength gets the number
+    /// of bytes written. Returns false if str isn't valid base64.
+    inline bool stringBase64DecodeToBuffer(
+        const char *str, size_t length,
+        void *out, size_t &outLength,
+        Base64Whitespace whitespace = BASE64WHITESPACE_STRICT);
+
+    /// Decode a base64 string, appending to the end of out. Returns
+    /// false, and leaves out the way it was, if str isn't valid
+    /// base64.
+    inline bool stringBase64DecodeAppend(
+        const char *str, size_t length, std::string &out,
+        Base64Whitespace whitespace = BASE64WHITESPACE_STRICT);
+
+    /// Base64 encoder for data that shows up a piece at a time. Bytes
+    /// that don't make up a whole three-byte group get held until the
+    /// next update() or finish().
+    class StringBase64Encoder
+    {
+    public:
+
+        inline StringBase64Encoder();
+
+        /// Most characters update() can write for length bytes of
+        /// input.
+        static inline size_t getMaxOutputLength(size_t length);
+
+        /// Encode some more data into out, which needs room for
+        /// getMaxOutputLength(length) characters. Returns the number
+        /// of characters written.
+        inline size_t update(const void *data, size_t length, char *out);
+
+        /// Encode whatever's left over, with padding. Writes at most
+        /// four characters. Returns the number of characters written.
+        /// The encoder can be used for a new stream afterwards.
+        inline size_t finish(char *out);
+
+    private:
+
+        uint8_t pending[3];
+        size_t pendingCount;
+    };
+
+    /// Base64 decoder for text that shows up a piece at a time, split
+    /// anywhere. Characters that don't make up a whole four-character
+    /// group get held until the next update().
+    class StringBase64Decoder
+    {
+    public:
+
+        inline StringBase64Decoder(
+            Base64Whitespace whitespace = BASE64WHITESPACE_STRICT);
+
+        /// Most bytes update() can write for length characters of
+        /// input.
+        static inline size_t getMaxOutputLength(size_t length);
+
+        /// Decode some more text into out, which needs room for
+        /// getMaxOutputLength(length) bytes. outLength gets the number
+        /// of bytes written. Returns false if the text isn't valid
+        /// base64. Once that happens, every call after it fails too.
+        inline bool update(
+            const char *str, size_t length,
+            void *out, size_t &outLength);
+
+        /// Check that the text ended on a whole group. Returns false if
+        /// it didn't, or if any update() failed.
+        inline bool finish() const;
+
+    private:
+
+        inline void decodeCharacter(uint8_t c, uint8_t *&out);
+
+        Base64Whitespace whitespace;
+        uint32_t partial;
+        uint32_t partialCount;
+        uint32_t paddingCount;
+        bool done;
+        bool failed;
+    };
 }
 
 // ----------------------------------------------------------------------
@@ -70,163 +201,502 @@ namespace ExPop
 
 namespace ExPop
 {
-    inline uint32_t stringBase64DecodeLetter(char c)
+    // Special values in StringBase64Tables::values, for characters
+    // that aren't base64 letters.
+    enum
+    {
+        STRINGBASE64_VALUE_PAD = 64,
+        STRINGBASE64_VALUE_SPACE = 65,
+        STRINGBASE64_VALUE_INVALID = 66
+    };
+
+    // Set in StringBase64Tables::shifted for anything that isn't a
+    // base64 letter. Above the 24 bits a group decodes to, so one test
+    // after ORing four of them together catches all of them.
+    const uint32_t STRINGBASE64_BAD_BITS = 0x80000000;
+
+    struct StringBase64Tables
     {
-        if(c >= 'A' && c <= 'Z') {
-            return c - 'A';
+        // 6-bit value for each character, or one of the special
+        // values above.
+        uint8_t values[256];
+
+        // The same values, shifted into place for each position in a
+        // four-character group.
+        uint32_t shifted[4][256];
+
+        // Both characters for every 12-bit piece of a group.
+        char pairs[4096][2];
+
+        StringBase64Tables()
+        {
+            static const char letters[] =
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                "abcdefghijklmnopqrstuvwxyz"
+                "0123456789"
+                "+/";
+
+            memset(values, STRINGBASE64_VALUE_INVALID, sizeof(values));
+            for(uint32_t i = 0; i < 64; i++) {
+                values[uint8_t(letters[i])] = uint8_t(i);
+            }
+            values[uint8_t('=')] = STRINGBASE64_VALUE_PAD;
+            values[uint8_t(' ')] = STRINGBASE64_VALUE_SPACE;
+            values[uint8_t('\t')] = STRINGBASE64_VALUE_SPACE;
+            values[uint8_t('\r')] = STRINGBASE64_VALUE_SPACE;
+            values[uint8_t('\n')] = STRINGBASE64_VALUE_SPACE;
+
+            for(uint32_t k = 0; k < 4; k++) {
+                for(uint32_t i = 0; i < 256; i++) {
+                    shifted[k][i] = values[i] < 64 ?
+                        uint32_t(values[i]) << ((3 - k) * 6) :
+                        STRINGBASE64_BAD_BITS;
+                }
+            }
+
+            for(uint32_t i = 0; i < 4096; i++) {
+                pairs[i][0] = letters[i >> 6];
+                pairs[i][1] = letters[i & 63];
+            }
         }
+    };
+
+    inline const StringBase64Tables &stringBase64_getTables()
+    {
+        static const StringBase64Tables tables;
+        return tables;
+    }
+
+  #if EXPOP_SIMD_NEON
+
+    // Map sixteen 6-bit values to their base64 letters.
+    inline uint8x16_t stringBase64_lettersNeon(uint8x16_t v)
+    {
+        uint8x16_t offset = vdupq_n_u8('A');
+        offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(v, vdupq_n_u8(25)), vdupq_n_u8(uint8_t('a' - 26 - 'A'))));
+        offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(v, vdupq_n_u8(51)), vdupq_n_u8(uint8_t('0' - 52 - ('a' - 26)))));
+        offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(v, vdupq_n_u8(61)), vdupq_n_u8(uint8_t('+' - 62 - ('0' - 52)))));
+        offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(v, vdupq_n_u8(62)), vdupq_n_u8(uint8_t('/' - 63 - ('+' - 62)))));
+        return vaddq_u8(v, offset);
+    }
+
+    // Map sixteen letters to their 6-bit values. valid gets 0xff in
+    // every lane that was a base64 letter.
+    inline uint8x16_t stringBase64_valuesNeon(uint8x16_t c, uint8x16_t &valid)
+    {
+        uint8x16_t upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')), vcleq_u8(c, vdupq_n_u8('Z')));
+        uint8x16_t lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')), vcleq_u8(c, vdupq_n_u8('z')));
+        uint8x16_t digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+        uint8x16_t plus = vceqq_u8(c, vdupq_n_u8('+'));
+        uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+
+        valid = vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(vorrq_u8(digit, plus), slash));
+
+        uint8x16_t offset = vandq_u8(upper, vdupq_n_u8(uint8_t(-'A')));
+        offset = vorrq_u8(offset, vandq_u8(lower, vdupq_n_u8(uint8_t(26 - 'a'))));
+        offset = vorrq_u8(offset, vandq_u8(digit, vdupq_n_u8(uint8_t(52 - '0'))));
+        offset = vorrq_u8(offset, vandq_u8(plus, vdupq_n_u8(uint8_t(62 - '+'))));
+        offset = vorrq_u8(offset, vandq_u8(slash, vdupq_n_u8(uint8_t(63 - '/'))));
+        return vaddq_u8(c, offset);
+    }
+
+  #endif
 
-        if(c >= 'a' && c <= 'z') {
-            return (c - 'a') + 26;
+    // Encode whole three-byte groups. Returns the number of
+    // characters written.
+    inline size_t stringBase64_encodeGroups(
+        const StringBase64Tables &tables,
+        const uint8_t *in, size_t groupCount, char *out)
+    {
+        size_t i = 0;
+
+      #if EXPOP_SIMD_NEON
+
+        // Sixteen groups at a time, split up into one vector per byte
+        // of the group by the load and zipped back up by the store.
+        for(; i + 16 <= groupCount; i += 16) {
+            uint8x16x3_t b = vld3q_u8(in + i * 3);
+            uint8x16x4_t c;
+            c.val[0] = stringBase64_lettersNeon(vshrq_n_u8(b.val[0], 2));
+            c.val[1] = stringBase64_lettersNeon(vandq_u8(
+                vorrq_u8(vshlq_n_u8(b.val[0], 4), vshrq_n_u8(b.val[1], 4)), vdupq_n_u8(63)));
+            c.val[2] = stringBase64_lettersNeon(vandq_u8(
+                vorrq_u8(vshlq_n_u8(b.val[1], 2), vshrq_n_u8(b.val[2], 6)), vdupq_n_u8(63)));
+            c.val[3] = stringBase64_lettersNeon(vandq_u8(b.val[2], vdupq_n_u8(63)));
+            vst4q_u8((uint8_t*)(out + i * 4), c);
         }
 
-        if(c >= '0' && c <= '9') {
-            return (c - '0') + 52;
+      #endif
+
+        for(; i < groupCount; i++) {
+            const uint8_t *p = in + i * 3;
+            uint32_t group = (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+            memcpy(out + i * 4, tables.pairs[group >> 12], 2);
+            memcpy(out + i * 4 + 2, tables.pairs[group & 0xfff], 2);
         }
 
-        if(c == '+') {
-            return 62;
+        return groupCount * 4;
+    }
+
+    // Encode the last one or two bytes, with padding.
+    inline void stringBase64_encodeTail(
+        const StringBase64Tables &tables,
+        const uint8_t *in, size_t length, char *out)
+    {
+        assert(length == 1 || length == 2);
+        uint32_t group = uint32_t(in[0]) << 16;
+        if(length == 2) {
+            group |= uint32_t(in[1]) << 8;
         }
+        memcpy(out, tables.pairs[group >> 12], 2);
+        out[2] = length == 2 ? tables.pairs[group & 0xfff][0] : '=';
+        out[3] = '=';
+    }
+
+    // Decode whole groups of plain base64 letters, stopping at the
+    // first group with anything else in it. Advances out. Returns the
+    // number of characters used.
+    inline size_t stringBase64_decodeGroups(
+        const StringBase64Tables &tables,
+        const uint8_t *in, size_t length, uint8_t *&out)
+    {
+        size_t i = 0;
 
-        if(c == '/') {
-            return 63;
+      #if EXPOP_SIMD_NEON
+
+        // Sixteen groups at a time, split up into one vector per
+        // character of the group by the load and zipped back up by
+        // the store.
+        for(; i + 64 <= length; i += 64) {
+
+            uint8x16x4_t c = vld4q_u8(in + i);
+            uint8x16_t valid[4];
+            uint8x16_t v[4];
+            for(size_t k = 0; k < 4; k++) {
+                v[k] = stringBase64_valuesNeon(c.val[k], valid[k]);
+            }
+
+            uint64x2_t allValid = vreinterpretq_u64_u8(
+                vandq_u8(vandq_u8(valid[0], valid[1]), vandq_u8(valid[2], valid[3])));
+            if((vgetq_lane_u64(allValid, 0) & vgetq_lane_u64(allValid, 1)) != ~uint64_t(0)) {
+                break;
+            }
+
+            uint8x16x3_t b;
+            b.val[0] = vorrq_u8(vshlq_n_u8(v[0], 2), vshrq_n_u8(v[1], 4));
+            b.val[1] = vorrq_u8(vshlq_n_u8(v[1], 4), vshrq_n_u8(v[2], 2));
+            b.val[2] = vorrq_u8(vshlq_n_u8(v[2], 6), v[3]);
+            vst3q_u8(out, b);
+            out += 48;
         }
 
-        if(c == '=') {
-            return 0;
+      #endif
+
+        for(; i + 4 <= length; i += 4) {
+            uint32_t group =
+                tables.shifted[0][in[i]] |
+                tables.shifted[1][in[i + 1]] |
+                tables.shifted[2][in[i + 2]] |
+                tables.shifted[3][in[i + 3]];
+            if(group & STRINGBASE64_BAD_BITS) {
+                break;
+            }
+            out[0] = uint8_t(group >> 16);
+            out[1] = uint8_t(group >> 8);
+            out[2] = uint8_t(group);
+            out += 3;
         }
 
-        return 0;
+        return i;
     }
 
-    inline uint32_t stringBase64DecodeChunk(const std::string &chunk)
+    // ----------------------------------------------------------------------
+    // StringBase64Encoder
+
+    inline StringBase64Encoder::StringBase64Encoder() :
+        pendingCount(0)
     {
-        assert(chunk.size() == 4);
-        return
-            (stringBase64DecodeLetter(chunk[0]) << 18) |
-            (stringBase64DecodeLetter(chunk[1]) << 12) |
-            (stringBase64DecodeLetter(chunk[2]) << 6) |
-            (stringBase64DecodeLetter(chunk[3]));
     }
 
-    inline unsigned char *stringBase64Decode(const std::string &str, unsigned int *length)
+    inline size_t StringBase64Encoder::getMaxOutputLength(size_t length)
     {
-        // These things are always 4-byte padded, so if it's not that,
-        // then we know it's invalid. Also, the algorithm would read off
-        // the end of the buffer in horrible ways, so just fail.
-        if(str.size() % 4) {
-            return NULL;
+        // Up to two bytes from last time, plus this.
+        return ((length + 2) / 3) * 4;
+    }
+
+    inline size_t StringBase64Encoder::update(const void *data, size_t length, char *out)
+    {
+        const StringBase64Tables &tables = stringBase64_getTables();
+        const uint8_t *src = (const uint8_t*)data;
+        size_t written = 0;
+
+        // Finish off the group from last time first.
+        if(pendingCount) {
+            while(pendingCount < 3 && length) {
+                pending[pendingCount++] = *(src++);
+                length--;
+            }
+            if(pendingCount < 3) {
+                return 0;
+            }
+            written += stringBase64_encodeGroups(tables, pending, 1, out);
+            pendingCount = 0;
         }
 
-        // Output buffer is 3 bytes per 4-character chunk. Each 4
-        // characters represents 24 bits.
-        size_t bufSize = (str.size() / 4) * 3;
+        size_t groupCount = length / 3;
+        written += stringBase64_encodeGroups(tables, src, groupCount, out + written);
 
-        // Adjust the buffer size down based on the padding at the end of
-        // the input string.
-        if(str.size() >= 3) {
+        // Hang onto whatever didn't make a whole group.
+        pendingCount = length - groupCount * 3;
+        memcpy(pending, src + groupCount * 3, pendingCount);
 
-            // No = - Last chunk is 24 bits.
-            // ==   - Last chunk is 8 bits.
-            // =    - Last chunk is 16 bits.
+        return written;
+    }
 
-            // Note: One '=' does not really correspond to one output
-            // byte, but the cases are all the same as if they did. Don't
-            // get confused between the encoded 6-bit digits and unencoded
-            // 8-bit digits!
-            if(str[str.size() - 1] == '=') bufSize--;
-            if(str[str.size() - 2] == '=') bufSize--;
+    inline size_t StringBase64Encoder::finish(char *out)
+    {
+        if(!pendingCount) {
+            return 0;
         }
 
-        unsigned char *buffer = new unsigned char[bufSize];
-        unsigned int dataPtr = 0;
+        stringBase64_encodeTail(stringBase64_getTables(), pending, pendingCount, out);
+        pendingCount = 0;
+        return 4;
+    }
 
-        // Iterate through the four character chunks of the string and
-        // decode them.
-        for(unsigned int i = 0; i < str.size(); i += 4) {
+    // ----------------------------------------------------------------------
+    // StringBase64Decoder
 
-            uint32_t t = stringBase64DecodeChunk(str.substr(i, 4));
+    inline StringBase64Decoder::StringBase64Decoder(Base64Whitespace whitespace) :
+        whitespace(whitespace),
+        partial(0),
+        partialCount(0),
+        paddingCount(0),
+        done(false),
+        failed(false)
+    {
+    }
 
-            // Write the bytes into the buffer from the decoded 24-bits.
-            for(unsigned int k = 0; k < 3; k++) {
-                if(dataPtr < bufSize) {
-                    buffer[dataPtr] = (t >> ((2-k)*8)) & 0xff;
-                    dataPtr++;
-                }
+    inline size_t StringBase64Decoder::getMaxOutputLength(size_t length)
+    {
+        // Up to three characters from last time, plus this.
+        return ((length + 3) / 4) * 3;
+    }
+
+    inline void StringBase64Decoder::decodeCharacter(uint8_t c, uint8_t *&out)
+    {
+        const uint8_t value = stringBase64_getTables().values[c];
+
+        if(value < 64) {
+
+            // Nothing but whitespace is allowed after padding.
+            if(done || paddingCount) {
+                failed = true;
+                return;
+            }
+
+            partial = (partial << 6) | value;
+            partialCount++;
+
+        } else if(value == STRINGBASE64_VALUE_PAD) {
+
+            // Padding only goes in the last two spots of the last
+            // group.
+            if(done || partialCount < 2) {
+                failed = true;
+                return;
             }
+
+            partial <<= 6;
+            partialCount++;
+            paddingCount++;
+
+        } else if(value == STRINGBASE64_VALUE_SPACE && whitespace == BASE64WHITESPACE_SKIP) {
+
+            return;
+
+        } else {
+
+            failed = true;
+            return;
         }
 
-        *length = bufSize;
-        return buffer;
+        if(partialCount == 4) {
+
+            // One byte for every character past the first that isn't
+            // padding.
+            const uint32_t byteCount = 3 - paddingCount;
+            for(uint32_t k = 0; k < byteCount; k++) {
+                *(out++) = uint8_t(partial >> (16 - k * 8));
+            }
+
+            partial = 0;
+            partialCount = 0;
+            done = paddingCount != 0;
+        }
     }
 
-    inline std::string stringBase64DecodeString(const std::string &str)
+    inline bool StringBase64Decoder::update(
+        const char *str, size_t length,
+        void *out, size_t &outLength)
     {
-        unsigned int length = 0;
-        unsigned char *buf = stringBase64Decode(str, &length);
+        const StringBase64Tables &tables = stringBase64_getTables();
+        const uint8_t *src = (const uint8_t*)str;
+        uint8_t *dst = (uint8_t*)out;
+        size_t i = 0;
+
+        while(!failed && i < length) {
+
+            // Whole groups at a time, whenever we're lined up on
+            // one. Anything the fast path can't handle goes through
+            // one character at a time.
+            if(!partialCount && !done) {
+                i += stringBase64_decodeGroups(tables, src + i, length - i, dst);
+                if(i >= length) {
+                    break;
+                }
+            }
 
-        std::string ret((const char*)buf, length);
-        delete[] buf;
-        return ret;
+            decodeCharacter(src[i], dst);
+            i++;
+        }
+
+        outLength = dst - (uint8_t*)out;
+        return !failed;
+    }
+
+    inline bool StringBase64Decoder::finish() const
+    {
+        return !failed && !partialCount;
     }
 
-    inline uint32_t stringBase64Encode_getNextChunk(unsigned char *&ptr, size_t &length)
+    // ----------------------------------------------------------------------
+    // Whole buffers
+
+    inline size_t stringBase64EncodedLength(size_t length)
     {
-        uint32_t ret = 0;
+        return ((length + 2) / 3) * 4;
+    }
 
-        for(unsigned int i = 0; i < 3; i++) {
+    inline size_t stringBase64EncodeToBuffer(
+        const void *buffer, size_t length, char *out)
+    {
+        const StringBase64Tables &tables = stringBase64_getTables();
+        const uint8_t *src = (const uint8_t*)buffer;
 
-            ret |= (uint32_t(*(ptr))) << ((2-i)*8);
-            ptr++;
-            length--;
+        size_t groupCount = length / 3;
+        size_t written = stringBase64_encodeGroups(tables, src, groupCount, out);
 
-            if(!length) break;
+        if(length % 3) {
+            stringBase64_encodeTail(tables, src + groupCount * 3, length % 3, out + written);
+            written += 4;
         }
 
-        return ret;
+        return written;
     }
 
-    inline std::string stringBase64Encode(const void *buffer, size_t length)
+    inline void stringBase64EncodeAppend(
+        const void *buffer, size_t length, std::string &out)
     {
-        unsigned char *ptr = (unsigned char*)buffer;
+        const size_t outStart = out.size();
+        out.resize(outStart + stringBase64EncodedLength(length));
+        if(length) {
+            stringBase64EncodeToBuffer(buffer, length, &out[outStart]);
+        }
+    }
 
-        std::ostringstream ostr;
+    inline size_t stringBase64DecodedLength(
+        const char *str, size_t length,
+        Base64Whitespace whitespace)
+    {
+        // Count the characters that aren't whitespace, and remember
+        // the last two.
+        size_t count = length;
+        char last[2] = { 0, 0 };
+
+        if(whitespace == BASE64WHITESPACE_SKIP) {
+            const StringBase64Tables &tables = stringBase64_getTables();
+            count = 0;
+            for(size_t i = 0; i < length; i++) {
+                if(tables.values[uint8_t(str[i])] != STRINGBASE64_VALUE_SPACE) {
+                    last[0] = last[1];
+                    last[1] = str[i];
+                    count++;
+                }
+            }
+        } else if(length >= 2) {
+            last[0] = str[length - 2];
+            last[1] = str[length - 1];
+        }
 
-        static const char strBase64Lookup[] =
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-            "abcdefghijklmnopqrstuvwxyz"
-            "0123456789"
-            "+/";
+        // Padding only counts on a whole number of groups. Anything
+        // else is invalid and won't decode past the last whole group
+        // anyway.
+        size_t bufSize = (count / 4) * 3;
+        if(count && count % 4 == 0) {
+            if(last[1] == '=') bufSize--;
+            if(last[0] == '=') bufSize--;
+        }
 
-        size_t tmpLength = length;
+        return bufSize;
+    }
 
-        while(tmpLength) {
-            std::ostringstream currentChunkStr;
+    inline bool stringBase64DecodeToBuffer(
+        const char *str, size_t length,
+        void *out, size_t &outLength,
+        Base64Whitespace whitespace)
+    {
+        StringBase64Decoder decoder(whitespace);
+        return decoder.update(str, length, out, outLength) && decoder.finish();
+    }
 
-            uint32_t nextChunk = stringBase64Encode_getNextChunk(ptr, tmpLength);
+    inline bool stringBase64DecodeAppend(
+        const char *str, size_t length, std::string &out,
+        Base64Whitespace whitespace)
+    {
+        // Size for the worst case, then trim down to what actually
+        // got written.
+        const size_t outStart = out.size();
+        out.resize(outStart + StringBase64Decoder::getMaxOutputLength(length));
 
-            for(unsigned int i = 0; i < 4; i++) {
-                uint32_t chunkPiece = nextChunk >> (6 * (3-i));
-                chunkPiece &= 63;
-                currentChunkStr << strBase64Lookup[chunkPiece];
-            }
+        size_t outLength = 0;
+        StringBase64Decoder decoder(whitespace);
+        bool ok = decoder.update(str, length, &out[0] + outStart, outLength) && decoder.finish();
 
-            ostr << currentChunkStr.str();
-        }
+        out.resize(ok ? outStart + outLength : outStart);
+        return ok;
+    }
+
+    // ----------------------------------------------------------------------
+    // Original interface
 
-        std::string ret = ostr.str();
+    inline unsigned char *stringBase64Decode(const std::string &str, unsigned int *length)
+    {
+        size_t bufSize = stringBase64DecodedLength(str.data(), str.size());
+        unsigned char *buffer = new unsigned char[bufSize];
 
-        // We didn't handle the '=' padding during the encoding for
-        // simplicity and just let the padded area encode as zero. Go back
-        // and fix that up now.
-        unsigned int lm3 = length % 3;
-        if(lm3 == 1) {
-            ret[ret.size() - 1] = '=';
-            ret[ret.size() - 2] = '=';
-        } else if(lm3 == 2) {
-            ret[ret.size() - 1] = '=';
+        size_t outLength = 0;
+        if(!stringBase64DecodeToBuffer(str.data(), str.size(), buffer, outLength)) {
+            delete[] buffer;
+            *length = 0;
+            return NULL;
         }
 
+        *length = (unsigned int)outLength;
+        return buffer;
+    }
+
+    inline std::string stringBase64DecodeString(const std::string &str)
+    {
+        std::string ret;
+        stringBase64DecodeAppend(str.data(), str.size(), ret);
+        return ret;
+    }
+
+    inline std::string stringBase64Encode(const void *buffer, size_t length)
+    {
+        std::string ret;
+        stringBase64EncodeAppend(buffer, length, ret);
         return ret;
     }
 
@@ -39,6 +39,10 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <type_traits>
 
 // ----------------------------------------------------------------------
 // Declarations and documentation
@@ -52,8 +56,12 @@ namespace ExPop
     /// 2D auto-expanding array with integer indices. Supports
     /// negative indicies. Will reallocate as necessary. Things in
     /// newly allocated space will be default-initialized. Things that
-    /// were previously defined will then be copied over those using
-    /// operator=.
+    /// were previously defined will then be moved over those using
+    /// move assignment (or memcpy for trivially copyable types).
+    ///
+    /// Storage grows geometrically, with slack kept on whichever
+    /// side needed to grow, so filling outwards one row or column at
+    /// a time doesn't reallocate every time.
     template<typename T>
     class CellArray
     {
@@ -77,6 +85,63 @@ namespace ExPop
         /// comes out of a default constructor for the data type.
         void expandToFit(CAINDEXTYPE x, CAINDEXTYPE y);
 
+        /// Expand the array to hold an entire rectangle, with at most
+        /// one reallocation. Does nothing if width or height is zero.
+        void expandToFitRect(
+            CAINDEXTYPE x, CAINDEXTYPE y,
+            CAUNSIGNED width, CAUNSIGNED height);
+
+        // ----------------------------------------------------------------------
+        // Region access. These all do their bounds checking and
+        // expansion once per call instead of once per cell.
+
+        /// Get a pointer to a run of count cells starting at (x, y)
+        /// and going right. Expands the array if necessary. The
+        /// pointer is good until the next call that might expand the
+        /// array.
+        T *getRowSpan(CAINDEXTYPE x, CAINDEXTYPE y, CAUNSIGNED count);
+
+        /// Get a pointer to a run of count cells starting at (x, y)
+        /// and going right. Returns NULL if any part of it is out of
+        /// bounds. Doesn't expand the array.
+        const T *getRowSpanConst(CAINDEXTYPE x, CAINDEXTYPE y, CAUNSIGNED count) const;
+
+        /// Call func(x, y, value) for every cell in a rectangle, in
+        /// row-major order. Expands the array to fit the rectangle
+        /// first.
+        template<typename FuncType>
+        void forEachInRect(
+            CAINDEXTYPE x, CAINDEXTYPE y,
+            CAUNSIGNED width, CAUNSIGNED height,
+            FuncType func);
+
+        /// Set every cell in a rectangle to a value. Expands the
+        /// array to fit.
+        void fillRect(
+            const T &t,
+            CAINDEXTYPE x, CAINDEXTYPE y,
+            CAUNSIGNED width, CAUNSIGNED height);
+
+        /// Copy a rectangle from another CellArray (or this one -
+        /// overlapping is fine) into this one at (dstX, dstY).
+        /// Destination expands to fit. Cells that are outside of the
+        /// source's bounds are skipped, leaving the destination cells
+        /// alone.
+        void copyRect(
+            const CellArray<T> &src,
+            CAINDEXTYPE srcX, CAINDEXTYPE srcY,
+            CAUNSIGNED width, CAUNSIGNED height,
+            CAINDEXTYPE dstX, CAINDEXTYPE dstY);
+
+        /// Read the (2 * radius + 1) squared cells centered on (x,
+        /// y) into out, in row-major order. Anything out of bounds
+        /// gets outsideValue. Doesn't expand the array.
+        void getNeighborhood(
+            CAINDEXTYPE x, CAINDEXTYPE y,
+            CAUNSIGNED radius,
+            T *out,
+            const T &outsideValue) const;
+
         /// Get the minimum X value.
         CAINDEXTYPE getMinX(void) const;
 
@@ -97,15 +162,58 @@ namespace ExPop
         /// returned from getMaxY().
         CAUNSIGNED getHeight(void) const;
 
+        /// Get the width of the actual allocation, including slack.
+        CAUNSIGNED getCapacityWidth(void) const;
+
+        /// Get the height of the actual allocation, including slack.
+        CAUNSIGNED getCapacityHeight(void) const;
+
         /// Delete everything and reset to the default state.
         void clear(void);
 
     private:
 
+        // Not copyable. Nothing ever implemented it, and the default
+        // would double-free cells.
+        CellArray(const CellArray &other);
+        CellArray &operator=(const CellArray &other);
+
+        /// Expand to fit an inclusive range. Shared by expandToFit()
+        /// and expandToFitRect().
+        void expandToFitRange(
+            CAINDEXTYPE minX, CAINDEXTYPE minY,
+            CAINDEXTYPE maxX, CAINDEXTYPE maxY);
+
+        /// Unchecked cell lookup. Must be inside the allocation.
+        T *cellAt(CAINDEXTYPE x, CAINDEXTYPE y) const;
+
+        /// True if the entire (inclusive) range is inside the
+        /// logical bounds.
+        bool rangeInBounds(
+            CAINDEXTYPE minX, CAINDEXTYPE minY,
+            CAINDEXTYPE maxX, CAINDEXTYPE maxY) const;
+
+        /// Reallocate so that the given (inclusive) range fits, with
+        /// extra slack on the sides that had to grow.
+        void reallocate(
+            CAINDEXTYPE newMinX, CAINDEXTYPE newMinY,
+            CAINDEXTYPE newMaxX, CAINDEXTYPE newMaxY);
+
+        // Logical bounds. These are what getMinX() and friends
+        // report.
         CAUNSIGNED width;
         CAUNSIGNED height;
         CAINDEXTYPE offsetx;
         CAINDEXTYPE offsety;
+
+        // Allocated area. Always contains the logical bounds. Cells
+        // outside the logical bounds are default-initialized and
+        // have never been handed out.
+        CAUNSIGNED capacityWidth;
+        CAUNSIGNED capacityHeight;
+        CAINDEXTYPE capacityOffsetx;
+        CAINDEXTYPE capacityOffsety;
+
         T *cells;
 
     };
@@ -125,6 +233,10 @@ namespace ExPop
         height = 0;
         offsetx = 0;
         offsety = 0;
+        capacityWidth = 0;
+        capacityHeight = 0;
+        capacityOffsetx = 0;
+        capacityOffsety = 0;
     }
 
     template<typename T>
@@ -136,76 +248,170 @@ namespace ExPop
     }
 
     template<typename T>
-    void CellArray<T>::expandToFit(CAINDEXTYPE x, CAINDEXTYPE y)
+    void CellArray<T>::reallocate(
+        CAINDEXTYPE newMinX, CAINDEXTYPE newMinY,
+        CAINDEXTYPE newMaxX, CAINDEXTYPE newMaxY)
     {
-        // We don't necessarily need the origin to be in the range of
-        // stuff we get, so the first time, just make sure that the
-        // offset is set right where our first value is.
-        if(!cells) {
-            offsetx = x;
-            offsety = y;
-        }
+        CAINDEXTYPE capMinX = newMinX;
+        CAINDEXTYPE capMinY = newMinY;
+        CAINDEXTYPE capMaxX = newMaxX;
+        CAINDEXTYPE capMaxY = newMaxY;
 
-        // First see if we have to expand this thing, and by how much.
-        CAINDEXTYPE expandleft = 0;
-        CAINDEXTYPE expandright = 0;
-        CAINDEXTYPE expandup = 0;
-        CAINDEXTYPE expanddown = 0;
+        if(cells) {
 
-        if(x < offsetx) {
-            expandleft = offsetx - x;
-        }
-        if(x >= (CAINDEXTYPE)(offsetx + width)) {
-            expandright = (x + 1) - (CAINDEXTYPE)(offsetx + width);
-        }
-        if(y < offsety) {
-            expandup = offsety - y;
-        }
-        if(y >= (CAINDEXTYPE)(offsety + height)) {
-            expanddown = (y + 1) - (CAINDEXTYPE)(offsety + height);
+            // Keep all of the old slack, and then for every side
+            // that has to grow, add as much again as the old
+            // capacity on that axis. That's enough to make growth
+            // one step at a time amortized constant per cell.
+            CAINDEXTYPE oldCapMaxX = capacityOffsetx + CAINDEXTYPE(capacityWidth) - 1;
+            CAINDEXTYPE oldCapMaxY = capacityOffsety + CAINDEXTYPE(capacityHeight) - 1;
+
+            if(capMinX > capacityOffsetx) capMinX = capacityOffsetx;
+            if(capMinY > capacityOffsety) capMinY = capacityOffsety;
+            if(capMaxX < oldCapMaxX) capMaxX = oldCapMaxX;
+            if(capMaxY < oldCapMaxY) capMaxY = oldCapMaxY;
+
+            if(newMinX < capacityOffsetx) capMinX -= CAINDEXTYPE(capacityWidth);
+            if(newMaxX > oldCapMaxX)      capMaxX += CAINDEXTYPE(capacityWidth);
+            if(newMinY < capacityOffsety) capMinY -= CAINDEXTYPE(capacityHeight);
+            if(newMaxY > oldCapMaxY)      capMaxY += CAINDEXTYPE(capacityHeight);
         }
 
-        // Expand if necessary.
-        if(expanddown || expandup || expandright || expandleft) {
+        CAUNSIGNED newCapacityWidth = CAUNSIGNED(capMaxX - capMinX) + 1;
+        CAUNSIGNED newCapacityHeight = CAUNSIGNED(capMaxY - capMinY) + 1;
 
-            CAUNSIGNED newWidth = expandright + expandleft + width;
-            CAUNSIGNED newHeight = expandup + expanddown + height;
+        // This might throw an exception. Thankfully we haven't
+        // modified anything yet.
+        T *newCells = new T[newCapacityWidth * newCapacityHeight]();
 
-            // If we've wrapped around, just clamp width and height.
-            // FIXME: Might be specifying something here that's fewer
-            // bits than the actual address space.
-            if(newWidth < width) {
-                newWidth = ~0;
-            }
-            if(newHeight < height) {
-                newHeight = ~0;
-            }
+        assert(newCells);
 
-            // This might throw an exception. Thankfully we haven't
-            // modified anything yet.
-            T *newCells = new T[newWidth * newHeight]();
+        // Move over the old data, a row at a time to match the
+        // layout. Only the logical area needs to come along. Slack
+        // was never written to, and the new slack is already
+        // default-initialized.
+        if(cells) {
 
-            assert(newCells);
+            CAUNSIGNED srcStartX = CAUNSIGNED(offsetx - capacityOffsetx);
+            CAUNSIGNED srcStartY = CAUNSIGNED(offsety - capacityOffsety);
+            CAUNSIGNED dstStartX = CAUNSIGNED(offsetx - capMinX);
+            CAUNSIGNED dstStartY = CAUNSIGNED(offsety - capMinY);
 
-            // Copy over the old data.
-            for(CAUNSIGNED x1 = 0; x1 < width; x1++) {
-                for(CAUNSIGNED y1 = 0; y1 < height; y1++) {
+            for(CAUNSIGNED y1 = 0; y1 < height; y1++) {
 
-                    CAUNSIGNED srcx = (x1 + expandleft) % ((CAUNSIGNED)~0);
-                    CAUNSIGNED srcy = (y1 + expandup) % ((CAUNSIGNED)~0);
+                T *srcRow = &cells[srcStartX + (srcStartY + y1) * capacityWidth];
+                T *dstRow = &newCells[dstStartX + (dstStartY + y1) * newCapacityWidth];
 
-                    newCells[srcx + srcy * newWidth] =
-                        cells[x1 + y1 * width];
+                if(std::is_trivially_copyable<T>::value) {
+                    memcpy((void*)dstRow, (const void*)srcRow, width * sizeof(T));
+                } else {
+                    for(CAUNSIGNED x1 = 0; x1 < width; x1++) {
+                        dstRow[x1] = std::move(srcRow[x1]);
+                    }
                 }
             }
 
             delete[] cells;
-            cells = newCells;
-            width = newWidth;
-            height = newHeight;
-            offsetx -= expandleft;
-            offsety -= expandup;
         }
+
+        cells = newCells;
+        capacityWidth = newCapacityWidth;
+        capacityHeight = newCapacityHeight;
+        capacityOffsetx = capMinX;
+        capacityOffsety = capMinY;
+    }
+
+    template<typename T>
+    bool CellArray<T>::rangeInBounds(
+        CAINDEXTYPE minX, CAINDEXTYPE minY,
+        CAINDEXTYPE maxX, CAINDEXTYPE maxY) const
+    {
+        return
+            minX >= offsetx &&
+            maxX < (CAINDEXTYPE)(offsetx + width) &&
+            minY >= offsety &&
+            maxY < (CAINDEXTYPE)(offsety + height);
+    }
+
+    template<typename T>
+    T *CellArray<T>::cellAt(CAINDEXTYPE x, CAINDEXTYPE y) const
+    {
+        CAUNSIGNED srcx = CAUNSIGNED(x - capacityOffsetx);
+        CAUNSIGNED srcy = CAUNSIGNED(y - capacityOffsety);
+        return &cells[srcx + srcy * capacityWidth];
+    }
+
+    template<typename T>
+    void CellArray<T>::expandToFit(CAINDEXTYPE x, CAINDEXTYPE y)
+    {
+        expandToFitRange(x, y, x, y);
+    }
+
+    template<typename T>
+    void CellArray<T>::expandToFitRect(
+        CAINDEXTYPE x, CAINDEXTYPE y,
+        CAUNSIGNED width, CAUNSIGNED height)
+    {
+        if(!width || !height) {
+            return;
+        }
+
+        expandToFitRange(
+            x, y,
+            x + CAINDEXTYPE(width) - 1,
+            y + CAINDEXTYPE(height) - 1);
+    }
+
+    template<typename T>
+    void CellArray<T>::expandToFitRange(
+        CAINDEXTYPE minX, CAINDEXTYPE minY,
+        CAINDEXTYPE maxX, CAINDEXTYPE maxY)
+    {
+        // We don't necessarily need the origin to be in the range of
+        // stuff we get, so the first time, just make sure that the
+        // offset is set right where our first value is.
+        if(!cells) {
+            offsetx = minX;
+            offsety = minY;
+        }
+
+        // Fast path. Already in the logical bounds.
+        if(rangeInBounds(minX, minY, maxX, maxY)) {
+            return;
+        }
+
+        // Figure out the new logical bounds (inclusive).
+        CAINDEXTYPE newMinX = offsetx;
+        CAINDEXTYPE newMinY = offsety;
+        CAINDEXTYPE newMaxX = offsetx + CAINDEXTYPE(width) - 1;
+        CAINDEXTYPE newMaxY = offsety + CAINDEXTYPE(height) - 1;
+
+        if(!width || !height) {
+            newMinX = minX;
+            newMaxX = maxX;
+            newMinY = minY;
+            newMaxY = maxY;
+        }
+
+        if(minX < newMinX) newMinX = minX;
+        if(maxX > newMaxX) newMaxX = maxX;
+        if(minY < newMinY) newMinY = minY;
+        if(maxY > newMaxY) newMaxY = maxY;
+
+        // Only touch the allocation if we've run out of slack.
+        if(!cells ||
+           newMinX < capacityOffsetx ||
+           newMaxX >= (CAINDEXTYPE)(capacityOffsetx + capacityWidth) ||
+           newMinY < capacityOffsety ||
+           newMaxY >= (CAINDEXTYPE)(capacityOffsety + capacityHeight))
+        {
+            reallocate(newMinX, newMinY, newMaxX, newMaxY);
+        }
+
+        offsetx = newMinX;
+        offsety = newMinY;
+        width = CAUNSIGNED(newMaxX - newMinX) + 1;
+        height = CAUNSIGNED(newMaxY - newMinY) + 1;
     }
 
     template<typename T>
@@ -218,9 +424,7 @@ namespace ExPop
     T &CellArray<T>::get(CAINDEXTYPE x, CAINDEXTYPE y)
     {
         expandToFit(x, y);
-        CAUNSIGNED srcx = (x - offsetx) % ((CAUNSIGNED)~0);
-        CAUNSIGNED srcy = (y - offsety) % ((CAUNSIGNED)~0);
-        return cells[srcx + srcy * width];
+        return *cellAt(x, y);
     }
 
     template<typename T>
@@ -233,10 +437,181 @@ namespace ExPop
             return NULL;
         }
 
-        CAUNSIGNED srcx = (x - offsetx) % ((CAUNSIGNED)~0);
-        CAUNSIGNED srcy = (y - offsety) % ((CAUNSIGNED)~0);
+        return cellAt(x, y);
+    }
 
-        return &cells[srcx + srcy * width];
+    template<typename T>
+    T *CellArray<T>::getRowSpan(CAINDEXTYPE x, CAINDEXTYPE y, CAUNSIGNED count)
+    {
+        expandToFitRect(x, y, count ? count : 1, 1);
+        return cellAt(x, y);
+    }
+
+    template<typename T>
+    const T *CellArray<T>::getRowSpanConst(CAINDEXTYPE x, CAINDEXTYPE y, CAUNSIGNED count) const
+    {
+        if(!count || !rangeInBounds(x, y, x + CAINDEXTYPE(count) - 1, y)) {
+            return NULL;
+        }
+        return cellAt(x, y);
+    }
+
+    template<typename T>
+    template<typename FuncType>
+    void CellArray<T>::forEachInRect(
+        CAINDEXTYPE x, CAINDEXTYPE y,
+        CAUNSIGNED width, CAUNSIGNED height,
+        FuncType func)
+    {
+        if(!width || !height) {
+            return;
+        }
+
+        expandToFitRect(x, y, width, height);
+
+        for(CAUNSIGNED y1 = 0; y1 < height; y1++) {
+            CAINDEXTYPE cellY = y + CAINDEXTYPE(y1);
+            T *row = cellAt(x, cellY);
+            for(CAUNSIGNED x1 = 0; x1 < width; x1++) {
+                func(x + CAINDEXTYPE(x1), cellY, row[x1]);
+            }
+        }
+    }
+
+    template<typename T>
+    void CellArray<T>::fillRect(
+        const T &t,
+        CAINDEXTYPE x, CAINDEXTYPE y,
+        CAUNSIGNED width, CAUNSIGNED height)
+    {
+        if(!width || !height) {
+            return;
+        }
+
+        expandToFitRect(x, y, width, height);
+
+        for(CAUNSIGNED y1 = 0; y1 < height; y1++) {
+            T *row = cellAt(x, y + CAINDEXTYPE(y1));
+            for(CAUNSIGNED x1 = 0; x1 < width; x1++) {
+                row[x1] = t;
+            }
+        }
+    }
+
+    template<typename T>
+    void CellArray<T>::copyRect(
+        const CellArray<T> &src,
+        CAINDEXTYPE srcX, CAINDEXTYPE srcY,
+        CAUNSIGNED width, CAUNSIGNED height,
+        CAINDEXTYPE dstX, CAINDEXTYPE dstY)
+    {
+        // Clip the source rectangle to the source's bounds, and move
+        // the destination along with it.
+        CAINDEXTYPE srcMinX = srcX;
+        CAINDEXTYPE srcMinY = srcY;
+        CAINDEXTYPE srcMaxX = srcX + CAINDEXTYPE(width);
+        CAINDEXTYPE srcMaxY = srcY + CAINDEXTYPE(height);
+
+        if(srcMinX < src.getMinX()) srcMinX = src.getMinX();
+        if(srcMinY < src.getMinY()) srcMinY = src.getMinY();
+        if(srcMaxX > src.getMaxX()) srcMaxX = src.getMaxX();
+        if(srcMaxY > src.getMaxY()) srcMaxY = src.getMaxY();
+
+        if(srcMinX >= srcMaxX || srcMinY >= srcMaxY) {
+            return;
+        }
+
+        CAUNSIGNED clippedWidth = CAUNSIGNED(srcMaxX - srcMinX);
+        CAUNSIGNED clippedHeight = CAUNSIGNED(srcMaxY - srcMinY);
+        dstX += srcMinX - srcX;
+        dstY += srcMinY - srcY;
+
+        // This may reallocate, which is fine even if src is this,
+        // because we look up the source rows afterwards.
+        expandToFitRect(dstX, dstY, clippedWidth, clippedHeight);
+
+        if(&src == this) {
+
+            // Overlapping copy within ourselves. Go bottom-up if
+            // we're moving down so we don't stomp rows we haven't
+            // read yet, and go through a temporary row in case the
+            // rows themselves overlap.
+            std::vector<T> tmpRow(clippedWidth);
+            bool bottomUp = dstY > srcMinY;
+
+            for(CAUNSIGNED i = 0; i < clippedHeight; i++) {
+                CAUNSIGNED y1 = bottomUp ? (clippedHeight - 1 - i) : i;
+                const T *srcRow = cellAt(srcMinX, srcMinY + CAINDEXTYPE(y1));
+                T *dstRow = cellAt(dstX, dstY + CAINDEXTYPE(y1));
+                for(CAUNSIGNED x1 = 0; x1 < clippedWidth; x1++) {
+                    tmpRow[x1] = srcRow[x1];
+                }
+                for(CAUNSIGNED x1 = 0; x1 < clippedWidth; x1++) {
+                    dstRow[x1] = tmpRow[x1];
+                }
+            }
+
+        } else {
+
+            for(CAUNSIGNED y1 = 0; y1 < clippedHeight; y1++) {
+                const T *srcRow = src.cellAt(srcMinX, srcMinY + CAINDEXTYPE(y1));
+                T *dstRow = cellAt(dstX, dstY + CAINDEXTYPE(y1));
+                if(std::is_trivially_copyable<T>::value) {
+                    memcpy((void*)dstRow, (const void*)srcRow, clippedWidth * sizeof(T));
+                } else {
+                    for(CAUNSIGNED x1 = 0; x1 < clippedWidth; x1++) {
+                        dstRow[x1] = srcRow[x1];
+                    }
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    void CellArray<T>::getNeighborhood(
+        CAINDEXTYPE x, CAINDEXTYPE y,
+        CAUNSIGNED radius,
+        T *out,
+        const T &outsideValue) const
+    {
+        CAINDEXTYPE r = CAINDEXTYPE(radius);
+        CAUNSIGNED diameter = radius * 2 + 1;
+
+        // Entirely inside is the common case, and needs no per-cell
+        // checks at all.
+        if(rangeInBounds(x - r, y - r, x + r, y + r)) {
+            for(CAUNSIGNED y1 = 0; y1 < diameter; y1++) {
+                const T *row = cellAt(x - r, y - r + CAINDEXTYPE(y1));
+                for(CAUNSIGNED x1 = 0; x1 < diameter; x1++) {
+                    *(out++) = row[x1];
+                }
+            }
+            return;
+        }
+
+        // Straddling the edge. Figure out the valid range once, and
+        // fill in everything else with outsideValue.
+        CAINDEXTYPE validMinX = x - r < offsetx ? offsetx : x - r;
+        CAINDEXTYPE validMaxX = x + r >= getMaxX() ? getMaxX() - 1 : x + r;
+
+        for(CAINDEXTYPE cellY = y - r; cellY <= y + r; cellY++) {
+
+            if(!width || cellY < offsety || cellY >= getMaxY() || validMinX > validMaxX) {
+                for(CAUNSIGNED x1 = 0; x1 < diameter; x1++) {
+                    *(out++) = outsideValue;
+                }
+                continue;
+            }
+
+            const T *row = cellAt(validMinX, cellY);
+            for(CAINDEXTYPE cellX = x - r; cellX <= x + r; cellX++) {
+                if(cellX < validMinX || cellX > validMaxX) {
+                    *(out++) = outsideValue;
+                } else {
+                    *(out++) = row[cellX - validMinX];
+                }
+            }
+        }
     }
 
     template<typename T>
@@ -251,6 +626,18 @@ namespace ExPop
         return height;
     }
 
+    template<typename T>
+    CAUNSIGNED CellArray<T>::getCapacityWidth(void) const
+    {
+        return capacityWidth;
+    }
+
+    template<typename T>
+    CAUNSIGNED CellArray<T>::getCapacityHeight(void) const
+    {
+        return capacityHeight;
+    }
+
     template<typename T>
     CAINDEXTYPE CellArray<T>::getMinX(void) const
     {
@@ -278,12 +665,16 @@ namespace ExPop
     template<typename T>
     void CellArray<T>::clear(void)
     {
-        delete cells;
+        delete[] cells;
         cells = nullptr;
         width = 0;
         height = 0;
         offsetx = 0;
         offsety = 0;
+        capacityWidth = 0;
+        capacityHeight = 0;
+        capacityOffsetx = 0;
+        capacityOffsety = 0;
     }
 
 }
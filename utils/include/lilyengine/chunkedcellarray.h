@@ -0,0 +1,393 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Sparse version of CellArray. Storage is split up into fixed-size
+// square tiles that only get allocated when something actually
+// touches them, so memory use follows the area that's been written
+// to instead of the bounding box of everything.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <unordered_map>
+
+#include "cellarray.h"
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// 2D auto-expanding array with integer indices, stored as a hash
+    /// table of square tiles that are (1 << tileSizeLog2) cells on a
+    /// side. Bounds (getMinX() and friends) work exactly like
+    /// CellArray, but only tiles that have had something fetched with
+    /// get() or set() take up any memory. Everything else reads back
+    /// as a default-constructed T.
+    template<typename T, CAUNSIGNED tileSizeLog2 = 5>
+    class ChunkedCellArray
+    {
+    public:
+
+        /// Width and height of a single tile.
+        static const CAUNSIGNED tileSize = CAUNSIGNED(1) << tileSizeLog2;
+
+        ChunkedCellArray(void);
+        ~ChunkedCellArray(void);
+
+        /// Set an element. Expands bounds and allocates the tile if
+        /// necessary.
+        void set(const T &t, CAINDEXTYPE x, CAINDEXTYPE y);
+
+        /// Get an element. Expands bounds and allocates the tile if
+        /// necessary.
+        T &get(CAINDEXTYPE x, CAINDEXTYPE y);
+
+        /// Get an element. Returns NULL if it's out of bounds.
+        /// Doesn't expand the bounds or allocate anything. Cells that
+        /// are in bounds but in a tile that hasn't been allocated
+        /// point to a shared default value.
+        const T *getConst(CAINDEXTYPE x, CAINDEXTYPE y);
+
+        /// Expand the bounds to hold a given element. This doesn't
+        /// allocate anything.
+        void expandToFit(CAINDEXTYPE x, CAINDEXTYPE y);
+
+        /// Get the minimum X value.
+        CAINDEXTYPE getMinX(void) const;
+
+        /// Get the maximum X value.
+        CAINDEXTYPE getMaxX(void) const;
+
+        /// Get the minimum Y value.
+        CAINDEXTYPE getMinY(void) const;
+
+        /// Get the maximum Y value.
+        CAINDEXTYPE getMaxY(void) const;
+
+        /// Get the width of the bounds.
+        CAUNSIGNED getWidth(void) const;
+
+        /// Get the height of the bounds.
+        CAUNSIGNED getHeight(void) const;
+
+        /// Get the number of tiles that have actually been allocated.
+        CAUNSIGNED getPopulatedTileCount(void) const;
+
+        /// Call func(x, y, value) for every cell inside the bounds
+        /// that lives in an allocated tile. Cells in tiles that were
+        /// never allocated are skipped entirely. Order is by tile,
+        /// then row-major inside each tile. Tiles are not visited in
+        /// any particular order.
+        template<typename FuncType>
+        void forEachPopulatedCell(FuncType func);
+
+        /// Delete everything and reset to the default state.
+        void clear(void);
+
+    private:
+
+        // Not copyable. Tiles are owned pointers.
+        ChunkedCellArray(const ChunkedCellArray &other);
+        ChunkedCellArray &operator=(const ChunkedCellArray &other);
+
+        static const CAUNSIGNED tileMask = tileSize - 1;
+
+        struct TileCoordinate
+        {
+            CAINDEXTYPE x;
+            CAINDEXTYPE y;
+
+            bool operator==(const TileCoordinate &other) const
+            {
+                return x == other.x && y == other.y;
+            }
+        };
+
+        struct TileCoordinateHash
+        {
+            size_t operator()(const TileCoordinate &coord) const
+            {
+                // Mix the two together so tiles along a diagonal
+                // don't all land in the same bucket.
+                size_t hash = size_t(coord.x) * size_t(0x9e3779b97f4a7c15ull);
+                hash ^= size_t(coord.y) + size_t(0x7f4a7c15) + (hash << 6) + (hash >> 2);
+                return hash;
+            }
+        };
+
+        struct Tile
+        {
+            T cells[tileSize * tileSize];
+
+            Tile(void) : cells() {}
+        };
+
+        /// Find the tile for a cell, optionally allocating it. Will
+        /// return NULL if it doesn't exist and allocate is false.
+        Tile *findTile(CAINDEXTYPE x, CAINDEXTYPE y, bool allocate);
+
+        static CAINDEXTYPE tileCoordinate(CAINDEXTYPE v);
+
+        std::unordered_map<TileCoordinate, Tile*, TileCoordinateHash> tiles;
+
+        // One-entry lookup cache. Most access patterns hit the same
+        // tile over and over, so this skips the hash lookup.
+        TileCoordinate lastTileCoordinate;
+        Tile *lastTile;
+
+        CAUNSIGNED width;
+        CAUNSIGNED height;
+        CAINDEXTYPE offsetx;
+        CAINDEXTYPE offsety;
+
+        T defaultValue;
+    };
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    ChunkedCellArray<T, tileSizeLog2>::ChunkedCellArray(void) :
+        defaultValue()
+    {
+        lastTile = NULL;
+        lastTileCoordinate.x = 0;
+        lastTileCoordinate.y = 0;
+        width = 0;
+        height = 0;
+        offsetx = 0;
+        offsety = 0;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    ChunkedCellArray<T, tileSizeLog2>::~ChunkedCellArray(void)
+    {
+        clear();
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAINDEXTYPE ChunkedCellArray<T, tileSizeLog2>::tileCoordinate(CAINDEXTYPE v)
+    {
+        // Arithmetic shift, so negative coordinates round down
+        // instead of towards zero.
+        return v >> CAINDEXTYPE(tileSizeLog2);
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    typename ChunkedCellArray<T, tileSizeLog2>::Tile *ChunkedCellArray<T, tileSizeLog2>::findTile(
+        CAINDEXTYPE x, CAINDEXTYPE y, bool allocate)
+    {
+        TileCoordinate coord;
+        coord.x = tileCoordinate(x);
+        coord.y = tileCoordinate(y);
+
+        if(lastTile && coord == lastTileCoordinate) {
+            return lastTile;
+        }
+
+        Tile *tile = NULL;
+        auto itr = tiles.find(coord);
+        if(itr != tiles.end()) {
+            tile = itr->second;
+        } else if(allocate) {
+            tile = new Tile();
+            tiles[coord] = tile;
+        }
+
+        if(tile) {
+            lastTile = tile;
+            lastTileCoordinate = coord;
+        }
+
+        return tile;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    void ChunkedCellArray<T, tileSizeLog2>::expandToFit(CAINDEXTYPE x, CAINDEXTYPE y)
+    {
+        // Same deal as CellArray. The first thing touched decides
+        // where the bounds start.
+        if(!width || !height) {
+            offsetx = x;
+            offsety = y;
+            width = 1;
+            height = 1;
+            return;
+        }
+
+        if(x < offsetx) {
+            width += offsetx - x;
+            offsetx = x;
+        }
+        if(x >= (CAINDEXTYPE)(offsetx + width)) {
+            width = (x + 1) - offsetx;
+        }
+        if(y < offsety) {
+            height += offsety - y;
+            offsety = y;
+        }
+        if(y >= (CAINDEXTYPE)(offsety + height)) {
+            height = (y + 1) - offsety;
+        }
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    void ChunkedCellArray<T, tileSizeLog2>::set(const T &t, CAINDEXTYPE x, CAINDEXTYPE y)
+    {
+        get(x, y) = t;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    T &ChunkedCellArray<T, tileSizeLog2>::get(CAINDEXTYPE x, CAINDEXTYPE y)
+    {
+        expandToFit(x, y);
+        Tile *tile = findTile(x, y, true);
+        return tile->cells[(x & tileMask) + (y & tileMask) * tileSize];
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    const T *ChunkedCellArray<T, tileSizeLog2>::getConst(CAINDEXTYPE x, CAINDEXTYPE y)
+    {
+        if(x < offsetx ||
+           x >= (CAINDEXTYPE)(offsetx + width) ||
+           y < offsety ||
+           y >= (CAINDEXTYPE)(offsety + height)) {
+            return NULL;
+        }
+
+        Tile *tile = findTile(x, y, false);
+        if(!tile) {
+            return &defaultValue;
+        }
+
+        return &tile->cells[(x & tileMask) + (y & tileMask) * tileSize];
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    template<typename FuncType>
+    void ChunkedCellArray<T, tileSizeLog2>::forEachPopulatedCell(FuncType func)
+    {
+        CAINDEXTYPE maxX = getMaxX();
+        CAINDEXTYPE maxY = getMaxY();
+
+        for(auto itr = tiles.begin(); itr != tiles.end(); itr++) {
+
+            // Multiply instead of shifting, because tile coordinates
+            // can be negative.
+            CAINDEXTYPE tileLeft = itr->first.x * CAINDEXTYPE(tileSize);
+            CAINDEXTYPE tileTop  = itr->first.y * CAINDEXTYPE(tileSize);
+            Tile *tile = itr->second;
+
+            // Clip the tile to the bounds. Tiles can hang over the
+            // edge when only part of them has been touched.
+            CAINDEXTYPE startX = tileLeft < offsetx ? offsetx : tileLeft;
+            CAINDEXTYPE startY = tileTop < offsety ? offsety : tileTop;
+            CAINDEXTYPE endX = tileLeft + CAINDEXTYPE(tileSize);
+            CAINDEXTYPE endY = tileTop + CAINDEXTYPE(tileSize);
+            if(endX > maxX) endX = maxX;
+            if(endY > maxY) endY = maxY;
+
+            for(CAINDEXTYPE y = startY; y < endY; y++) {
+                T *row = &tile->cells[(y - tileTop) * tileSize];
+                for(CAINDEXTYPE x = startX; x < endX; x++) {
+                    func(x, y, row[x - tileLeft]);
+                }
+            }
+        }
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAUNSIGNED ChunkedCellArray<T, tileSizeLog2>::getPopulatedTileCount(void) const
+    {
+        return tiles.size();
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAUNSIGNED ChunkedCellArray<T, tileSizeLog2>::getWidth(void) const
+    {
+        return width;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAUNSIGNED ChunkedCellArray<T, tileSizeLog2>::getHeight(void) const
+    {
+        return height;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAINDEXTYPE ChunkedCellArray<T, tileSizeLog2>::getMinX(void) const
+    {
+        return offsetx;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAINDEXTYPE ChunkedCellArray<T, tileSizeLog2>::getMaxX(void) const
+    {
+        return offsetx + width;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAINDEXTYPE ChunkedCellArray<T, tileSizeLog2>::getMinY(void) const
+    {
+        return offsety;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    CAINDEXTYPE ChunkedCellArray<T, tileSizeLog2>::getMaxY(void) const
+    {
+        return offsety + height;
+    }
+
+    template<typename T, CAUNSIGNED tileSizeLog2>
+    void ChunkedCellArray<T, tileSizeLog2>::clear(void)
+    {
+        for(auto itr = tiles.begin(); itr != tiles.end(); itr++) {
+            delete itr->second;
+        }
+        tiles.clear();
+        lastTile = NULL;
+        width = 0;
+        height = 0;
+        offsetx = 0;
+        offsety = 0;
+    }
+}
@@ -334,9 +334,32 @@ namespace ExPop
             bool buildPath)
         {
             std::string fullPath = makeFullPath(path);
-            std::vector<std::string> fullPathParts;
-            stringTokenize(fullPath, "/", fullPathParts);
-            return resolvePath(fullPathParts, 0, buildPath);
+
+            // Walk down one path component at a time. name gets
+            // reused for the map lookups, so it only allocates for
+            // names too long for the small string buffer.
+            ArchiveTreeNode *node = this;
+            std::string name;
+            StringTokenizer tokenizer(fullPath, "/");
+            StringView part;
+
+            while(tokenizer.next(part)) {
+
+                name.assign(part.data(), part.size());
+                auto it = node->children.find(name);
+
+                if(it != node->children.end()) {
+                    node = it->second.get();
+                } else if(buildPath) {
+                    std::shared_ptr<ArchiveTreeNode> child(new ArchiveTreeNode);
+                    node->children[name] = child;
+                    node = child.get();
+                } else {
+                    return nullptr;
+                }
+            }
+
+            return node;
         }
 
         inline void ArchiveTreeNode::dump(size_t indent)
@@ -478,85 +501,69 @@ namespace ExPop
 
         inline std::string fixFileName(const std::string &str)
         {
-            // Split the path into directories and the filename.
-            std::vector<std::string> fileNameParts;
-            stringTokenize(str, "\\/", fileNameParts);
-
-            std::ostringstream outStr;
+            // Split the path into directories and the filename. These
+            // are views into str, so nothing gets copied until the
+            // final string gets put together.
+            std::vector<StringView> fileNameParts;
+            StringTokenizer tokenizer(str, "\\/");
+            StringView part;
 
             // For ".." going above the current directory.
             int numHigherDirectories = 0;
 
-            for(unsigned int i = 0; i < fileNameParts.size(); i++) {
-
-                if(fileNameParts[i] == ".") {
-
-                    // "." for the current directory. Just drop these from
-                    // the list. They're redundant.
+            while(tokenizer.next(part)) {
 
-                    fileNameParts.erase(fileNameParts.begin() + i);
-                    i--;
+                if(part == ".") {
 
-                } else if(fileNameParts[i] == "..") {
+                    // "." for the current directory. Just drop these.
+                    // They're redundant.
 
-                    // ".." for previous directory. Remove this one and the one
-                    // before it, UNLESS it's the first one, in which case it's
-                    // a directory above the current one.
+                } else if(part == "..") {
 
-                    if(i == 0) {
+                    // ".." for previous directory. Remove the one before
+                    // it, UNLESS there isn't one, in which case it's a
+                    // directory above the current one.
 
-                        // Top level. Remove this directory and count how
-                        // far we've gone above the current directory.
+                    if(fileNameParts.size()) {
+                        fileNameParts.pop_back();
+                    } else {
                         numHigherDirectories++;
-                        fileNameParts.erase(fileNameParts.begin());
+                    }
 
-                        // I know this will cause the unsigned int to wrap
-                        // around, but it'll wrap back when it increments
-                        // again. Please don't kill me.
-                        i--;
+                } else {
 
-                    } else {
+                    fileNameParts.push_back(part);
 
-                        // Remove the previous directory.
-                        fileNameParts.erase(fileNameParts.begin() + (i-1));
+                }
+            }
 
-                        // Remove THIS directory.
-                        fileNameParts.erase(fileNameParts.begin() + (i-1));
+            std::string ret;
+            ret.reserve(str.size() + 1 + numHigherDirectories * 3);
 
-                        // Unsigned weirdness: We're at at least 1 here, so
-                        // the most this can do is wrap around for -1. The
-                        // next iteration of the for loop will bring it back
-                        // to zero.
-                        i -= 2;
-                    }
-                }
+            // Restore the root slash that we dropped in the
+            // tokenization stage.
+            if(str.size() && str[0] == '/') {
+                ret += '/';
             }
 
             for(int i = 0; i < numHigherDirectories; i++) {
                 // Add "../" for as many directories we ended up going
                 // above the current one.
-                outStr << "../";
+                ret += "../";
             }
 
-            for(unsigned int i = 0; i < fileNameParts.size(); i++) {
+            for(size_t i = 0; i < fileNameParts.size(); i++) {
+
                 // Add the current name.
-                outStr << fileNameParts[i];
+                ret.append(fileNameParts[i].data(), fileNameParts[i].size());
 
                 // If this isn't the last one, then it's not at the file
                 // name yet.
                 if(i != fileNameParts.size() - 1) {
-                    outStr << "/";
+                    ret += '/';
                 }
             }
 
-            std::string ret = outStr.str();
-
-            // Little hack to restore the root slash that we may have
-            // dropped in the tokenization stage.
-            if(str.size() && str[0] == '/') {
-                ret = "/" + ret;
-            }
-
             return ret;
         }
 
@@ -565,19 +572,26 @@ namespace ExPop
             const std::vector<std::string> &inputList,
             std::vector<std::string> &outputList)
         {
-            std::vector<std::string> extensions;
-
+            std::vector<StringView> extensions;
             stringTokenize(extension, ", ", extensions);
 
             for(unsigned int i = 0; i < inputList.size(); i++) {
+
+                const std::string &name = inputList[i];
+
                 for(unsigned int j = 0; j < extensions.size(); j++) {
-                    if(stringEndsWith(std::string(".") + extensions[j], inputList[i])) {
 
+                    // Ends with "." and then the extension.
+                    const StringView &ext = extensions[j];
+                    if(name.size() > ext.size() &&
+                        name[name.size() - ext.size() - 1] == '.' &&
+                        !name.compare(name.size() - ext.size(), ext.size(), ext.data(), ext.size()))
+                    {
                         // This check only does anything if the list is
                         // sorted. Removes doubles.
-                        if(!outputList.size() || inputList[i] != outputList[outputList.size() - 1]) {
+                        if(!outputList.size() || name != outputList[outputList.size() - 1]) {
 
-                            outputList.push_back(inputList[i]);
+                            outputList.push_back(name);
                         }
                     }
                 }
@@ -629,34 +643,38 @@ namespace ExPop
             std::string cwd = getCwd();
 
             // Tokenize.
-            std::vector<std::string> cwdParts;
+            std::vector<StringView> cwdParts;
             stringTokenize(cwd, "/", cwdParts);
 
-            std::vector<std::string> pathParts;
+            std::vector<StringView> pathParts;
             stringTokenize(fullPath, "/", pathParts);
 
-            // Strip off common elements from the front.
-            while(cwdParts.size() && pathParts.size() && cwdParts[0] == pathParts[0]) {
-                cwdParts.erase(cwdParts.begin());
-                pathParts.erase(pathParts.begin());
+            // Skip over common elements at the front.
+            size_t common = 0;
+            while(common < cwdParts.size() && common < pathParts.size() &&
+                cwdParts[common] == pathParts[common])
+            {
+                common++;
             }
 
             // Now just turn every directory left in the cwd into a
-            // "..".
-            for(size_t i = 0; i < cwdParts.size(); i++) {
-                pathParts.insert(pathParts.begin(), "..");
+            // "..", and then add whatever's left of the path.
+            std::string ret;
+            for(size_t i = common; i < cwdParts.size(); i++) {
+                ret += "../";
             }
 
-            // Re-assemble the full path.
-            std::ostringstream retStr;
-            for(size_t i = 0; i < pathParts.size(); i++) {
-                retStr << pathParts[i];
-                if(i + 1 < pathParts.size()) {
-                    retStr << "/";
-                }
+            for(size_t i = common; i < pathParts.size(); i++) {
+                ret.append(pathParts[i].data(), pathParts[i].size());
+                ret += '/';
             }
 
-            return retStr.str();
+            // Drop the trailing slash.
+            if(ret.size()) {
+                ret.resize(ret.size() - 1);
+            }
+
+            return ret;
         }
 
         // ----------------------------------------------------------------------
@@ -1339,7 +1357,7 @@ namespace ExPop
             const char *systemPath = getenv("PATH");
             if(systemPath) {
 
-                std::vector<std::string> splitPath;
+                std::vector<StringView> splitPath;
                 stringTokenize(systemPath, pathSeparator, splitPath, false);
 
               #ifdef _WIN32
@@ -1349,7 +1367,7 @@ namespace ExPop
               #endif
 
                 for(size_t i = 0; i < splitPath.size(); i++) {
-                    std::string maybePath = fixFileName(splitPath[i] + "/" + argv0);
+                    std::string maybePath = fixFileName(splitPath[i].str() + "/" + argv0);
                     if(fileExists(maybePath)) {
                         // TODO: Check to see if it's actually executable!
                         return maybePath;
@@ -0,0 +1,444 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// View frustum culling. makeFrustumFromMatrix() pulls the six clip
+// planes out of a projection (or projection * view) matrix, and the
+// batch functions test whole arrays of spheres or boxes against them
+// and write out the indices of the ones that might be visible.
+//
+// Objects are passed as structure-of-arrays (one array of x values,
+// one of y values and so on) so four of them can be loaded into
+// SimdFloat4s at once without any shuffling. Each plane gets tested
+// against four objects at a time, and the results come back as a
+// bitmask that gets turned into indices without any branches.
+//
+// Like the usual plane test, this is conservative: anything that
+// straddles a plane outside the frustum's corners can still come back
+// as visible. Nothing visible ever gets culled.
+//
+// Results are the same as calling frustumTestSphere() or
+// frustumTestAabb() on each object, whatever SIMD or thread count is
+// used. Counts don't need to be a multiple of four.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "matrix.h"
+#include "simd.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Six planes, as (normal x, normal y, normal z, distance) with
+    /// unit-length normals pointing into the frustum. A point p is
+    /// inside a plane if dot(normal, p) + distance >= 0.
+    struct Frustum
+    {
+        enum
+        {
+            PLANE_LEFT,
+            PLANE_RIGHT,
+            PLANE_BOTTOM,
+            PLANE_TOP,
+            PLANE_NEAR,
+            PLANE_FAR,
+
+            PLANE_COUNT
+        };
+
+        FVec4 planes[PLANE_COUNT];
+    };
+
+    /// Extract the frustum planes from a projection matrix, or a
+    /// projection * view matrix to get them in world space. The
+    /// matrix has to transform points the way Matrix::multiply() and
+    /// makeFrustumMatrix() do (clip = m * point).
+    inline Frustum makeFrustumFromMatrix(const FMatrix4x4 &m);
+
+    /// Test one sphere. Returns false if it's entirely outside any
+    /// one of the planes.
+    inline bool frustumTestSphere(
+        const Frustum &frustum,
+        const FVec3 &center,
+        float radius);
+
+    /// Test one axis-aligned box. Returns false if it's entirely
+    /// outside any one of the planes.
+    inline bool frustumTestAabb(
+        const Frustum &frustum,
+        const FVec3 &boxMin,
+        const FVec3 &boxMax);
+
+    /// Test an array of spheres, and write the indices of the ones
+    /// that passed to visibleIndices, in order. visibleIndices needs
+    /// room for count entries. Returns the number of visible spheres.
+    ///
+    /// Work is split up between threadCount threads (0 for every
+    /// processor). It's only worth it for 100k or so objects or more,
+    /// and small counts stay on the calling thread anyway.
+    inline size_t frustumCullSpheres(
+        const Frustum &frustum,
+        const float *centerX,
+        const float *centerY,
+        const float *centerZ,
+        const float *radius,
+        size_t count,
+        uint32_t *visibleIndices,
+        size_t threadCount = 1);
+
+    /// Test an array of axis-aligned boxes, given by their minimum
+    /// and maximum corners. Otherwise the same as
+    /// frustumCullSpheres().
+    inline size_t frustumCullAabbs(
+        const Frustum &frustum,
+        const float *minX,
+        const float *minY,
+        const float *minZ,
+        const float *maxX,
+        const float *maxY,
+        const float *maxZ,
+        size_t count,
+        uint32_t *visibleIndices,
+        size_t threadCount = 1);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    inline Frustum makeFrustumFromMatrix(const FMatrix4x4 &m)
+    {
+        // Gribb and Hartmann. Each plane is the bottom row of the
+        // matrix plus or minus one of the others, since -w <= x <= w
+        // (and so on) inside the clip volume.
+        Frustum frustum;
+        for(unsigned int i = 0; i < Frustum::PLANE_COUNT; i++) {
+
+            unsigned int row = i / 2;
+            float sign = (i & 1) ? -1.0f : 1.0f;
+
+            FVec4 plane;
+            for(unsigned int col = 0; col < 4; col++) {
+                plane.data[col] = m.getConst(3, col) + sign * m.getConst(row, col);
+            }
+
+            float length = std::sqrt(
+                plane.data[0] * plane.data[0] +
+                plane.data[1] * plane.data[1] +
+                plane.data[2] * plane.data[2]);
+
+            for(unsigned int col = 0; col < 4; col++) {
+                frustum.planes[i].data[col] = plane.data[col] / length;
+            }
+        }
+        return frustum;
+    }
+
+    // Signed distance from a plane to a point, added up in the same
+    // order as the SIMD versions.
+    inline float frustum_planeDistance(const FVec4 &plane, float x, float y, float z)
+    {
+        return ((plane.data[0] * x + plane.data[1] * y) + plane.data[2] * z) + plane.data[3];
+    }
+
+    inline bool frustumTestSphere(
+        const Frustum &frustum,
+        const FVec3 &center,
+        float radius)
+    {
+        for(unsigned int i = 0; i < Frustum::PLANE_COUNT; i++) {
+            float distance = frustum_planeDistance(
+                frustum.planes[i], center.data[0], center.data[1], center.data[2]);
+            if(distance < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline bool frustumTestAabb(
+        const Frustum &frustum,
+        const FVec3 &boxMin,
+        const FVec3 &boxMax)
+    {
+        // Only the corner furthest along the plane's normal matters.
+        // If that one's outside, they all are.
+        for(unsigned int i = 0; i < Frustum::PLANE_COUNT; i++) {
+            const FVec4 &plane = frustum.planes[i];
+            float distance = frustum_planeDistance(
+                plane,
+                plane.data[0] >= 0.0f ? boxMax.data[0] : boxMin.data[0],
+                plane.data[1] >= 0.0f ? boxMax.data[1] : boxMin.data[1],
+                plane.data[2] >= 0.0f ? boxMax.data[2] : boxMin.data[2]);
+            if(distance < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Write out index + lane for each lane that's set in
+    // visibleMask. Every lane gets written and the count only moves
+    // forward for the visible ones, which avoids a hard-to-predict
+    // branch per object. out has to have room for four entries.
+    inline size_t frustum_writeIndices(uint32_t *out, uint32_t index, int visibleMask)
+    {
+        size_t written = 0;
+        for(int lane = 0; lane < 4; lane++) {
+            out[written] = index + lane;
+            written += (visibleMask >> lane) & 1;
+        }
+        return written;
+    }
+
+    // Plane coefficients already copied across all four lanes.
+    struct Frustum_SplatPlane
+    {
+        SimdFloat4 x;
+        SimdFloat4 y;
+        SimdFloat4 z;
+        SimdFloat4 w;
+    };
+
+    inline void frustum_splatPlanes(const Frustum &frustum, Frustum_SplatPlane *out)
+    {
+        for(unsigned int i = 0; i < Frustum::PLANE_COUNT; i++) {
+            out[i].x = SimdFloat4::splat(frustum.planes[i].data[0]);
+            out[i].y = SimdFloat4::splat(frustum.planes[i].data[1]);
+            out[i].z = SimdFloat4::splat(frustum.planes[i].data[2]);
+            out[i].w = SimdFloat4::splat(frustum.planes[i].data[3]);
+        }
+    }
+
+    inline SimdFloat4 frustum_planeDistance(
+        const Frustum_SplatPlane &plane,
+        const SimdFloat4 &x,
+        const SimdFloat4 &y,
+        const SimdFloat4 &z)
+    {
+        SimdFloat4 distance = plane.x * x;
+        distance = simdMulAdd(distance, plane.y, y);
+        distance = simdMulAdd(distance, plane.z, z);
+        return distance + plane.w;
+    }
+
+    // Cull [begin, end), writing indices to out. Returns how many got
+    // written.
+    inline size_t frustumCullSpheres_range(
+        const Frustum &frustum,
+        const float *centerX,
+        const float *centerY,
+        const float *centerZ,
+        const float *radius,
+        size_t begin,
+        size_t end,
+        uint32_t *out)
+    {
+        Frustum_SplatPlane planes[Frustum::PLANE_COUNT];
+        frustum_splatPlanes(frustum, planes);
+
+        size_t written = 0;
+        size_t i = begin;
+        for(; i + 4 <= end; i += 4) {
+
+            SimdFloat4 x = SimdFloat4::load(centerX + i);
+            SimdFloat4 y = SimdFloat4::load(centerY + i);
+            SimdFloat4 z = SimdFloat4::load(centerZ + i);
+            SimdFloat4 negativeRadius = SimdFloat4::zero() - SimdFloat4::load(radius + i);
+
+            int outsideMask = 0;
+            for(unsigned int p = 0; p < Frustum::PLANE_COUNT; p++) {
+                outsideMask |= simdLessThanMask(
+                    frustum_planeDistance(planes[p], x, y, z), negativeRadius);
+            }
+
+            written += frustum_writeIndices(out + written, uint32_t(i), ~outsideMask);
+        }
+
+        for(; i < end; i++) {
+            if(frustumTestSphere(frustum, FVec3(centerX[i], centerY[i], centerZ[i]), radius[i])) {
+                out[written++] = uint32_t(i);
+            }
+        }
+
+        return written;
+    }
+
+    inline size_t frustumCullAabbs_range(
+        const Frustum &frustum,
+        const float *minX,
+        const float *minY,
+        const float *minZ,
+        const float *maxX,
+        const float *maxY,
+        const float *maxZ,
+        size_t begin,
+        size_t end,
+        uint32_t *out)
+    {
+        Frustum_SplatPlane planes[Frustum::PLANE_COUNT];
+        frustum_splatPlanes(frustum, planes);
+
+        // Which corner to test against each plane doesn't change
+        // from box to box, so pick the arrays up front.
+        const float *cornerX[Frustum::PLANE_COUNT];
+        const float *cornerY[Frustum::PLANE_COUNT];
+        const float *cornerZ[Frustum::PLANE_COUNT];
+        for(unsigned int p = 0; p < Frustum::PLANE_COUNT; p++) {
+            cornerX[p] = frustum.planes[p].data[0] >= 0.0f ? maxX : minX;
+            cornerY[p] = frustum.planes[p].data[1] >= 0.0f ? maxY : minY;
+            cornerZ[p] = frustum.planes[p].data[2] >= 0.0f ? maxZ : minZ;
+        }
+
+        const SimdFloat4 zero = SimdFloat4::zero();
+
+        size_t written = 0;
+        size_t i = begin;
+        for(; i + 4 <= end; i += 4) {
+
+            int outsideMask = 0;
+            for(unsigned int p = 0; p < Frustum::PLANE_COUNT; p++) {
+                SimdFloat4 distance = frustum_planeDistance(
+                    planes[p],
+                    SimdFloat4::load(cornerX[p] + i),
+                    SimdFloat4::load(cornerY[p] + i),
+                    SimdFloat4::load(cornerZ[p] + i));
+                outsideMask |= simdLessThanMask(distance, zero);
+            }
+
+            written += frustum_writeIndices(out + written, uint32_t(i), ~outsideMask);
+        }
+
+        for(; i < end; i++) {
+            if(frustumTestAabb(
+                    frustum,
+                    FVec3(minX[i], minY[i], minZ[i]),
+                    FVec3(maxX[i], maxY[i], maxZ[i])))
+            {
+                out[written++] = uint32_t(i);
+            }
+        }
+
+        return written;
+    }
+
+    // Run a range function over [0, count) in parallel. Each chunk
+    // writes into its own part of visibleIndices (starting at the
+    // chunk's first index, so there's always room), and then the
+    // pieces get slid down together in order.
+    template<typename RangeFuncType>
+    inline size_t frustum_cullParallel(
+        size_t count,
+        uint32_t *visibleIndices,
+        size_t threadCount,
+        const RangeFuncType &rangeFunc)
+    {
+        const size_t minimumChunkSize = 16384;
+        if(threadCount == 1 || count <= minimumChunkSize) {
+            return rangeFunc(0, count, visibleIndices);
+        }
+
+        size_t chunkSize = parallelGetChunkSize(count, threadCount, minimumChunkSize);
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+
+        std::vector<size_t> chunkVisibleCounts(chunkCount);
+        parallelForChunks(
+            count, chunkSize, threadCount,
+            [&](size_t begin, size_t end) {
+                chunkVisibleCounts[begin / chunkSize] = rangeFunc(begin, end, visibleIndices + begin);
+            });
+
+        size_t total = chunkVisibleCounts[0];
+        for(size_t chunk = 1; chunk < chunkCount; chunk++) {
+            memmove(
+                visibleIndices + total,
+                visibleIndices + chunk * chunkSize,
+                chunkVisibleCounts[chunk] * sizeof(uint32_t));
+            total += chunkVisibleCounts[chunk];
+        }
+        return total;
+    }
+
+    inline size_t frustumCullSpheres(
+        const Frustum &frustum,
+        const float *centerX,
+        const float *centerY,
+        const float *centerZ,
+        const float *radius,
+        size_t count,
+        uint32_t *visibleIndices,
+        size_t threadCount)
+    {
+        return frustum_cullParallel(
+            count, visibleIndices, threadCount,
+            [&](size_t begin, size_t end, uint32_t *out) {
+                return frustumCullSpheres_range(
+                    frustum, centerX, centerY, centerZ, radius,
+                    begin, end, out);
+            });
+    }
+
+    inline size_t frustumCullAabbs(
+        const Frustum &frustum,
+        const float *minX,
+        const float *minY,
+        const float *minZ,
+        const float *maxX,
+        const float *maxY,
+        const float *maxZ,
+        size_t count,
+        uint32_t *visibleIndices,
+        size_t threadCount)
+    {
+        return frustum_cullParallel(
+            count, visibleIndices, threadCount,
+            [&](size_t begin, size_t end, uint32_t *out) {
+                return frustumCullAabbs_range(
+                    frustum, minX, minY, minZ, maxX, maxY, maxZ,
+                    begin, end, out);
+            });
+    }
+}
@@ -138,6 +138,7 @@
 #include <mutex>
 #include <thread>
 #include <functional>
+#include <atomic>
 
 #include "../pixelimage/pixelimage.h"
 #include "../pixelimage/pixelimage_tga.h"
@@ -145,6 +146,7 @@
 #include "graphicalconsole_fontimage.h"
 
 #include "../filesystem.h"
+#include "../ringqueue.h"
 
 #endif // EXPOP_DOXYGEN_IGNORE
 
@@ -364,7 +366,10 @@ namespace ExPop
         PixelImage<uint8_t> *gradImg;
         PixelImage<uint8_t> *gradientsByColor[8*3];
         PixelImage<uint8_t> *backBuffer;
-        bool backBufferIsDirty;
+
+        // Set from any thread (addLine() doesn't hold
+        // lineRingBufferMutex), and cleared in updateBackbuffer().
+        std::atomic<bool> backBufferIsDirty;
         float bgAlpha;
         float visibility;
         uint32_t backbufferUpdateCount;
@@ -379,6 +384,17 @@ namespace ExPop
         Threads::Mutex lineRingBufferMutex;
       #endif
 
+        // Lines submitted with addLine() (already converted to the
+        // display codepage) that haven't made it into lineRingBuffer
+        // yet. Any thread can push here without taking
+        // lineRingBufferMutex. The lines get moved over in
+        // updateBackbuffer().
+        MPMCRingQueue<std::string> pendingLineQueue;
+
+        // Move everything out of pendingLineQueue into
+        // lineRingBuffer. lineRingBufferMutex must be locked.
+        void flushPendingLines();
+
         std::basic_string<uint32_t> editLineBuffer;
         int editLineCursorLocation;
         int viewOffset;
@@ -496,7 +512,8 @@ namespace ExPop
 
     inline GraphicalConsole::GraphicalConsole() :
         out(&streamBufOut),
-        streamBufOut(this)
+        streamBufOut(this),
+        pendingLineQueue(256)
     {
         backBufferIsDirty = true;
         lineRingBufferIndex = 0;
@@ -614,24 +631,46 @@ namespace ExPop
 
     inline void GraphicalConsole::addLine(const std::string &text)
     {
-      #if EXPOP_ENABLE_THREADS
-        lineRingBufferMutex.lock();
-      #endif
-
-        lineRingBuffer[lineRingBufferIndex] =
+        std::string displayLine =
             stringUTF32ToCodepage437(stringUTF8ToUTF32(text));
-        lineRingBufferIndex++;
-        lineRingBufferIndex %= lineRingBufferSize;
+
+        if(!pendingLineQueue.push(std::move(displayLine))) {
+
+            // Queue is full. Nobody has drawn in a while, so take the
+            // lock and move everything over ourselves. push() leaves
+            // displayLine alone when it fails.
+          #if EXPOP_ENABLE_THREADS
+            lineRingBufferMutex.lock();
+          #endif
+
+            flushPendingLines();
+
+            lineRingBuffer[lineRingBufferIndex] = std::move(displayLine);
+            lineRingBufferIndex++;
+            lineRingBufferIndex %= lineRingBufferSize;
+
+          #if EXPOP_ENABLE_THREADS
+            lineRingBufferMutex.unlock();
+          #endif
+        }
 
         if(writeCout) {
-            std::cout << text << "\e[0m" << std::endl;
+            // Single write so lines from different threads don't get
+            // interleaved now that we aren't holding a lock here.
+            std::cout << (text + "\e[0m\n") << std::flush;
         }
 
         backBufferIsDirty = true;
+    }
 
-      #if EXPOP_ENABLE_THREADS
-        lineRingBufferMutex.unlock();
-      #endif
+    inline void GraphicalConsole::flushPendingLines()
+    {
+        std::string line;
+        while(pendingLineQueue.pop(line)) {
+            lineRingBuffer[lineRingBufferIndex] = std::move(line);
+            lineRingBufferIndex++;
+            lineRingBufferIndex %= lineRingBufferSize;
+        }
     }
 
 
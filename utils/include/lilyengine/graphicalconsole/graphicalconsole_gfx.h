@@ -60,9 +60,11 @@ namespace ExPop
 
         for(int y = 0; y < blankSize; y++) {
 
+            PixelImageRowSpan<PixelValue<uint8_t>, 4> row = gradImg->getRowSpan<4>(y);
+
             for(int x = 0; x < blankSize; x++) {
 
-                PixelValue<uint8_t> *p = &gradImg->getData(x, y, 0);
+                PixelValue<uint8_t> *p = row.getPixel(x);
 
                 // Calculate alpha.
                 int grad_y = y - gradientSquish;
@@ -255,6 +257,13 @@ namespace ExPop
         lineRingBufferMutex.lock();
       #endif
 
+        // Clear this before taking the pending lines, so a line that
+        // shows up after the flush marks it dirty again instead of
+        // getting lost.
+        backBufferIsDirty = false;
+
+        flushPendingLines();
+
         // Make a transparent checkered backround.
         uint8_t bgcolor[4] = {0};
         bgcolor[2] = 0x20;
@@ -266,10 +275,13 @@ namespace ExPop
 
         const size_t checkerSpacing = 16;
         for(PixelImage_Coordinate y = 0; y < backBuffer->getHeight(); y++) {
+
+            PixelImageRowSpan<PixelValue<uint8_t>, 4> row = backBuffer->getRowSpan<4>(y);
+
             for(PixelImage_Coordinate x = 0; x < backBuffer->getWidth(); x++) {
 
                 bool b = ((y / checkerSpacing) + (x / checkerSpacing)) % 2;
-                PixelValue<uint8_t> *val = &backBuffer->getData(x, y, 0);
+                PixelValue<uint8_t> *val = row.getPixel(x);
 
                 if(b) {
                     val[0].value = bgcolor[0];
@@ -320,16 +332,28 @@ namespace ExPop
             std::string lineTextToPrint = lineText;
             if(int(lineText.size()) > rowLengthInCharacters) {
 
-                // FIXME: Not color-code aware!
-                // FIXME: This strips out a lot of spacing.
-                lineTextToPrint = ExPop::stringWordWrap(
+                // Wrap with everything after the first row indented.
+                // Lines are in codepage 437, so every byte is one
+                // column.
+                ExPop::StringWordWrapper<char> wrapper(
                     lineText,
-                    std::max(0, rowLengthInCharacters),
-                    std::max(0, rowLengthInCharacters - 4));
-
-                lineTextToPrint = ExPop::stringIndent(
-                    lineTextToPrint,
-                    0, 4);
+                    std::max(1, rowLengthInCharacters),
+                    std::max(1, rowLengthInCharacters - 4),
+                    false);
+
+                lineTextToPrint.clear();
+                ExPop::StringWrappedLine wrappedLine;
+                bool firstRow = true;
+                while(wrapper.next(wrappedLine)) {
+                    if(!firstRow) {
+                        lineTextToPrint.append("\n    ");
+                    }
+                    firstRow = false;
+                    lineTextToPrint.append(
+                        lineText,
+                        wrappedLine.begin,
+                        wrappedLine.end - wrappedLine.begin);
+                }
             }
 
             size_t newlineCount = 0;
@@ -453,8 +477,6 @@ namespace ExPop
                 -rowSquish, -characterSquish);
         }
 
-        backBufferIsDirty = false;
-
         backbufferUpdateCount++;
 
       #if EXPOP_ENABLE_THREADS
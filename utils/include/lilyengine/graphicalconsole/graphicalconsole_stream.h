@@ -69,17 +69,26 @@ namespace ExPop
         std::string &threadBuffer = singleThreadedBuffer;
       #endif
 
+        // Pull the finished line out so we don't have to hold
+        // buffersMutex while submitting it.
+        std::string finishedLine;
+        bool lineFinished = false;
+
         if(c != '\n') {
             threadBuffer.append(1, c);
         } else {
-            parent->addLine(threadBuffer);
-            threadBuffer.clear();
+            finishedLine.swap(threadBuffer);
+            lineFinished = true;
         }
 
       #if EXPOP_ENABLE_THREADS
         buffersMutex.unlock();
       #endif
 
+        if(lineFinished) {
+            parent->addLine(finishedLine);
+        }
+
         return c;
     }
 
@@ -40,6 +40,8 @@
 
 #include "../matrix.h"
 #include "../deflate/deflate_zlib.h"
+#include "../pixelimage/pixelimage_access.h"
+#include "../pixelimage/pixelimage_blit.h"
 
 // ----------------------------------------------------------------------
 // Declarations and documentation
@@ -97,8 +99,9 @@ namespace ExPop
             PixelImage<uint8_t> &img)
         {
             for(PixelImage_Coordinate y = 0; y < img.getHeight(); y++) {
+                PixelImageRowSpan<PixelValue<uint8_t>, 4> row = img.getRowSpan<4>(y);
                 for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
-                    PixelValue<uint8_t> *outp = &img.getData(x, y, 0);
+                    PixelValue<uint8_t> *outp = row.getPixel(x);
                     if(outp[0].value == 0) {
                         outp[3].value = 0;
                     }
@@ -115,67 +118,19 @@ namespace ExPop
             int h;
         };
 
-        // TODO: Maybe "expose" the blitting interface outside of the
-        // font system.
+        /// Opaque copy, clipped to the destination, with source
+        /// coordinates wrapping around.
         inline void imgBlit(
             const PixelImage<uint8_t> &src,
             const Gfx::Rectangle &srcRect,
             PixelImage<uint8_t> &dst,
             const Gfx::Rectangle &dstRect)
         {
-            Gfx::Rectangle realBounds = dstRect;
-
-            // Check if output is before the buffer on either axis.
-            if(realBounds.x + realBounds.w <= 0) {
-                return;
-            }
-            if(realBounds.y + realBounds.h <= 0) {
-                return;
-            }
-
-            // Check if output starts off the end on either axis.
-            if(realBounds.x >= int(dst.getWidth())) {
-                return;
-            }
-            if(realBounds.y >= int(dst.getHeight())) {
-                return;
-            }
-
-            // Clamp area if we're over the edge.
-            if(realBounds.x + realBounds.w > int(dst.getWidth())) {
-                realBounds.w = dst.getWidth() - realBounds.x;
-            }
-            if(realBounds.y + realBounds.h > int(dst.getHeight())) {
-                realBounds.h = dst.getHeight() - realBounds.y;
-            }
-
-            // Handle the case of starting off the edge.
-            int xStartOffset = 0;
-            if(dstRect.x < 0) {
-                xStartOffset = -dstRect.x;
-            }
-
-            int yStartOffset = 0;
-            if(dstRect.y < 0) {
-                yStartOffset = -dstRect.y;
-            }
-
-            for(int y = yStartOffset; y < realBounds.h; y++) {
-
-                for(int x = xStartOffset; x < realBounds.w; x++) {
-
-                    // Okay due to our bounds checking.
-                    PixelValue<uint8_t> *pd = &dst.getData(x + dstRect.x, y + dstRect.y, 0);
-
-                    // Okay only if we're sure about our backing texture image.
-                    const PixelValue<uint8_t> *ps = &src.getData(x + srcRect.x, y + srcRect.y, 0);
-
-                    pd[0] = ps[0];
-                    pd[1] = ps[1];
-                    pd[2] = ps[2];
-                    pd[3] = ps[3];
-                }
-            }
+            pixelImageBlit(
+                src, srcRect.x, srcRect.y,
+                dst, dstRect.x, dstRect.y,
+                dstRect.w, dstRect.h,
+                -1);
         }
 
         inline void imgBlitForText(
@@ -224,20 +179,37 @@ namespace ExPop
 
             for(int y = yStartOffset; y < realBounds.h; y++) {
 
+                // Okay due to our bounds checking.
+                PixelImageRowSpan<PixelValue<uint8_t>, 4> dstRow =
+                    dst.getRowSpan<4>(y + dstRect.y);
+
+                // Source and mask coordinates still wrap, like
+                // getData() would.
+                PixelImageRowSpan<const PixelValue<uint8_t>, 4> srcRow =
+                    src.getRowSpan<4>(pixelImageApplyEdgeMode(
+                            y + srcRect.y, src.getHeight(), PixelImage_EdgeMode_Wrap));
+
+                PixelImageRowSpan<const PixelValue<uint8_t>, 4> maskRow = { nullptr, 0, 4 };
+                if(mask) {
+                    maskRow = mask->getRowSpan<4>(pixelImageApplyEdgeMode(
+                            y + maskRect->y, mask->getHeight(), PixelImage_EdgeMode_Wrap));
+                }
+
                 for(int x = xStartOffset; x < realBounds.w; x++) {
 
-                    // Okay due to our bounds checking.
-                    PixelValue<uint8_t> *pd =
-                        &dst.getData(x + dstRect.x, y + dstRect.y, 0);
+                    PixelValue<uint8_t> *pd = dstRow.getPixel(x + dstRect.x);
 
                     // Okay only if we're sure about our backing
                     // texture image.
-                    const PixelValue<uint8_t> *ps =
-                        &src.getData(x + srcRect.x, y + srcRect.y, 0);
+                    const PixelValue<uint8_t> *ps = srcRow.getPixel(
+                        pixelImageApplyEdgeMode(
+                            x + srcRect.x, src.getWidth(), PixelImage_EdgeMode_Wrap));
 
                     // Okay only if we're sure about our font.
                     const PixelValue<uint8_t> *pm =
-                        mask ? &mask->getData(x + maskRect->x, y + maskRect->y, 0) : nullptr;
+                        mask ? maskRow.getPixel(
+                            pixelImageApplyEdgeMode(
+                                x + maskRect->x, mask->getWidth(), PixelImage_EdgeMode_Wrap)) : nullptr;
 
                     if(pm[3].value > 0)
                     {
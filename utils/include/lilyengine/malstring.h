@@ -49,6 +49,10 @@
 #include <sstream>
 #include <cstring>
 #include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+#include "simd.h"
 
 // ----------------------------------------------------------------------
 // Declarations and documentation
@@ -79,20 +83,142 @@ namespace ExPop
         const std::basic_string<T> &needle,
         const std::basic_string<T> &haystack);
 
+    /// Non-owning view of a run of characters in some other string,
+    /// for pulling pieces out of a string without copying them. (C++11
+    /// doesn't have std::string_view.) Whatever the view points into
+    /// has to outlive it.
+    class StringView
+    {
+    public:
+
+        static const size_t npos = size_t(-1);
+
+        /// Empty view.
+        inline StringView(void);
+
+        /// View of a nul-terminated string, not including the nul.
+        inline StringView(const char *str);
+
+        inline StringView(const char *str, size_t length);
+
+        inline StringView(const std::string &str);
+
+        inline const char *data(void) const;
+        inline size_t size(void) const;
+        inline bool empty(void) const;
+
+        inline char operator[](size_t index) const;
+
+        inline const char *begin(void) const;
+        inline const char *end(void) const;
+
+        /// View of part of this view. Gets clipped to the end, like
+        /// std::string::substr().
+        inline StringView substr(size_t pos, size_t count = npos) const;
+
+        /// Copy into a std::string.
+        inline std::string str(void) const;
+
+    private:
+
+        const char *chars;
+        size_t length;
+    };
+
+    inline bool operator==(const StringView &a, const StringView &b);
+    inline bool operator!=(const StringView &a, const StringView &b);
+    inline std::ostream &operator<<(std::ostream &out, const StringView &view);
+
+    /// Set of single-byte delimiter characters, stored as a 256-bit
+    /// table so checking a character is one lookup instead of a
+    /// strchr() each time.
+    class StringDelimiterSet
+    {
+    public:
+
+        inline StringDelimiterSet(const char *delims);
+        inline StringDelimiterSet(const StringView &delims);
+
+        inline bool contains(char c) const;
+
+        /// Position of the first delimiter in [pos, end) of str, or end
+        /// if there isn't one.
+        inline size_t findDelimiter(const char *str, size_t pos, size_t end) const;
+
+        /// Position of the first non-delimiter in [pos, end) of str,
+        /// or end if there isn't one.
+        inline size_t findNonDelimiter(const char *str, size_t pos, size_t end) const;
+
+    private:
+
+        inline void init(const StringView &delims);
+
+        uint32_t bits[8];
+
+        // With only one delimiter we can hand the search off to
+        // memchr(), which is vectorized on pretty much every libc.
+        // -1 otherwise.
+        int singleDelimiter;
+    };
+
+    /// Pull tokens out of a string one at a time, as views into the
+    /// original string, so nothing gets allocated. Splits up tokens
+    /// the same way stringTokenize() does.
+    class StringTokenizer
+    {
+    public:
+
+        inline StringTokenizer(
+            const StringView &str,
+            const StringDelimiterSet &delims,
+            bool allowEmpty = false);
+
+        /// Get the next token. Returns false when there aren't any
+        /// more.
+        inline bool next(StringView &token);
+
+    private:
+
+        StringView str;
+        StringDelimiterSet delims;
+        size_t pos;
+        bool allowEmpty;
+        bool afterDelimiter;
+    };
+
     /// Generate tokens from a string. Stores saved tokens into the
-    /// passed-in tokens parameter.
+    /// passed-in tokens parameter. With allowEmpty, every delimiter
+    /// after the first in a run of them adds an empty token.
     inline void stringTokenize(
         const std::string &str,
         const std::string &delims,
         std::vector<std::string> &tokens,
         bool allowEmpty = false);
 
+    /// stringTokenize(), but the tokens are views into str. Tokens
+    /// get added to the end of the vector, so clearing and reusing the
+    /// same one avoids allocating anything at all.
+    inline void stringTokenize(
+        const StringView &str,
+        const StringDelimiterSet &delims,
+        std::vector<StringView> &tokens,
+        bool allowEmpty = false);
+
     /// Escape a string.
     template<typename T>
     inline std::basic_string<T> stringEscape(
         const std::basic_string<T> &str,
         bool replaceNewlines = true);
 
+    /// stringEscape(), but appends to the end of out instead of
+    /// returning a new string. The output size is worked out before
+    /// anything gets written, so out grows at most once.
+    template<typename T>
+    inline void stringEscapeAppend(
+        const std::basic_string<T> &str,
+        std::basic_string<T> &out,
+        bool replaceNewlines = true);
+
     /// Unescape a string.
     template<typename T>
     inline std::basic_string<T> stringUnescape(
@@ -102,6 +228,10 @@ namespace ExPop
     /// them.
     inline std::string stringXmlEscape(const std::string &str);
 
+    /// stringXmlEscape(), appending to the end of out. Sized in one
+    /// pass before writing, like stringEscapeAppend().
+    inline void stringXmlEscapeAppend(const StringView &str, std::string &out);
+
     /// Not-really-compliant XML string unescape. Handles XML/HTML
     /// special entities. But only a few of them, and ASCII-range
     /// numerical special values.
@@ -110,6 +240,10 @@ namespace ExPop
     /// Encode a binary buffer as a string of hex values..
     inline void strEncodeHex(const void *buf, int length, std::string &str, int columns = 80);
 
+    /// strEncodeHex(), but appends to the end of str instead of
+    /// replacing its contents.
+    inline void strEncodeHexAppend(const void *buf, int length, std::string &str, int columns = 80);
+
     /// Decode a string of hex values. Ownership of the buffer given
     /// to the caller.
     inline char *strDecodeHex(const std::string &str, int *length);
@@ -123,6 +257,14 @@ namespace ExPop
         std::string &out2,
         bool startFromEnd = false);
 
+    /// stringSplit(), but the two halves are views into str.
+    inline void stringSplit(
+        const StringView &str,
+        const StringView &divider,
+        StringView &out1,
+        StringView &out2,
+        bool startFromEnd = false);
+
     /// Parse a URI in a probably not-standard way. Returns true on
     /// success.
     inline bool stringParseUri(
@@ -136,14 +278,62 @@ namespace ExPop
     // TODO: Switch all UTF-32 vectors from unsigned int type over to
     // uint32_t.
 
-    /// Convert a UTF-8 string to a UTF-32 string.
+    /// Convert a UTF-8 string to a UTF-32 string. Invalid UTF-8 still
+    /// gets converted, as well as it can be.
     inline std::basic_string<uint32_t> stringUTF8ToUTF32(
         const std::string &utf8Str);
 
-    /// Convert a UTF-32 string to a UTF-8 string.
+    /// Convert a UTF-32 string to a UTF-8 string. Surrogates and
+    /// values past U+10FFFF still get encoded, as well as they can
+    /// be.
     inline std::string stringUTF32ToUTF8(
         const std::basic_string<uint32_t> &utf32Str);
 
+    /// Check that a buffer is valid UTF-8: no stray or missing
+    /// continuation bytes, overlong encodings, surrogates, or code
+    /// points past U+10FFFF. If it isn't, errorPosition (when it's
+    /// not null) gets the byte offset of the first bad sequence.
+    inline bool stringValidateUTF8(
+        const char *str,
+        size_t length,
+        size_t *errorPosition = nullptr);
+
+    /// Count the code points in a UTF-8 buffer, which is also the
+    /// exact length it'll have as UTF-32. This only counts the bytes
+    /// that aren't continuation bytes, so it's meaningless for invalid
+    /// input.
+    inline size_t stringUTF8CountCodePoints(
+        const char *str,
+        size_t length);
+
+    /// Get the exact number of bytes a UTF-32 buffer takes up as
+    /// UTF-8. Returns false if there's a surrogate or a value past
+    /// U+10FFFF in there, with errorPosition (when it's not null) set
+    /// to the index of the first one.
+    inline bool stringUTF32MeasureUTF8(
+        const uint32_t *str,
+        size_t length,
+        size_t &utf8Length,
+        size_t *errorPosition = nullptr);
+
+    /// Convert UTF-8 to UTF-32, checking that the input is valid
+    /// first. Returns false, with errorPosition set like
+    /// stringValidateUTF8() does, if it isn't. out gets replaced
+    /// either way.
+    inline bool stringUTF8ToUTF32Checked(
+        const std::string &utf8Str,
+        std::basic_string<uint32_t> &out,
+        size_t *errorPosition = nullptr);
+
+    /// Convert UTF-32 to UTF-8, checking that the input is valid
+    /// first. Returns false, with errorPosition set like
+    /// stringUTF32MeasureUTF8() does, if it isn't. out gets replaced
+    /// either way.
+    inline bool stringUTF32ToUTF8Checked(
+        const std::basic_string<uint32_t> &utf32Str,
+        std::string &out,
+        size_t *errorPosition = nullptr);
+
     /// Crappy UTF32->437 converter. Kinda slow. This only exists
     /// because I wanted to use all the "extended ASCII" graphical
     /// characters in the graphical console system. Non-representable
@@ -164,12 +354,87 @@ namespace ExPop
     inline std::basic_string<T> stringTrim(const std::basic_string<T> &str);
 
     /// Returns a word-wrapped version of the input string, wrapped at
-    /// the number of characters in columns.
+    /// the number of characters in columns. All whitespace, including
+    /// newlines, gets collapsed into single spaces between words.
     inline std::string stringWordWrap(
         const std::string &str,
         unsigned int columns,
         unsigned int columnsAfterFirstLine = 0);
 
+    /// One line of word-wrapped text, as offsets into the original
+    /// string.
+    struct StringWrappedLine
+    {
+        /// First character of the line.
+        size_t begin;
+
+        /// One past the last character of the line. Whitespace the
+        /// line was broken at isn't included.
+        size_t end;
+
+        /// Number of columns the line takes up, not counting VT100
+        /// codes.
+        size_t width;
+    };
+
+    /// Finds word wrap points in a UTF-8 (char) or UTF-32 (uint32_t)
+    /// string one line at a time, without copying or allocating
+    /// anything, so a renderer can wrap text incrementally and keep
+    /// the results around. VT100 codes don't take up any columns.
+    /// Newlines always end a line. Whitespace at a wrap point is
+    /// dropped, but spacing inside a line is kept as-is. Words too
+    /// long for a line get a line to themselves.
+    template<typename T>
+    class StringWordWrapper
+    {
+    public:
+
+        /// columnsAfterFirstLine applies to every line after the
+        /// very first one, and 0 means the same as columns. columns
+        /// of 0 means no limit. With utf8 set to false, every char
+        /// counts as one column, for single-byte encodings like
+        /// codepage 437.
+        inline StringWordWrapper(
+            const T *text,
+            size_t length,
+            size_t columns,
+            size_t columnsAfterFirstLine = 0,
+            bool utf8 = true);
+
+        inline StringWordWrapper(
+            const std::basic_string<T> &text,
+            size_t columns,
+            size_t columnsAfterFirstLine = 0,
+            bool utf8 = true);
+
+        /// Get the next line. Returns false when there aren't any
+        /// more. An empty string has no lines. A trailing newline
+        /// adds an empty line at the end.
+        inline bool next(StringWrappedLine &line);
+
+    private:
+
+        const T *text;
+        size_t length;
+        size_t columns;
+        size_t columnsAfterFirstLine;
+        bool utf8;
+        size_t pos;
+        bool firstLine;
+        bool linePending;
+    };
+
+    /// Word wrap a whole string with StringWordWrapper. Lines get
+    /// added to the end of the vector, so reusing it avoids
+    /// allocation.
+    template<typename T>
+    inline void stringWordWrapLines(
+        const std::basic_string<T> &text,
+        size_t columns,
+        size_t columnsAfterFirstLine,
+        std::vector<StringWrappedLine> &lines,
+        bool utf8 = true);
+
     /// Indent a block of text.
     inline std::string stringIndent(
         const std::string &str,
@@ -199,6 +464,15 @@ namespace ExPop
         const std::basic_string<T> &replacement,
         const std::basic_string<T> &sourceText);
 
+    /// stringReplace(), appending the result to the end of
+    /// output. Matches are counted first so output only grows once.
+    template<typename T>
+    inline void stringReplaceAppend(
+        const std::basic_string<T> &stringToReplace,
+        const std::basic_string<T> &replacement,
+        const std::basic_string<T> &sourceText,
+        std::basic_string<T> &output);
+
     /// tolower(), now on full strings.
     template<typename T>
     inline std::basic_string<T> stringToLower(
@@ -210,6 +484,9 @@ namespace ExPop
     /// URL-Decode a string. (%20 becomes ' ', etc).
     inline std::string urlEncode(const std::string &data);
 
+    /// urlEncode(), appending to the end of out.
+    inline void urlEncodeAppend(const StringView &data, std::string &out);
+
     /// Read a quoted section of a string. Handles escape characters
     /// and escaped quotes. When calling this, in[ptr] should be on
     /// the first '"'. By the end of the function, in[ptr] will be the
@@ -270,49 +547,85 @@ namespace ExPop
         return true;
     }
 
-    template<typename T>
-    inline std::basic_string<T> stringEscape(
-        const std::basic_string<T> &str,
-        bool replaceNewlines)
+    // Escape letter for each ASCII character that stringEscape()
+    // replaces, or 0 for characters that pass through. One table
+    // without newlines escaped and one with.
+    struct StringEscapeTables
     {
-        std::basic_ostringstream<T> outStr;
-
-        for(size_t i = 0; i < str.size(); i++) {
-
-            switch(str[i]) {
+        char escapes[2][128];
+
+        StringEscapeTables()
+        {
+            memset(escapes, 0, sizeof(escapes));
+            for(size_t i = 0; i < 2; i++) {
+                escapes[i][uint8_t('"')] = '"';
+                escapes[i][uint8_t('\\')] = '\\';
+                escapes[i][uint8_t('\r')] = 'r';
+                escapes[i][uint8_t('\e')] = 'e';
+            }
+            escapes[1][uint8_t('\n')] = 'n';
+        }
+    };
 
-                case '"':
-                    outStr << '\\' << '\"';
-                    break;
+    inline const char *stringEscape_getTable(bool replaceNewlines)
+    {
+        static const StringEscapeTables tables;
+        return tables.escapes[replaceNewlines ? 1 : 0];
+    }
 
-                case '\\':
-                    outStr << '\\' << '\\';
-                    break;
+    template<typename T>
+    inline char stringEscape_lookup(const char *escapes, T c)
+    {
+        return (c >= 0 && c < 128) ? escapes[size_t(c)] : 0;
+    }
 
-                case '\n':
-                    if(replaceNewlines) {
-                        outStr << '\\' << 'n';
-                    } else {
-                        outStr << str[i];
-                    }
-                    break;
+    template<typename T>
+    inline void stringEscapeAppend(
+        const std::basic_string<T> &str,
+        std::basic_string<T> &out,
+        bool replaceNewlines)
+    {
+        const char *escapes = stringEscape_getTable(replaceNewlines);
+        const T *src = str.data();
+        const size_t srcLength = str.size();
+
+        // Every escaped character turns into two.
+        size_t outLength = srcLength;
+        for(size_t i = 0; i < srcLength; i++) {
+            outLength += stringEscape_lookup(escapes, src[i]) ? 1 : 0;
+        }
 
-                case '\r':
-                    outStr << '\\' << 'r';
-                    break;
+        const size_t outStart = out.size();
+        out.resize(outStart + outLength);
+        if(!outLength) {
+            return;
+        }
 
-                case '\e':
-                    outStr << '\\' << 'e';
-                    break;
+        T *dst = &out[outStart];
+        if(outLength == srcLength) {
+            std::copy(src, src + srcLength, dst);
+            return;
+        }
 
-                default:
-                    outStr << str[i];
-                    break;
+        for(size_t i = 0; i < srcLength; i++) {
+            const char escape = stringEscape_lookup(escapes, src[i]);
+            if(escape) {
+                *(dst++) = '\\';
+                *(dst++) = escape;
+            } else {
+                *(dst++) = src[i];
             }
-
         }
+    }
 
-        return outStr.str();
+    template<typename T>
+    inline std::basic_string<T> stringEscape(
+        const std::basic_string<T> &str,
+        bool replaceNewlines)
+    {
+        std::basic_string<T> out;
+        stringEscapeAppend(str, out, replaceNewlines);
+        return out;
     }
 
     template<typename T>
@@ -443,113 +756,350 @@ namespace ExPop
     }
 
     template<typename T>
-    inline std::basic_string<T> stringReplace(
+    inline void stringReplaceAppend(
         const std::basic_string<T> &stringToReplace,
         const std::basic_string<T> &replacement,
-        const std::basic_string<T> &sourceText)
+        const std::basic_string<T> &sourceText,
+        std::basic_string<T> &output)
     {
         assert(stringToReplace.size());
 
         // Early-out for obvious situations.
         if(stringToReplace.size() > sourceText.size()) {
-            return sourceText;
+            output.append(sourceText);
+            return;
+        }
+
+        // Count matches first so the output can be sized exactly.
+        // Matches don't overlap, same as scanning left to right and
+        // skipping past each one.
+        size_t matchCount = 0;
+        size_t pos = sourceText.find(stringToReplace);
+        while(pos != std::basic_string<T>::npos) {
+            matchCount++;
+            pos = sourceText.find(stringToReplace, pos + stringToReplace.size());
         }
 
+        if(!matchCount) {
+            output.append(sourceText);
+            return;
+        }
+
+        output.reserve(
+            output.size() + sourceText.size() +
+            matchCount * replacement.size() -
+            matchCount * stringToReplace.size());
+
+        size_t copyStart = 0;
+        pos = sourceText.find(stringToReplace);
+        while(pos != std::basic_string<T>::npos) {
+            output.append(sourceText, copyStart, pos - copyStart);
+            output.append(replacement);
+            copyStart = pos + stringToReplace.size();
+            pos = sourceText.find(stringToReplace, copyStart);
+        }
+        output.append(sourceText, copyStart, std::basic_string<T>::npos);
+    }
+
+    template<typename T>
+    inline std::basic_string<T> stringReplace(
+        const std::basic_string<T> &stringToReplace,
+        const std::basic_string<T> &replacement,
+        const std::basic_string<T> &sourceText)
+    {
         std::basic_string<T> output;
-        for(size_t i = 0; i < sourceText.size(); i++) {
+        stringReplaceAppend(stringToReplace, replacement, sourceText, output);
+        return output;
+    }
 
-            if(stringCompareOffset(stringToReplace, sourceText, i)) {
+    // ----------------------------------------------------------------------
+    // StringView
 
-                // Found the string to replace.
-                output = output + replacement;
-                i += stringToReplace.size() - 1;
+    inline StringView::StringView(void) :
+        chars(""),
+        length(0)
+    {
+    }
 
-            } else {
+    inline StringView::StringView(const char *str) :
+        chars(str),
+        length(strlen(str))
+    {
+    }
+
+    inline StringView::StringView(const char *str, size_t length) :
+        chars(str),
+        length(length)
+    {
+    }
+
+    inline StringView::StringView(const std::string &str) :
+        chars(str.data()),
+        length(str.size())
+    {
+    }
+
+    inline const char *StringView::data(void) const
+    {
+        return chars;
+    }
+
+    inline size_t StringView::size(void) const
+    {
+        return length;
+    }
+
+    inline bool StringView::empty(void) const
+    {
+        return !length;
+    }
+
+    inline char StringView::operator[](size_t index) const
+    {
+        assert(index < length);
+        return chars[index];
+    }
+
+    inline const char *StringView::begin(void) const
+    {
+        return chars;
+    }
+
+    inline const char *StringView::end(void) const
+    {
+        return chars + length;
+    }
+
+    inline StringView StringView::substr(size_t pos, size_t count) const
+    {
+        assert(pos <= length);
+        if(count > length - pos) {
+            count = length - pos;
+        }
+        return StringView(chars + pos, count);
+    }
 
-                // No replacement. Just append characters.
-                output = output + sourceText.substr(i, 1);
+    inline std::string StringView::str(void) const
+    {
+        return std::string(chars, length);
+    }
+
+    inline bool operator==(const StringView &a, const StringView &b)
+    {
+        return a.size() == b.size() && !memcmp(a.data(), b.data(), a.size());
+    }
+
+    inline bool operator!=(const StringView &a, const StringView &b)
+    {
+        return !(a == b);
+    }
 
+    inline std::ostream &operator<<(std::ostream &out, const StringView &view)
+    {
+        return out.write(view.data(), view.size());
+    }
+
+    // ----------------------------------------------------------------------
+    // StringDelimiterSet
+
+    inline StringDelimiterSet::StringDelimiterSet(const char *delims)
+    {
+        init(StringView(delims));
+    }
+
+    inline StringDelimiterSet::StringDelimiterSet(const StringView &delims)
+    {
+        init(delims);
+    }
+
+    inline void StringDelimiterSet::init(const StringView &delims)
+    {
+        memset(bits, 0, sizeof(bits));
+        for(size_t i = 0; i < delims.size(); i++) {
+            uint8_t c = uint8_t(delims[i]);
+            bits[c >> 5] |= uint32_t(1) << (c & 31);
+        }
+
+        // Repeats of the same character still count as one.
+        singleDelimiter = -1;
+        for(size_t i = 0; i < delims.size(); i++) {
+            if(i && delims[i] != delims[0]) {
+                singleDelimiter = -1;
+                break;
             }
+            singleDelimiter = uint8_t(delims[0]);
+        }
+    }
 
+    inline bool StringDelimiterSet::contains(char c) const
+    {
+        uint8_t index = uint8_t(c);
+        return (bits[index >> 5] >> (index & 31)) & 1;
+    }
+
+    inline size_t StringDelimiterSet::findDelimiter(const char *str, size_t pos, size_t end) const
+    {
+        if(singleDelimiter >= 0) {
+            const void *found = memchr(str + pos, singleDelimiter, end - pos);
+            return found ? size_t((const char*)found - str) : end;
         }
 
-        return output;
+        while(pos < end && !contains(str[pos])) {
+            pos++;
+        }
+        return pos;
     }
 
-    inline void stringTokenize(
-        const std::string &str, const std::string &delims,
-        std::vector<std::string> &tokens, bool allowEmpty)
+    inline size_t StringDelimiterSet::findNonDelimiter(const char *str, size_t pos, size_t end) const
     {
-        size_t i = 0;
-        while(i < str.size()) {
+        while(pos < end && contains(str[pos])) {
+            pos++;
+        }
+        return pos;
+    }
 
-            bool firstDelim = true;
+    // ----------------------------------------------------------------------
+    // StringTokenizer
+
+    inline StringTokenizer::StringTokenizer(
+        const StringView &str,
+        const StringDelimiterSet &delims,
+        bool allowEmpty) :
+        str(str),
+        delims(delims),
+        pos(0),
+        allowEmpty(allowEmpty),
+        afterDelimiter(false)
+    {
+    }
 
-            // Skip over delimeters.
-            while(i < str.size() && strchr(delims.c_str(), str[i])) {
-                i++;
+    inline bool StringTokenizer::next(StringView &token)
+    {
+        const char *chars = str.data();
+        size_t end = str.size();
+
+        while(pos < end) {
 
-                if(!firstDelim && allowEmpty) {
-                    tokens.push_back("");
+            if(delims.contains(chars[pos])) {
+
+                // Only the gaps between delimiters make empty tokens,
+                // not the one between the last token and the first
+                // delimiter.
+                pos++;
+                if(allowEmpty && afterDelimiter) {
+                    token = StringView(chars + pos, 0);
+                    return true;
                 }
+                afterDelimiter = true;
 
-                firstDelim = false;
+                if(!allowEmpty) {
+                    pos = delims.findNonDelimiter(chars, pos, end);
+                }
+                continue;
             }
 
-            // Mark the start of a token.
-            int tokStart = i;
+            size_t tokenStart = pos;
+            pos = delims.findDelimiter(chars, pos, end);
+            token = StringView(chars + tokenStart, pos - tokenStart);
+            afterDelimiter = false;
+            return true;
+        }
 
-            // Skip to the next delimeter.
-            while(i < str.size() && !strchr(delims.c_str(), str[i])) {
-                i++;
-            }
+        return false;
+    }
 
-            // Mark the end.
-            int tokEnd = i;
+    inline void stringTokenize(
+        const std::string &str, const std::string &delims,
+        std::vector<std::string> &tokens, bool allowEmpty)
+    {
+        StringTokenizer tokenizer(str, StringView(delims), allowEmpty);
+        StringView token;
+        while(tokenizer.next(token)) {
+            tokens.push_back(token.str());
+        }
+    }
 
-            // Copy the token.
-            if(tokStart != tokEnd) {
-                std::string token = str.substr(tokStart, (tokEnd - tokStart));
-                tokens.push_back(token);
-            }
+    inline void stringTokenize(
+        const StringView &str,
+        const StringDelimiterSet &delims,
+        std::vector<StringView> &tokens,
+        bool allowEmpty)
+    {
+        StringTokenizer tokenizer(str, delims, allowEmpty);
+        StringView token;
+        while(tokenizer.next(token)) {
+            tokens.push_back(token);
         }
     }
 
-    inline std::string stringXmlEscape(const std::string &str)
+    // Output length of each byte after stringXmlEscape(). 1 for
+    // everything that passes through unchanged.
+    struct StringXmlEscapeTable
     {
-        std::ostringstream outStr;
+        uint8_t lengths[256];
+
+        StringXmlEscapeTable()
+        {
+            memset(lengths, 1, sizeof(lengths));
+            lengths[uint8_t('"')] = 6;
+            lengths[uint8_t('<')] = 4;
+            lengths[uint8_t('>')] = 4;
+            lengths[uint8_t('&')] = 5;
+        }
+    };
 
-        for(size_t i = 0; i < str.size(); i++) {
+    inline void stringXmlEscapeAppend(const StringView &str, std::string &out)
+    {
+        static const StringXmlEscapeTable table;
 
-            // TODO: Add a case for completely bizarre Unicode
-            // stuff. (Inverse of #xNUMBER;)
+        const uint8_t *src = (const uint8_t*)str.data();
+        const size_t srcLength = str.size();
 
-            switch(str[i]) {
+        size_t outLength = 0;
+        for(size_t i = 0; i < srcLength; i++) {
+            outLength += table.lengths[src[i]];
+        }
 
-                case '"':
-                    outStr << "&quot;";
-                    break;
+        const size_t outStart = out.size();
+        out.resize(outStart + outLength);
+        if(!outLength) {
+            return;
+        }
 
-                case '<':
-                    outStr << "&lt;";
-                    break;
+        char *dst = &out[outStart];
+        if(outLength == srcLength) {
+            memcpy(dst, src, srcLength);
+            return;
+        }
 
-                case '>':
-                    outStr << "&gt;";
-                    break;
+        // TODO: Add a case for completely bizarre Unicode
+        // stuff. (Inverse of #xNUMBER;)
 
-                case '&':
-                    outStr << "&amp;";
-                    break;
+        for(size_t i = 0; i < srcLength; i++) {
+
+            const char *entity = nullptr;
 
+            switch(src[i]) {
+                case '"': entity = "&quot;"; break;
+                case '<': entity = "&lt;";   break;
+                case '>': entity = "&gt;";   break;
+                case '&': entity = "&amp;";  break;
                 default:
-                    outStr << str[i];
-                    break;
+                    *(dst++) = char(src[i]);
+                    continue;
             }
 
+            const size_t entityLength = table.lengths[src[i]];
+            memcpy(dst, entity, entityLength);
+            dst += entityLength;
         }
+    }
 
-        return outStr.str();
+    inline std::string stringXmlEscape(const std::string &str)
+    {
+        std::string out;
+        stringXmlEscapeAppend(str, out);
+        return out;
     }
 
     inline std::string stringXmlUnescape(const std::string &str)
@@ -665,28 +1215,40 @@ namespace ExPop
 
     }
 
-    inline void strEncodeHex(const void *buf, int length, std::string &str, int columns)
+    inline void strEncodeHexAppend(const void *buf, int length, std::string &str, int columns)
     {
-        str.resize((length * 2) + ((length * 2) / columns), 0);
-
-        int strPos = 0;
-        int lineCounter = 0;
-        const char *cbuf = (const char *)buf;
-
-        for(int i = 0; i < length; i++) {
-            str[strPos++] = stringNibbleToHex((cbuf[i] & 0xf0) >> 4);
-            str[strPos++] = stringNibbleToHex((cbuf[i] & 0x0f));
-
-            lineCounter += 2;
+        if(length <= 0) {
+            return;
+        }
 
-            if(lineCounter > columns) {
-                str[strPos++] = '\n';
+        // A newline goes after every byte that takes the line past
+        // the column limit.
+        const size_t bytesPerLine = columns > 0 ? size_t(columns / 2) + 1 : 1;
+        const size_t byteCount = size_t(length);
+        const size_t outLength = byteCount * 2 + byteCount / bytesPerLine;
+
+        const size_t outStart = str.size();
+        str.resize(outStart + outLength);
+
+        static const char hexTable[] = "0123456789abcdef";
+        const uint8_t *src = (const uint8_t*)buf;
+        char *dst = &str[outStart];
+
+        size_t lineCounter = 0;
+        for(size_t i = 0; i < byteCount; i++) {
+            *(dst++) = hexTable[src[i] >> 4];
+            *(dst++) = hexTable[src[i] & 0xf];
+            if(++lineCounter == bytesPerLine) {
+                *(dst++) = '\n';
                 lineCounter = 0;
             }
         }
+    }
 
-        str.resize(strPos);
-
+    inline void strEncodeHex(const void *buf, int length, std::string &str, int columns)
+    {
+        str.clear();
+        strEncodeHexAppend(buf, length, str, columns);
     }
 
     inline char *strDecodeHex(const std::string &str, int *length)
@@ -801,6 +1363,44 @@ namespace ExPop
         }
     }
 
+    inline void stringSplit(
+        const StringView &str,
+        const StringView &divider,
+        StringView &out1,
+        StringView &out2,
+        bool startFromEnd)
+    {
+        out1 = out2 = StringView();
+
+        if(!divider.size()) {
+            out1 = str;
+            return;
+        }
+
+        if(divider.size() <= str.size()) {
+
+            size_t lastStart = str.size() - divider.size();
+            for(size_t n = 0; n <= lastStart; n++) {
+
+                size_t i = startFromEnd ? lastStart - n : n;
+                if(str.data()[i] == divider.data()[0] &&
+                    !memcmp(str.data() + i, divider.data(), divider.size()))
+                {
+                    out1 = str.substr(0, i);
+                    out2 = str.substr(i + divider.size());
+                    return;
+                }
+            }
+        }
+
+        // Made it to the end of the string without finding anything.
+        if(startFromEnd) {
+            out2 = str;
+        } else {
+            out1 = str;
+        }
+    }
+
     inline bool stringParseUri(
         const std::string &input,
         std::string &outScheme,
@@ -881,8 +1481,11 @@ namespace ExPop
     const uint8_t EXPOP_b01000000 = 64;
     const uint8_t EXPOP_b00111111 = 63;
 
+    // The original decoder, which never gives up. Only used for
+    // input that isn't valid UTF-8 now.
+    //
     // TODO: Handle byte order marker.
-    inline std::basic_string<uint32_t> stringUTF8ToUTF32(
+    inline std::basic_string<uint32_t> stringUTF8ToUTF32_lenient(
         const std::string &utf8Str) {
 
         std::basic_string<uint32_t> utf32Out;
@@ -968,7 +1571,9 @@ namespace ExPop
     //     return str.str();
     // }
 
-    inline std::string stringUTF32ToUTF8(
+    // The original encoder. Only used for surrogates and values past
+    // U+10FFFF now. (Past U+FFFF, this comes out wrong anyway.)
+    inline std::string stringUTF32ToUTF8_lenient(
         const std::basic_string<uint32_t> &utf32Str)
     {
         std::ostringstream outStr;
@@ -1055,6 +1660,361 @@ namespace ExPop
         return outStr.str();
     }
 
+    // ----------------------------------------------------------------------
+    // Validated UTF-8 <-> UTF-32
+
+    // The SIMD parts only speed up runs of plain ASCII, sixteen
+    // characters at a time. Everything else goes through the scalar
+    // code one character at a time, so the results don't depend on
+    // which one got used.
+
+    // True if the sixteen bytes at p are all ASCII.
+    inline bool stringUTF8_isAscii16(const uint8_t *p)
+    {
+      #if EXPOP_SIMD_SSE2
+        return !_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+      #elif EXPOP_SIMD_NEON
+        uint64x2_t v = vreinterpretq_u64_u8(vld1q_u8(p));
+        return !((vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1)) & 0x8080808080808080ull);
+      #else
+        uint64_t a, b;
+        memcpy(&a, p, 8);
+        memcpy(&b, p + 8, 8);
+        return !((a | b) & 0x8080808080808080ull);
+      #endif
+    }
+
+    // Zero-extend sixteen bytes into sixteen 32-bit values.
+    inline void stringUTF8_widen16(const uint8_t *p, uint32_t *out)
+    {
+      #if EXPOP_SIMD_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i low = _mm_unpacklo_epi8(v, zero);
+        __m128i high = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(high, zero));
+      #elif EXPOP_SIMD_NEON
+        uint8x16_t v = vld1q_u8(p);
+        uint16x8_t low = vmovl_u8(vget_low_u8(v));
+        uint16x8_t high = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(out, vmovl_u16(vget_low_u16(low)));
+        vst1q_u32(out + 4, vmovl_u16(vget_high_u16(low)));
+        vst1q_u32(out + 8, vmovl_u16(vget_low_u16(high)));
+        vst1q_u32(out + 12, vmovl_u16(vget_high_u16(high)));
+      #else
+        for(int i = 0; i < 16; i++) out[i] = p[i];
+      #endif
+    }
+
+    // If the sixteen values at p are all ASCII, narrow them down to
+    // bytes and return true. Otherwise leave out alone.
+    inline bool stringUTF32_narrowAscii16(const uint32_t *p, uint8_t *out)
+    {
+      #if EXPOP_SIMD_SSE2
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + 4));
+        __m128i c = _mm_loadu_si128((const __m128i*)(p + 8));
+        __m128i d = _mm_loadu_si128((const __m128i*)(p + 12));
+        __m128i highBits = _mm_srli_epi32(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), 7);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(highBits, _mm_setzero_si128())) != 0xffff) {
+            return false;
+        }
+        _mm_storeu_si128(
+            (__m128i*)out,
+            _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+        return true;
+      #elif EXPOP_SIMD_NEON
+        uint32x4_t a = vld1q_u32(p);
+        uint32x4_t b = vld1q_u32(p + 4);
+        uint32x4_t c = vld1q_u32(p + 8);
+        uint32x4_t d = vld1q_u32(p + 12);
+        uint64x2_t highBits = vreinterpretq_u64_u32(
+            vshrq_n_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d)), 7));
+        if(vgetq_lane_u64(highBits, 0) | vgetq_lane_u64(highBits, 1)) {
+            return false;
+        }
+        uint8x8_t low = vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(b)));
+        uint8x8_t high = vmovn_u16(vcombine_u16(vmovn_u32(c), vmovn_u32(d)));
+        vst1q_u8(out, vcombine_u8(low, high));
+        return true;
+      #else
+        uint32_t highBits = 0;
+        for(int i = 0; i < 16; i++) highBits |= p[i];
+        if(highBits >> 7) {
+            return false;
+        }
+        for(int i = 0; i < 16; i++) out[i] = uint8_t(p[i]);
+        return true;
+      #endif
+    }
+
+    // Decode one UTF-8 sequence from p, with length bytes available.
+    // Returns its length, or 0 if it's invalid or cut off.
+    inline size_t stringUTF8_decodeOne(const uint8_t *p, size_t length, uint32_t &codePoint)
+    {
+        uint8_t first = p[0];
+
+        if(first < 0x80) {
+            codePoint = first;
+            return 1;
+        }
+
+        // Continuation bytes can't start a sequence, and 0xc0 and
+        // 0xc1 could only start overlong two-byte ones.
+        if(first < 0xc2) {
+            return 0;
+        }
+
+        size_t sequenceLength;
+        uint8_t secondMin = 0x80;
+        uint8_t secondMax = 0xbf;
+
+        if(first < 0xe0) {
+            sequenceLength = 2;
+            codePoint = first & 0x1f;
+        } else if(first < 0xf0) {
+            sequenceLength = 3;
+            codePoint = first & 0x0f;
+            if(first == 0xe0) secondMin = 0xa0; // Overlong.
+            if(first == 0xed) secondMax = 0x9f; // Surrogates.
+        } else if(first < 0xf5) {
+            sequenceLength = 4;
+            codePoint = first & 0x07;
+            if(first == 0xf0) secondMin = 0x90; // Overlong.
+            if(first == 0xf4) secondMax = 0x8f; // Past U+10FFFF.
+        } else {
+            return 0;
+        }
+
+        if(length < sequenceLength || p[1] < secondMin || p[1] > secondMax) {
+            return 0;
+        }
+
+        codePoint = (codePoint << 6) | (p[1] & 0x3f);
+        for(size_t i = 2; i < sequenceLength; i++) {
+            if((p[i] & 0xc0) != 0x80) {
+                return 0;
+            }
+            codePoint = (codePoint << 6) | (p[i] & 0x3f);
+        }
+
+        return sequenceLength;
+    }
+
+    inline bool stringValidateUTF8(
+        const char *str,
+        size_t length,
+        size_t *errorPosition)
+    {
+        const uint8_t *p = (const uint8_t*)str;
+        size_t i = 0;
+        while(i < length) {
+
+            // Only bother checking for a run of ASCII when we're
+            // already looking at an ASCII byte, so text with few of
+            // them doesn't pay for it.
+            if(p[i] < 0x80) {
+                i += (i + 16 <= length && stringUTF8_isAscii16(p + i)) ? 16 : 1;
+                continue;
+            }
+
+            uint32_t codePoint;
+            size_t sequenceLength = stringUTF8_decodeOne(p + i, length - i, codePoint);
+            if(!sequenceLength) {
+                if(errorPosition) {
+                    *errorPosition = i;
+                }
+                return false;
+            }
+            i += sequenceLength;
+        }
+        return true;
+    }
+
+    inline size_t stringUTF8CountCodePoints(
+        const char *str,
+        size_t length)
+    {
+        const uint8_t *p = (const uint8_t*)str;
+        size_t count = 0;
+        size_t i = 0;
+
+      #if EXPOP_SIMD_SSE2
+
+        // Anything above 0xbf as a signed byte isn't a continuation
+        // byte (0x80 to 0xbf).
+        const __m128i lastContinuation = _mm_set1_epi8(char(0xbf));
+        for(; i + 16 <= length; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+            uint32_t starts = _mm_movemask_epi8(_mm_cmpgt_epi8(v, lastContinuation));
+            starts = starts - ((starts >> 1) & 0x5555);
+            starts = (starts & 0x3333) + ((starts >> 2) & 0x3333);
+            starts = (starts + (starts >> 4)) & 0x0f0f;
+            count += (starts + (starts >> 8)) & 0x1f;
+        }
+
+      #elif EXPOP_SIMD_NEON
+
+        const int8x16_t lastContinuation = vdupq_n_s8(int8_t(0xbf));
+        for(; i + 16 <= length; i += 16) {
+            uint8x16_t starts = vshrq_n_u8(
+                vcgtq_s8(vreinterpretq_s8_u8(vld1q_u8(p + i)), lastContinuation), 7);
+            uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(starts)));
+            count += size_t(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+        }
+
+      #endif
+
+        for(; i < length; i++) {
+            count += (p[i] & 0xc0) != 0x80;
+        }
+
+        return count;
+    }
+
+    inline bool stringUTF32MeasureUTF8(
+        const uint32_t *str,
+        size_t length,
+        size_t &utf8Length,
+        size_t *errorPosition)
+    {
+        size_t total = 0;
+        for(size_t i = 0; i < length; i++) {
+
+            uint32_t c = str[i];
+            if(c > 0x10ffff || (c & 0xfffff800) == 0xd800) {
+                if(errorPosition) {
+                    *errorPosition = i;
+                }
+                return false;
+            }
+
+            total += 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+        }
+
+        utf8Length = total;
+        return true;
+    }
+
+    inline bool stringUTF8ToUTF32Checked(
+        const std::string &utf8Str,
+        std::basic_string<uint32_t> &out,
+        size_t *errorPosition)
+    {
+        const uint8_t *p = (const uint8_t*)utf8Str.data();
+        size_t length = utf8Str.size();
+
+        // Size it exactly up front, so there's one allocation at most.
+        out.resize(stringUTF8CountCodePoints(utf8Str.data(), length));
+        uint32_t *outPtr = &out[0];
+        uint32_t *outEnd = outPtr + out.size();
+
+        size_t i = 0;
+        while(i < length) {
+
+            if(p[i] < 0x80) {
+                if(i + 16 <= length && stringUTF8_isAscii16(p + i)) {
+                    stringUTF8_widen16(p + i, outPtr);
+                    outPtr += 16;
+                    i += 16;
+                } else {
+                    *(outPtr++) = p[i++];
+                }
+                continue;
+            }
+
+            uint32_t codePoint;
+            size_t sequenceLength = stringUTF8_decodeOne(p + i, length - i, codePoint);
+            if(!sequenceLength) {
+                if(errorPosition) {
+                    *errorPosition = i;
+                }
+                out.clear();
+                return false;
+            }
+
+            // Valid sequences have exactly one non-continuation byte
+            // each, so the count from before is always right here.
+            assert(outPtr < outEnd);
+            *(outPtr++) = codePoint;
+            i += sequenceLength;
+        }
+
+        assert(outPtr == outEnd);
+        (void)outEnd;
+        return true;
+    }
+
+    inline bool stringUTF32ToUTF8Checked(
+        const std::basic_string<uint32_t> &utf32Str,
+        std::string &out,
+        size_t *errorPosition)
+    {
+        const uint32_t *p = utf32Str.data();
+        size_t length = utf32Str.size();
+
+        size_t utf8Length = 0;
+        if(!stringUTF32MeasureUTF8(p, length, utf8Length, errorPosition)) {
+            out.clear();
+            return false;
+        }
+
+        out.resize(utf8Length);
+        uint8_t *outPtr = (uint8_t*)&out[0];
+
+        size_t i = 0;
+        while(i < length) {
+
+            if(p[i] < 0x80 && i + 16 <= length && stringUTF32_narrowAscii16(p + i, outPtr)) {
+                outPtr += 16;
+                i += 16;
+                continue;
+            }
+
+            uint32_t c = p[i++];
+            if(c < 0x80) {
+                *(outPtr++) = uint8_t(c);
+            } else if(c < 0x800) {
+                *(outPtr++) = uint8_t(0xc0 | (c >> 6));
+                *(outPtr++) = uint8_t(0x80 | (c & 0x3f));
+            } else if(c < 0x10000) {
+                *(outPtr++) = uint8_t(0xe0 | (c >> 12));
+                *(outPtr++) = uint8_t(0x80 | ((c >> 6) & 0x3f));
+                *(outPtr++) = uint8_t(0x80 | (c & 0x3f));
+            } else {
+                *(outPtr++) = uint8_t(0xf0 | (c >> 18));
+                *(outPtr++) = uint8_t(0x80 | ((c >> 12) & 0x3f));
+                *(outPtr++) = uint8_t(0x80 | ((c >> 6) & 0x3f));
+                *(outPtr++) = uint8_t(0x80 | (c & 0x3f));
+            }
+        }
+
+        return true;
+    }
+
+    inline std::basic_string<uint32_t> stringUTF8ToUTF32(
+        const std::string &utf8Str)
+    {
+        std::basic_string<uint32_t> out;
+        if(!stringUTF8ToUTF32Checked(utf8Str, out)) {
+            out = stringUTF8ToUTF32_lenient(utf8Str);
+        }
+        return out;
+    }
+
+    inline std::string stringUTF32ToUTF8(
+        const std::basic_string<uint32_t> &utf32Str)
+    {
+        std::string out;
+        if(!stringUTF32ToUTF8Checked(utf32Str, out)) {
+            out = stringUTF32ToUTF8_lenient(utf32Str);
+        }
+        return out;
+    }
+
     inline uint32_t *getCodepage437Table()
     {
         static uint32_t conversionTable[256] =
@@ -1232,34 +2192,202 @@ namespace ExPop
         return ret;
     }
 
-    // FIXME: Not UTF-8 compatible.
+    // Columns taken up by a single code unit. UTF-8 continuation
+    // bytes don't count.
+    inline size_t stringWordWrap_unitWidth(char c, bool utf8)
+    {
+        return (utf8 && (uint8_t(c) & 0xc0) == 0x80) ? 0 : 1;
+    }
+
+    template<typename T>
+    inline size_t stringWordWrap_unitWidth(T c, bool utf8)
+    {
+        return 1;
+    }
+
+    template<typename T>
+    inline bool stringWordWrap_isSpace(T c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    // Skip past a VT100 code starting at text[i], which must be
+    // '\e'. Eats the same characters stripVT100() does, except that
+    // it won't eat a newline.
+    template<typename T>
+    inline size_t stringWordWrap_skipVT100(const T *text, size_t length, size_t i)
+    {
+        // Skip '\e'.
+        i++;
+
+        if(i < length && text[i] == '[') {
+
+            // Skip '[' and the numbers and semicolons after it.
+            i++;
+            while(i < length && ((text[i] >= '0' && text[i] <= '9') || text[i] == ';')) {
+                i++;
+            }
+        }
+
+        // Skip the final character.
+        if(i < length && text[i] != '\n') {
+            i++;
+        }
+
+        return i;
+    }
+
+    // Find the end of the word starting at text[i] and add up how
+    // many columns it takes.
+    template<typename T>
+    inline size_t stringWordWrap_measureWord(
+        const T *text, size_t length, size_t i, bool utf8, size_t &width)
+    {
+        width = 0;
+        while(i < length && text[i] != '\n' && !stringWordWrap_isSpace(text[i])) {
+            if(text[i] == 0x1b) {
+                i = stringWordWrap_skipVT100(text, length, i);
+            } else {
+                width += stringWordWrap_unitWidth(text[i], utf8);
+                i++;
+            }
+        }
+        return i;
+    }
+
+    template<typename T>
+    inline StringWordWrapper<T>::StringWordWrapper(
+        const T *text,
+        size_t length,
+        size_t columns,
+        size_t columnsAfterFirstLine,
+        bool utf8) :
+        text(text),
+        length(length),
+        columns(columns),
+        columnsAfterFirstLine(columnsAfterFirstLine ? columnsAfterFirstLine : columns),
+        utf8(utf8),
+        pos(0),
+        firstLine(true),
+        linePending(length != 0)
+    {
+    }
+
+    template<typename T>
+    inline StringWordWrapper<T>::StringWordWrapper(
+        const std::basic_string<T> &text,
+        size_t columns,
+        size_t columnsAfterFirstLine,
+        bool utf8) :
+        StringWordWrapper(text.data(), text.size(), columns, columnsAfterFirstLine, utf8)
+    {
+    }
+
+    template<typename T>
+    inline bool StringWordWrapper<T>::next(StringWrappedLine &line)
+    {
+        if(!linePending) {
+            return false;
+        }
+
+        const size_t limit = firstLine ? columns : columnsAfterFirstLine;
+        firstLine = false;
+
+        line.begin = pos;
+        line.end = pos;
+        line.width = 0;
+        bool hasWord = false;
+
+        size_t i = pos;
+        while(true) {
+
+            // Whitespace between words.
+            size_t gapStart = i;
+            while(i < length && stringWordWrap_isSpace(text[i])) {
+                i++;
+            }
+            size_t gapWidth = i - gapStart;
+
+            if(i >= length) {
+                pos = length;
+                linePending = false;
+                break;
+            }
+
+            if(text[i] == '\n') {
+                pos = i + 1;
+                break;
+            }
+
+            size_t wordWidth = 0;
+            size_t wordEnd = stringWordWrap_measureWord(text, length, i, utf8, wordWidth);
+
+            // Wrap before this word if it doesn't fit, unless it's
+            // the only thing on the line. The next line starts at the
+            // word, dropping the whitespace before it.
+            if(hasWord && limit && line.width + gapWidth + wordWidth > limit) {
+                pos = i;
+                return true;
+            }
+
+            // Leading whitespace on the line stays.
+            line.width += gapWidth + wordWidth;
+            line.end = wordEnd;
+            hasWord = true;
+            i = wordEnd;
+        }
+
+        // Leading whitespace on a line with nothing else on it still
+        // counts, so blank-but-indented lines keep their width.
+        if(!hasWord) {
+            line.end = i;
+            line.width = line.end - line.begin;
+        }
+
+        return true;
+    }
+
+    template<typename T>
+    inline void stringWordWrapLines(
+        const std::basic_string<T> &text,
+        size_t columns,
+        size_t columnsAfterFirstLine,
+        std::vector<StringWrappedLine> &lines,
+        bool utf8)
+    {
+        StringWordWrapper<T> wrapper(text, columns, columnsAfterFirstLine, utf8);
+        StringWrappedLine line;
+        while(wrapper.next(line)) {
+            lines.push_back(line);
+        }
+    }
+
     inline std::string stringWordWrap(
         const std::string &str,
         unsigned int columns,
         unsigned int columnsAfterFirstLine)
     {
-        std::vector<std::string> lines;
-        std::vector<std::string> words;
-        std::ostringstream outStr;
+        std::string out;
+        out.reserve(str.size());
         unsigned int thisLineLength = 0;
         bool firstLine = true;
         bool firstWordOnLine = true;
 
         if(!columnsAfterFirstLine) columnsAfterFirstLine = columns;
 
-        stringTokenize(str, " \t\r\n", words, false);
-
-        for(unsigned int i = 0; i < words.size(); i++) {
+        StringTokenizer tokenizer(str, " \t\r\n");
+        StringView word;
+        while(tokenizer.next(word)) {
 
-            // Get the word with invisible control codes removed, so
-            // we know how many characters it really has.
-            std::string strippedWord = stripVT100(words[i]);
+            // Count the columns without the invisible control codes.
+            size_t wordWidth = 0;
+            stringWordWrap_measureWord(word.data(), word.size(), 0, true, wordWidth);
 
             // New line?
-            if(thisLineLength != 0 && strippedWord.size() +
+            if(thisLineLength != 0 && wordWidth +
                 thisLineLength >= (firstLine ? columns : columnsAfterFirstLine))
             {
-                outStr << std::endl;
+                out.append(1, '\n');
                 thisLineLength = 0;
                 firstLine = false;
                 firstWordOnLine = true;
@@ -1269,18 +2397,17 @@ namespace ExPop
             // of a line. Don't put the space before this word if it's
             // the first one on a line.
             if(!firstWordOnLine) {
-                outStr << " ";
+                out.append(1, ' ');
                 thisLineLength++;
             } else {
                 firstWordOnLine = false;
             }
 
-            // Add the word.
-            outStr << words[i];
-            thisLineLength += strippedWord.size();
+            out.append(word.data(), word.size());
+            thisLineLength += wordWidth;
         }
 
-        return outStr.str();
+        return out;
     }
 
     inline std::string stringIndent(
@@ -1288,66 +2415,61 @@ namespace ExPop
         unsigned int firstRow,
         unsigned int afterFirstRow)
     {
-        std::vector<std::string> lines;
-        std::ostringstream outStr;
+        std::string out;
+        out.reserve(str.size() + firstRow);
 
-        stringTokenize(str, "\n", lines);
+        StringTokenizer tokenizer(str, "\n");
+        StringView line;
+        bool firstLine = true;
 
-        for(size_t i = 0; i < lines.size(); i++) {
+        while(tokenizer.next(line)) {
 
             // Skip past whatever whitespace might have been here in
             // the first place.
-            unsigned int j = 0;
-            while(j < lines[i].size() && isWhiteSpace(lines[i][j])) {
+            size_t j = 0;
+            while(j < line.size() && isWhiteSpace(line[j])) {
                 j++;
             }
 
             // Output a newline if this isn't the first line. We do it
             // here so we don't end up with some extra newline at the
             // end.
-            if(i != 0) outStr << std::endl;
-
-            if(j < lines[i].size()) {
-
-                // FIXME: Generate strings for first line and after
-                // first line indentation, then use one or the other
-                // here.
-
-                // Output the desired indentation.
-                unsigned int dstLen = (i == 0) ? firstRow : afterFirstRow;
-                for(unsigned int k = 0; k < dstLen; k++) {
-                    outStr << " ";
-                }
-
-                outStr << lines[i].substr(j);
+            if(!firstLine) out.append(1, '\n');
 
+            if(j < line.size()) {
+                out.append(firstLine ? firstRow : afterFirstRow, ' ');
+                out.append(line.data() + j, line.size() - j);
             }
+
+            firstLine = false;
         }
 
-        return outStr.str();
+        return out;
     }
 
     inline std::string stringPrefixLines(
         const std::string &str,
         const std::string &prefix)
     {
-        std::ostringstream outStr;
-        std::vector<std::string> lines;
+        std::string out;
+        out.reserve(str.size() + prefix.size());
 
-        stringTokenize(str, "\n", lines, true);
-
-        for(unsigned int i = 0; i < lines.size(); i++) {
+        StringTokenizer tokenizer(str, "\n", true);
+        StringView line;
+        bool firstLine = true;
 
-            outStr << prefix << lines[i];
+        while(tokenizer.next(line)) {
 
-            // Add a newline if this isn't the last one. Avoids
+            // Newline before every line but the first. Avoids
             // trailing newline.
-            if(i != lines.size() - 1) {
-                outStr << std::endl;
-            }
+            if(!firstLine) out.append(1, '\n');
+
+            out.append(prefix);
+            out.append(line.data(), line.size());
+            firstLine = false;
         }
 
-        return outStr.str();
+        return out;
     }
 
     template<typename T>
@@ -1388,25 +2510,67 @@ namespace ExPop
         return ostr.str();
     }
 
-    inline std::string urlEncode(const std::string &data)
+    // Output length of each byte after urlEncode(). Unreserved
+    // characters stay as they are, and everything else becomes %XX.
+    struct StringUrlEncodeTable
     {
-        const char *hexTable = "0123456789ABCDEF";
-        std::ostringstream ostr;
-        for(size_t i = 0; i < data.size(); i++) {
+        uint8_t lengths[256];
+
+        StringUrlEncodeTable()
+        {
+            for(size_t i = 0; i < 256; i++) {
+                const bool unreserved =
+                    i == '-' || i == '.' || i == '_' ||
+                    (i >= 'A' && i <= 'Z') ||
+                    (i >= 'a' && i <= 'z') ||
+                    (i >= '0' && i <= '9');
+                lengths[i] = unreserved ? 1 : 3;
+            }
+        }
+    };
 
-            if(data[i] == '-' || data[i] == '.' || data[i] == '_' ||
-                (data[i] >= 'A' && data[i] <= 'Z') ||
-                (data[i] >= 'a' && data[i] <= 'z') ||
-                (data[i] >= '0' && data[i] <= '9'))
-            {
-                ostr << data[i];
+    inline void urlEncodeAppend(const StringView &data, std::string &out)
+    {
+        static const StringUrlEncodeTable table;
+        static const char hexTable[] = "0123456789ABCDEF";
+
+        const uint8_t *src = (const uint8_t*)data.data();
+        const size_t srcLength = data.size();
+
+        size_t outLength = 0;
+        for(size_t i = 0; i < srcLength; i++) {
+            outLength += table.lengths[src[i]];
+        }
+
+        const size_t outStart = out.size();
+        out.resize(outStart + outLength);
+        if(!outLength) {
+            return;
+        }
+
+        char *dst = &out[outStart];
+        if(outLength == srcLength) {
+            memcpy(dst, src, srcLength);
+            return;
+        }
+
+        for(size_t i = 0; i < srcLength; i++) {
+            const uint8_t c = src[i];
+            if(table.lengths[c] == 1) {
+                *(dst++) = char(c);
             } else {
-                ostr << "%" << hexTable[uint8_t(data[i]) >> 4] << hexTable[uint8_t(data[i]) & 0xf];
+                *(dst++) = '%';
+                *(dst++) = hexTable[c >> 4];
+                *(dst++) = hexTable[c & 0xf];
             }
-
         }
+    }
 
-        return ostr.str();
+    inline std::string urlEncode(const std::string &data)
+    {
+        std::string out;
+        urlEncodeAppend(data, out);
+        return out;
     }
 
     inline std::string readQuotedString(const std::string &in, size_t &ptr)
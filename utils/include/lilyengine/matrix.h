@@ -55,6 +55,8 @@
 
 #define EXPOP_MATRIX_ASSERT_STATIC(x) static_assert(x, "Bad matrix operation")
 
+#include "simd.h"
+
 #include <cmath>
 #include <iomanip>
 #include <iostream>
@@ -165,10 +167,35 @@ namespace ExPop
         inline void swapRows(unsigned int rowNum1, unsigned int rowNum2);
 
         /// Invert a Matrix. Matrix must have the same number of rows
-        /// and columns. If the Matrix is not invertible, it resorts
-        /// to ugly hacks to prevent dividing by zero.
+        /// and columns. 2x2, 3x3 and 4x4 matrices use closed-form
+        /// (adjugate over determinant) inverses, and anything bigger
+        /// uses Gauss-Jordan elimination. If the Matrix is singular,
+        /// this returns all zeros. Use tryInverse() to find out when
+        /// that happens.
         inline MyType inverse() const;
 
+        /// Invert a Matrix into out. Returns false, and sets out to
+        /// all zeros, if the Matrix is singular.
+        inline bool tryInverse(MyType &out) const;
+
+        /// Invert an affine transform, where the last row is 0, ...,
+        /// 0, 1. Only the smaller linear part (rotation, scale,
+        /// shear) gets a full inverse, and the translation is just
+        /// run backwards through it. Returns all zeros if the linear
+        /// part is singular.
+        inline MyType inverseAffine() const;
+
+        /// inverseAffine(), reporting singular matrices the same way
+        /// tryInverse() does.
+        inline bool tryInverseAffine(MyType &out) const;
+
+        /// Invert a rigid transform (rotation and translation only)
+        /// by transposing the rotation and rotating the negated
+        /// translation. Gives wrong results for anything with scale
+        /// or shear in it, so only use this when you know the
+        /// transform is rigid.
+        inline MyType inverseRigid() const;
+
         // ----------------------------------------------------------------------
         // Now some math operations...
         // ----------------------------------------------------------------------
@@ -546,52 +573,53 @@ namespace ExPop
         }
     }
 
-    // inverse
-    template<typename MatScalar, unsigned int ROWS, unsigned int COLS>
-    inline Matrix<MatScalar, ROWS, COLS> Matrix<MatScalar, ROWS, COLS>::inverse() const
-    {
-        EXPOP_MATRIX_ASSERT_STATIC(ROWS == COLS);
-
-        MyType out;
+    // Inverse helpers. matrixInverse_compute has an overload for each
+    // size with a closed-form inverse, and falls back to Gauss-Jordan
+    // for the rest. They all return false and fill out with zeros for
+    // singular matrices.
 
+    template<typename MatScalar, unsigned int SIZE>
+    inline bool matrixInverse_gaussJordan(
+        const Matrix<MatScalar, SIZE, SIZE> &in,
+        Matrix<MatScalar, SIZE, SIZE> &out)
+    {
         // Make a new matrix that's twice the number of columns so
         // we can do the work inside it.
-        Matrix<MatScalar, ROWS, COLS * 2> workMatrix(data, ROWS, COLS);
+        Matrix<MatScalar, SIZE, SIZE * 2> workMatrix(in.data, SIZE, SIZE);
 
         // Initialize the right side of this thing to an identity
         // matrix.
-        for(unsigned int row = 0; row < ROWS; row++) {
-            for(unsigned int col = 0; col < COLS; col++) {
-                workMatrix(row, col + COLS) = (row == col);
+        for(unsigned int row = 0; row < SIZE; row++) {
+            for(unsigned int col = 0; col < SIZE; col++) {
+                workMatrix(row, col + SIZE) = (row == col);
             }
         }
 
-        for(unsigned int workRow = 0; workRow < ROWS; workRow++) {
+        for(unsigned int workRow = 0; workRow < SIZE; workRow++) {
 
-            // Find a row without a zero for this slot and swap
-            // this row with it.
+            // Use whichever remaining row has the biggest value in
+            // this column, to keep the error down.
             unsigned int swapRow = workRow;
-            while(swapRow < ROWS && workMatrix(swapRow, workRow) == 0) {
-                swapRow++;
+            MatScalar biggest = 0;
+            for(unsigned int row = workRow; row < SIZE; row++) {
+                MatScalar v = workMatrix(row, workRow);
+                if(v < 0) v = -v;
+                if(v > biggest) {
+                    biggest = v;
+                    swapRow = row;
+                }
             }
 
-            if(swapRow == ROWS) {
-
-                // Didn't find the row we need. Just use the row
-                // we started with and jam in some values to work
-                // around this. (UGLY HACK ALERT!)
-                swapRow = workRow;
-                workMatrix(workRow, workRow) = 0.00000001;
-
-            } else if(swapRow != workRow) {
+            if(biggest == 0) {
+                out = Matrix<MatScalar, SIZE, SIZE>(MatScalar(0));
+                return false;
+            }
 
-                // We did find a suitable row, but it's not the
-                // one we're working on.
+            if(swapRow != workRow) {
                 workMatrix.swapRows(swapRow, workRow);
-
             }
 
-            float val = workMatrix(workRow, workRow);
+            MatScalar val = workMatrix(workRow, workRow);
 
             // Divide this whole row by the value in workRow,
             // workRow so we have a 1 in the diagonal slot.
@@ -600,7 +628,7 @@ namespace ExPop
             // Now subtract this row from all other rows, scaled
             // to an appropriate value to eliminate the value from
             // this column.
-            for(unsigned int subRow = 0; subRow < ROWS; subRow++) {
+            for(unsigned int subRow = 0; subRow < SIZE; subRow++) {
                 if(subRow != workRow) {
                     workMatrix.subtractRow(subRow, workRow, workMatrix(subRow, workRow));
                 }
@@ -610,12 +638,249 @@ namespace ExPop
 
         // Now take all the values from the right side of
         // workMatrix and stick them into their own Matrix.
-        for(unsigned int row = 0; row < ROWS; row++) {
-            for(unsigned int col = 0; col < COLS; col++) {
-                out(row, col) = workMatrix(row, col + COLS);
+        for(unsigned int row = 0; row < SIZE; row++) {
+            for(unsigned int col = 0; col < SIZE; col++) {
+                out(row, col) = workMatrix(row, col + SIZE);
+            }
+        }
+
+        return true;
+    }
+
+    template<typename MatScalar, unsigned int SIZE>
+    inline bool matrixInverse_compute(
+        const Matrix<MatScalar, SIZE, SIZE> &in,
+        Matrix<MatScalar, SIZE, SIZE> &out)
+    {
+        return matrixInverse_gaussJordan(in, out);
+    }
+
+    template<typename MatScalar>
+    inline bool matrixInverse_compute(
+        const Matrix<MatScalar, 2, 2> &in,
+        Matrix<MatScalar, 2, 2> &out)
+    {
+        const MatScalar *m = in.data;
+        MatScalar det = m[0] * m[3] - m[2] * m[1];
+        if(det == 0) {
+            out = Matrix<MatScalar, 2, 2>(MatScalar(0));
+            return false;
+        }
+
+        MatScalar invDet = MatScalar(1) / det;
+        out.data[0] =  m[3] * invDet;
+        out.data[1] = -m[1] * invDet;
+        out.data[2] = -m[2] * invDet;
+        out.data[3] =  m[0] * invDet;
+        return true;
+    }
+
+    template<typename MatScalar>
+    inline bool matrixInverse_compute(
+        const Matrix<MatScalar, 3, 3> &in,
+        Matrix<MatScalar, 3, 3> &out)
+    {
+        // Column-major, so m[row + col * 3].
+        const MatScalar *m = in.data;
+
+        // Cofactors of the first row, which also give the
+        // determinant.
+        MatScalar c00 = m[4] * m[8] - m[7] * m[5];
+        MatScalar c01 = m[7] * m[2] - m[1] * m[8];
+        MatScalar c02 = m[1] * m[5] - m[4] * m[2];
+
+        MatScalar det = m[0] * c00 + m[3] * c01 + m[6] * c02;
+        if(det == 0) {
+            out = Matrix<MatScalar, 3, 3>(MatScalar(0));
+            return false;
+        }
+
+        MatScalar invDet = MatScalar(1) / det;
+
+        // The inverse is the transposed cofactor matrix over the
+        // determinant, so cofactors for row N of the input go into
+        // column N of the output.
+        out.data[0] = c00 * invDet;
+        out.data[1] = c01 * invDet;
+        out.data[2] = c02 * invDet;
+        out.data[3] = (m[6] * m[5] - m[3] * m[8]) * invDet;
+        out.data[4] = (m[0] * m[8] - m[6] * m[2]) * invDet;
+        out.data[5] = (m[3] * m[2] - m[0] * m[5]) * invDet;
+        out.data[6] = (m[3] * m[7] - m[6] * m[4]) * invDet;
+        out.data[7] = (m[6] * m[1] - m[0] * m[7]) * invDet;
+        out.data[8] = (m[0] * m[4] - m[3] * m[1]) * invDet;
+        return true;
+    }
+
+    template<typename MatScalar>
+    inline bool matrixInverse_compute(
+        const Matrix<MatScalar, 4, 4> &in,
+        Matrix<MatScalar, 4, 4> &out)
+    {
+        // aRC is row R, column C.
+        const MatScalar *m = in.data;
+        const MatScalar
+            a00 = m[0], a10 = m[1], a20 = m[2],  a30 = m[3],
+            a01 = m[4], a11 = m[5], a21 = m[6],  a31 = m[7],
+            a02 = m[8], a12 = m[9], a22 = m[10], a32 = m[11],
+            a03 = m[12], a13 = m[13], a23 = m[14], a33 = m[15];
+
+        // 2x2 determinants from the top two rows and the bottom two
+        // rows. Every 3x3 cofactor is a combination of these.
+        MatScalar s0 = a00 * a11 - a10 * a01;
+        MatScalar s1 = a00 * a12 - a10 * a02;
+        MatScalar s2 = a00 * a13 - a10 * a03;
+        MatScalar s3 = a01 * a12 - a11 * a02;
+        MatScalar s4 = a01 * a13 - a11 * a03;
+        MatScalar s5 = a02 * a13 - a12 * a03;
+
+        MatScalar c5 = a22 * a33 - a32 * a23;
+        MatScalar c4 = a21 * a33 - a31 * a23;
+        MatScalar c3 = a21 * a32 - a31 * a22;
+        MatScalar c2 = a20 * a33 - a30 * a23;
+        MatScalar c1 = a20 * a32 - a30 * a22;
+        MatScalar c0 = a20 * a31 - a30 * a21;
+
+        MatScalar det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+        if(det == 0) {
+            out = Matrix<MatScalar, 4, 4>(MatScalar(0));
+            return false;
+        }
+
+        MatScalar invDet = MatScalar(1) / det;
+        MatScalar *o = out.data;
+
+        o[0]  = ( a11 * c5 - a12 * c4 + a13 * c3) * invDet;
+        o[4]  = (-a01 * c5 + a02 * c4 - a03 * c3) * invDet;
+        o[8]  = ( a31 * s5 - a32 * s4 + a33 * s3) * invDet;
+        o[12] = (-a21 * s5 + a22 * s4 - a23 * s3) * invDet;
+
+        o[1]  = (-a10 * c5 + a12 * c2 - a13 * c1) * invDet;
+        o[5]  = ( a00 * c5 - a02 * c2 + a03 * c1) * invDet;
+        o[9]  = (-a30 * s5 + a32 * s2 - a33 * s1) * invDet;
+        o[13] = ( a20 * s5 - a22 * s2 + a23 * s1) * invDet;
+
+        o[2]  = ( a10 * c4 - a11 * c2 + a13 * c0) * invDet;
+        o[6]  = (-a00 * c4 + a01 * c2 - a03 * c0) * invDet;
+        o[10] = ( a30 * s4 - a31 * s2 + a33 * s0) * invDet;
+        o[14] = (-a20 * s4 + a21 * s2 - a23 * s0) * invDet;
+
+        o[3]  = (-a10 * c3 + a11 * c1 - a12 * c0) * invDet;
+        o[7]  = ( a00 * c3 - a01 * c1 + a02 * c0) * invDet;
+        o[11] = (-a30 * s3 + a31 * s1 - a32 * s0) * invDet;
+        o[15] = ( a20 * s3 - a21 * s1 + a22 * s0) * invDet;
+
+        return true;
+    }
+
+    // SimdFloat4 version, defined with the other float
+    // specialisations further down.
+    inline bool matrixInverse_compute(
+        const Matrix<float, 4, 4> &in,
+        Matrix<float, 4, 4> &out);
+
+    // tryInverse
+    template<typename MatScalar, unsigned int ROWS, unsigned int COLS>
+    inline bool Matrix<MatScalar, ROWS, COLS>::tryInverse(MyType &out) const
+    {
+        EXPOP_MATRIX_ASSERT_STATIC(ROWS == COLS);
+        return matrixInverse_compute(*this, out);
+    }
+
+    // inverse
+    template<typename MatScalar, unsigned int ROWS, unsigned int COLS>
+    inline Matrix<MatScalar, ROWS, COLS> Matrix<MatScalar, ROWS, COLS>::inverse() const
+    {
+        MyType out;
+        tryInverse(out);
+        return out;
+    }
+
+    // tryInverseAffine
+    template<typename MatScalar, unsigned int ROWS, unsigned int COLS>
+    inline bool Matrix<MatScalar, ROWS, COLS>::tryInverseAffine(MyType &out) const
+    {
+        EXPOP_MATRIX_ASSERT_STATIC(ROWS == COLS && ROWS > 1);
+        for(unsigned int col = 0; col < COLS; col++) {
+            EXPOP_MATRIX_ASSERT(getConst(ROWS - 1, col) == MatScalar(col == COLS - 1));
+        }
+
+        const unsigned int last = ROWS - 1;
+
+        // Cutting off the last row and column leaves the linear
+        // part.
+        Matrix<MatScalar, ROWS - 1, COLS - 1> linear;
+        for(unsigned int col = 0; col < last; col++) {
+            for(unsigned int row = 0; row < last; row++) {
+                linear.data[row + col * last] = data[row + col * ROWS];
+            }
+        }
+
+        Matrix<MatScalar, ROWS - 1, COLS - 1> linearInverse;
+        if(!linear.tryInverse(linearInverse)) {
+            out = MyType(MatScalar(0));
+            return false;
+        }
+
+        // Translation becomes -(linearInverse * translation).
+        for(unsigned int col = 0; col < last; col++) {
+            for(unsigned int row = 0; row < last; row++) {
+                out.data[row + col * ROWS] = linearInverse.data[row + col * last];
             }
+            out.data[last + col * ROWS] = 0;
         }
 
+        for(unsigned int row = 0; row < last; row++) {
+            MatScalar t = 0;
+            for(unsigned int i = 0; i < last; i++) {
+                t += linearInverse.data[row + i * last] * data[i + last * ROWS];
+            }
+            out.data[row + last * ROWS] = -t;
+        }
+        out.data[last + last * ROWS] = 1;
+
+        return true;
+    }
+
+    // inverseAffine
+    template<typename MatScalar, unsigned int ROWS, unsigned int COLS>
+    inline Matrix<MatScalar, ROWS, COLS> Matrix<MatScalar, ROWS, COLS>::inverseAffine() const
+    {
+        MyType out;
+        tryInverseAffine(out);
+        return out;
+    }
+
+    // inverseRigid
+    template<typename MatScalar, unsigned int ROWS, unsigned int COLS>
+    inline Matrix<MatScalar, ROWS, COLS> Matrix<MatScalar, ROWS, COLS>::inverseRigid() const
+    {
+        EXPOP_MATRIX_ASSERT_STATIC(ROWS == COLS && ROWS > 1);
+
+        const unsigned int last = ROWS - 1;
+        MyType out;
+
+        // Rotation part is just transposed.
+        for(unsigned int col = 0; col < last; col++) {
+            for(unsigned int row = 0; row < last; row++) {
+                out.data[row + col * ROWS] = data[col + row * ROWS];
+            }
+        }
+
+        // Translation becomes -(transposed rotation * translation).
+        for(unsigned int row = 0; row < last; row++) {
+            MatScalar t = 0;
+            for(unsigned int i = 0; i < last; i++) {
+                t += data[i + row * ROWS] * data[i + last * ROWS];
+            }
+            out.data[row + last * ROWS] = -t;
+        }
+
+        for(unsigned int col = 0; col < last; col++) {
+            out.data[last + col * ROWS] = 0;
+        }
+        out.data[last + last * ROWS] = 1;
+
         return out;
     }
 
@@ -884,6 +1149,260 @@ namespace ExPop
         return COLS;
     }
 
+    // ----------------------------------------------------------------------
+    // SimdFloat4 versions of the common float operations.
+
+    // These do the same multiplies and adds, in the same order, as the
+    // generic versions (starting from zero, like they do), so results
+    // are bit-for-bit the same. Products work a column at a time:
+    // each output column is the left matrix's columns scaled by that
+    // column of the right matrix, which fits the column-major data
+    // without any shuffling.
+
+    // operator*, 4x4
+    template<>
+    inline FMatrix4x4 FMatrix4x4::operator*(const FMatrix4x4 &otherMat) const
+    {
+        const SimdFloat4 c0 = SimdFloat4::load(data);
+        const SimdFloat4 c1 = SimdFloat4::load(data + 4);
+        const SimdFloat4 c2 = SimdFloat4::load(data + 8);
+        const SimdFloat4 c3 = SimdFloat4::load(data + 12);
+
+        FMatrix4x4 output;
+        for(unsigned int col = 0; col < 4; col++) {
+            const float *b = otherMat.data + col * 4;
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), c0, SimdFloat4::splat(b[0]));
+            acc = simdMulAdd(acc, c1, SimdFloat4::splat(b[1]));
+            acc = simdMulAdd(acc, c2, SimdFloat4::splat(b[2]));
+            acc = simdMulAdd(acc, c3, SimdFloat4::splat(b[3]));
+            acc.store(output.data + col * 4);
+        }
+        return output;
+    }
+
+    // multiply, 4x4 by 4x4
+    template<>
+    template<>
+    inline FMatrix4x4 FMatrix4x4::multiply<4, 4>(const FMatrix4x4 &otherMat) const
+    {
+        return *this * otherMat;
+    }
+
+    // multiply, 4x4 by a vector
+    template<>
+    template<>
+    inline FVec4 FMatrix4x4::multiply<4, 1>(const FVec4 &otherMat) const
+    {
+        SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), SimdFloat4::load(data), SimdFloat4::splat(otherMat.data[0]));
+        acc = simdMulAdd(acc, SimdFloat4::load(data + 4), SimdFloat4::splat(otherMat.data[1]));
+        acc = simdMulAdd(acc, SimdFloat4::load(data + 8), SimdFloat4::splat(otherMat.data[2]));
+        acc = simdMulAdd(acc, SimdFloat4::load(data + 12), SimdFloat4::splat(otherMat.data[3]));
+
+        FVec4 output;
+        acc.store(output.data);
+        return output;
+    }
+
+    // transpose, 4x4
+    template<>
+    inline FMatrix4x4 FMatrix4x4::transpose() const
+    {
+        SimdFloat4 c0 = SimdFloat4::load(data);
+        SimdFloat4 c1 = SimdFloat4::load(data + 4);
+        SimdFloat4 c2 = SimdFloat4::load(data + 8);
+        SimdFloat4 c3 = SimdFloat4::load(data + 12);
+        simdTranspose(c0, c1, c2, c3);
+
+        FMatrix4x4 output;
+        c0.store(output.data);
+        c1.store(output.data + 4);
+        c2.store(output.data + 8);
+        c3.store(output.data + 12);
+        return output;
+    }
+
+    // inverse, 4x4. This is the cofactor expansion from Intel's
+    // "Streaming SIMD Extensions - Inverse of 4x4 Matrix" note. It
+    // works on the transpose with the second and fourth rows
+    // rotated, so every cofactor product lines up in the right lane
+    // with nothing but pair and half swaps. Inverting the transpose
+    // and transposing back is the same as inverting directly, so the
+    // columns that come out are the columns of the inverse.
+    inline bool matrixInverse_compute(
+        const Matrix<float, 4, 4> &in,
+        Matrix<float, 4, 4> &out)
+    {
+        SimdFloat4 row0 = SimdFloat4::load(in.data);
+        SimdFloat4 row1 = SimdFloat4::load(in.data + 4);
+        SimdFloat4 row2 = SimdFloat4::load(in.data + 8);
+        SimdFloat4 row3 = SimdFloat4::load(in.data + 12);
+        simdTranspose(row0, row1, row2, row3);
+        row1 = simdSwapHalves(row1);
+        row3 = simdSwapHalves(row3);
+
+        SimdFloat4 minor0, minor1, minor2, minor3;
+        SimdFloat4 tmp;
+
+        tmp = simdSwapPairs(row2 * row3);
+        minor0 = row1 * tmp;
+        minor1 = row0 * tmp;
+        tmp = simdSwapHalves(tmp);
+        minor0 = row1 * tmp - minor0;
+        minor1 = simdSwapHalves(row0 * tmp - minor1);
+
+        tmp = simdSwapPairs(row1 * row2);
+        minor0 = row3 * tmp + minor0;
+        minor3 = row0 * tmp;
+        tmp = simdSwapHalves(tmp);
+        minor0 = minor0 - row3 * tmp;
+        minor3 = simdSwapHalves(row0 * tmp - minor3);
+
+        tmp = simdSwapPairs(simdSwapHalves(row1) * row3);
+        row2 = simdSwapHalves(row2);
+        minor0 = row2 * tmp + minor0;
+        minor2 = row0 * tmp;
+        tmp = simdSwapHalves(tmp);
+        minor0 = minor0 - row2 * tmp;
+        minor2 = simdSwapHalves(row0 * tmp - minor2);
+
+        tmp = simdSwapPairs(row0 * row1);
+        minor2 = row3 * tmp + minor2;
+        minor3 = row2 * tmp - minor3;
+        tmp = simdSwapHalves(tmp);
+        minor2 = row3 * tmp - minor2;
+        minor3 = minor3 - row2 * tmp;
+
+        tmp = simdSwapPairs(row0 * row3);
+        minor1 = minor1 - row2 * tmp;
+        minor2 = row1 * tmp + minor2;
+        tmp = simdSwapHalves(tmp);
+        minor1 = row2 * tmp + minor1;
+        minor2 = minor2 - row1 * tmp;
+
+        tmp = simdSwapPairs(row0 * row2);
+        minor1 = row3 * tmp + minor1;
+        minor3 = minor3 - row1 * tmp;
+        tmp = simdSwapHalves(tmp);
+        minor1 = minor1 - row3 * tmp;
+        minor3 = row1 * tmp + minor3;
+
+        // Sum across the lanes for the determinant, which ends up in
+        // all four of them.
+        SimdFloat4 det = row0 * minor0;
+        det = simdSwapHalves(det) + det;
+        det = simdSwapPairs(det) + det;
+
+        if(det.getLane(0) == 0.0f) {
+            out = Matrix<float, 4, 4>(0.0f);
+            return false;
+        }
+
+        const SimdFloat4 invDet = SimdFloat4::splat(1.0f) / det;
+        (minor0 * invDet).store(out.data);
+        (minor1 * invDet).store(out.data + 4);
+        (minor2 * invDet).store(out.data + 8);
+        (minor3 * invDet).store(out.data + 12);
+        return true;
+    }
+
+    // tryInverseAffine, 4x4. The 3x3 cofactors are scalar, but the
+    // scaling and the translation work a column at a time.
+    template<>
+    inline bool FMatrix4x4::tryInverseAffine(FMatrix4x4 &out) const
+    {
+        EXPOP_MATRIX_ASSERT(data[3] == 0.0f && data[7] == 0.0f && data[11] == 0.0f && data[15] == 1.0f);
+
+        const float *m = data;
+        const float c00 = m[5] * m[10] - m[9] * m[6];
+        const float c01 = m[9] * m[2] - m[1] * m[10];
+        const float c02 = m[1] * m[6] - m[5] * m[2];
+
+        const float det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+        if(det == 0.0f) {
+            out = FMatrix4x4(0.0f);
+            return false;
+        }
+
+        const SimdFloat4 invDet = SimdFloat4::splat(1.0f) / SimdFloat4::splat(det);
+        const SimdFloat4 col0 = SimdFloat4::set(
+            c00, c01, c02, 0.0f) * invDet;
+        const SimdFloat4 col1 = SimdFloat4::set(
+            m[8] * m[6] - m[4] * m[10],
+            m[0] * m[10] - m[8] * m[2],
+            m[4] * m[2] - m[0] * m[6], 0.0f) * invDet;
+        const SimdFloat4 col2 = SimdFloat4::set(
+            m[4] * m[9] - m[8] * m[5],
+            m[8] * m[1] - m[0] * m[9],
+            m[0] * m[5] - m[4] * m[1], 0.0f) * invDet;
+
+        SimdFloat4 t = col0 * SimdFloat4::splat(m[12]);
+        t = simdMulAdd(t, col1, SimdFloat4::splat(m[13]));
+        t = simdMulAdd(t, col2, SimdFloat4::splat(m[14]));
+
+        col0.store(out.data);
+        col1.store(out.data + 4);
+        col2.store(out.data + 8);
+        (SimdFloat4::set(0.0f, 0.0f, 0.0f, 1.0f) - t).store(out.data + 12);
+        return true;
+    }
+
+    // operator*, 3x3
+    template<>
+    inline FMatrix3x3 FMatrix3x3::operator*(const FMatrix3x3 &otherMat) const
+    {
+        // The first two columns can be loaded four wide. The extra
+        // lane is just the start of the next column.
+        const SimdFloat4 c0 = SimdFloat4::load(data);
+        const SimdFloat4 c1 = SimdFloat4::load(data + 3);
+        const SimdFloat4 c2 = SimdFloat4::load3(data + 6);
+
+        SimdFloat4 out[3];
+        for(unsigned int col = 0; col < 3; col++) {
+            const float *b = otherMat.data + col * 3;
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), c0, SimdFloat4::splat(b[0]));
+            acc = simdMulAdd(acc, c1, SimdFloat4::splat(b[1]));
+            out[col] = simdMulAdd(acc, c2, SimdFloat4::splat(b[2]));
+        }
+
+        // Same trick for storing, as long as it goes in order.
+        FMatrix3x3 output;
+        out[0].store(output.data);
+        out[1].store(output.data + 3);
+        out[2].store3(output.data + 6);
+        return output;
+    }
+
+    // multiply, 3x3 by 3x3
+    template<>
+    template<>
+    inline FMatrix3x3 FMatrix3x3::multiply<3, 3>(const FMatrix3x3 &otherMat) const
+    {
+        return *this * otherMat;
+    }
+
+    // multiply, 3x3 by a vector
+    template<>
+    template<>
+    inline FVec3 FMatrix3x3::multiply<3, 1>(const FVec3 &otherMat) const
+    {
+        SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), SimdFloat4::load(data), SimdFloat4::splat(otherMat.data[0]));
+        acc = simdMulAdd(acc, SimdFloat4::load(data + 3), SimdFloat4::splat(otherMat.data[1]));
+        acc = simdMulAdd(acc, SimdFloat4::load3(data + 6), SimdFloat4::splat(otherMat.data[2]));
+
+        FVec3 output;
+        acc.store3(output.data);
+        return output;
+    }
+
+    // normalize, 4 wide
+    template<>
+    inline FVec4 FVec4::normalize(void) const
+    {
+        FVec4 output;
+        (SimdFloat4::load(data) / SimdFloat4::splat(magnitude())).store(output.data);
+        return output;
+    }
+
     // Utility/helper functions...
 
     inline FMatrix4x4 makePerspectiveMatrix(
@@ -902,8 +1421,8 @@ namespace ExPop
         mat(0, 0) = tmp1 / aspectRatio;
         mat(1, 1) = tmp1;
         mat(2, 2) = -(zFar + zNear) / tmp2;
-        mat(2, 3) = -1;
-        mat(3, 2) = (-2 * zNear * zFar) / tmp2;
+        mat(2, 3) = (-2 * zNear * zFar) / tmp2;
+        mat(3, 2) = -1;
         mat(3, 3) = 0;
 
         return mat;
@@ -0,0 +1,520 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Batch versions of the common Matrix operations, for when there are
+// a lot of points or matrices to get through at once. Everything
+// works on four points at a time. Points that need to be combined
+// with each other (distances, dot products, structure-of-arrays
+// output) get transposed so that one SimdFloat4 holds all four x
+// values, another all four y values, and so on. Plain transforms keep
+// each point in one register and copy the coordinates across from
+// three loads of twelve floats instead. The matrix only gets split up
+// once per call either way.
+//
+// Results are bit-for-bit the same as calling the per-vector Matrix
+// functions in a loop. Counts don't need to be a multiple of four.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "matrix.h"
+#include "simd.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Transform positions (w = 1) by a 4x4 matrix. Same as
+    /// m.multiply(FVec4(x, y, z, 1)) with the w dropped, so there's
+    /// no perspective divide. in and out may be the same array.
+    inline void matrixBatchTransformPoints(
+        const FMatrix4x4 &m,
+        const FVec3 *in,
+        FVec3 *out,
+        size_t count);
+
+    /// Transform positions, writing the results out as separate x,
+    /// y and z arrays.
+    inline void matrixBatchTransformPointsSoA(
+        const FMatrix4x4 &m,
+        const FVec3 *in,
+        float *outX,
+        float *outY,
+        float *outZ,
+        size_t count);
+
+    /// Transform directions (w = 0), so translation is ignored. For
+    /// normals under non-uniform scale, pass the inverse transpose of
+    /// the matrix. in and out may be the same array.
+    inline void matrixBatchTransformDirections(
+        const FMatrix4x4 &m,
+        const FVec3 *in,
+        FVec3 *out,
+        size_t count);
+
+    /// Full 4-component transform. Same as m.multiply(in[i]). in and
+    /// out may be the same array.
+    inline void matrixBatchTransform(
+        const FMatrix4x4 &m,
+        const FVec4 *in,
+        FVec4 *out,
+        size_t count);
+
+    /// out[i] = a[i] * b[i]. out may be the same array as a or b.
+    inline void matrixBatchMultiply(
+        const FMatrix4x4 *a,
+        const FMatrix4x4 *b,
+        FMatrix4x4 *out,
+        size_t count);
+
+    /// Compute world transforms for a hierarchy. parents[i] is the
+    /// index of the parent of node i, or -1 for a root, and every
+    /// parent has to come before its children. world[i] ends up as
+    /// world[parents[i]] * local[i].
+    inline void matrixBatchWorldTransforms(
+        const FMatrix4x4 *local,
+        const int32_t *parents,
+        FMatrix4x4 *world,
+        size_t count);
+
+    /// out[i] = (points[i] - from).magnitudeSquared().
+    inline void matrixBatchDistancesSquared(
+        const FVec3 &from,
+        const FVec3 *points,
+        float *out,
+        size_t count);
+
+    /// out[i] = (points[i] - from).magnitude().
+    inline void matrixBatchDistances(
+        const FVec3 &from,
+        const FVec3 *points,
+        float *out,
+        size_t count);
+
+    /// out[i] = v.dot(points[i]).
+    inline void matrixBatchDots(
+        const FVec3 &v,
+        const FVec3 *points,
+        float *out,
+        size_t count);
+
+    /// out[i] = a[i].dot(b[i]).
+    inline void matrixBatchDots(
+        const FVec3 *a,
+        const FVec3 *b,
+        float *out,
+        size_t count);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    // Whatever is left over at the end of an array gets copied into a
+    // zero-padded block of four and run through the same function
+    // again, so the main loops never have to check for a partial
+    // block.
+
+    template<typename T>
+    inline void matrixBatch_pad(const T *in, size_t n, T *block)
+    {
+        for(size_t i = 0; i < 4; i++) {
+            block[i] = i < n ? in[i] : T(0.0f);
+        }
+    }
+
+    template<typename T>
+    inline void matrixBatch_unpad(const T *block, size_t n, T *out)
+    {
+        for(size_t i = 0; i < n; i++) {
+            out[i] = block[i];
+        }
+    }
+
+    // Four FVec3s to x, y and z registers.
+    inline void matrixBatch_load(
+        const FVec3 *in,
+        SimdFloat4 &x, SimdFloat4 &y, SimdFloat4 &z)
+    {
+        SimdFloat4 p0 = SimdFloat4::load3(in[0].data);
+        SimdFloat4 p1 = SimdFloat4::load3(in[1].data);
+        SimdFloat4 p2 = SimdFloat4::load3(in[2].data);
+        SimdFloat4 p3 = SimdFloat4::load3(in[3].data);
+        simdTranspose(p0, p1, p2, p3);
+        x = p0;
+        y = p1;
+        z = p2;
+    }
+
+    // Four FVec4s to x, y, z and w registers.
+    inline void matrixBatch_load(
+        const FVec4 *in,
+        SimdFloat4 &x, SimdFloat4 &y, SimdFloat4 &z, SimdFloat4 &w)
+    {
+        x = SimdFloat4::load(in[0].data);
+        y = SimdFloat4::load(in[1].data);
+        z = SimdFloat4::load(in[2].data);
+        w = SimdFloat4::load(in[3].data);
+        simdTranspose(x, y, z, w);
+    }
+
+    // And back again.
+    inline void matrixBatch_store(
+        FVec4 *out,
+        SimdFloat4 x, SimdFloat4 y, SimdFloat4 z, SimdFloat4 w)
+    {
+        simdTranspose(x, y, z, w);
+        x.store(out[0].data);
+        y.store(out[1].data);
+        z.store(out[2].data);
+        w.store(out[3].data);
+    }
+
+    // One row of a matrix, spread across all lanes, for the
+    // transposed points.
+    struct MatrixBatch_Row
+    {
+        SimdFloat4 m[4];
+
+        MatrixBatch_Row(const FMatrix4x4 &mat, unsigned int row)
+        {
+            for(unsigned int col = 0; col < 4; col++) {
+                m[col] = SimdFloat4::splat(mat.data[row + col * 4]);
+            }
+        }
+
+        // Same order as the generic multiply, starting from zero. For
+        // points, multiplying the last column by w = 1 changes
+        // nothing, so it's just added.
+        SimdFloat4 point(const SimdFloat4 &x, const SimdFloat4 &y, const SimdFloat4 &z) const
+        {
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), m[0], x);
+            acc = simdMulAdd(acc, m[1], y);
+            acc = simdMulAdd(acc, m[2], z);
+            return acc + m[3];
+        }
+
+        SimdFloat4 full(
+            const SimdFloat4 &x, const SimdFloat4 &y,
+            const SimdFloat4 &z, const SimdFloat4 &w) const
+        {
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), m[0], x);
+            acc = simdMulAdd(acc, m[1], y);
+            acc = simdMulAdd(acc, m[2], z);
+            return simdMulAdd(acc, m[3], w);
+        }
+    };
+
+    // The columns of a matrix, for transforming FVec3s without
+    // transposing them. Four of them are twelve floats, which is
+    // exactly three SimdFloat4 loads, and each coordinate gets copied
+    // across a register straight from those.
+    struct MatrixBatch_Columns
+    {
+        SimdFloat4 c[4];
+        bool isPoint;
+
+        MatrixBatch_Columns(const FMatrix4x4 &mat, bool point)
+        {
+            for(unsigned int col = 0; col < 4; col++) {
+                c[col] = SimdFloat4::load(mat.data + col * 4);
+            }
+            isPoint = point;
+        }
+
+        SimdFloat4 apply(const SimdFloat4 &x, const SimdFloat4 &y, const SimdFloat4 &z) const
+        {
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), c[0], x);
+            acc = simdMulAdd(acc, c[1], y);
+            acc = simdMulAdd(acc, c[2], z);
+            return isPoint ? acc + c[3] : acc;
+        }
+
+        // Each full store spills one junk float into the next point,
+        // which then gets overwritten, so only the last one needs
+        // store3(). Everything is loaded before anything is stored,
+        // so in and out can be the same.
+        void transform4(const FVec3 *in, FVec3 *out) const
+        {
+            const SimdFloat4 a = SimdFloat4::load(in[0].data);
+            const SimdFloat4 b = SimdFloat4::load(in[0].data + 4);
+            const SimdFloat4 d = SimdFloat4::load(in[0].data + 8);
+            float *o = out[0].data;
+            apply(simdSplatLane<0>(a), simdSplatLane<1>(a), simdSplatLane<2>(a)).store(o);
+            apply(simdSplatLane<3>(a), simdSplatLane<0>(b), simdSplatLane<1>(b)).store(o + 3);
+            apply(simdSplatLane<2>(b), simdSplatLane<3>(b), simdSplatLane<0>(d)).store(o + 6);
+            apply(simdSplatLane<1>(d), simdSplatLane<2>(d), simdSplatLane<3>(d)).store3(o + 9);
+        }
+
+        void transform(const FVec3 *in, FVec3 *out, size_t count) const
+        {
+            size_t i = 0;
+            for(; i + 4 <= count; i += 4) {
+                transform4(in + i, out + i);
+            }
+
+            if(i < count) {
+                FVec3 inBlock[4];
+                FVec3 outBlock[4];
+                matrixBatch_pad(in + i, count - i, inBlock);
+                transform4(inBlock, outBlock);
+                matrixBatch_unpad(outBlock, count - i, out + i);
+            }
+        }
+    };
+
+    inline void matrixBatchTransformPoints(
+        const FMatrix4x4 &m,
+        const FVec3 *in,
+        FVec3 *out,
+        size_t count)
+    {
+        MatrixBatch_Columns(m, true).transform(in, out, count);
+    }
+
+    inline void matrixBatchTransformPointsSoA(
+        const FMatrix4x4 &m,
+        const FVec3 *in,
+        float *outX,
+        float *outY,
+        float *outZ,
+        size_t count)
+    {
+        const MatrixBatch_Row r0(m, 0);
+        const MatrixBatch_Row r1(m, 1);
+        const MatrixBatch_Row r2(m, 2);
+
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            SimdFloat4 x, y, z;
+            matrixBatch_load(in + i, x, y, z);
+            r0.point(x, y, z).store(outX + i);
+            r1.point(x, y, z).store(outY + i);
+            r2.point(x, y, z).store(outZ + i);
+        }
+
+        if(i < count) {
+            FVec3 inBlock[4];
+            float xBlock[4];
+            float yBlock[4];
+            float zBlock[4];
+            matrixBatch_pad(in + i, count - i, inBlock);
+            matrixBatchTransformPointsSoA(m, inBlock, xBlock, yBlock, zBlock, 4);
+            matrixBatch_unpad(xBlock, count - i, outX + i);
+            matrixBatch_unpad(yBlock, count - i, outY + i);
+            matrixBatch_unpad(zBlock, count - i, outZ + i);
+        }
+    }
+
+    inline void matrixBatchTransformDirections(
+        const FMatrix4x4 &m,
+        const FVec3 *in,
+        FVec3 *out,
+        size_t count)
+    {
+        MatrixBatch_Columns(m, false).transform(in, out, count);
+    }
+
+    inline void matrixBatchTransform(
+        const FMatrix4x4 &m,
+        const FVec4 *in,
+        FVec4 *out,
+        size_t count)
+    {
+        const MatrixBatch_Row r0(m, 0);
+        const MatrixBatch_Row r1(m, 1);
+        const MatrixBatch_Row r2(m, 2);
+        const MatrixBatch_Row r3(m, 3);
+
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            SimdFloat4 x, y, z, w;
+            matrixBatch_load(in + i, x, y, z, w);
+            matrixBatch_store(
+                out + i,
+                r0.full(x, y, z, w), r1.full(x, y, z, w),
+                r2.full(x, y, z, w), r3.full(x, y, z, w));
+        }
+
+        if(i < count) {
+            FVec4 inBlock[4];
+            FVec4 outBlock[4];
+            matrixBatch_pad(in + i, count - i, inBlock);
+            matrixBatchTransform(m, inBlock, outBlock, 4);
+            matrixBatch_unpad(outBlock, count - i, out + i);
+        }
+    }
+
+    inline void matrixBatchMultiply(
+        const FMatrix4x4 *a,
+        const FMatrix4x4 *b,
+        FMatrix4x4 *out,
+        size_t count)
+    {
+        for(size_t i = 0; i < count; i++) {
+            out[i] = a[i] * b[i];
+        }
+    }
+
+    inline void matrixBatchWorldTransforms(
+        const FMatrix4x4 *local,
+        const int32_t *parents,
+        FMatrix4x4 *world,
+        size_t count)
+    {
+        for(size_t i = 0; i < count; i++) {
+            EXPOP_MATRIX_ASSERT(parents[i] < int64_t(i));
+            if(parents[i] < 0) {
+                world[i] = local[i];
+            } else {
+                world[i] = world[parents[i]] * local[i];
+            }
+        }
+    }
+
+    inline void matrixBatchDistancesSquared(
+        const FVec3 &from,
+        const FVec3 *points,
+        float *out,
+        size_t count)
+    {
+        const SimdFloat4 fx = SimdFloat4::splat(from.data[0]);
+        const SimdFloat4 fy = SimdFloat4::splat(from.data[1]);
+        const SimdFloat4 fz = SimdFloat4::splat(from.data[2]);
+
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            SimdFloat4 x, y, z;
+            matrixBatch_load(points + i, x, y, z);
+            x = x - fx;
+            y = y - fy;
+            z = z - fz;
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), x, x);
+            acc = simdMulAdd(acc, y, y);
+            acc = simdMulAdd(acc, z, z);
+            acc.store(out + i);
+        }
+
+        if(i < count) {
+            FVec3 inBlock[4];
+            float outBlock[4];
+            matrixBatch_pad(points + i, count - i, inBlock);
+            matrixBatchDistancesSquared(from, inBlock, outBlock, 4);
+            matrixBatch_unpad(outBlock, count - i, out + i);
+        }
+    }
+
+    inline void matrixBatchDistances(
+        const FVec3 &from,
+        const FVec3 *points,
+        float *out,
+        size_t count)
+    {
+        matrixBatchDistancesSquared(from, points, out, count);
+
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            simdSqrt(SimdFloat4::load(out + i)).store(out + i);
+        }
+        for(; i < count; i++) {
+            out[i] = std::sqrt(out[i]);
+        }
+    }
+
+    inline void matrixBatchDots(
+        const FVec3 &v,
+        const FVec3 *points,
+        float *out,
+        size_t count)
+    {
+        const SimdFloat4 vx = SimdFloat4::splat(v.data[0]);
+        const SimdFloat4 vy = SimdFloat4::splat(v.data[1]);
+        const SimdFloat4 vz = SimdFloat4::splat(v.data[2]);
+
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            SimdFloat4 x, y, z;
+            matrixBatch_load(points + i, x, y, z);
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), vx, x);
+            acc = simdMulAdd(acc, vy, y);
+            acc = simdMulAdd(acc, vz, z);
+            acc.store(out + i);
+        }
+
+        if(i < count) {
+            FVec3 inBlock[4];
+            float outBlock[4];
+            matrixBatch_pad(points + i, count - i, inBlock);
+            matrixBatchDots(v, inBlock, outBlock, 4);
+            matrixBatch_unpad(outBlock, count - i, out + i);
+        }
+    }
+
+    inline void matrixBatchDots(
+        const FVec3 *a,
+        const FVec3 *b,
+        float *out,
+        size_t count)
+    {
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            SimdFloat4 ax, ay, az;
+            SimdFloat4 bx, by, bz;
+            matrixBatch_load(a + i, ax, ay, az);
+            matrixBatch_load(b + i, bx, by, bz);
+            SimdFloat4 acc = simdMulAdd(SimdFloat4::zero(), ax, bx);
+            acc = simdMulAdd(acc, ay, by);
+            acc = simdMulAdd(acc, az, bz);
+            acc.store(out + i);
+        }
+
+        if(i < count) {
+            FVec3 aBlock[4];
+            FVec3 bBlock[4];
+            float outBlock[4];
+            matrixBatch_pad(a + i, count - i, aBlock);
+            matrixBatch_pad(b + i, count - i, bBlock);
+            matrixBatchDots(aBlock, bBlock, outBlock, 4);
+            matrixBatch_unpad(outBlock, count - i, out + i);
+        }
+    }
+}
@@ -0,0 +1,222 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Splitting loops up across threads.
+//
+// parallelForChunks() chops a range of work items into fixed-size
+// chunks and hands them out to a set of threads (including the
+// calling one) through an atomic counter, so faster threads just
+// pick up more chunks. It's fork-join: the threads get started for
+// the call and joined before it returns. That costs a little per
+// call, but the Threads wrapper doesn't have anything to let a
+// persistent pool sleep while it waits for work, and these are meant
+// for loops that take milliseconds anyway.
+//
+// Which thread runs which chunk isn't deterministic, so the function
+// has to write to separate output for each item if the results are
+// going to come out the same every time.
+//
+// Without EXPOP_ENABLE_THREADS everything just runs on the calling
+// thread.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "config.h"
+#include "thread.h"
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+#if EXPOP_ENABLE_THREADS
+#if _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#endif
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Number of threads to use when a caller asks for "as many as
+    /// makes sense" (usually by passing 0 as a thread count). This is
+    /// the number of processors available, or 1 without thread
+    /// support.
+    size_t parallelGetDefaultThreadCount();
+
+    /// Call func(begin, end) for chunks of up to chunkSize items
+    /// covering [0, count), spread across up to threadCount threads.
+    /// A threadCount of 0 uses parallelGetDefaultThreadCount(). func
+    /// gets called from multiple threads at once, so it has to be
+    /// safe for that.
+    template<typename FuncType>
+    void parallelForChunks(
+        size_t count,
+        size_t chunkSize,
+        size_t threadCount,
+        const FuncType &func);
+
+    /// Pick a chunk size that gives each thread a few chunks to
+    /// balance the load, but not less than minimumChunkSize.
+    size_t parallelGetChunkSize(
+        size_t count,
+        size_t threadCount,
+        size_t minimumChunkSize);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    inline size_t parallelGetDefaultThreadCount()
+    {
+      #if EXPOP_ENABLE_THREADS
+      #if _WIN32
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        return systemInfo.dwNumberOfProcessors ? systemInfo.dwNumberOfProcessors : 1;
+      #else
+        long processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+        return processorCount > 0 ? size_t(processorCount) : 1;
+      #endif
+      #else
+        return 1;
+      #endif
+    }
+
+    inline size_t parallelGetChunkSize(
+        size_t count,
+        size_t threadCount,
+        size_t minimumChunkSize)
+    {
+        if(!threadCount) {
+            threadCount = parallelGetDefaultThreadCount();
+        }
+
+        // Four chunks per thread.
+        size_t chunkSize = count / (threadCount * 4);
+        return chunkSize > minimumChunkSize ? chunkSize : (minimumChunkSize ? minimumChunkSize : 1);
+    }
+
+    template<typename FuncType>
+    struct ParallelForChunksState
+    {
+        const FuncType *func;
+        size_t count;
+        size_t chunkSize;
+        std::atomic<size_t> nextChunk;
+    };
+
+    template<typename FuncType>
+    inline void parallelForChunks_worker(void *data)
+    {
+        ParallelForChunksState<FuncType> *state = (ParallelForChunksState<FuncType>*)data;
+
+        while(true) {
+            size_t begin = state->nextChunk.fetch_add(1) * state->chunkSize;
+            if(begin >= state->count) {
+                break;
+            }
+            size_t end = begin + state->chunkSize;
+            if(end > state->count) {
+                end = state->count;
+            }
+            (*state->func)(begin, end);
+        }
+    }
+
+    template<typename FuncType>
+    inline void parallelForChunks(
+        size_t count,
+        size_t chunkSize,
+        size_t threadCount,
+        const FuncType &func)
+    {
+        if(!count) {
+            return;
+        }
+
+        if(!chunkSize) {
+            chunkSize = 1;
+        }
+
+        if(!threadCount) {
+            threadCount = parallelGetDefaultThreadCount();
+        }
+
+        // No point in having threads with nothing to do.
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        if(threadCount > chunkCount) {
+            threadCount = chunkCount;
+        }
+
+      #if EXPOP_ENABLE_THREADS
+
+        if(threadCount > 1) {
+
+            ParallelForChunksState<FuncType> state;
+            state.func = &func;
+            state.count = count;
+            state.chunkSize = chunkSize;
+            state.nextChunk = 0;
+
+            std::vector<Threads::Thread> threads;
+            for(size_t i = 1; i < threadCount; i++) {
+                threads.push_back(Threads::Thread(parallelForChunks_worker<FuncType>, &state));
+            }
+
+            // This thread does its share too.
+            parallelForChunks_worker<FuncType>(&state);
+
+            for(size_t i = 0; i < threads.size(); i++) {
+                threads[i].join();
+            }
+
+            return;
+        }
+
+      #endif
+
+        for(size_t begin = 0; begin < count; begin += chunkSize) {
+            func(begin, begin + chunkSize < count ? begin + chunkSize : count);
+        }
+    }
+}
@@ -42,6 +42,7 @@
 
 #include "pixelvalue.h"
 #include "pixelimagebase.h"
+#include "pixelimage_pool.h"
 
 #include <cstring>
 
@@ -51,6 +52,40 @@
 
 namespace ExPop
 {
+    /// A single row of pixels, for walking through an image without
+    /// going through findIndex() or virtual calls for every value.
+    /// If channelCount is non-zero, it's used as a compile-time
+    /// channel count and must match the image's real channel count.
+    /// Otherwise the channel count is read at runtime.
+    template<typename PixelValueType, PixelImage_Dimension channelCount = 0>
+    struct PixelImageRowSpan
+    {
+        PixelValueType *data;
+        PixelImage_Dimension width;
+        PixelImage_Dimension runtimeChannelCount;
+
+        /// Channel count. Constant if the template parameter was set.
+        PixelImage_Dimension getChannelCount() const
+        {
+            return channelCount ? channelCount : runtimeChannelCount;
+        }
+
+        /// First channel of a pixel in this row. No bounds checking.
+        PixelValueType *getPixel(PixelImage_Coordinate x) const
+        {
+            return data + x * getChannelCount();
+        }
+
+        /// A single channel of a pixel in this row. No bounds
+        /// checking.
+        PixelValueType &operator()(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate channel) const
+        {
+            return data[x * getChannelCount() + channel];
+        }
+    };
+
     /// Image type that actually has a format.
     template<
         typename ValueType,
@@ -90,8 +125,19 @@ namespace ExPop
         MyType &operator=(const PixelImageBase &other);
 
         /// Copy another image of THIS type into this with operator=.
+        /// Reuses the existing storage if it's the same size.
         MyType &operator=(const MyType &other);
 
+        /// Move constructor. Takes the other image's storage and
+        /// leaves it 0x0 with no channels. The only things that
+        /// should be done with a moved-from image are assigning to
+        /// it, resizing it, and destroying it.
+        PixelImage(MyType &&other);
+
+        /// Move assignment. Same as the move constructor, but
+        /// releases whatever storage this image had first.
+        MyType &operator=(MyType &&other);
+
         /// Destructor.
         virtual ~PixelImage();
 
@@ -111,6 +157,30 @@ namespace ExPop
             PixelImage_Coordinate channel,
             PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Wrap) const;
 
+        // ----------------------------------------------------------------------
+        // Typed row access. None of this is virtual, and none of it
+        // does any edge wrapping or clamping. Rows are contiguous,
+        // with getChannelCount() values per pixel, and start
+        // getRowStride() values apart.
+
+        /// Get a pointer to the first value in a row. y must be in
+        /// range.
+        PixelValueType *getRow(PixelImage_Coordinate y);
+        const PixelValueType *getRow(PixelImage_Coordinate y) const;
+
+        /// Distance between the start of one row and the start of
+        /// the next, in values (not bytes).
+        size_t getRowStride() const;
+
+        /// Get a row as a span. Set channelCount to the number of
+        /// channels you know the image has to let the compiler
+        /// constant-fold the channel stride.
+        template<PixelImage_Dimension channelCount>
+        PixelImageRowSpan<PixelValueType, channelCount> getRowSpan(PixelImage_Coordinate y);
+
+        template<PixelImage_Dimension channelCount>
+        PixelImageRowSpan<const PixelValueType, channelCount> getRowSpan(PixelImage_Coordinate y) const;
+
         // ----------------------------------------------------------------------
         // PixelImageBase interface implementation.
 
@@ -137,8 +207,28 @@ namespace ExPop
 
     private:
 
+        /// Get uninitialized storage for count values. Goes through
+        /// the pool, if it's on. (See pixelimage_pool.h.)
+        static PixelValueType *allocateData(size_t count);
+
+        /// Release storage from allocateData().
+        static void freeData(PixelValueType *ptr, size_t count);
+
+        /// Number of values in the image.
+        size_t getValueCount() const;
+
         PixelValueType *data;
     };
+
+    // Every type in here is another instantiation of every kernel
+    // that gets dispatched (see pixelimage_access.h and
+    // pixelimage_convert.h), so only the types that actually get used
+    // a lot go in here.
+  #define EXPOP_PIXELIMAGE_DISPATCH_TYPES(x)     \
+      x(uint8_t)                                 \
+      x(uint16_t)                                \
+      x(float)                                   \
+      x(double)
 }
 
 // ----------------------------------------------------------------------
@@ -153,7 +243,7 @@ namespace ExPop
         ScalingType scalingType>
     inline PixelImage<ValueType, scalingType>::PixelImage()
     {
-        data = new PixelValueType[1];
+        data = allocateData(1);
         width = 1;
         height = 1;
         numChannels = 1;
@@ -172,10 +262,25 @@ namespace ExPop
         height = other.height;
         numChannels = other.numChannels;
 
-        data = new PixelValueType[width * height * numChannels];
+        data = allocateData(getValueCount());
+        memcpy((void*)data, (const void*)other.data, getValueCount() * sizeof(PixelValueType));
+    }
+
+    // Move constructor
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline PixelImage<ValueType, scalingType>::PixelImage(MyType &&other)
+    {
+        width = other.width;
+        height = other.height;
+        numChannels = other.numChannels;
+        data = other.data;
 
-        size_t dataSize = width * height * numChannels * sizeof(PixelValueType);
-        memcpy(data, other.data, dataSize);
+        other.width = 0;
+        other.height = 0;
+        other.numChannels = 0;
+        other.data = nullptr;
     }
 
     // Copy constructor from unknown type.
@@ -188,16 +293,11 @@ namespace ExPop
         height = other.getHeight();
         numChannels = other.getChannelCount();
 
-        data = new PixelValueType[width * height * numChannels];
+        data = allocateData(getValueCount());
 
-        // Copy data over, rescaling as needed.
-        for(PixelImage_Coordinate y = 0; y < height; y++) {
-            for(PixelImage_Coordinate x = 0; x < width; x++) {
-                for(PixelImage_Coordinate c = 0; c < numChannels; c++) {
-                    setDouble(x, y, c, other.getDouble(x, y, c));
-                }
-            }
-        }
+        // Copy data over, rescaling as needed. (See
+        // pixelimage_convert.h.)
+        pixelImageConvert(other, *this);
     }
 
     // Constructor with dimensions.
@@ -216,9 +316,9 @@ namespace ExPop
         width = inWidth;
         height = inHeight;
         numChannels = inNumChannels;
-        data = new PixelValueType[width * height * numChannels];
+        data = allocateData(getValueCount());
 
-        memset((void*)data, 0, sizeof(PixelValueType) * width * height * numChannels);
+        memset((void*)data, 0, sizeof(PixelValueType) * getValueCount());
     }
 
     // Destructor
@@ -227,10 +327,43 @@ namespace ExPop
         ScalingType scalingType>
     inline PixelImage<ValueType, scalingType>::~PixelImage()
     {
-        delete[] data;
+        freeData(data, getValueCount());
         data = nullptr;
     }
 
+    // allocateData
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline typename PixelImage<ValueType, scalingType>::PixelValueType *PixelImage<ValueType, scalingType>::allocateData(
+        size_t count)
+    {
+        // PixelValue is just a number, so raw storage is fine as
+        // long as it gets filled in before anything reads it.
+        return static_cast<PixelValueType*>(
+            pixelImagePoolAllocate(count * sizeof(PixelValueType)));
+    }
+
+    // freeData
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline void PixelImage<ValueType, scalingType>::freeData(
+        PixelValueType *ptr,
+        size_t count)
+    {
+        pixelImagePoolFree(ptr, count * sizeof(PixelValueType));
+    }
+
+    // getValueCount
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline size_t PixelImage<ValueType, scalingType>::getValueCount() const
+    {
+        return size_t(width) * size_t(height) * size_t(numChannels);
+    }
+
     // getData
     template<
         typename ValueType,
@@ -259,6 +392,69 @@ namespace ExPop
         return data[index];
     }
 
+    // getRow
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline typename PixelImage<ValueType, scalingType>::PixelValueType *PixelImage<ValueType, scalingType>::getRow(
+        PixelImage_Coordinate y)
+    {
+        assert(y >= 0 && y < height);
+        return data + size_t(y) * getRowStride();
+    }
+
+    // getRow (const)
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline const typename PixelImage<ValueType, scalingType>::PixelValueType *PixelImage<ValueType, scalingType>::getRow(
+        PixelImage_Coordinate y) const
+    {
+        assert(y >= 0 && y < height);
+        return data + size_t(y) * getRowStride();
+    }
+
+    // getRowStride
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline size_t PixelImage<ValueType, scalingType>::getRowStride() const
+    {
+        return size_t(width) * size_t(numChannels);
+    }
+
+    // getRowSpan
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    template<PixelImage_Dimension channelCount>
+    inline PixelImageRowSpan<typename PixelImage<ValueType, scalingType>::PixelValueType, channelCount>
+    PixelImage<ValueType, scalingType>::getRowSpan(PixelImage_Coordinate y)
+    {
+        assert(channelCount == 0 || channelCount == numChannels);
+        PixelImageRowSpan<PixelValueType, channelCount> span;
+        span.data = getRow(y);
+        span.width = width;
+        span.runtimeChannelCount = numChannels;
+        return span;
+    }
+
+    // getRowSpan (const)
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    template<PixelImage_Dimension channelCount>
+    inline PixelImageRowSpan<const typename PixelImage<ValueType, scalingType>::PixelValueType, channelCount>
+    PixelImage<ValueType, scalingType>::getRowSpan(PixelImage_Coordinate y) const
+    {
+        assert(channelCount == 0 || channelCount == numChannels);
+        PixelImageRowSpan<const PixelValueType, channelCount> span;
+        span.data = getRow(y);
+        span.width = width;
+        span.runtimeChannelCount = numChannels;
+        return span;
+    }
+
     // setSizeAndChannels
     template<
         typename ValueType,
@@ -268,22 +464,38 @@ namespace ExPop
         PixelImage_Dimension inHeight,
         PixelImage_Dimension inNumChannels)
     {
+        // Nothing to do. Keeps the same storage.
+        if(inWidth == width && inHeight == height && inNumChannels == numChannels) {
+            return;
+        }
+
         // Make a new image buffer and clear it.
-        PixelValueType *newData = new PixelValueType[inWidth * inHeight * inNumChannels];
-        memset((void*)newData, 0, sizeof(PixelValueType) * inWidth * inHeight * inNumChannels);
+        const size_t newCount = size_t(inWidth) * size_t(inHeight) * size_t(inNumChannels);
+        PixelValueType *newData = allocateData(newCount);
+        memset((void*)newData, 0, sizeof(PixelValueType) * newCount);
 
         // Copy old image over.
         for(PixelImage_Coordinate y = 0; y < height && y < inHeight; y++) {
+
+            PixelValueType *newRow = newData + size_t(y) * inWidth * inNumChannels;
+            const PixelValueType *oldRow = data + size_t(y) * width * numChannels;
+
+            if(numChannels == inNumChannels) {
+                memcpy(
+                    (void*)newRow, (const void*)oldRow,
+                    sizeof(PixelValueType) * (width < inWidth ? width : inWidth) * numChannels);
+                continue;
+            }
+
             for(PixelImage_Coordinate x = 0; x < width && x < inWidth; x++) {
                 for(PixelImage_Coordinate c = 0; c < numChannels && c < inNumChannels; c++) {
-                    newData[c + x * inNumChannels + y * (inWidth * inNumChannels)].value =
-                        data[c + x * numChannels + y * (width * numChannels)].value;
+                    newRow[c + x * inNumChannels].value = oldRow[c + x * numChannels].value;
                 }
             }
         }
 
         // Swap buffers around.
-        delete[] data;
+        freeData(data, getValueCount());
         data = newData;
         width = inWidth;
         height = inHeight;
@@ -342,16 +554,46 @@ namespace ExPop
     inline PixelImage<ValueType, scalingType> &PixelImage<ValueType, scalingType>::operator=(
         const PixelImage<ValueType, scalingType> &other)
     {
-        delete[] data;
+        if(this == &other) {
+            return *this;
+        }
+
+        if(getValueCount() != other.getValueCount()) {
+            freeData(data, getValueCount());
+            data = allocateData(other.getValueCount());
+        }
 
         width = other.width;
         height = other.height;
         numChannels = other.numChannels;
 
-        data = new PixelValueType[width * height * numChannels];
+        memcpy((void*)data, (const void*)other.data, getValueCount() * sizeof(PixelValueType));
+
+        return *this;
+    }
+
+    // operator= (Move)
+    template<
+        typename ValueType,
+        ScalingType scalingType>
+    inline PixelImage<ValueType, scalingType> &PixelImage<ValueType, scalingType>::operator=(
+        PixelImage<ValueType, scalingType> &&other)
+    {
+        if(this == &other) {
+            return *this;
+        }
+
+        freeData(data, getValueCount());
+
+        width = other.width;
+        height = other.height;
+        numChannels = other.numChannels;
+        data = other.data;
 
-        size_t dataSize = width * height * numChannels * sizeof(PixelValueType);
-        memcpy(data, other.data, dataSize);
+        other.width = 0;
+        other.height = 0;
+        other.numChannels = 0;
+        other.data = nullptr;
 
         return *this;
     }
@@ -375,3 +617,6 @@ namespace ExPop
     }
 }
 
+// Format conversion needs the full PixelImage definition, but the
+// conversion constructor and operator=() need format conversion.
+#include "pixelimage_convert.h"
@@ -0,0 +1,449 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Non-virtual access to PixelImage data for the image kernels.
+
+// Pixel operations are written against a small "reader" or "writer"
+// interface (getWidth(), getHeight(), getChannelCount(), get() and
+// set()) instead of PixelImageBase directly. The typed versions read
+// straight out of the rows of a PixelImage with no virtual calls and
+// no edge handling, so the compiler can inline everything. The
+// virtual versions wrap any PixelImageBase and fall back to
+// getDouble()/setDouble().
+//
+// pixelImageDispatchReader() and pixelImageDispatchWriter() do the
+// type check once per image and hand the right one to a functor, so
+// each kernel gets instantiated for each common pixel type.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "pixelvalue.h"
+#include "pixelimagebase.h"
+#include "pixelimage.h"
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Read-only typed access to pixel data laid out as rows of
+    /// interleaved channels. Coordinates passed to get() must already
+    /// be in range.
+    template<typename PixelValueType>
+    class PixelImageTypedReader
+    {
+    public:
+
+        PixelImageTypedReader(
+            const PixelValueType *inData,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight,
+            PixelImage_Dimension inNumChannels,
+            size_t inRowStride);
+
+        PixelImage_Dimension getWidth() const;
+        PixelImage_Dimension getHeight() const;
+        PixelImage_Dimension getChannelCount() const;
+
+        /// Distance between rows, in values.
+        size_t getRowStride() const;
+
+        /// Pointer to the first value of a row.
+        const PixelValueType *getRow(PixelImage_Coordinate y) const;
+
+        /// Get a single value, scaled to a double the same way
+        /// PixelImageBase::getDouble() would.
+        double get(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Coordinate channel) const;
+
+    protected:
+
+        const PixelValueType *data;
+        PixelImage_Dimension width;
+        PixelImage_Dimension height;
+        PixelImage_Dimension numChannels;
+        size_t rowStride;
+    };
+
+    /// Read/write typed access to pixel data. Same rules as
+    /// PixelImageTypedReader.
+    template<typename PixelValueType>
+    class PixelImageTypedWriter : public PixelImageTypedReader<PixelValueType>
+    {
+    public:
+
+        PixelImageTypedWriter(
+            PixelValueType *inData,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight,
+            PixelImage_Dimension inNumChannels,
+            size_t inRowStride);
+
+        /// Pointer to the first value of a row.
+        PixelValueType *getRow(PixelImage_Coordinate y) const;
+
+        /// Set a single value from a double, with the same clamping
+        /// and rounding as PixelImageBase::setDouble().
+        void set(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Coordinate channel,
+            double value) const;
+    };
+
+    /// Reader for images with a type we don't know about. Goes
+    /// through getDouble() for everything.
+    class PixelImageVirtualReader
+    {
+    public:
+
+        PixelImageVirtualReader(const PixelImageBase &inImage);
+
+        PixelImage_Dimension getWidth() const;
+        PixelImage_Dimension getHeight() const;
+        PixelImage_Dimension getChannelCount() const;
+
+        double get(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Coordinate channel) const;
+
+    protected:
+
+        const PixelImageBase *image;
+    };
+
+    /// Writer for images with a type we don't know about. Goes
+    /// through getDouble() and setDouble() for everything.
+    class PixelImageVirtualWriter : public PixelImageVirtualReader
+    {
+    public:
+
+        PixelImageVirtualWriter(PixelImageBase &inImage);
+
+        void set(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Coordinate channel,
+            double value) const;
+
+    private:
+
+        PixelImageBase *writableImage;
+    };
+
+    /// Make a typed reader for a whole image.
+    template<typename ValueType, ScalingType scalingType>
+    PixelImageTypedReader<PixelValue<ValueType, scalingType> > pixelImageMakeReader(
+        const PixelImage<ValueType, scalingType> &image);
+
+    /// Make a typed writer for a whole image.
+    template<typename ValueType, ScalingType scalingType>
+    PixelImageTypedWriter<PixelValue<ValueType, scalingType> > pixelImageMakeWriter(
+        PixelImage<ValueType, scalingType> &image);
+
+    /// Figure out what the image actually is and call func with the
+    /// best reader for it. func needs a templated operator() that
+    /// takes a const reference to any reader type. Images with types
+    /// other than the common ones get a PixelImageVirtualReader.
+    template<typename FuncType>
+    void pixelImageDispatchReader(const PixelImageBase &image, FuncType &func);
+
+    /// Same as pixelImageDispatchReader(), for writers.
+    template<typename FuncType>
+    void pixelImageDispatchWriter(PixelImageBase &image, FuncType &func);
+
+    /// Apply an edge mode to a single coordinate, exactly the way
+    /// PixelImageBase::findIndex() does. size must be non-zero.
+    PixelImage_Coordinate pixelImageApplyEdgeMode(
+        PixelImage_Coordinate v,
+        PixelImage_Dimension size,
+        PixelImage_EdgeMode edgeMode);
+
+    /// Read a value from a reader with out-of-range x and y handled
+    /// by the edge mode. Equivalent to PixelImageBase::getDouble(),
+    /// except the channel must already be in range.
+    template<typename ReaderType>
+    double pixelImageReadEdge(
+        const ReaderType &reader,
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Coordinate channel,
+        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Wrap);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    // ----------------------------------------------------------------------
+    // PixelImageTypedReader
+
+    template<typename PixelValueType>
+    inline PixelImageTypedReader<PixelValueType>::PixelImageTypedReader(
+        const PixelValueType *inData,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight,
+        PixelImage_Dimension inNumChannels,
+        size_t inRowStride) :
+        data(inData),
+        width(inWidth),
+        height(inHeight),
+        numChannels(inNumChannels),
+        rowStride(inRowStride)
+    {
+    }
+
+    template<typename PixelValueType>
+    inline PixelImage_Dimension PixelImageTypedReader<PixelValueType>::getWidth() const
+    {
+        return width;
+    }
+
+    template<typename PixelValueType>
+    inline PixelImage_Dimension PixelImageTypedReader<PixelValueType>::getHeight() const
+    {
+        return height;
+    }
+
+    template<typename PixelValueType>
+    inline PixelImage_Dimension PixelImageTypedReader<PixelValueType>::getChannelCount() const
+    {
+        return numChannels;
+    }
+
+    template<typename PixelValueType>
+    inline size_t PixelImageTypedReader<PixelValueType>::getRowStride() const
+    {
+        return rowStride;
+    }
+
+    template<typename PixelValueType>
+    inline const PixelValueType *PixelImageTypedReader<PixelValueType>::getRow(
+        PixelImage_Coordinate y) const
+    {
+        assert(y >= 0 && y < height);
+        return data + size_t(y) * rowStride;
+    }
+
+    template<typename PixelValueType>
+    inline double PixelImageTypedReader<PixelValueType>::get(
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Coordinate channel) const
+    {
+        assert(x >= 0 && x < width);
+        assert(channel >= 0 && channel < numChannels);
+        return getRow(y)[size_t(x) * size_t(numChannels) + channel].template getScaledValue<double>();
+    }
+
+    // ----------------------------------------------------------------------
+    // PixelImageTypedWriter
+
+    template<typename PixelValueType>
+    inline PixelImageTypedWriter<PixelValueType>::PixelImageTypedWriter(
+        PixelValueType *inData,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight,
+        PixelImage_Dimension inNumChannels,
+        size_t inRowStride) :
+        PixelImageTypedReader<PixelValueType>(
+            inData, inWidth, inHeight, inNumChannels, inRowStride)
+    {
+    }
+
+    template<typename PixelValueType>
+    inline PixelValueType *PixelImageTypedWriter<PixelValueType>::getRow(
+        PixelImage_Coordinate y) const
+    {
+        // We were constructed from a non-const pointer, so this is
+        // fine.
+        return const_cast<PixelValueType*>(
+            PixelImageTypedReader<PixelValueType>::getRow(y));
+    }
+
+    template<typename PixelValueType>
+    inline void PixelImageTypedWriter<PixelValueType>::set(
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Coordinate channel,
+        double value) const
+    {
+        assert(x >= 0 && x < this->width);
+        assert(channel >= 0 && channel < this->numChannels);
+        getRow(y)[size_t(x) * size_t(this->numChannels) + channel].template setScaledValue<double>(value);
+    }
+
+    // ----------------------------------------------------------------------
+    // PixelImageVirtualReader
+
+    inline PixelImageVirtualReader::PixelImageVirtualReader(const PixelImageBase &inImage) :
+        image(&inImage)
+    {
+    }
+
+    inline PixelImage_Dimension PixelImageVirtualReader::getWidth() const
+    {
+        return image->getWidth();
+    }
+
+    inline PixelImage_Dimension PixelImageVirtualReader::getHeight() const
+    {
+        return image->getHeight();
+    }
+
+    inline PixelImage_Dimension PixelImageVirtualReader::getChannelCount() const
+    {
+        return image->getChannelCount();
+    }
+
+    inline double PixelImageVirtualReader::get(
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Coordinate channel) const
+    {
+        return image->getDouble(x, y, channel);
+    }
+
+    // ----------------------------------------------------------------------
+    // PixelImageVirtualWriter
+
+    inline PixelImageVirtualWriter::PixelImageVirtualWriter(PixelImageBase &inImage) :
+        PixelImageVirtualReader(inImage),
+        writableImage(&inImage)
+    {
+    }
+
+    inline void PixelImageVirtualWriter::set(
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Coordinate channel,
+        double value) const
+    {
+        writableImage->setDouble(x, y, channel, value);
+    }
+
+    // ----------------------------------------------------------------------
+    // Reader/writer creation and dispatch
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageTypedReader<PixelValue<ValueType, scalingType> > pixelImageMakeReader(
+        const PixelImage<ValueType, scalingType> &image)
+    {
+        return PixelImageTypedReader<PixelValue<ValueType, scalingType> >(
+            image.getHeight() ? image.getRow(0) : nullptr,
+            image.getWidth(), image.getHeight(), image.getChannelCount(),
+            image.getRowStride());
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageTypedWriter<PixelValue<ValueType, scalingType> > pixelImageMakeWriter(
+        PixelImage<ValueType, scalingType> &image)
+    {
+        return PixelImageTypedWriter<PixelValue<ValueType, scalingType> >(
+            image.getHeight() ? image.getRow(0) : nullptr,
+            image.getWidth(), image.getHeight(), image.getChannelCount(),
+            image.getRowStride());
+    }
+
+    // EXPOP_PIXELIMAGE_DISPATCH_TYPES is in pixelimage.h.
+
+    template<typename FuncType>
+    inline void pixelImageDispatchReader(const PixelImageBase &image, FuncType &func)
+    {
+      #define EXPOP_PIXELIMAGE_DISPATCH_READER(type)                         \
+        if(const PixelImage<type> *typed = dynamic_cast<const PixelImage<type>*>(&image)) { \
+            func(pixelImageMakeReader(*typed));                             \
+            return;                                                         \
+        }
+
+        EXPOP_PIXELIMAGE_DISPATCH_TYPES(EXPOP_PIXELIMAGE_DISPATCH_READER)
+
+      #undef EXPOP_PIXELIMAGE_DISPATCH_READER
+
+        func(PixelImageVirtualReader(image));
+    }
+
+    template<typename FuncType>
+    inline void pixelImageDispatchWriter(PixelImageBase &image, FuncType &func)
+    {
+      #define EXPOP_PIXELIMAGE_DISPATCH_WRITER(type)                         \
+        if(PixelImage<type> *typed = dynamic_cast<PixelImage<type>*>(&image)) { \
+            func(pixelImageMakeWriter(*typed));                             \
+            return;                                                         \
+        }
+
+        EXPOP_PIXELIMAGE_DISPATCH_TYPES(EXPOP_PIXELIMAGE_DISPATCH_WRITER)
+
+      #undef EXPOP_PIXELIMAGE_DISPATCH_WRITER
+
+        func(PixelImageVirtualWriter(image));
+    }
+
+    inline PixelImage_Coordinate pixelImageApplyEdgeMode(
+        PixelImage_Coordinate v,
+        PixelImage_Dimension size,
+        PixelImage_EdgeMode edgeMode)
+    {
+        if(edgeMode == PixelImage_EdgeMode_Clamp) {
+            if(v < 0) return 0;
+            if(v >= size) return size - 1;
+            return v;
+        }
+
+        if(v < 0) v = size + (v % size);
+        if(v >= size) v = v % size;
+        return v;
+    }
+
+    template<typename ReaderType>
+    inline double pixelImageReadEdge(
+        const ReaderType &reader,
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Coordinate channel,
+        PixelImage_EdgeMode edgeMode)
+    {
+        return reader.get(
+            pixelImageApplyEdgeMode(x, reader.getWidth(), edgeMode),
+            pixelImageApplyEdgeMode(y, reader.getHeight(), edgeMode),
+            channel);
+    }
+}
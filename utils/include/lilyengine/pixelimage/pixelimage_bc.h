@@ -0,0 +1,958 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Block compression (BC1 through BC5, also known as DXT1, DXT3, DXT5,
+// and the two RGTC formats) for PixelImage<uint8_t>.
+//
+// Images map onto blocks like this: one channel is grey, copied into
+// red, green, and blue. Two channels are red and green, for normal
+// maps and such in BC5. Three is RGB, and four is RGBA. Decoding does
+// the reverse, and BC4 and BC5 decode to (R, 0, 0, 255) and (R, G, 0,
+// 255) like Direct3D does.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "pixelimage.h"
+#include "../simd.h"
+#include "../parallel.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Block-compressed formats. All of them store 4x4 pixel blocks,
+    /// left to right and then top to bottom.
+    enum PixelImage_BCFormat
+    {
+        /// RGB with optional 1-bit alpha, 8 bytes per block. (DXT1)
+        PixelImage_BCFormat_BC1,
+
+        /// RGB and 4-bit alpha, 16 bytes per block. (DXT3)
+        PixelImage_BCFormat_BC2,
+
+        /// RGB and interpolated alpha, 16 bytes per block. (DXT5)
+        PixelImage_BCFormat_BC3,
+
+        /// One channel, 8 bytes per block.
+        PixelImage_BCFormat_BC4,
+
+        /// Two channels, 16 bytes per block.
+        PixelImage_BCFormat_BC5
+    };
+
+    /// How hard the encoder tries.
+    enum PixelImage_BCQuality
+    {
+        /// Endpoints at the extremes of the block's colors along their
+        /// main axis.
+        PixelImage_BCQuality_RangeFit,
+
+        /// Least-squares endpoints for every way of splitting the
+        /// colors into palette entries along the main axis, and both
+        /// alpha modes. A few times slower, and never worse than
+        /// range fit.
+        PixelImage_BCQuality_ClusterFit
+    };
+
+    /// Bytes per 4x4 block.
+    size_t pixelImageGetBCBlockSize(PixelImage_BCFormat format);
+
+    /// Bytes for a whole image. Partial blocks at the right and
+    /// bottom edges count as whole ones.
+    size_t pixelImageGetBCDataSize(
+        PixelImage_BCFormat format,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height);
+
+    /// Decode one block into 16 RGBA pixels.
+    void pixelImageDecodeBCBlock(
+        PixelImage_BCFormat format,
+        const uint8_t *block,
+        uint8_t *rgba);
+
+    /// Encode 16 RGBA pixels into one block. BC1 uses its
+    /// transparent mode if any pixel's alpha is under 128.
+    void pixelImageEncodeBCBlock(
+        PixelImage_BCFormat format,
+        const uint8_t *rgba,
+        uint8_t *block,
+        PixelImage_BCQuality quality = PixelImage_BCQuality_RangeFit);
+
+    /// Decode into an image that's already the right size. Returns
+    /// false if there isn't enough data. Rows of blocks get split up
+    /// between threadCount threads (0 for every processor).
+    bool pixelImageDecodeBC(
+        PixelImage_BCFormat format,
+        const void *data, size_t length,
+        PixelImage<uint8_t> &img,
+        size_t threadCount = 1);
+
+    /// Decode into a new image, with four channels for BC1 to BC3,
+    /// one for BC4 and two for BC5. Returns nullptr if there isn't
+    /// enough data.
+    PixelImage<uint8_t> *pixelImageLoadBC(
+        PixelImage_BCFormat format,
+        const void *data, size_t length,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        size_t threadCount = 1);
+
+    /// Encode into caller memory, which needs to hold
+    /// pixelImageGetBCDataSize() bytes.
+    void pixelImageEncodeBC(
+        const PixelImage<uint8_t> &img,
+        PixelImage_BCFormat format,
+        uint8_t *out,
+        PixelImage_BCQuality quality = PixelImage_BCQuality_RangeFit,
+        size_t threadCount = 1);
+
+    /// Encode into a new buffer. Free it with delete[].
+    uint8_t *pixelImageSaveBC(
+        const PixelImage<uint8_t> &img,
+        PixelImage_BCFormat format,
+        size_t *length,
+        PixelImage_BCQuality quality = PixelImage_BCQuality_RangeFit,
+        size_t threadCount = 1);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    inline size_t pixelImageGetBCBlockSize(PixelImage_BCFormat format)
+    {
+        return (format == PixelImage_BCFormat_BC1 || format == PixelImage_BCFormat_BC4) ? 8 : 16;
+    }
+
+    inline size_t pixelImageGetBCDataSize(
+        PixelImage_BCFormat format,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height)
+    {
+        return size_t((width + 3) / 4) * size_t((height + 3) / 4) * pixelImageGetBCBlockSize(format);
+    }
+
+    // ----------------------------------------------------------------------
+    // Palettes. The encoder picks indices against exactly what the
+    // decoder will produce, so both go through these.
+
+    inline void pixelImageBCExpand565(uint16_t color, uint8_t *rgba)
+    {
+        // Copy the top bits into the bottom so 0 stays 0 and the
+        // maximum value turns into 255.
+        const uint32_t r = (color >> 11) & 31;
+        const uint32_t g = (color >> 5) & 63;
+        const uint32_t b = color & 31;
+        rgba[0] = uint8_t((r << 3) | (r >> 2));
+        rgba[1] = uint8_t((g << 2) | (g >> 4));
+        rgba[2] = uint8_t((b << 3) | (b >> 2));
+        rgba[3] = 255;
+    }
+
+    /// Build the four RGBA palette entries for a color block.
+    /// fourColor is forced on for everything but BC1, where it
+    /// depends on the endpoint order. In three-color mode the last
+    /// entry is transparent black.
+    inline void pixelImageBCMakeColorPalette(
+        uint16_t color0, uint16_t color1, bool fourColor,
+        uint8_t *palette)
+    {
+        pixelImageBCExpand565(color0, palette);
+        pixelImageBCExpand565(color1, palette + 4);
+
+        // Every interpolated value is a whole number over 3 or 2, so
+        // adding a half and truncating rounds exactly (ties up).
+        const SimdFloat4 c0 = SimdFloat4::loadBytes(palette);
+        const SimdFloat4 c1 = SimdFloat4::loadBytes(palette + 4);
+        const SimdFloat4 half = SimdFloat4::splat(0.5f);
+
+        if(fourColor) {
+            const SimdFloat4 third = SimdFloat4::splat(1.0f / 3.0f);
+            const SimdFloat4 two = SimdFloat4::splat(2.0f);
+            ((c0 * two + c1) * third + half).storeBytes(palette + 8);
+            ((c0 + c1 * two) * third + half).storeBytes(palette + 12);
+        } else {
+            ((c0 + c1) * half + half).storeBytes(palette + 8);
+            memset(palette + 12, 0, 4);
+        }
+    }
+
+    /// Build the eight palette entries for an alpha (or BC4/BC5)
+    /// block.
+    inline void pixelImageBCMakeAlphaPalette(
+        uint8_t alpha0, uint8_t alpha1,
+        uint8_t *palette)
+    {
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+
+        if(alpha0 > alpha1) {
+            for(uint32_t i = 2; i < 8; i++) {
+                palette[i] = uint8_t(((8 - i) * alpha0 + (i - 1) * alpha1 + 3) / 7);
+            }
+        } else {
+            for(uint32_t i = 2; i < 6; i++) {
+                palette[i] = uint8_t(((6 - i) * alpha0 + (i - 1) * alpha1 + 2) / 5);
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    // ----------------------------------------------------------------------
+    // Block decoding
+
+    inline void pixelImageBCDecodeColorBlock(
+        const uint8_t *block, uint8_t *rgba, bool bc1)
+    {
+        const uint16_t color0 = uint16_t(block[0] | (block[1] << 8));
+        const uint16_t color1 = uint16_t(block[2] | (block[3] << 8));
+        const uint32_t indices =
+            uint32_t(block[4]) | (uint32_t(block[5]) << 8) |
+            (uint32_t(block[6]) << 16) | (uint32_t(block[7]) << 24);
+
+        uint8_t palette[16];
+        pixelImageBCMakeColorPalette(color0, color1, !bc1 || color0 > color1, palette);
+
+        for(uint32_t i = 0; i < 16; i++) {
+            memcpy(rgba + i * 4, palette + ((indices >> (i * 2)) & 3) * 4, 4);
+        }
+    }
+
+    /// Decode an alpha-style block into one channel of 16 RGBA
+    /// pixels.
+    inline void pixelImageBCDecodeAlphaBlock(
+        const uint8_t *block, uint8_t *rgba, size_t channel)
+    {
+        uint8_t palette[8];
+        pixelImageBCMakeAlphaPalette(block[0], block[1], palette);
+
+        uint64_t indices = 0;
+        for(size_t i = 0; i < 6; i++) {
+            indices |= uint64_t(block[2 + i]) << (i * 8);
+        }
+
+        for(uint32_t i = 0; i < 16; i++) {
+            rgba[i * 4 + channel] = palette[(indices >> (i * 3)) & 7];
+        }
+    }
+
+    inline void pixelImageDecodeBCBlock(
+        PixelImage_BCFormat format,
+        const uint8_t *block,
+        uint8_t *rgba)
+    {
+        switch(format) {
+
+            case PixelImage_BCFormat_BC1:
+                pixelImageBCDecodeColorBlock(block, rgba, true);
+                break;
+
+            case PixelImage_BCFormat_BC2:
+                pixelImageBCDecodeColorBlock(block + 8, rgba, false);
+                for(uint32_t i = 0; i < 16; i++) {
+                    rgba[i * 4 + 3] = uint8_t(((block[i / 2] >> ((i & 1) * 4)) & 15) * 17);
+                }
+                break;
+
+            case PixelImage_BCFormat_BC3:
+                pixelImageBCDecodeColorBlock(block + 8, rgba, false);
+                pixelImageBCDecodeAlphaBlock(block, rgba, 3);
+                break;
+
+            case PixelImage_BCFormat_BC4:
+            case PixelImage_BCFormat_BC5:
+                for(uint32_t i = 0; i < 16; i++) {
+                    rgba[i * 4 + 1] = 0;
+                    rgba[i * 4 + 2] = 0;
+                    rgba[i * 4 + 3] = 255;
+                }
+                pixelImageBCDecodeAlphaBlock(block, rgba, 0);
+                if(format == PixelImage_BCFormat_BC5) {
+                    pixelImageBCDecodeAlphaBlock(block + 8, rgba, 1);
+                }
+                break;
+        }
+    }
+
+    // ----------------------------------------------------------------------
+    // Color block encoding
+
+    inline uint16_t pixelImageBCPack565(const float *rgb)
+    {
+        const float scale[3] = { 31.0f, 63.0f, 31.0f };
+        uint32_t q[3];
+        for(size_t c = 0; c < 3; c++) {
+            float v = rgb[c] < 0.0f ? 0.0f : (rgb[c] > 255.0f ? 255.0f : rgb[c]);
+            q[c] = uint32_t(v * (scale[c] / 255.0f) + 0.5f);
+        }
+        return uint16_t((q[0] << 11) | (q[1] << 5) | q[2]);
+    }
+
+    /// Quantize endpoints, pick the best index for every pixel
+    /// against the real palette, and write the block. Returns the
+    /// squared error over the opaque pixels.
+    inline uint32_t pixelImageBCFinishColorBlock(
+        const uint8_t *rgba,
+        const bool *transparent,
+        const float *endpoint0,
+        const float *endpoint1,
+        bool bc1, bool threeColor,
+        uint8_t *block)
+    {
+        uint16_t color0 = pixelImageBCPack565(endpoint0);
+        uint16_t color1 = pixelImageBCPack565(endpoint1);
+
+        // Four-color mode on BC1 needs color0 > color1, and
+        // three-color mode needs the reverse. The other formats
+        // don't care, but go with four-color ordering anyway.
+        if(threeColor ? color0 > color1 : color0 < color1) {
+            std::swap(color0, color1);
+        }
+
+        const bool fourColor = !bc1 || color0 > color1;
+        uint8_t palette[16];
+        pixelImageBCMakeColorPalette(color0, color1, fourColor, palette);
+
+        uint32_t indices = 0;
+        uint32_t totalError = 0;
+
+        for(uint32_t i = 0; i < 16; i++) {
+
+            uint32_t best = 3;
+
+            if(!transparent[i]) {
+
+                uint32_t bestError = ~uint32_t(0);
+                const uint32_t paletteSize = fourColor ? 4 : 3;
+
+                for(uint32_t p = 0; p < paletteSize; p++) {
+                    uint32_t error = 0;
+                    for(uint32_t c = 0; c < 3; c++) {
+                        const int32_t d = int32_t(rgba[i * 4 + c]) - int32_t(palette[p * 4 + c]);
+                        error += uint32_t(d * d);
+                    }
+                    if(error < bestError) {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+
+                totalError += bestError;
+            }
+
+            indices |= best << (i * 2);
+        }
+
+        block[0] = uint8_t(color0 & 0xff);
+        block[1] = uint8_t(color0 >> 8);
+        block[2] = uint8_t(color1 & 0xff);
+        block[3] = uint8_t(color1 >> 8);
+        block[4] = uint8_t(indices & 0xff);
+        block[5] = uint8_t((indices >> 8) & 0xff);
+        block[6] = uint8_t((indices >> 16) & 0xff);
+        block[7] = uint8_t(indices >> 24);
+
+        return totalError;
+    }
+
+    /// Weight sums for one way of splitting a block's colors (sorted
+    /// along the main axis) into clusters, each cluster using one
+    /// palette entry. Clusters run [0, s0), [s0, s1), [s1, s2), and
+    /// [s2, count).
+    struct PixelImageBCClusterSplit
+    {
+        uint8_t s0;
+        uint8_t s1;
+        uint8_t s2;
+
+        float alpha2;
+        float beta2;
+        float alphaBeta;
+        float invDet;
+    };
+
+    /// Fill in a split. Returns false if it can't pin down both
+    /// endpoints.
+    inline bool pixelImageBCMakeClusterSplit(
+        size_t count, size_t s0, size_t s1, size_t s2, bool threeColor,
+        PixelImageBCClusterSplit &split)
+    {
+        const float n0 = float(s0);
+        const float n1 = float(s1 - s0);
+        const float n2 = float(s2 - s1);
+        const float n3 = float(count - s2);
+
+        split.s0 = uint8_t(s0);
+        split.s1 = uint8_t(s1);
+        split.s2 = uint8_t(s2);
+
+        if(threeColor) {
+            split.alpha2 = n0 + n1 * 0.25f;
+            split.beta2 = n1 * 0.25f + n2;
+            split.alphaBeta = n1 * 0.25f;
+        } else {
+            split.alpha2 = n0 + (n1 * 4.0f + n2) / 9.0f;
+            split.beta2 = (n1 + n2 * 4.0f) / 9.0f + n3;
+            split.alphaBeta = (n1 + n2) * 2.0f / 9.0f;
+        }
+
+        const float det = split.alpha2 * split.beta2 - split.alphaBeta * split.alphaBeta;
+        if(det < 1e-6f) {
+            return false;
+        }
+
+        split.invDet = 1.0f / det;
+        return true;
+    }
+
+    /// Every usable four-color split of a full block.
+    inline const std::vector<PixelImageBCClusterSplit> &pixelImageBCGetFullBlockSplits()
+    {
+        static const std::vector<PixelImageBCClusterSplit> splits = []() {
+            std::vector<PixelImageBCClusterSplit> ret;
+            PixelImageBCClusterSplit split;
+            for(size_t s0 = 0; s0 <= 16; s0++) {
+                for(size_t s1 = s0; s1 <= 16; s1++) {
+                    for(size_t s2 = s1; s2 <= 16; s2++) {
+                        if(pixelImageBCMakeClusterSplit(16, s0, s1, s2, false, split)) {
+                            ret.push_back(split);
+                        }
+                    }
+                }
+            }
+            return ret;
+        }();
+
+        return splits;
+    }
+
+    inline void pixelImageBCEncodeColorBlock(
+        const uint8_t *rgba,
+        uint8_t *block,
+        bool bc1,
+        PixelImage_BCQuality quality)
+    {
+        // BC1 can only do transparency in three-color mode.
+        bool transparent[16];
+        bool threeColor = false;
+        float colors[16][3];
+        size_t count = 0;
+
+        for(size_t i = 0; i < 16; i++) {
+            transparent[i] = bc1 && rgba[i * 4 + 3] < 128;
+            threeColor = threeColor || transparent[i];
+            if(!transparent[i]) {
+                for(size_t c = 0; c < 3; c++) {
+                    colors[count][c] = rgba[i * 4 + c];
+                }
+                count++;
+            }
+        }
+
+        if(!count) {
+            // Nothing visible at all.
+            const float black[3] = { 0.0f, 0.0f, 0.0f };
+            pixelImageBCFinishColorBlock(rgba, transparent, black, black, bc1, true, block);
+            return;
+        }
+
+        // Mean and covariance.
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for(size_t i = 0; i < count; i++) {
+            for(size_t c = 0; c < 3; c++) {
+                mean[c] += colors[i][c];
+            }
+        }
+        for(size_t c = 0; c < 3; c++) {
+            mean[c] /= float(count);
+        }
+
+        float covariance[3][3] = { { 0.0f } };
+        for(size_t i = 0; i < count; i++) {
+            const float d[3] = {
+                colors[i][0] - mean[0],
+                colors[i][1] - mean[1],
+                colors[i][2] - mean[2] };
+            for(size_t a = 0; a < 3; a++) {
+                for(size_t b = 0; b < 3; b++) {
+                    covariance[a][b] += d[a] * d[b];
+                }
+            }
+        }
+
+        // Main axis, by power iteration. Starting from the column with
+        // the largest variance instead of grey means colors varying at
+        // right angles to grey (red against green) don't come out as
+        // a zero vector on the first step.
+        size_t seedColumn = 0;
+        for(size_t a = 1; a < 3; a++) {
+            if(covariance[a][a] > covariance[seedColumn][seedColumn]) {
+                seedColumn = a;
+            }
+        }
+        float axis[3] = {
+            covariance[0][seedColumn],
+            covariance[1][seedColumn],
+            covariance[2][seedColumn] };
+        if(covariance[seedColumn][seedColumn] == 0.0f) {
+            // Solid color. Any axis will do.
+            axis[0] = axis[1] = axis[2] = 1.0f;
+        }
+        for(size_t iteration = 0; iteration < 8; iteration++) {
+            float next[3];
+            float largest = 0.0f;
+            for(size_t a = 0; a < 3; a++) {
+                next[a] =
+                    covariance[a][0] * axis[0] +
+                    covariance[a][1] * axis[1] +
+                    covariance[a][2] * axis[2];
+                largest = std::max(largest, std::fabs(next[a]));
+            }
+            if(largest == 0.0f) {
+                break;
+            }
+            for(size_t a = 0; a < 3; a++) {
+                axis[a] = next[a] / largest;
+            }
+        }
+
+        // Range fit. Endpoints at the extremes along the axis.
+        float projections[16];
+        float minProjection = 0.0f;
+        float maxProjection = 0.0f;
+        const float axisLengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        for(size_t i = 0; i < count; i++) {
+            projections[i] =
+                ((colors[i][0] - mean[0]) * axis[0] +
+                 (colors[i][1] - mean[1]) * axis[1] +
+                 (colors[i][2] - mean[2]) * axis[2]) / axisLengthSquared;
+            minProjection = i ? std::min(minProjection, projections[i]) : projections[i];
+            maxProjection = i ? std::max(maxProjection, projections[i]) : projections[i];
+        }
+
+        float endpoint0[3];
+        float endpoint1[3];
+        for(size_t c = 0; c < 3; c++) {
+            endpoint0[c] = mean[c] + axis[c] * maxProjection;
+            endpoint1[c] = mean[c] + axis[c] * minProjection;
+        }
+
+        uint32_t bestError = pixelImageBCFinishColorBlock(
+            rgba, transparent, endpoint0, endpoint1, bc1, threeColor, block);
+
+        if(quality != PixelImage_BCQuality_ClusterFit || !bestError) {
+            return;
+        }
+
+        // Cluster fit. With the colors sorted along the axis, try
+        // every split into palette entries, solving for the best
+        // endpoints each time. Endpoint 0 has weight 1 in the first
+        // cluster and 0 in the last.
+        size_t order[16];
+        for(size_t i = 0; i < count; i++) {
+            order[i] = i;
+        }
+        std::sort(order, order + count, [&projections](size_t a, size_t b) {
+            return projections[a] > projections[b];
+        });
+
+        // Running sums of colors in sorted order. The fourth lane
+        // stays zero.
+        SimdFloat4 prefix[17];
+        prefix[0] = SimdFloat4::splat(0.0f);
+        for(size_t i = 0; i < count; i++) {
+            const float *color = colors[order[i]];
+            prefix[i + 1] = prefix[i] + SimdFloat4::set(color[0], color[1], color[2], 0.0f);
+        }
+
+        // Full blocks in four-color mode (nearly all of them) use the
+        // shared table. Three-color mode has few enough splits to
+        // work out here.
+        PixelImageBCClusterSplit localSplits[153];
+        const PixelImageBCClusterSplit *splits = localSplits;
+        size_t splitCount = 0;
+
+        if(!threeColor) {
+            splits = &pixelImageBCGetFullBlockSplits()[0];
+            splitCount = pixelImageBCGetFullBlockSplits().size();
+        } else {
+            for(size_t s0 = 0; s0 <= count; s0++) {
+                for(size_t s1 = s0; s1 <= count; s1++) {
+                    if(pixelImageBCMakeClusterSplit(count, s0, s1, count, true, localSplits[splitCount])) {
+                        splitCount++;
+                    }
+                }
+            }
+        }
+
+        // In four-color mode the weights are 1, 2/3, 1/3 and 0, so
+        // the weighted sum of colors for endpoint 0 works out to
+        // (P[s0] + P[s1] + P[s2]) / 3. Three-color mode has weights 1,
+        // 1/2 and 0, for (P[s0] + P[s1]) / 2. Endpoint 1 gets the
+        // rest of the total.
+        const SimdFloat4 sumWeight = SimdFloat4::splat(threeColor ? 0.5f : 1.0f / 3.0f);
+        const SimdFloat4 lastSumWeight = SimdFloat4::splat(threeColor ? 0.0f : 1.0f / 3.0f);
+        const SimdFloat4 total = prefix[count];
+
+        // Snapping to the 5:6:5 grid here is q * 255 / 31 (or 63),
+        // which can be one off from the real bit-copying expansion.
+        // Good enough to compare splits.
+        const SimdFloat4 zero = SimdFloat4::splat(0.0f);
+        const SimdFloat4 max255 = SimdFloat4::splat(255.0f);
+        const SimdFloat4 half = SimdFloat4::splat(0.5f);
+        const SimdFloat4 two = SimdFloat4::splat(2.0f);
+        const SimdFloat4 toGrid = SimdFloat4::set(31.0f / 255.0f, 63.0f / 255.0f, 31.0f / 255.0f, 0.0f);
+        const SimdFloat4 fromGrid = SimdFloat4::set(255.0f / 31.0f, 255.0f / 63.0f, 255.0f / 31.0f, 0.0f);
+
+        float bestClusterError = 0.0f;
+        bool foundCluster = false;
+        SimdFloat4 best0;
+        SimdFloat4 best1;
+
+        for(size_t i = 0; i < splitCount; i++) {
+
+            const PixelImageBCClusterSplit &split = splits[i];
+
+            const SimdFloat4 alphaX = (prefix[split.s0] + prefix[split.s1]) * sumWeight + prefix[split.s2] * lastSumWeight;
+            const SimdFloat4 betaX = total - alphaX;
+
+            const SimdFloat4 alpha2 = SimdFloat4::splat(split.alpha2);
+            const SimdFloat4 beta2 = SimdFloat4::splat(split.beta2);
+            const SimdFloat4 alphaBeta = SimdFloat4::splat(split.alphaBeta);
+            const SimdFloat4 invDet = SimdFloat4::splat(split.invDet);
+
+            SimdFloat4 e0 = (alphaX * beta2 - betaX * alphaBeta) * invDet;
+            SimdFloat4 e1 = (betaX * alpha2 - alphaX * alphaBeta) * invDet;
+            e0 = simdTruncate(simdMin(simdMax(e0, zero), max255) * toGrid + half) * fromGrid;
+            e1 = simdTruncate(simdMin(simdMax(e1, zero), max255) * toGrid + half) * fromGrid;
+
+            // Squared error, minus the sum of squared colors, which
+            // is the same for every split.
+            const SimdFloat4 errors =
+                e0 * e0 * alpha2 + e1 * e1 * beta2 +
+                (e0 * e1 * alphaBeta - e0 * alphaX - e1 * betaX) * two;
+
+            float lanes[4];
+            errors.store(lanes);
+            const float error = lanes[0] + lanes[1] + lanes[2];
+
+            if(!foundCluster || error < bestClusterError) {
+                foundCluster = true;
+                bestClusterError = error;
+                best0 = e0;
+                best1 = e1;
+            }
+        }
+
+        if(foundCluster) {
+            float endpoints[2][4];
+            best0.store(endpoints[0]);
+            best1.store(endpoints[1]);
+            uint8_t clusterBlock[8];
+            const uint32_t clusterError = pixelImageBCFinishColorBlock(
+                rgba, transparent, endpoints[0], endpoints[1], bc1, threeColor, clusterBlock);
+            if(clusterError < bestError) {
+                memcpy(block, clusterBlock, 8);
+            }
+        }
+    }
+
+    // ----------------------------------------------------------------------
+    // Alpha block encoding
+
+    /// Write an alpha block with the given endpoints and the best
+    /// indices for them. Returns the squared error.
+    inline uint32_t pixelImageBCFinishAlphaBlock(
+        const uint8_t *rgba, size_t channel,
+        uint8_t alpha0, uint8_t alpha1,
+        uint8_t *block)
+    {
+        uint8_t palette[8];
+        pixelImageBCMakeAlphaPalette(alpha0, alpha1, palette);
+
+        uint64_t indices = 0;
+        uint32_t totalError = 0;
+
+        for(uint32_t i = 0; i < 16; i++) {
+            const int32_t value = rgba[i * 4 + channel];
+            uint32_t best = 0;
+            uint32_t bestError = ~uint32_t(0);
+            for(uint32_t p = 0; p < 8; p++) {
+                const int32_t d = value - int32_t(palette[p]);
+                if(uint32_t(d * d) < bestError) {
+                    bestError = uint32_t(d * d);
+                    best = p;
+                }
+            }
+            totalError += bestError;
+            indices |= uint64_t(best) << (i * 3);
+        }
+
+        block[0] = alpha0;
+        block[1] = alpha1;
+        for(size_t i = 0; i < 6; i++) {
+            block[2 + i] = uint8_t((indices >> (i * 8)) & 0xff);
+        }
+
+        return totalError;
+    }
+
+    inline void pixelImageBCEncodeAlphaBlock(
+        const uint8_t *rgba, size_t channel,
+        uint8_t *block,
+        PixelImage_BCQuality quality)
+    {
+        // Eight-value mode across the whole range.
+        uint8_t lowest = 255;
+        uint8_t highest = 0;
+
+        // Six-value mode only has to cover what 0 and 255 can't.
+        uint8_t innerLowest = 255;
+        uint8_t innerHighest = 0;
+
+        for(size_t i = 0; i < 16; i++) {
+            const uint8_t value = rgba[i * 4 + channel];
+            lowest = std::min(lowest, value);
+            highest = std::max(highest, value);
+            if(value != 0 && value != 255) {
+                innerLowest = std::min(innerLowest, value);
+                innerHighest = std::max(innerHighest, value);
+            }
+        }
+
+        const uint32_t error = pixelImageBCFinishAlphaBlock(rgba, channel, highest, lowest, block);
+
+        if(quality == PixelImage_BCQuality_ClusterFit && error && innerLowest <= innerHighest) {
+            uint8_t sixValueBlock[8];
+            if(pixelImageBCFinishAlphaBlock(rgba, channel, innerLowest, innerHighest, sixValueBlock) < error) {
+                memcpy(block, sixValueBlock, 8);
+            }
+        }
+    }
+
+    inline void pixelImageEncodeBCBlock(
+        PixelImage_BCFormat format,
+        const uint8_t *rgba,
+        uint8_t *block,
+        PixelImage_BCQuality quality)
+    {
+        switch(format) {
+
+            case PixelImage_BCFormat_BC1:
+                pixelImageBCEncodeColorBlock(rgba, block, true, quality);
+                break;
+
+            case PixelImage_BCFormat_BC2:
+                for(uint32_t i = 0; i < 8; i++) {
+                    const uint32_t low = (rgba[(i * 2) * 4 + 3] * 15 + 127) / 255;
+                    const uint32_t high = (rgba[(i * 2 + 1) * 4 + 3] * 15 + 127) / 255;
+                    block[i] = uint8_t(low | (high << 4));
+                }
+                pixelImageBCEncodeColorBlock(rgba, block + 8, false, quality);
+                break;
+
+            case PixelImage_BCFormat_BC3:
+                pixelImageBCEncodeAlphaBlock(rgba, 3, block, quality);
+                pixelImageBCEncodeColorBlock(rgba, block + 8, false, quality);
+                break;
+
+            case PixelImage_BCFormat_BC4:
+                pixelImageBCEncodeAlphaBlock(rgba, 0, block, quality);
+                break;
+
+            case PixelImage_BCFormat_BC5:
+                pixelImageBCEncodeAlphaBlock(rgba, 0, block, quality);
+                pixelImageBCEncodeAlphaBlock(rgba, 1, block + 8, quality);
+                break;
+        }
+    }
+
+    // ----------------------------------------------------------------------
+    // Whole images
+
+    inline bool pixelImageDecodeBC(
+        PixelImage_BCFormat format,
+        const void *data, size_t length,
+        PixelImage<uint8_t> &img,
+        size_t threadCount)
+    {
+        const size_t blockSize = pixelImageGetBCBlockSize(format);
+        const size_t blocksWide = (img.getWidth() + 3) / 4;
+        const size_t blocksHigh = (img.getHeight() + 3) / 4;
+
+        if(length < pixelImageGetBCDataSize(format, img.getWidth(), img.getHeight())) {
+            return false;
+        }
+
+        const size_t channelCount = img.getChannelCount() < 4 ? img.getChannelCount() : 4;
+        const uint8_t *blocks = (const uint8_t*)data;
+
+        parallelForChunks(
+            blocksHigh, parallelGetChunkSize(blocksHigh, threadCount, 4), threadCount,
+            [&](size_t begin, size_t end) {
+
+                uint8_t rgba[16 * 4];
+
+                for(size_t by = begin; by < end; by++) {
+                    for(size_t bx = 0; bx < blocksWide; bx++) {
+
+                        pixelImageDecodeBCBlock(format, blocks + (by * blocksWide + bx) * blockSize, rgba);
+
+                        // Clip partial blocks at the edges.
+                        const size_t x0 = bx * 4;
+                        const size_t y0 = by * 4;
+                        const size_t w = std::min<size_t>(4, img.getWidth() - x0);
+                        const size_t h = std::min<size_t>(4, img.getHeight() - y0);
+
+                        for(size_t y = 0; y < h; y++) {
+
+                            // PixelValue holds nothing but the value
+                            // itself.
+                            uint8_t *row = reinterpret_cast<uint8_t*>(img.getRow(y0 + y)) +
+                                x0 * img.getChannelCount();
+
+                            if(img.getChannelCount() == 4) {
+                                memcpy(row, rgba + y * 16, w * 4);
+                            } else {
+                                for(size_t x = 0; x < w; x++) {
+                                    memcpy(row + x * img.getChannelCount(), rgba + (y * 4 + x) * 4, channelCount);
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+
+        return true;
+    }
+
+    inline PixelImage<uint8_t> *pixelImageLoadBC(
+        PixelImage_BCFormat format,
+        const void *data, size_t length,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        size_t threadCount)
+    {
+        if(width <= 0 || height <= 0) {
+            return nullptr;
+        }
+
+        const PixelImage_Dimension channelCount =
+            format == PixelImage_BCFormat_BC4 ? 1 :
+            format == PixelImage_BCFormat_BC5 ? 2 : 4;
+
+        PixelImage<uint8_t> *img = new PixelImage<uint8_t>(width, height, channelCount);
+        if(!pixelImageDecodeBC(format, data, length, *img, threadCount)) {
+            delete img;
+            return nullptr;
+        }
+
+        return img;
+    }
+
+    inline void pixelImageEncodeBC(
+        const PixelImage<uint8_t> &img,
+        PixelImage_BCFormat format,
+        uint8_t *out,
+        PixelImage_BCQuality quality,
+        size_t threadCount)
+    {
+        const size_t blockSize = pixelImageGetBCBlockSize(format);
+        const size_t blocksWide = (img.getWidth() + 3) / 4;
+        const size_t blocksHigh = (img.getHeight() + 3) / 4;
+        const size_t channelCount = img.getChannelCount();
+
+        parallelForChunks(
+            blocksHigh, parallelGetChunkSize(blocksHigh, threadCount, 1), threadCount,
+            [&](size_t begin, size_t end) {
+
+                uint8_t rgba[16 * 4];
+
+                for(size_t by = begin; by < end; by++) {
+                    for(size_t bx = 0; bx < blocksWide; bx++) {
+
+                        // Gather the block, repeating the last row and
+                        // column for partial blocks at the edges.
+                        for(size_t y = 0; y < 4; y++) {
+
+                            const PixelImage_Coordinate sy = std::min<PixelImage_Coordinate>(by * 4 + y, img.getHeight() - 1);
+                            const uint8_t *row = reinterpret_cast<const uint8_t*>(img.getRow(sy));
+
+                            for(size_t x = 0; x < 4; x++) {
+
+                                const PixelImage_Coordinate sx = std::min<PixelImage_Coordinate>(bx * 4 + x, img.getWidth() - 1);
+                                const uint8_t *src = row + sx * channelCount;
+                                uint8_t *dst = rgba + (y * 4 + x) * 4;
+
+                                if(channelCount >= 4) {
+                                    memcpy(dst, src, 4);
+                                } else {
+                                    dst[0] = src[0];
+                                    dst[1] = channelCount == 1 ? src[0] : src[1];
+                                    dst[2] = channelCount == 1 ? src[0] : (channelCount == 3 ? src[2] : 0);
+                                    dst[3] = 255;
+                                }
+                            }
+                        }
+
+                        pixelImageEncodeBCBlock(format, rgba, out + (by * blocksWide + bx) * blockSize, quality);
+                    }
+                }
+            });
+    }
+
+    inline uint8_t *pixelImageSaveBC(
+        const PixelImage<uint8_t> &img,
+        PixelImage_BCFormat format,
+        size_t *length,
+        PixelImage_BCQuality quality,
+        size_t threadCount)
+    {
+        *length = pixelImageGetBCDataSize(format, img.getWidth(), img.getHeight());
+        uint8_t *out = new uint8_t[*length];
+        pixelImageEncodeBC(img, format, out, quality, threadCount);
+        return out;
+    }
+}
@@ -38,6 +38,12 @@
 #pragma once
 
 #include "pixelimagebase.h"
+#include "pixelimage_access.h"
+#include "../parallel.h"
+#include "../simd.h"
+
+#include <cstring>
+#include <cstdint>
 
 // ----------------------------------------------------------------------
 // Declarations and documentation
@@ -45,12 +51,36 @@
 
 namespace ExPop
 {
+    /// How pixelImageBlit combines source and destination.
+    enum PixelImage_BlendMode
+    {
+        /// dst = dst * (1 - alpha) + src * alpha, on every channel
+        /// except the alpha channel, which keeps the destination's
+        /// value.
+        PixelImage_BlendMode_Straight,
+
+        /// Source is already multiplied by its alpha. dst = src + dst
+        /// * (1 - alpha), on every channel including alpha.
+        PixelImage_BlendMode_Premultiplied
+    };
+
     /// Blit from source to destination. Set alphaChannelIndex to -1
     /// to ignore alpha. wrapDst controls whether to wrap coordinates
     /// in the destination image (true) or just clip to the image
     /// edge. overrideAlpha comes into play only when
     /// alphaChannelIndex is -1, as the alpha value to use instead of
-    /// the image's own alpha channel.
+    /// the image's own alpha channel. Rows get split up between
+    /// threadCount threads (0 for every processor), except when src
+    /// and dst are the same image or wrapping would make rows
+    /// overlap, where it has to go in order.
+    ///
+    /// Some common cases skip the generic per-value path: same-format
+    /// opaque copies (alphaChannelIndex -1, overrideAlpha 1) are just
+    /// a memcpy per row, and 4-channel uint8_t and float images
+    /// blend a pixel at a time with SimdFloat4. The uint8_t path
+    /// gives exactly the same results as the generic path. The float
+    /// path does its math in single precision, so it can be off in
+    /// the last bit.
     void pixelImageBlit(
         const PixelImageBase &src,
         PixelImage_Coordinate src_left,
@@ -62,7 +92,31 @@ namespace ExPop
         PixelImage_Dimension height,
         PixelImage_Coordinate alphaChannelIndex = 3,
         double overrideAlpha = 1.0f,
-        bool wrapDst = false);
+        bool wrapDst = false,
+        PixelImage_BlendMode blendMode = PixelImage_BlendMode_Straight,
+        size_t threadCount = 1);
+
+    /// pixelImageBlit() between typed readers and writers, like a
+    /// PixelImageView of one rectangle of an atlas, or a view of
+    /// memory the caller owns. Coordinates and wrapping are relative
+    /// to the views. Views of the same memory are fine, but run on
+    /// one thread and skip the fast paths, like blitting an image
+    /// onto itself.
+    template<typename SrcPixelValueType, typename DstPixelValueType>
+    void pixelImageBlit(
+        const PixelImageTypedReader<SrcPixelValueType> &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<DstPixelValueType> &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex = 3,
+        double overrideAlpha = 1.0f,
+        bool wrapDst = false,
+        PixelImage_BlendMode blendMode = PixelImage_BlendMode_Straight,
+        size_t threadCount = 1);
 }
 
 // ----------------------------------------------------------------------
@@ -71,52 +125,665 @@ namespace ExPop
 
 namespace ExPop
 {
-    inline void pixelImageBlit(
-        const PixelImageBase &src,
+    /// Clip a blit to the destination (unless wrapDst is set), then
+    /// call spanFunc(srcx, srcy, dstx, dsty, count) for every run of
+    /// pixels in a row where neither image wraps around. Rows get
+    /// split between threads, and spans within a row always go left
+    /// to right.
+    template<typename SpanFuncType>
+    inline void pixelImageBlitForEachSpan(
+        PixelImage_Dimension srcWidth,
+        PixelImage_Dimension srcHeight,
         PixelImage_Coordinate src_left,
         PixelImage_Coordinate src_top,
-        PixelImageBase &dst,
+        PixelImage_Dimension dstWidth,
+        PixelImage_Dimension dstHeight,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        bool wrapDst,
+        size_t threadCount,
+        const SpanFuncType &spanFunc)
+    {
+        // Blit-space area that's actually going to get drawn.
+        PixelImage_Coordinate x0 = 0;
+        PixelImage_Coordinate y0 = 0;
+        PixelImage_Coordinate x1 = width;
+        PixelImage_Coordinate y1 = height;
+
+        if(!wrapDst) {
+            if(dst_left < 0) x0 = -dst_left;
+            if(dst_top < 0) y0 = -dst_top;
+            if(dst_left + x1 > dstWidth) x1 = dstWidth - dst_left;
+            if(dst_top + y1 > dstHeight) y1 = dstHeight - dst_top;
+        }
+
+        if(x0 >= x1 || y0 >= y1) {
+            return;
+        }
+
+        const size_t rowCount = y1 - y0;
+
+        parallelForChunks(
+            rowCount, parallelGetChunkSize(rowCount, threadCount, 16), threadCount,
+            [&](size_t yBegin, size_t yEnd) {
+
+                for(PixelImage_Coordinate y = y0 + yBegin; y < y0 + PixelImage_Coordinate(yEnd); y++) {
+
+                    const PixelImage_Coordinate srcy = pixelImageApplyEdgeMode(
+                        y + src_top, srcHeight, PixelImage_EdgeMode_Wrap);
+                    const PixelImage_Coordinate dsty = pixelImageApplyEdgeMode(
+                        y + dst_top, dstHeight, PixelImage_EdgeMode_Wrap);
+
+                    PixelImage_Coordinate x = x0;
+                    while(x < x1) {
+
+                        const PixelImage_Coordinate srcx = pixelImageApplyEdgeMode(
+                            x + src_left, srcWidth, PixelImage_EdgeMode_Wrap);
+                        const PixelImage_Coordinate dstx = pixelImageApplyEdgeMode(
+                            x + dst_left, dstWidth, PixelImage_EdgeMode_Wrap);
+
+                        PixelImage_Coordinate count = x1 - x;
+                        if(count > srcWidth - srcx) count = srcWidth - srcx;
+                        if(count > dstWidth - dstx) count = dstWidth - dstx;
+
+                        spanFunc(srcx, srcy, dstx, dsty, count);
+
+                        x += count;
+                    }
+                }
+            });
+    }
+
+    /// The actual blit loop, for any reader and writer types. See
+    /// pixelimage_access.h. Only use more than one thread if no two
+    /// source rows land on the same destination row, and the source
+    /// and destination don't overlap.
+    template<typename ReaderType, typename WriterType>
+    inline void pixelImageBlit_kernel(
+        const ReaderType &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const WriterType &dst,
         PixelImage_Coordinate dst_left,
         PixelImage_Coordinate dst_top,
         PixelImage_Dimension width,
         PixelImage_Dimension height,
         PixelImage_Coordinate alphaChannelIndex,
         double overrideAlpha,
-        bool wrapDst)
+        bool wrapDst,
+        PixelImage_BlendMode blendMode = PixelImage_BlendMode_Straight,
+        size_t threadCount = 1)
     {
+        if(width <= 0 || height <= 0) {
+            return;
+        }
 
-        for(PixelImage_Coordinate x = 0; x < width; x++) {
-            for(PixelImage_Coordinate y = 0; y < height; y++) {
-                for(PixelImage_Coordinate c = 0; c < dst.getChannelCount(); c++) {
+        const PixelImage_Dimension dstChannelCount = dst.getChannelCount();
+        const PixelImage_Dimension srcChannelCount = src.getChannelCount();
+        const bool premultiplied = blendMode == PixelImage_BlendMode_Premultiplied;
 
-                    // Preserve destination alpha channel.
-                    if(c == alphaChannelIndex) {
-                        continue;
-                    }
+        // Source reads always wrap, channels included, like
+        // getDouble() does by default.
+        const PixelImage_Coordinate srcAlphaChannel = alphaChannelIndex == -1 ? -1 :
+            pixelImageApplyEdgeMode(alphaChannelIndex, srcChannelCount, PixelImage_EdgeMode_Wrap);
 
-                    PixelImage_Coordinate dstx = x + dst_left;
-                    PixelImage_Coordinate dsty = y + dst_top;
+        pixelImageBlitForEachSpan(
+            src.getWidth(), src.getHeight(), src_left, src_top,
+            dst.getWidth(), dst.getHeight(), dst_left, dst_top,
+            width, height, wrapDst, threadCount,
+            [&](PixelImage_Coordinate srcx, PixelImage_Coordinate srcy,
+                PixelImage_Coordinate dstx, PixelImage_Coordinate dsty,
+                PixelImage_Coordinate count)
+            {
+                for(PixelImage_Coordinate i = 0; i < count; i++) {
 
-                    if(wrapDst || (
-                            (dstx >= 0 && dstx < dst.getWidth()) &&
-                            (dsty >= 0 && dsty < dst.getHeight())))
-                    {
-                        double alpha = alphaChannelIndex == -1 ? overrideAlpha :
-                            src.getDouble(x + src_left, y + src_top, alphaChannelIndex);
+                    double alpha = srcAlphaChannel == -1 ? overrideAlpha :
+                        src.get(srcx + i, srcy, srcAlphaChannel);
 
-                        double srcVal =
-                            src.getDouble(x + src_left, y + src_top, c);
+                    for(PixelImage_Coordinate c = 0; c < dstChannelCount; c++) {
 
-                        double dstVal =
-                            dst.getDouble(x + dst_left, y + dst_top, c);
+                        // Preserve destination alpha channel.
+                        if(!premultiplied && c == alphaChannelIndex) {
+                            continue;
+                        }
 
-                        dst.setDouble(dstx, dsty, c, dstVal * (1.0f - alpha) + srcVal * alpha);
+                        double srcVal = src.get(
+                            srcx + i, srcy,
+                            pixelImageApplyEdgeMode(c, srcChannelCount, PixelImage_EdgeMode_Wrap));
+
+                        double dstVal = dst.get(dstx + i, dsty, c);
+
+                        dst.set(dstx + i, dsty, c, premultiplied ?
+                            srcVal + dstVal * (1.0f - alpha) :
+                            dstVal * (1.0f - alpha) + srcVal * alpha);
                     }
                 }
+            });
+    }
+
+    /// Blend a span of RGBA8 pixels. alphaFromSource picks between
+    /// the source's alpha channel and constantAlpha (0 to 255, must
+    /// be a whole number). Results match the generic path exactly:
+    /// every sum here is a whole number, and n / 255 is never
+    /// exactly halfway between two integers, so the float error
+    /// can't change which way it rounds.
+    template<bool alphaFromSource, bool premultiplied>
+    inline void pixelImageBlendSpan4(
+        const uint8_t *src,
+        uint8_t *dst,
+        size_t count,
+        float constantAlpha)
+    {
+        const SimdFloat4 one255 = SimdFloat4::splat(255.0f);
+        const SimdFloat4 inv255 = SimdFloat4::splat(1.0f / 255.0f);
+        const SimdFloat4 half = SimdFloat4::splat(0.5f);
+
+        // Straight alpha with a real alpha channel keeps the
+        // destination's alpha.
+        const bool keepAlpha = alphaFromSource && !premultiplied;
+        const SimdFloat4 colorMask = SimdFloat4::set(1.0f, 1.0f, 1.0f, keepAlpha ? 0.0f : 1.0f);
+        const SimdFloat4 alphaMask = SimdFloat4::set(0.0f, 0.0f, 0.0f, keepAlpha ? 1.0f : 0.0f);
+
+        SimdFloat4 alpha = SimdFloat4::splat(constantAlpha);
+
+        for(size_t i = 0; i < count; i++) {
+
+            const SimdFloat4 s = SimdFloat4::loadBytes(src + i * 4);
+            const SimdFloat4 d = SimdFloat4::loadBytes(dst + i * 4);
+
+            if(alphaFromSource) {
+                alpha = simdSplatLane<3>(s);
             }
+
+            SimdFloat4 n = premultiplied ?
+                s * one255 + d * (one255 - alpha) :
+                d * (one255 - alpha) + s * alpha;
+
+            SimdFloat4 r = n * inv255 * colorMask + d * alphaMask + half;
+            r.storeBytes(dst + i * 4);
         }
+    }
 
+    /// Blend a span of four-channel float pixels. constantAlpha is 0
+    /// to 1 here.
+    template<bool alphaFromSource, bool premultiplied>
+    inline void pixelImageBlendSpan4(
+        const float *src,
+        float *dst,
+        size_t count,
+        float constantAlpha)
+    {
+        const SimdFloat4 one = SimdFloat4::splat(1.0f);
 
+        const bool keepAlpha = alphaFromSource && !premultiplied;
+        const SimdFloat4 colorMask = SimdFloat4::set(1.0f, 1.0f, 1.0f, keepAlpha ? 0.0f : 1.0f);
+        const SimdFloat4 alphaMask = SimdFloat4::set(0.0f, 0.0f, 0.0f, keepAlpha ? 1.0f : 0.0f);
+
+        SimdFloat4 alpha = SimdFloat4::splat(constantAlpha);
+
+        for(size_t i = 0; i < count; i++) {
+
+            const SimdFloat4 s = SimdFloat4::load(src + i * 4);
+            const SimdFloat4 d = SimdFloat4::load(dst + i * 4);
+
+            if(alphaFromSource) {
+                alpha = simdSplatLane<3>(s);
+            }
+
+            SimdFloat4 r = premultiplied ?
+                s + d * (one - alpha) :
+                d * (one - alpha) + s * alpha;
+
+            if(keepAlpha) {
+                r = r * colorMask + d * alphaMask;
+            }
+
+            r.store(dst + i * 4);
+        }
     }
-}
 
+    /// Opaque same-format copy. Returns false if the channel counts
+    /// don't match.
+    template<typename PixelValueType>
+    inline bool pixelImageBlit_copy(
+        const PixelImageTypedReader<PixelValueType> &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<PixelValueType> &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        bool wrapDst,
+        size_t threadCount)
+    {
+        if(src.getChannelCount() != dst.getChannelCount()) {
+            return false;
+        }
+
+        const size_t channelCount = dst.getChannelCount();
+
+        pixelImageBlitForEachSpan(
+            src.getWidth(), src.getHeight(), src_left, src_top,
+            dst.getWidth(), dst.getHeight(), dst_left, dst_top,
+            width, height, wrapDst, threadCount,
+            [&](PixelImage_Coordinate srcx, PixelImage_Coordinate srcy,
+                PixelImage_Coordinate dstx, PixelImage_Coordinate dsty,
+                PixelImage_Coordinate count)
+            {
+                memcpy(
+                    dst.getRow(dsty) + dstx * channelCount,
+                    src.getRow(srcy) + srcx * channelCount,
+                    count * channelCount * sizeof(PixelValueType));
+            });
+
+        return true;
+    }
+
+    /// Four-channel blend for uint8_t or float pixels. Returns false
+    /// if either side isn't four channels.
+    template<typename ValueType, bool alphaFromSource, bool premultiplied>
+    inline bool pixelImageBlit_rgba(
+        const PixelImageTypedReader<PixelValue<ValueType> > &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<PixelValue<ValueType> > &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        float constantAlpha,
+        bool wrapDst,
+        size_t threadCount)
+    {
+        if(src.getChannelCount() != 4 || dst.getChannelCount() != 4) {
+            return false;
+        }
+
+        pixelImageBlitForEachSpan(
+            src.getWidth(), src.getHeight(), src_left, src_top,
+            dst.getWidth(), dst.getHeight(), dst_left, dst_top,
+            width, height, wrapDst, threadCount,
+            [&](PixelImage_Coordinate srcx, PixelImage_Coordinate srcy,
+                PixelImage_Coordinate dstx, PixelImage_Coordinate dsty,
+                PixelImage_Coordinate count)
+            {
+                // PixelValue holds nothing but the value itself.
+                const ValueType *s = reinterpret_cast<const ValueType*>(src.getRow(srcy) + srcx * 4);
+                ValueType *d = reinterpret_cast<ValueType*>(dst.getRow(dsty) + dstx * 4);
+                pixelImageBlendSpan4<alphaFromSource, premultiplied>(s, d, count, constantAlpha);
+            });
+
+        return true;
+    }
+
+    /// Pick the right pixelImageBlit_rgba() for the alpha settings.
+    template<typename ValueType>
+    inline bool pixelImageBlit_rgbaDispatch(
+        const PixelImageTypedReader<PixelValue<ValueType> > &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<PixelValue<ValueType> > &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        float constantAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+        // Four-channel blends need alpha in the last channel, or no
+        // alpha channel at all.
+        if(alphaChannelIndex != 3 && alphaChannelIndex != -1) {
+            return false;
+        }
+
+        const bool alphaFromSource = alphaChannelIndex == 3;
+        const bool premultiplied = blendMode == PixelImage_BlendMode_Premultiplied;
+
+      #define EXPOP_PIXELIMAGE_BLIT_RGBA(fromSource, premult)                 \
+        pixelImageBlit_rgba<ValueType, fromSource, premult>(                \
+            src, src_left, src_top, dst, dst_left, dst_top,                 \
+            width, height, constantAlpha, wrapDst, threadCount)
+
+        const bool ret = alphaFromSource ?
+            (premultiplied ?
+                EXPOP_PIXELIMAGE_BLIT_RGBA(true, true) :
+                EXPOP_PIXELIMAGE_BLIT_RGBA(true, false)) :
+            (premultiplied ?
+                EXPOP_PIXELIMAGE_BLIT_RGBA(false, true) :
+                EXPOP_PIXELIMAGE_BLIT_RGBA(false, false));
+
+      #undef EXPOP_PIXELIMAGE_BLIT_RGBA
+
+        return ret;
+    }
+
+    /// Try the fast blit paths. Returns false if none of them fit and
+    /// the generic path has to do it. Different formats never have a
+    /// fast path.
+    template<typename SrcPixelValueType, typename DstPixelValueType>
+    inline bool pixelImageBlit_fast(
+        const PixelImageTypedReader<SrcPixelValueType> &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<DstPixelValueType> &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        double overrideAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+        return false;
+    }
+
+    /// Same format on both sides. Fully opaque with no alpha channel
+    /// is just a copy, in either blend mode.
+    template<typename PixelValueType>
+    inline bool pixelImageBlit_fast(
+        const PixelImageTypedReader<PixelValueType> &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<PixelValueType> &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        double overrideAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+        return alphaChannelIndex == -1 && overrideAlpha == 1.0 &&
+            pixelImageBlit_copy(src, src_left, src_top, dst, dst_left, dst_top, width, height, wrapDst, threadCount);
+    }
+
+    /// uint8_t on both sides. Copies, or four-channel blends.
+    inline bool pixelImageBlit_fast(
+        const PixelImageTypedReader<PixelValue<uint8_t> > &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<PixelValue<uint8_t> > &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        double overrideAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+        if(alphaChannelIndex == -1 && overrideAlpha == 1.0) {
+            return pixelImageBlit_copy(src, src_left, src_top, dst, dst_left, dst_top, width, height, wrapDst, threadCount);
+        }
+
+        // The 8-bit path is only exact for whole-number alphas out of
+        // 255.
+        const float alpha255 = float(overrideAlpha * 255.0);
+        const bool alpha255IsWhole =
+            alpha255 >= 0.0f && alpha255 <= 255.0f &&
+            alpha255 == float(int(alpha255));
+
+        return (alphaChannelIndex != -1 || alpha255IsWhole) &&
+            pixelImageBlit_rgbaDispatch<uint8_t>(
+                src, src_left, src_top, dst, dst_left, dst_top, width, height,
+                alphaChannelIndex, alpha255, wrapDst, blendMode, threadCount);
+    }
+
+    /// float on both sides. Copies, or four-channel blends.
+    inline bool pixelImageBlit_fast(
+        const PixelImageTypedReader<PixelValue<float> > &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<PixelValue<float> > &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        double overrideAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+        if(alphaChannelIndex == -1 && overrideAlpha == 1.0) {
+            return pixelImageBlit_copy(src, src_left, src_top, dst, dst_left, dst_top, width, height, wrapDst, threadCount);
+        }
+
+        return pixelImageBlit_rgbaDispatch<float>(
+            src, src_left, src_top, dst, dst_left, dst_top, width, height,
+            alphaChannelIndex, float(overrideAlpha), wrapDst, blendMode, threadCount);
+    }
+
+    /// True if two views could share any memory. Only the first
+    /// byte of the first row to the end of the last row is checked,
+    /// so views that just interleave rows count as overlapping.
+    template<typename SrcPixelValueType, typename DstPixelValueType>
+    inline bool pixelImageBlit_overlaps(
+        const PixelImageTypedReader<SrcPixelValueType> &src,
+        const PixelImageTypedReader<DstPixelValueType> &dst)
+    {
+        const uintptr_t srcBegin = uintptr_t(src.getRow(0));
+        const uintptr_t srcEnd = uintptr_t(src.getRow(src.getHeight() - 1) + size_t(src.getWidth()) * src.getChannelCount());
+        const uintptr_t dstBegin = uintptr_t(dst.getRow(0));
+        const uintptr_t dstEnd = uintptr_t(dst.getRow(dst.getHeight() - 1) + size_t(dst.getWidth()) * dst.getChannelCount());
+        return srcBegin < dstEnd && dstBegin < srcEnd;
+    }
+
+    /// Second half of the blit dispatch. Holds on to the source
+    /// reader while we figure out the destination type.
+    template<typename ReaderType>
+    struct PixelImageBlitDstFunc
+    {
+        const ReaderType *src;
+        PixelImage_Coordinate src_left;
+        PixelImage_Coordinate src_top;
+        PixelImage_Coordinate dst_left;
+        PixelImage_Coordinate dst_top;
+        PixelImage_Dimension width;
+        PixelImage_Dimension height;
+        PixelImage_Coordinate alphaChannelIndex;
+        double overrideAlpha;
+        bool wrapDst;
+        PixelImage_BlendMode blendMode;
+        size_t threadCount;
+
+        template<typename WriterType>
+        void operator()(const WriterType &dst)
+        {
+            pixelImageBlit_kernel(
+                *src, src_left, src_top,
+                dst, dst_left, dst_top,
+                width, height,
+                alphaChannelIndex, overrideAlpha, wrapDst,
+                blendMode, threadCount);
+        }
+    };
+
+    /// First half of the blit dispatch.
+    struct PixelImageBlitSrcFunc
+    {
+        PixelImageBase *dst;
+        PixelImage_Coordinate src_left;
+        PixelImage_Coordinate src_top;
+        PixelImage_Coordinate dst_left;
+        PixelImage_Coordinate dst_top;
+        PixelImage_Dimension width;
+        PixelImage_Dimension height;
+        PixelImage_Coordinate alphaChannelIndex;
+        double overrideAlpha;
+        bool wrapDst;
+        PixelImage_BlendMode blendMode;
+        size_t threadCount;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &src)
+        {
+            PixelImageBlitDstFunc<ReaderType> dstFunc;
+            dstFunc.src = &src;
+            dstFunc.src_left = src_left;
+            dstFunc.src_top = src_top;
+            dstFunc.dst_left = dst_left;
+            dstFunc.dst_top = dst_top;
+            dstFunc.width = width;
+            dstFunc.height = height;
+            dstFunc.alphaChannelIndex = alphaChannelIndex;
+            dstFunc.overrideAlpha = overrideAlpha;
+            dstFunc.wrapDst = wrapDst;
+            dstFunc.blendMode = blendMode;
+            dstFunc.threadCount = threadCount;
+            pixelImageDispatchWriter(*dst, dstFunc);
+        }
+    };
+
+    /// Try the fast blit paths on two images. Returns false if none
+    /// of them fit and the generic path has to do it.
+    inline bool pixelImageBlit_fast(
+        const PixelImageBase &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        PixelImageBase &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        double overrideAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+      #define EXPOP_PIXELIMAGE_BLIT_FAST(type)                               \
+        if(const PixelImage<type> *typedSrc = dynamic_cast<const PixelImage<type>*>(&src)) { \
+            PixelImage<type> *typedDst = dynamic_cast<PixelImage<type>*>(&dst); \
+            return typedDst && pixelImageBlit_fast(                         \
+                pixelImageMakeReader(*typedSrc), src_left, src_top,         \
+                pixelImageMakeWriter(*typedDst), dst_left, dst_top,         \
+                width, height,                                              \
+                alphaChannelIndex, overrideAlpha, wrapDst,                  \
+                blendMode, threadCount);                                    \
+        }
+
+        EXPOP_PIXELIMAGE_DISPATCH_TYPES(EXPOP_PIXELIMAGE_BLIT_FAST)
+
+      #undef EXPOP_PIXELIMAGE_BLIT_FAST
+
+        return false;
+    }
+
+    inline void pixelImageBlit(
+        const PixelImageBase &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        PixelImageBase &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        double overrideAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+        if(!src.getWidth() || !src.getHeight() ||
+            !dst.getWidth() || !dst.getHeight() ||
+            width <= 0 || height <= 0)
+        {
+            return;
+        }
+
+        // Rows have to go in order if one row can see another's
+        // results.
+        if(&src == &dst || (wrapDst && height > dst.getHeight())) {
+            threadCount = 1;
+        }
+
+        // The fast paths read whole spans before writing them, so
+        // they can't deal with the source and destination being the
+        // same memory.
+        if(&src != &dst && pixelImageBlit_fast(
+                src, src_left, src_top,
+                dst, dst_left, dst_top,
+                width, height,
+                alphaChannelIndex, overrideAlpha, wrapDst,
+                blendMode, threadCount))
+        {
+            return;
+        }
+
+        PixelImageBlitSrcFunc func;
+        func.dst = &dst;
+        func.src_left = src_left;
+        func.src_top = src_top;
+        func.dst_left = dst_left;
+        func.dst_top = dst_top;
+        func.width = width;
+        func.height = height;
+        func.alphaChannelIndex = alphaChannelIndex;
+        func.overrideAlpha = overrideAlpha;
+        func.wrapDst = wrapDst;
+        func.blendMode = blendMode;
+        func.threadCount = threadCount;
+
+        pixelImageDispatchReader(src, func);
+    }
+
+    template<typename SrcPixelValueType, typename DstPixelValueType>
+    inline void pixelImageBlit(
+        const PixelImageTypedReader<SrcPixelValueType> &src,
+        PixelImage_Coordinate src_left,
+        PixelImage_Coordinate src_top,
+        const PixelImageTypedWriter<DstPixelValueType> &dst,
+        PixelImage_Coordinate dst_left,
+        PixelImage_Coordinate dst_top,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Coordinate alphaChannelIndex,
+        double overrideAlpha,
+        bool wrapDst,
+        PixelImage_BlendMode blendMode,
+        size_t threadCount)
+    {
+        if(!src.getWidth() || !src.getHeight() ||
+            !dst.getWidth() || !dst.getHeight() ||
+            width <= 0 || height <= 0)
+        {
+            return;
+        }
+
+        // Same rules as the image version, except that two views can
+        // share memory without being the same object.
+        const bool overlaps = pixelImageBlit_overlaps(src, dst);
+        if(overlaps || (wrapDst && height > dst.getHeight())) {
+            threadCount = 1;
+        }
+
+        if(!overlaps && pixelImageBlit_fast(
+                src, src_left, src_top,
+                dst, dst_left, dst_top,
+                width, height,
+                alphaChannelIndex, overrideAlpha, wrapDst,
+                blendMode, threadCount))
+        {
+            return;
+        }
+
+        pixelImageBlit_kernel(
+            src, src_left, src_top,
+            dst, dst_left, dst_top,
+            width, height,
+            alphaChannelIndex, overrideAlpha, wrapDst,
+            blendMode, threadCount);
+    }
+}
@@ -0,0 +1,616 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Gaussian blur for PixelImage.
+
+// The Gaussian is done as two separable 1D passes (horizontal, then
+// vertical) over float copies of the data, in tiles so the
+// intermediate data stays small. For big radii, where even the
+// separable version gets slow, there's an approximation that does
+// three running-sum box blurs per axis instead, so the cost doesn't
+// depend on the radius at all.
+//
+// Both can split their work across threads: bands of rows for the
+// exact version, and rows then column strips for the box version.
+// Neither one's output depends on how the work gets split.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "pixelvalue.h"
+#include "pixelimagebase.h"
+#include "pixelimage.h"
+#include "pixelimage_access.h"
+#include "../simd.h"
+#include "../parallel.h"
+
+#include <vector>
+#include <cmath>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Which way to do a Gaussian blur.
+    enum PixelImage_BlurMode
+    {
+        /// Exact below pixelImageBlurBoxThreshold, box approximation
+        /// above it.
+        PixelImage_BlurMode_Auto,
+
+        /// Real Gaussian kernel. Cost is proportional to the radius.
+        PixelImage_BlurMode_Exact,
+
+        /// Three box blurs per axis. Cost doesn't depend on radius,
+        /// but it's only an approximation.
+        PixelImage_BlurMode_Box
+    };
+
+    /// Radius (in pixels, on either axis) where
+    /// PixelImage_BlurMode_Auto switches over to box blurs.
+    const float pixelImageBlurBoxThreshold = 16.0f;
+
+    /// Blur an image. The kernel extends radius_x and radius_y pixels
+    /// out (plus one), with a standard deviation of half the radius.
+    /// Returns a new image that the caller owns.
+    template<typename ValueType, ScalingType scalingType>
+    PixelImage<ValueType, scalingType> *pixelImageGaussianBlur(
+        PixelImageBase &img,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp,
+        PixelImage_BlurMode blurMode = PixelImage_BlurMode_Auto,
+        size_t threadCount = 1);
+
+    /// pixelImageGaussianBlur() into an image the caller already
+    /// has, which gets resized to match img. No allocation happens
+    /// if it's already the right size. out can't be img.
+    template<typename ValueType, ScalingType scalingType>
+    void pixelImageGaussianBlurInto(
+        const PixelImageBase &img,
+        PixelImage<ValueType, scalingType> &out,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp,
+        PixelImage_BlurMode blurMode = PixelImage_BlurMode_Auto,
+        size_t threadCount = 1);
+
+    /// Blur from any reader (see pixelimage_access.h) into an image
+    /// or typed writer that's already the same size as the reader.
+    /// Either side can be a PixelImageView, so this works on part of
+    /// an image without copying it out first, as long as the two
+    /// don't overlap. A threadCount of 0 uses every processor. Output
+    /// is the same for any number of threads.
+    template<typename ReaderType, typename WriterType>
+    void pixelImageGaussianBlur_kernel(
+        const ReaderType &img,
+        WriterType &&out,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode,
+        PixelImage_BlurMode blurMode = PixelImage_BlurMode_Auto,
+        size_t threadCount = 1);
+
+    /// Work out what PixelImage_BlurMode_Auto turns into for a pair
+    /// of radii. Other modes come back unchanged.
+    PixelImage_BlurMode pixelImageResolveBlurMode(
+        float radius_x,
+        float radius_y,
+        PixelImage_BlurMode blurMode);
+
+    /// How many pixels away from an output pixel a blur along one
+    /// axis can read from. blurMode must already be resolved.
+    PixelImage_Coordinate pixelImageGaussianBlurReach(
+        float radius,
+        PixelImage_BlurMode blurMode);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    // ----------------------------------------------------------------------
+    // Float row helpers
+
+    /// out[j] = sum(in[j + k * step] * weights[k]) for every j in
+    /// [0, count). Used for both the horizontal pass (step is the
+    /// channel count) and the vertical pass (step is a whole row).
+    inline void pixelImageConvolveFloats(
+        const float *in,
+        float *out,
+        size_t count,
+        size_t step,
+        const float *weights,
+        size_t taps)
+    {
+        size_t j = 0;
+
+        for(; j + 8 <= count; j += 8) {
+            SimdFloat4 acc0 = SimdFloat4::zero();
+            SimdFloat4 acc1 = SimdFloat4::zero();
+            const float *p = in + j;
+            for(size_t k = 0; k < taps; k++) {
+                SimdFloat4 w = SimdFloat4::splat(weights[k]);
+                acc0 = simdMulAdd(acc0, SimdFloat4::load(p), w);
+                acc1 = simdMulAdd(acc1, SimdFloat4::load(p + 4), w);
+                p += step;
+            }
+            acc0.store(out + j);
+            acc1.store(out + j + 4);
+        }
+
+        for(; j + 4 <= count; j += 4) {
+            SimdFloat4 acc = SimdFloat4::zero();
+            const float *p = in + j;
+            for(size_t k = 0; k < taps; k++) {
+                acc = simdMulAdd(acc, SimdFloat4::load(p), SimdFloat4::splat(weights[k]));
+                p += step;
+            }
+            acc.store(out + j);
+        }
+
+        for(; j < count; j++) {
+            float acc = 0.0f;
+            const float *p = in + j;
+            for(size_t k = 0; k < taps; k++) {
+                acc = acc + *p * weights[k];
+                p += step;
+            }
+            out[j] = acc;
+        }
+    }
+
+    /// Running-sum box blur over itemCount items of lanes floats
+    /// each, stored contiguously. Each lane gets blurred with the
+    /// matching lane of the items around it. acc needs room for
+    /// lanes floats.
+    inline void pixelImageBoxBlurItems(
+        const float *in,
+        float *out,
+        PixelImage_Dimension itemCount,
+        size_t lanes,
+        PixelImage_Coordinate radius,
+        PixelImage_EdgeMode edgeMode,
+        float *acc)
+    {
+        if(radius == 0) {
+            memcpy(out, in, sizeof(float) * lanes * size_t(itemCount));
+            return;
+        }
+
+        const float scale = 1.0f / float(radius * 2 + 1);
+        const SimdFloat4 scale4 = SimdFloat4::splat(scale);
+
+        // Fill up the window for the first item.
+        for(size_t l = 0; l < lanes; l++) {
+            acc[l] = 0.0f;
+        }
+        for(PixelImage_Coordinate d = -radius; d <= radius; d++) {
+            const float *item = in + size_t(pixelImageApplyEdgeMode(d, itemCount, edgeMode)) * lanes;
+            for(size_t l = 0; l < lanes; l++) {
+                acc[l] += item[l];
+            }
+        }
+
+        for(PixelImage_Coordinate i = 0; i < itemCount; i++) {
+
+            const float *leaving = in + size_t(pixelImageApplyEdgeMode(i - radius, itemCount, edgeMode)) * lanes;
+            const float *entering = in + size_t(pixelImageApplyEdgeMode(i + radius + 1, itemCount, edgeMode)) * lanes;
+            float *dst = out + size_t(i) * lanes;
+
+            size_t l = 0;
+            for(; l + 4 <= lanes; l += 4) {
+                SimdFloat4 a = SimdFloat4::load(acc + l);
+                (a * scale4).store(dst + l);
+                a = a + (SimdFloat4::load(entering + l) - SimdFloat4::load(leaving + l));
+                a.store(acc + l);
+            }
+            for(; l < lanes; l++) {
+                dst[l] = acc[l] * scale;
+                acc[l] = acc[l] + (entering[l] - leaving[l]);
+            }
+        }
+    }
+
+    /// Normalized 1D Gaussian weights for a radius. Taps start at
+    /// firstOffset pixels from the center.
+    inline void pixelImageMakeGaussianWeights(
+        float radius,
+        std::vector<float> &weights,
+        PixelImage_Coordinate &firstOffset)
+    {
+        if(!(radius > 0.0f)) {
+            // No blur at all on this axis.
+            weights.assign(1, 1.0f);
+            firstOffset = 0;
+            return;
+        }
+
+        const float sigma = 1.0f;
+        size_t intRadius = size_t(radius) + 1;
+        size_t diameter = intRadius * 2;
+
+        weights.resize(diameter);
+        float total = 0.0f;
+        for(size_t i = 0; i < diameter; i++) {
+            float delta = ((float(i) - float(intRadius)) / radius) * 2.0f;
+            weights[i] = powf(2.718281828459f, -(delta * delta) / (2.0f * sigma * sigma));
+            total += weights[i];
+        }
+        for(size_t i = 0; i < diameter; i++) {
+            weights[i] /= total;
+        }
+
+        firstOffset = -PixelImage_Coordinate(intRadius);
+    }
+
+    /// Radii for three box blurs in a row that come out close to a
+    /// Gaussian with the given standard deviation.
+    inline void pixelImageBoxRadiiForGaussian(
+        float sigma,
+        PixelImage_Coordinate *radii)
+    {
+        const int n = 3;
+        float idealWidth = sqrtf(12.0f * sigma * sigma / n + 1.0f);
+
+        int lowerWidth = int(floorf(idealWidth));
+        if(lowerWidth % 2 == 0) lowerWidth--;
+        if(lowerWidth < 1) lowerWidth = 1;
+        int upperWidth = lowerWidth + 2;
+
+        // How many of the passes use the smaller box.
+        float idealLowerCount =
+            (12.0f * sigma * sigma - n * lowerWidth * lowerWidth - 4.0f * n * lowerWidth - 3.0f * n) /
+            (-4.0f * lowerWidth - 4.0f);
+        int lowerCount = int(floorf(idealLowerCount + 0.5f));
+
+        for(int i = 0; i < n; i++) {
+            radii[i] = ((i < lowerCount ? lowerWidth : upperWidth) - 1) / 2;
+        }
+    }
+
+    // ----------------------------------------------------------------------
+    // Exact Gaussian
+
+    template<typename ReaderType, typename WriterType>
+    inline void pixelImageGaussianBlurExact_kernel(
+        const ReaderType &img,
+        WriterType &&out,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode,
+        size_t threadCount)
+    {
+        const PixelImage_Dimension width = img.getWidth();
+        const PixelImage_Dimension height = img.getHeight();
+        const size_t channelCount = img.getChannelCount();
+
+        if(!width || !height || !channelCount) {
+            return;
+        }
+
+        std::vector<float> weightsX;
+        std::vector<float> weightsY;
+        PixelImage_Coordinate offsetX = 0;
+        PixelImage_Coordinate offsetY = 0;
+        pixelImageMakeGaussianWeights(radius_x, weightsX, offsetX);
+        pixelImageMakeGaussianWeights(radius_y, weightsY, offsetY);
+        const PixelImage_Coordinate tapsX = PixelImage_Coordinate(weightsX.size());
+        const PixelImage_Coordinate tapsY = PixelImage_Coordinate(weightsY.size());
+
+        // Work in tiles big enough that the overlap between them
+        // isn't most of the work, but small enough that the
+        // horizontal pass results stay in cache for the vertical
+        // pass.
+        PixelImage_Dimension tileWidth = tapsX * 4 > 128 ? tapsX * 4 : 128;
+        PixelImage_Dimension bandHeight = tapsY * 2 > 32 ? tapsY * 2 : 32;
+        if(tileWidth > width) tileWidth = width;
+        if(bandHeight > height) bandHeight = height;
+
+        // Bands are independent, apart from reading some of the
+        // same source rows, so they get split up between threads.
+        const size_t bandCount = (height + bandHeight - 1) / bandHeight;
+
+        parallelForChunks(
+            bandCount, parallelGetChunkSize(bandCount, threadCount, 1), threadCount,
+            [&](size_t bandBegin, size_t bandEnd) {
+
+                std::vector<PixelImage_Coordinate> sourceColumns(tileWidth + tapsX - 1);
+                std::vector<float> paddedRow((tileWidth + tapsX - 1) * channelCount);
+                std::vector<float> horizontal((bandHeight + tapsY - 1) * tileWidth * channelCount);
+                std::vector<float> vertical(tileWidth * channelCount);
+
+                for(PixelImage_Coordinate band = bandBegin; band < PixelImage_Coordinate(bandEnd); band++) {
+
+                    const PixelImage_Coordinate y0 = band * bandHeight;
+                    const PixelImage_Coordinate y1 = y0 + bandHeight < height ? y0 + bandHeight : height;
+                    const PixelImage_Coordinate bandRows = (y1 - y0) + tapsY - 1;
+
+                    for(PixelImage_Coordinate x0 = 0; x0 < width; x0 += tileWidth) {
+
+                        const PixelImage_Coordinate x1 = x0 + tileWidth < width ? x0 + tileWidth : width;
+                        const size_t rowFloats = size_t(x1 - x0) * channelCount;
+                        const PixelImage_Coordinate paddedWidth = (x1 - x0) + tapsX - 1;
+
+                        for(PixelImage_Coordinate p = 0; p < paddedWidth; p++) {
+                            sourceColumns[p] = pixelImageApplyEdgeMode(x0 + offsetX + p, width, edgeMode);
+                        }
+
+                        // Horizontal pass, for every source row this
+                        // band needs.
+                        for(PixelImage_Coordinate r = 0; r < bandRows; r++) {
+
+                            const PixelImage_Coordinate sy = pixelImageApplyEdgeMode(y0 + offsetY + r, height, edgeMode);
+
+                            float *padded = &paddedRow[0];
+                            for(PixelImage_Coordinate p = 0; p < paddedWidth; p++) {
+                                for(size_t c = 0; c < channelCount; c++) {
+                                    *(padded++) = float(img.get(sourceColumns[p], sy, c));
+                                }
+                            }
+
+                            pixelImageConvolveFloats(
+                                &paddedRow[0], &horizontal[r * rowFloats],
+                                rowFloats, channelCount,
+                                &weightsX[0], tapsX);
+                        }
+
+                        // Vertical pass, straight into the output.
+                        for(PixelImage_Coordinate y = y0; y < y1; y++) {
+
+                            pixelImageConvolveFloats(
+                                &horizontal[(y - y0) * rowFloats], &vertical[0],
+                                rowFloats, rowFloats,
+                                &weightsY[0], tapsY);
+
+                            auto *outRow =
+                                out.getRow(y) + size_t(x0) * channelCount;
+                            for(size_t j = 0; j < rowFloats; j++) {
+                                outRow[j].template setScaledValue<double>(vertical[j]);
+                            }
+                        }
+                    }
+                }
+            });
+    }
+
+    // ----------------------------------------------------------------------
+    // Box approximation
+
+    template<typename ReaderType, typename WriterType>
+    inline void pixelImageGaussianBlurBox_kernel(
+        const ReaderType &img,
+        WriterType &&out,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode,
+        size_t threadCount)
+    {
+        const PixelImage_Dimension width = img.getWidth();
+        const PixelImage_Dimension height = img.getHeight();
+        const size_t channelCount = img.getChannelCount();
+        const size_t rowFloats = size_t(width) * channelCount;
+
+        if(!width || !height || !channelCount) {
+            return;
+        }
+
+        // Standard deviation is half the radius, same as the exact
+        // version.
+        PixelImage_Coordinate radiiX[3] = { 0, 0, 0 };
+        PixelImage_Coordinate radiiY[3] = { 0, 0, 0 };
+        if(radius_x > 0.0f) pixelImageBoxRadiiForGaussian(radius_x * 0.5f, radiiX);
+        if(radius_y > 0.0f) pixelImageBoxRadiiForGaussian(radius_y * 0.5f, radiiY);
+
+        // Horizontal passes, one row at a time, into a float copy of
+        // the whole image.
+        std::vector<float> image(rowFloats * size_t(height));
+
+        parallelForChunks(
+            height, parallelGetChunkSize(height, threadCount, 16), threadCount,
+            [&](size_t yBegin, size_t yEnd) {
+
+                std::vector<float> rowA(rowFloats);
+                std::vector<float> rowB(rowFloats);
+                std::vector<float> acc(channelCount);
+
+                for(PixelImage_Coordinate y = yBegin; y < PixelImage_Coordinate(yEnd); y++) {
+
+                    float *dst = &rowA[0];
+                    for(PixelImage_Coordinate x = 0; x < width; x++) {
+                        for(size_t c = 0; c < channelCount; c++) {
+                            *(dst++) = float(img.get(x, y, c));
+                        }
+                    }
+
+                    float *imageRow = &image[size_t(y) * rowFloats];
+                    pixelImageBoxBlurItems(&rowA[0], &rowB[0], width, channelCount, radiiX[0], edgeMode, &acc[0]);
+                    pixelImageBoxBlurItems(&rowB[0], &rowA[0], width, channelCount, radiiX[1], edgeMode, &acc[0]);
+                    pixelImageBoxBlurItems(&rowA[0], imageRow, width, channelCount, radiiX[2], edgeMode, &acc[0]);
+                }
+            });
+
+        // Vertical passes, in narrow strips of columns so that each
+        // strip fits in cache.
+        const size_t stripFloats = 64;
+        const size_t stripCount = (rowFloats + stripFloats - 1) / stripFloats;
+
+        parallelForChunks(
+            stripCount, parallelGetChunkSize(stripCount, threadCount, 1), threadCount,
+            [&](size_t stripBegin, size_t stripEnd) {
+
+                std::vector<float> stripA(stripFloats * size_t(height));
+                std::vector<float> stripB(stripFloats * size_t(height));
+                std::vector<float> acc(stripFloats);
+
+                for(size_t j0 = stripBegin * stripFloats; j0 < stripEnd * stripFloats && j0 < rowFloats; j0 += stripFloats) {
+
+                    const size_t lanes = j0 + stripFloats < rowFloats ? stripFloats : rowFloats - j0;
+
+                    for(PixelImage_Coordinate y = 0; y < height; y++) {
+                        memcpy(&stripA[size_t(y) * lanes], &image[size_t(y) * rowFloats + j0], sizeof(float) * lanes);
+                    }
+
+                    pixelImageBoxBlurItems(&stripA[0], &stripB[0], height, lanes, radiiY[0], edgeMode, &acc[0]);
+                    pixelImageBoxBlurItems(&stripB[0], &stripA[0], height, lanes, radiiY[1], edgeMode, &acc[0]);
+                    pixelImageBoxBlurItems(&stripA[0], &stripB[0], height, lanes, radiiY[2], edgeMode, &acc[0]);
+
+                    for(PixelImage_Coordinate y = 0; y < height; y++) {
+                        auto *outRow = out.getRow(y) + j0;
+                        const float *src = &stripB[size_t(y) * lanes];
+                        for(size_t l = 0; l < lanes; l++) {
+                            outRow[l].template setScaledValue<double>(src[l]);
+                        }
+                    }
+                }
+            });
+    }
+
+    // ----------------------------------------------------------------------
+    // Mode selection and dispatch
+
+    inline PixelImage_BlurMode pixelImageResolveBlurMode(
+        float radius_x,
+        float radius_y,
+        PixelImage_BlurMode blurMode)
+    {
+        if(blurMode == PixelImage_BlurMode_Auto) {
+            return (radius_x > pixelImageBlurBoxThreshold || radius_y > pixelImageBlurBoxThreshold) ?
+                PixelImage_BlurMode_Box : PixelImage_BlurMode_Exact;
+        }
+        return blurMode;
+    }
+
+    inline PixelImage_Coordinate pixelImageGaussianBlurReach(
+        float radius,
+        PixelImage_BlurMode blurMode)
+    {
+        if(!(radius > 0.0f)) {
+            return 0;
+        }
+
+        if(blurMode == PixelImage_BlurMode_Box) {
+            // Each pass reaches out its own radius, plus one for the
+            // pixel entering the running sum.
+            PixelImage_Coordinate radii[3] = { 0, 0, 0 };
+            pixelImageBoxRadiiForGaussian(radius * 0.5f, radii);
+            return radii[0] + radii[1] + radii[2] + 3;
+        }
+
+        // Same taps as pixelImageMakeGaussianWeights().
+        return PixelImage_Coordinate(radius) + 1;
+    }
+
+    template<typename ReaderType, typename WriterType>
+    inline void pixelImageGaussianBlur_kernel(
+        const ReaderType &img,
+        WriterType &&out,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode,
+        PixelImage_BlurMode blurMode,
+        size_t threadCount)
+    {
+        blurMode = pixelImageResolveBlurMode(radius_x, radius_y, blurMode);
+
+        if(blurMode == PixelImage_BlurMode_Box) {
+            pixelImageGaussianBlurBox_kernel(img, out, radius_x, radius_y, edgeMode, threadCount);
+        } else {
+            pixelImageGaussianBlurExact_kernel(img, out, radius_x, radius_y, edgeMode, threadCount);
+        }
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    struct PixelImageGaussianBlurFunc
+    {
+        PixelImage<ValueType, scalingType> *outputImage;
+        float radius_x;
+        float radius_y;
+        PixelImage_EdgeMode edgeMode;
+        PixelImage_BlurMode blurMode;
+        size_t threadCount;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &reader)
+        {
+            pixelImageGaussianBlur_kernel(reader, *outputImage, radius_x, radius_y, edgeMode, blurMode, threadCount);
+        }
+    };
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImage<ValueType, scalingType> *pixelImageGaussianBlur(
+        PixelImageBase &img,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode,
+        PixelImage_BlurMode blurMode,
+        size_t threadCount)
+    {
+        PixelImage<ValueType, scalingType> *out =
+            new PixelImage<ValueType, scalingType>(
+                img.getWidth(),
+                img.getHeight(),
+                img.getChannelCount());
+
+        pixelImageGaussianBlurInto(img, *out, radius_x, radius_y, edgeMode, blurMode, threadCount);
+
+        return out;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline void pixelImageGaussianBlurInto(
+        const PixelImageBase &img,
+        PixelImage<ValueType, scalingType> &out,
+        float radius_x,
+        float radius_y,
+        PixelImage_EdgeMode edgeMode,
+        PixelImage_BlurMode blurMode,
+        size_t threadCount)
+    {
+        out.setSizeAndChannels(img.getWidth(), img.getHeight(), img.getChannelCount());
+
+        PixelImageGaussianBlurFunc<ValueType, scalingType> func;
+        func.outputImage = &out;
+        func.radius_x = radius_x;
+        func.radius_y = radius_y;
+        func.edgeMode = edgeMode;
+        func.blurMode = blurMode;
+        func.threadCount = threadCount;
+        pixelImageDispatchReader(img, func);
+    }
+}
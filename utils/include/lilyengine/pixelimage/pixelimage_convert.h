@@ -0,0 +1,386 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Conversion between PixelImage formats.
+
+// The obvious way to convert an image is to go through getDouble()
+// and setDouble() for every value, which is two virtual calls and two
+// findIndex() calls (with their edge wrapping) per channel per pixel.
+// Instead, we figure out the concrete types of both images once and
+// then run a typed row kernel for that pair.
+//
+// Every kernel gives the exact same result as
+// setScaledValue<double>(getScaledValue<double>()) on each value, so
+// nothing changes depending on which path gets picked:
+//
+// - Anything from uint8_t goes through a 256-entry table made with
+//   that exact expression.
+//
+// - uint8_t and uint16_t to float divide in single precision. Since
+//   double has more than twice float's precision, rounding the double
+//   quotient to float gives the same answer as dividing in float.
+//
+// - float and double to uint8_t and uint16_t clamp, multiply in
+//   double, and then round half away from zero by comparing the
+//   fractional part against 0.5, which is what std::round does for
+//   positive values.
+//
+// - Same-type copies are a memcpy.
+//
+// Everything else goes through copyValue() with the types known at
+// compile time. Images with types we don't know about fall back to
+// getDouble() and setDouble().
+//
+// When the channel count changes, rows get converted into a scratch
+// buffer and then expanded or contracted. Extra channels are filled
+// with zero, except for a fourth channel (alpha), which is filled
+// with one.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "pixelvalue.h"
+#include "pixelimagebase.h"
+#include "pixelimage.h"
+#include "../parallel.h"
+#include "../simd.h"
+
+#include <cstring>
+#include <vector>
+#include <type_traits>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Convert src into dst, resizing dst to match. If channelCount
+    /// is zero, dst gets the same number of channels as src.
+    /// Otherwise dst ends up with channelCount channels, with extra
+    /// channels filled with zero, except a fourth channel, which gets
+    /// filled with one. src and dst can only be the same image if the
+    /// channel count stays the same, in which case nothing happens.
+    void pixelImageConvert(
+        const PixelImageBase &src,
+        PixelImageBase &dst,
+        PixelImage_Dimension channelCount = 0,
+        size_t threadCount = 1);
+
+    /// pixelImageConvert() between two images of known types. dst
+    /// must already be the same size as src, but may have a
+    /// different number of channels.
+    template<
+        typename SrcValueType, ScalingType srcScalingType,
+        typename DstValueType, ScalingType dstScalingType>
+    void pixelImageConvert_kernel(
+        const PixelImage<SrcValueType, srcScalingType> &src,
+        PixelImage<DstValueType, dstScalingType> &dst,
+        size_t threadCount = 1);
+
+    /// Converts a run of values from one PixelValue type to another.
+    /// The general version uses copyValue(). Specializations must
+    /// give bit-identical results.
+    template<
+        typename SrcValueType, ScalingType srcScalingType,
+        typename DstValueType, ScalingType dstScalingType>
+    struct PixelImageConvertRow
+    {
+        void operator()(const SrcValueType *in, DstValueType *out, size_t count) const;
+    };
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    // ----------------------------------------------------------------------
+    // Row converters
+
+    template<
+        typename SrcValueType, ScalingType srcScalingType,
+        typename DstValueType, ScalingType dstScalingType>
+    inline void PixelImageConvertRow<SrcValueType, srcScalingType, DstValueType, dstScalingType>::operator()(
+        const SrcValueType *in, DstValueType *out, size_t count) const
+    {
+        const PixelValue<SrcValueType, srcScalingType> *src =
+            reinterpret_cast<const PixelValue<SrcValueType, srcScalingType>*>(in);
+        PixelValue<DstValueType, dstScalingType> *dst =
+            reinterpret_cast<PixelValue<DstValueType, dstScalingType>*>(out);
+
+        for(size_t i = 0; i < count; i++) {
+            copyValue(src[i], dst[i]);
+        }
+    }
+
+    /// uint8_t to anything. Table lookup.
+    template<typename DstValueType, ScalingType dstScalingType>
+    struct PixelImageConvertRow<uint8_t, ScalingType_OneIsMaxInt, DstValueType, dstScalingType>
+    {
+        DstValueType table[256];
+
+        PixelImageConvertRow()
+        {
+            for(size_t i = 0; i < 256; i++) {
+                PixelValue<uint8_t, ScalingType_OneIsMaxInt> src;
+                PixelValue<DstValueType, dstScalingType> dst;
+                src.value = uint8_t(i);
+                copyValue(src, dst);
+                table[i] = dst.value;
+            }
+        }
+
+        void operator()(const uint8_t *in, DstValueType *out, size_t count) const
+        {
+            for(size_t i = 0; i < count; i++) {
+                out[i] = table[in[i]];
+            }
+        }
+    };
+
+    /// uint8_t or uint16_t to float, with a divide.
+    template<typename SrcValueType>
+    inline void pixelImageConvertRow_unormToFloat(
+        const SrcValueType *in, float *out, size_t count)
+    {
+        const float one = float(std::numeric_limits<SrcValueType>::max());
+        const SimdFloat4 oneV = SimdFloat4::splat(one);
+
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            SimdFloat4 v = SimdFloat4::set(
+                float(in[i]), float(in[i + 1]), float(in[i + 2]), float(in[i + 3]));
+            (v / oneV).store(out + i);
+        }
+
+        for(; i < count; i++) {
+            out[i] = float(in[i]) / one;
+        }
+    }
+
+    /// float or double to uint8_t or uint16_t. For float input the
+    /// multiply is exact (24 + 16 bits fits in a double). For double
+    /// input it rounds the same way setScaledValue() does.
+    template<typename SrcValueType, typename DstValueType>
+    inline void pixelImageConvertRow_floatToUnorm(
+        const SrcValueType *in, DstValueType *out, size_t count)
+    {
+        const double one = double(std::numeric_limits<DstValueType>::max());
+
+        // Written without branches so the compiler can vectorize
+        // it. Clamping first gives the same results as the
+        // out-of-range checks in setScaledValue().
+        for(size_t i = 0; i < count; i++) {
+            double v = double(in[i]);
+            v = v < 0.0 ? 0.0 : v;
+            v = v > 1.0 ? 1.0 : v;
+            const double scaled = v * one;
+            const int32_t whole = int32_t(scaled);
+            out[i] = DstValueType(whole + (scaled - double(whole) >= 0.5 ? 1 : 0));
+        }
+    }
+
+  #define EXPOP_PIXELIMAGE_CONVERT_ROW(srcType, srcScaling, dstType, dstScaling, func) \
+    template<>                                                          \
+    struct PixelImageConvertRow<srcType, srcScaling, dstType, dstScaling> \
+    {                                                                   \
+        void operator()(const srcType *in, dstType *out, size_t count) const \
+        {                                                               \
+            func(in, out, count);                                       \
+        }                                                               \
+    };
+
+    EXPOP_PIXELIMAGE_CONVERT_ROW(uint8_t,  ScalingType_OneIsMaxInt, float,    ScalingType_OneIsOne,    pixelImageConvertRow_unormToFloat)
+    EXPOP_PIXELIMAGE_CONVERT_ROW(uint16_t, ScalingType_OneIsMaxInt, float,    ScalingType_OneIsOne,    pixelImageConvertRow_unormToFloat)
+    EXPOP_PIXELIMAGE_CONVERT_ROW(float,    ScalingType_OneIsOne,    uint8_t,  ScalingType_OneIsMaxInt, pixelImageConvertRow_floatToUnorm)
+    EXPOP_PIXELIMAGE_CONVERT_ROW(float,    ScalingType_OneIsOne,    uint16_t, ScalingType_OneIsMaxInt, pixelImageConvertRow_floatToUnorm)
+    EXPOP_PIXELIMAGE_CONVERT_ROW(double,   ScalingType_OneIsOne,    uint8_t,  ScalingType_OneIsMaxInt, pixelImageConvertRow_floatToUnorm)
+    EXPOP_PIXELIMAGE_CONVERT_ROW(double,   ScalingType_OneIsOne,    uint16_t, ScalingType_OneIsMaxInt, pixelImageConvertRow_floatToUnorm)
+
+  #undef EXPOP_PIXELIMAGE_CONVERT_ROW
+
+    // ----------------------------------------------------------------------
+    // Image conversion
+
+    template<
+        typename SrcValueType, ScalingType srcScalingType,
+        typename DstValueType, ScalingType dstScalingType>
+    inline void pixelImageConvert_kernel(
+        const PixelImage<SrcValueType, srcScalingType> &src,
+        PixelImage<DstValueType, dstScalingType> &dst,
+        size_t threadCount)
+    {
+        const bool sameType =
+            std::is_same<SrcValueType, DstValueType>::value &&
+            srcScalingType == dstScalingType;
+
+        const size_t width = dst.getWidth();
+        const size_t height = dst.getHeight();
+        const size_t srcChannels = src.getChannelCount();
+        const size_t dstChannels = dst.getChannelCount();
+        const size_t copyChannels = srcChannels < dstChannels ? srcChannels : dstChannels;
+
+        // Built once, since the uint8_t version has a table in it.
+        PixelImageConvertRow<SrcValueType, srcScalingType, DstValueType, dstScalingType> convertRow;
+
+        PixelValue<DstValueType, dstScalingType> zero;
+        PixelValue<DstValueType, dstScalingType> one;
+        zero.template setScaledValue<double>(0.0);
+        one.template setScaledValue<double>(1.0);
+
+        parallelForChunks(
+            height, parallelGetChunkSize(height, threadCount, 16), threadCount,
+            [&](size_t yBegin, size_t yEnd) {
+
+                std::vector<DstValueType> scratch;
+                if(srcChannels != dstChannels) {
+                    scratch.resize(width * srcChannels);
+                }
+
+                for(size_t y = yBegin; y < yEnd; y++) {
+
+                    const SrcValueType *in = reinterpret_cast<const SrcValueType*>(src.getRow(y));
+                    DstValueType *out = reinterpret_cast<DstValueType*>(dst.getRow(y));
+                    DstValueType *converted = scratch.size() ? &scratch[0] : out;
+
+                    if(sameType) {
+                        memcpy((void*)converted, (const void*)in, width * srcChannels * sizeof(DstValueType));
+                    } else {
+                        convertRow(in, converted, width * srcChannels);
+                    }
+
+                    if(converted == out) {
+                        continue;
+                    }
+
+                    // Expand or contract channels.
+                    for(size_t x = 0; x < width; x++) {
+                        const DstValueType *inPixel = converted + x * srcChannels;
+                        DstValueType *outPixel = out + x * dstChannels;
+                        size_t c = 0;
+                        for(; c < copyChannels; c++) {
+                            outPixel[c] = inPixel[c];
+                        }
+                        for(; c < dstChannels; c++) {
+                            outPixel[c] = c == 3 ? one.value : zero.value;
+                        }
+                    }
+                }
+            });
+    }
+
+    template<typename SrcValueType, ScalingType srcScalingType>
+    inline bool pixelImageConvert_dispatchDst(
+        const PixelImage<SrcValueType, srcScalingType> &src,
+        PixelImageBase &dst,
+        size_t threadCount)
+    {
+      #define EXPOP_PIXELIMAGE_CONVERT_DST(type)                             \
+        if(PixelImage<type> *typed = dynamic_cast<PixelImage<type>*>(&dst)) { \
+            pixelImageConvert_kernel(src, *typed, threadCount);             \
+            return true;                                                    \
+        }
+
+        EXPOP_PIXELIMAGE_DISPATCH_TYPES(EXPOP_PIXELIMAGE_CONVERT_DST)
+
+      #undef EXPOP_PIXELIMAGE_CONVERT_DST
+
+        return false;
+    }
+
+    inline bool pixelImageConvert_dispatch(
+        const PixelImageBase &src,
+        PixelImageBase &dst,
+        size_t threadCount)
+    {
+      #define EXPOP_PIXELIMAGE_CONVERT_SRC(type)                             \
+        if(const PixelImage<type> *typed = dynamic_cast<const PixelImage<type>*>(&src)) { \
+            return pixelImageConvert_dispatchDst(*typed, dst, threadCount); \
+        }
+
+        EXPOP_PIXELIMAGE_DISPATCH_TYPES(EXPOP_PIXELIMAGE_CONVERT_SRC)
+
+      #undef EXPOP_PIXELIMAGE_CONVERT_SRC
+
+        return false;
+    }
+
+    inline void pixelImageConvert(
+        const PixelImageBase &src,
+        PixelImageBase &dst,
+        PixelImage_Dimension channelCount,
+        size_t threadCount)
+    {
+        if(!channelCount) {
+            channelCount = src.getChannelCount();
+        }
+
+        if(&src == &dst) {
+            return;
+        }
+
+        if(dst.getWidth() != src.getWidth() ||
+            dst.getHeight() != src.getHeight() ||
+            dst.getChannelCount() != channelCount)
+        {
+            dst.setSizeAndChannels(src.getWidth(), src.getHeight(), channelCount);
+        }
+
+        if(pixelImageConvert_dispatch(src, dst, threadCount)) {
+            return;
+        }
+
+        // Unknown types. Do it the slow way.
+        const PixelImage_Dimension srcChannels = src.getChannelCount();
+        for(PixelImage_Coordinate y = 0; y < dst.getHeight(); y++) {
+            for(PixelImage_Coordinate x = 0; x < dst.getWidth(); x++) {
+                for(PixelImage_Coordinate c = 0; c < channelCount; c++) {
+                    dst.setDouble(
+                        x, y, c,
+                        c < srcChannels ? src.getDouble(x, y, c) : (c == 3 ? 1.0 : 0.0));
+                }
+            }
+        }
+    }
+
+    // This lives here instead of pixelimagebase.h because it needs
+    // pixelImageConvert().
+    inline PixelImageBase &PixelImageBase::operator=(const PixelImageBase &other)
+    {
+        pixelImageConvert(other, *this);
+        return *this;
+    }
+}
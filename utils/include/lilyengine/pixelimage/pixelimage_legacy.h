@@ -40,9 +40,12 @@
 #include "pixelvalue.h"
 #include "pixelimagebase.h"
 #include "pixelimage.h"
+#include "pixelimage_convert.h"
 
 #include "../image.h"
 
+#include <cstring>
+
 // ----------------------------------------------------------------------
 // Declarations and documentation
 // ----------------------------------------------------------------------
@@ -71,13 +74,12 @@ namespace ExPop
         PixelImage<uint8_t> *newImage = new PixelImage<uint8_t>(
             img.getWidth(), img.getHeight(), 4);
 
-        for(PixelImage_Coordinate y = 0; y < newImage->getHeight(); y++) {
-            for(PixelImage_Coordinate x = 0; x < newImage->getWidth(); x++) {
-                ExPop::Gfx::Pixel *p = img.getPixel(x, y);
-                for(PixelImage_Coordinate c = 0; c < newImage->getChannelCount(); c++) {
-                    newImage->getData(x, y, c).value = p->colorsAsArray[c];
-                }
-            }
+        // Both are rows of tightly packed RGBA bytes.
+        for(PixelImage_Coordinate y = 0; y < PixelImage_Coordinate(img.getHeight()); y++) {
+            memcpy(
+                (void*)newImage->getRow(y),
+                (const void*)img.getPixel(0, y),
+                img.getWidth() * sizeof(ExPop::Gfx::Pixel));
         }
 
         return newImage;
@@ -85,31 +87,20 @@ namespace ExPop
 
     inline ExPop::Gfx::Image *pixelImageToOldImage(PixelImageBase &img)
     {
-        // Convert to uint8_t.
-        PixelImage<uint8_t> newImage(img);
-
-        // Bring it up to the 4-channel RGBA the old system uses.
-        if(newImage.getChannelCount() < 4) {
-            newImage.setNumChannels(4);
-
-            // Fill in alpha to 1.
-            for(PixelImage_Coordinate y = 0; y < newImage.getHeight(); y++) {
-                for(PixelImage_Coordinate x = 0; x < newImage.getWidth(); x++) {
-                    newImage.getData(x, y, 3).value = 0xff;
-                }
-            }
-        }
+        // Convert to uint8_t and bring it up (or down) to the
+        // 4-channel RGBA the old system uses. Missing alpha gets
+        // filled in as opaque.
+        PixelImage<uint8_t> newImage;
+        pixelImageConvert(img, newImage, 4);
 
         ExPop::Gfx::Image *ret = new ExPop::Gfx::Image(
             newImage.getWidth(), newImage.getHeight());
 
         for(PixelImage_Coordinate y = 0; y < newImage.getHeight(); y++) {
-            for(PixelImage_Coordinate x = 0; x < newImage.getWidth(); x++) {
-                ExPop::Gfx::Pixel *p = ret->getPixel(x, y);
-                for(PixelImage_Coordinate c = 0; c < 4; c++) {
-                    p->colorsAsArray[c] = newImage.getData(x, y, c).value;
-                }
-            }
+            memcpy(
+                (void*)ret->getPixel(0, y),
+                (const void*)newImage.getRow(y),
+                newImage.getWidth() * sizeof(ExPop::Gfx::Pixel));
         }
 
         return ret;
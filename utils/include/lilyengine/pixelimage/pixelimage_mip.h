@@ -0,0 +1,658 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Mipmap chain generation.
+
+// Every level down to 1x1 gets written into one contiguous block, in
+// order from largest to smallest, with a table of where each level
+// starts. That's the layout most texture upload APIs want.
+//
+// Levels are made in a single pass over the source. Each level pulls
+// the rows it needs out of the level above it, which pulls from the
+// level above that, and so on up to the source image. Every level
+// only keeps a few rows (horizontally resampled, the same way
+// pixelImageResample() does it), so the working set is tiny and
+// every source row gets read once. Each level is filtered from the
+// previous level's unrounded float values, not from what got written
+// out.
+//
+// Sizes don't have to be powers of two. Each level is half the size
+// of the one before it, rounded down (but never less than 1), and the
+// resampling filters handle the odd ratios that come out of that.
+//
+// With sRGB enabled, color channels get converted to linear before
+// filtering and back afterwards. Alpha always gets filtered as-is.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "pixelvalue.h"
+#include "pixelimagebase.h"
+#include "pixelimage.h"
+#include "pixelimage_access.h"
+#include "pixelimage_resample.h"
+
+#include <vector>
+#include <cmath>
+#include <cassert>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Size and location of one level in a PixelImageMipChain.
+    struct PixelImageMipLevel
+    {
+        PixelImage_Dimension width;
+        PixelImage_Dimension height;
+
+        /// Where the level starts, in values (not bytes) from the
+        /// start of the chain's data.
+        size_t offset;
+
+        /// Number of values in the level.
+        size_t size;
+    };
+
+    /// Every mip level for an image, in one allocation. Rows within
+    /// a level are tightly packed, with interleaved channels, same as
+    /// PixelImage.
+    template<
+        typename ValueType,
+        ScalingType scalingType = pixelValueGetDefaultScalingType<ValueType>()>
+    class PixelImageMipChain
+    {
+    public:
+
+        typedef PixelValue<ValueType, scalingType> PixelValueType;
+
+        /// Creates an empty chain with no levels.
+        PixelImageMipChain();
+
+        /// Set up levels for an image of the given size, all the way
+        /// down to 1x1, and allocate space for them. Existing
+        /// contents are lost.
+        void setBaseSize(
+            PixelImage_Dimension width,
+            PixelImage_Dimension height,
+            PixelImage_Dimension channelCount);
+
+        size_t getLevelCount() const;
+        PixelImage_Dimension getChannelCount() const;
+
+        /// Size and offset of a single level.
+        const PixelImageMipLevel &getLevel(size_t level) const;
+
+        /// Sizes and offsets for every level, largest first.
+        const std::vector<PixelImageMipLevel> &getLevels() const;
+
+        /// Start of the data for every level.
+        PixelValueType *getData();
+        const PixelValueType *getData() const;
+
+        /// Total number of values in every level.
+        size_t getDataSize() const;
+
+        /// Start of the data for one level.
+        PixelValueType *getLevelData(size_t level);
+        const PixelValueType *getLevelData(size_t level) const;
+
+        /// Reader for one level. See pixelimage_access.h.
+        PixelImageTypedReader<PixelValueType> getLevelReader(size_t level) const;
+
+        /// Copy one level out into a new image that the caller owns.
+        PixelImage<ValueType, scalingType> *makeLevelImage(size_t level) const;
+
+    private:
+
+        std::vector<PixelValueType> data;
+        std::vector<PixelImageMipLevel> levels;
+        PixelImage_Dimension channelCount;
+    };
+
+    /// Make every mip level for an image. Returns a new chain that
+    /// the caller owns. Set alphaChannelIndex to -1 if there's no
+    /// alpha. edgeMode determines what's past the edges of the image
+    /// for filters that reach out that far.
+    template<typename ValueType, ScalingType scalingType>
+    PixelImageMipChain<ValueType, scalingType> *pixelImageMakeMipChain(
+        const PixelImageBase &img,
+        PixelImage_ResampleFilter filter = PixelImage_ResampleFilter_Box,
+        bool srgb = false,
+        PixelImage_Coordinate alphaChannelIndex = 3,
+        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp);
+
+    /// Make every mip level from any reader (see
+    /// pixelimage_access.h) into a chain that's already been set up
+    /// for the reader's size.
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    void pixelImageMakeMipChain_kernel(
+        const ReaderType &img,
+        PixelImageMipChain<ValueType, scalingType> &chain,
+        PixelImage_ResampleFilter filter,
+        bool srgb,
+        PixelImage_Coordinate alphaChannelIndex,
+        PixelImage_EdgeMode edgeMode);
+
+    /// Convert one sRGB-encoded value in [0, 1] to linear.
+    float pixelImageSRGBToLinear(float value);
+
+    /// Convert one linear value in [0, 1] to sRGB encoding.
+    float pixelImageLinearToSRGB(float value);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    // ----------------------------------------------------------------------
+    // sRGB
+
+    inline float pixelImageSRGBToLinear(float value)
+    {
+        if(value <= 0.04045f) {
+            return value / 12.92f;
+        }
+        return powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    inline float pixelImageLinearToSRGB(float value)
+    {
+        if(value <= 0.0031308f) {
+            return value * 12.92f;
+        }
+        return 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+    }
+
+    // ----------------------------------------------------------------------
+    // PixelImageMipChain
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageMipChain<ValueType, scalingType>::PixelImageMipChain()
+    {
+        channelCount = 0;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline void PixelImageMipChain<ValueType, scalingType>::setBaseSize(
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Dimension inChannelCount)
+    {
+        channelCount = inChannelCount;
+        levels.clear();
+        data.clear();
+
+        if(width <= 0 || height <= 0) {
+            return;
+        }
+
+        size_t offset = 0;
+
+        while(true) {
+
+            PixelImageMipLevel level;
+            level.width = width;
+            level.height = height;
+            level.offset = offset;
+            level.size = size_t(width) * size_t(height) * size_t(channelCount);
+            levels.push_back(level);
+
+            offset += level.size;
+
+            if(width <= 1 && height <= 1) {
+                break;
+            }
+
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+
+        data.resize(offset);
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline size_t PixelImageMipChain<ValueType, scalingType>::getLevelCount() const
+    {
+        return levels.size();
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImage_Dimension PixelImageMipChain<ValueType, scalingType>::getChannelCount() const
+    {
+        return channelCount;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline const PixelImageMipLevel &PixelImageMipChain<ValueType, scalingType>::getLevel(size_t level) const
+    {
+        assert(level < levels.size());
+        return levels[level];
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline const std::vector<PixelImageMipLevel> &PixelImageMipChain<ValueType, scalingType>::getLevels() const
+    {
+        return levels;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline typename PixelImageMipChain<ValueType, scalingType>::PixelValueType *
+    PixelImageMipChain<ValueType, scalingType>::getData()
+    {
+        return data.size() ? &data[0] : nullptr;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline const typename PixelImageMipChain<ValueType, scalingType>::PixelValueType *
+    PixelImageMipChain<ValueType, scalingType>::getData() const
+    {
+        return data.size() ? &data[0] : nullptr;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline size_t PixelImageMipChain<ValueType, scalingType>::getDataSize() const
+    {
+        return data.size();
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline typename PixelImageMipChain<ValueType, scalingType>::PixelValueType *
+    PixelImageMipChain<ValueType, scalingType>::getLevelData(size_t level)
+    {
+        return getData() + getLevel(level).offset;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline const typename PixelImageMipChain<ValueType, scalingType>::PixelValueType *
+    PixelImageMipChain<ValueType, scalingType>::getLevelData(size_t level) const
+    {
+        return getData() + getLevel(level).offset;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageTypedReader<typename PixelImageMipChain<ValueType, scalingType>::PixelValueType>
+    PixelImageMipChain<ValueType, scalingType>::getLevelReader(size_t level) const
+    {
+        const PixelImageMipLevel &info = getLevel(level);
+        return PixelImageTypedReader<PixelValueType>(
+            getLevelData(level), info.width, info.height, channelCount,
+            size_t(info.width) * size_t(channelCount));
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImage<ValueType, scalingType> *
+    PixelImageMipChain<ValueType, scalingType>::makeLevelImage(size_t level) const
+    {
+        const PixelImageMipLevel &info = getLevel(level);
+        PixelImage<ValueType, scalingType> *image =
+            new PixelImage<ValueType, scalingType>(info.width, info.height, channelCount);
+        if(info.size) {
+            memcpy(image->getRow(0), getLevelData(level), info.size * sizeof(PixelValueType));
+        }
+        return image;
+    }
+
+    // ----------------------------------------------------------------------
+    // Building
+
+    /// State for pixelImageMakeMipChain_kernel().
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    class PixelImageMipChainBuilder
+    {
+    public:
+
+        PixelImageMipChainBuilder(
+            const ReaderType &inImg,
+            PixelImageMipChain<ValueType, scalingType> &inChain,
+            PixelImage_ResampleFilter filter,
+            bool inSrgb,
+            PixelImage_Coordinate inAlphaChannelIndex,
+            PixelImage_EdgeMode inEdgeMode);
+
+        void build();
+
+    private:
+
+        struct Level
+        {
+            PixelImage_Dimension width;
+            PixelImage_Dimension height;
+
+            /// How to get this level from the one above it.
+            PixelImageResampleTable tableX;
+            PixelImageResampleTable tableY;
+
+            /// Ring of rows from the level above, already resampled
+            /// horizontally to this level's width.
+            std::vector<float> slots;
+            std::vector<PixelImage_Coordinate> slotKeys;
+            std::vector<bool> slotValid;
+            std::vector<const float*> rowPointers;
+
+            /// Scratch space for one row of this level.
+            std::vector<float> row;
+
+            /// Rows that have been written to the chain already.
+            std::vector<bool> written;
+        };
+
+        /// Rows are identified by keys. With wrapping, keys past the
+        /// edge stay as they are, so that the rows a level asks for
+        /// only ever go forward, even when they wrap around.
+        /// Otherwise keys get clamped right away.
+        PixelImage_Coordinate getKey(size_t level, PixelImage_Coordinate y) const;
+
+        /// Make a row of a level, in linear float form.
+        void makeRow(size_t level, PixelImage_Coordinate key, float *dst);
+
+        /// A row of the level above this one, resampled
+        /// horizontally to this level's width.
+        const float *getResampledRowFromAbove(size_t level, PixelImage_Coordinate key);
+
+        void writeRow(size_t level, PixelImage_Coordinate y, const float *src);
+
+        bool isColorChannel(size_t channel) const;
+
+        const ReaderType &img;
+        PixelImageMipChain<ValueType, scalingType> &chain;
+        bool srgb;
+        PixelImage_Coordinate alphaChannelIndex;
+        PixelImage_EdgeMode edgeMode;
+        size_t channelCount;
+
+        std::vector<Level> levels;
+
+        /// sRGB decoding for values that are exactly n/255.
+        float srgbTable[256];
+    };
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline PixelImageMipChainBuilder<ReaderType, ValueType, scalingType>::PixelImageMipChainBuilder(
+        const ReaderType &inImg,
+        PixelImageMipChain<ValueType, scalingType> &inChain,
+        PixelImage_ResampleFilter filter,
+        bool inSrgb,
+        PixelImage_Coordinate inAlphaChannelIndex,
+        PixelImage_EdgeMode inEdgeMode) :
+        img(inImg),
+        chain(inChain),
+        srgb(inSrgb),
+        alphaChannelIndex(inAlphaChannelIndex),
+        edgeMode(inEdgeMode)
+    {
+        channelCount = chain.getChannelCount();
+        levels.resize(chain.getLevelCount());
+
+        for(size_t i = 0; i < levels.size(); i++) {
+
+            Level &level = levels[i];
+            level.width = chain.getLevel(i).width;
+            level.height = chain.getLevel(i).height;
+            level.row.resize(size_t(level.width) * channelCount);
+            level.written.resize(level.height, false);
+
+            if(i) {
+
+                pixelImageMakeResampleTable(levels[i - 1].width, level.width, filter, edgeMode, level.tableX);
+                pixelImageMakeResampleTable(levels[i - 1].height, level.height, filter, edgeMode, level.tableY);
+
+                const size_t slotCount = level.tableY.taps;
+                level.slots.resize(slotCount * level.row.size());
+                level.slotKeys.resize(slotCount);
+                level.slotValid.resize(slotCount, false);
+                level.rowPointers.resize(slotCount);
+            }
+        }
+
+        for(size_t i = 0; i < 256; i++) {
+            srgbTable[i] = pixelImageSRGBToLinear(float(i) / 255.0f);
+        }
+    }
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline bool PixelImageMipChainBuilder<ReaderType, ValueType, scalingType>::isColorChannel(size_t channel) const
+    {
+        return srgb && PixelImage_Coordinate(channel) != alphaChannelIndex;
+    }
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline PixelImage_Coordinate PixelImageMipChainBuilder<ReaderType, ValueType, scalingType>::getKey(
+        size_t level,
+        PixelImage_Coordinate y) const
+    {
+        if(edgeMode == PixelImage_EdgeMode_Wrap) {
+            return y;
+        }
+        return pixelImageApplyEdgeMode(y, levels[level].height, edgeMode);
+    }
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline void PixelImageMipChainBuilder<ReaderType, ValueType, scalingType>::writeRow(
+        size_t level,
+        PixelImage_Coordinate y,
+        const float *src)
+    {
+        if(levels[level].written[y]) {
+            return;
+        }
+        levels[level].written[y] = true;
+
+        const size_t rowValues = levels[level].row.size();
+        typename PixelImageMipChain<ValueType, scalingType>::PixelValueType *dst =
+            chain.getLevelData(level) + size_t(y) * rowValues;
+
+        for(size_t j = 0; j < rowValues; j++) {
+            float value = src[j];
+            if(isColorChannel(j % channelCount)) {
+                value = pixelImageLinearToSRGB(value < 0.0f ? 0.0f : value);
+            }
+            dst[j].template setScaledValue<double>(value);
+        }
+    }
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline const float *PixelImageMipChainBuilder<ReaderType, ValueType, scalingType>::getResampledRowFromAbove(
+        size_t level,
+        PixelImage_Coordinate key)
+    {
+        Level &info = levels[level];
+        const size_t slotCount = info.tableY.taps;
+
+        PixelImage_Coordinate slot = key % PixelImage_Coordinate(slotCount);
+        if(slot < 0) slot += PixelImage_Coordinate(slotCount);
+
+        float *slotRow = &info.slots[size_t(slot) * info.row.size()];
+
+        if(!info.slotValid[slot] || info.slotKeys[slot] != key) {
+
+            Level &above = levels[level - 1];
+            makeRow(level - 1, key, &above.row[0]);
+            pixelImageResampleRow(&above.row[0], slotRow, channelCount, info.width, info.tableX);
+
+            info.slotKeys[slot] = key;
+            info.slotValid[slot] = true;
+        }
+
+        return slotRow;
+    }
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline void PixelImageMipChainBuilder<ReaderType, ValueType, scalingType>::makeRow(
+        size_t level,
+        PixelImage_Coordinate key,
+        float *dst)
+    {
+        Level &info = levels[level];
+        const PixelImage_Coordinate y = pixelImageApplyEdgeMode(key, info.height, edgeMode);
+
+        if(level == 0) {
+
+            // Straight from the source. This level gets written out
+            // exactly as it came in.
+            typename PixelImageMipChain<ValueType, scalingType>::PixelValueType *out =
+                info.written[y] ? nullptr : chain.getLevelData(0) + size_t(y) * info.row.size();
+            info.written[y] = true;
+
+            for(PixelImage_Coordinate x = 0; x < info.width; x++) {
+                for(size_t c = 0; c < channelCount; c++) {
+
+                    const double value = img.get(x, y, c);
+                    if(out) {
+                        (out++)->template setScaledValue<double>(value);
+                    }
+
+                    float linear = float(value);
+                    if(isColorChannel(c)) {
+                        // Use the table for anything that came from
+                        // 8-bit data.
+                        float scaled = linear * 255.0f;
+                        int index = int(scaled + 0.5f);
+                        if(index >= 0 && index <= 255 && fabs(scaled - float(index)) < 0.001f) {
+                            linear = srgbTable[index];
+                        } else {
+                            linear = pixelImageSRGBToLinear(linear);
+                        }
+                    }
+                    *(dst++) = linear;
+                }
+            }
+
+            return;
+        }
+
+        // Which rows of the level above we need. Past the edges with
+        // wrapping, shift everything by whole periods so the keys
+        // keep going forward.
+        const Level &above = levels[level - 1];
+        PixelImage_Coordinate first = info.tableY.firstSource[y];
+        if(edgeMode == PixelImage_EdgeMode_Wrap) {
+            PixelImage_Coordinate period = (key - y) / info.height;
+            first += period * above.height;
+        }
+
+        const size_t taps = info.tableY.taps;
+        for(size_t k = 0; k < taps; k++) {
+            info.rowPointers[k] = getResampledRowFromAbove(
+                level, getKey(level - 1, first + PixelImage_Coordinate(k)));
+        }
+
+        pixelImageResampleColumns(
+            &info.rowPointers[0], dst, info.row.size(),
+            &info.tableY.weights[size_t(y) * taps], taps);
+
+        writeRow(level, y, dst);
+    }
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline void PixelImageMipChainBuilder<ReaderType, ValueType, scalingType>::build()
+    {
+        if(!levels.size() || !channelCount || !levels[0].width || !levels[0].height) {
+            return;
+        }
+
+        // Pulling every row of the smallest level pulls everything
+        // above it, in order.
+        const size_t last = levels.size() - 1;
+        for(PixelImage_Coordinate y = 0; y < levels[last].height; y++) {
+            makeRow(last, y, &levels[last].row[0]);
+        }
+
+        // Just in case a filter skipped some rows entirely.
+        for(size_t i = 0; i < levels.size(); i++) {
+            for(PixelImage_Coordinate y = 0; y < levels[i].height; y++) {
+                if(!levels[i].written[y]) {
+                    makeRow(i, y, &levels[i].row[0]);
+                }
+            }
+        }
+    }
+
+    template<typename ReaderType, typename ValueType, ScalingType scalingType>
+    inline void pixelImageMakeMipChain_kernel(
+        const ReaderType &img,
+        PixelImageMipChain<ValueType, scalingType> &chain,
+        PixelImage_ResampleFilter filter,
+        bool srgb,
+        PixelImage_Coordinate alphaChannelIndex,
+        PixelImage_EdgeMode edgeMode)
+    {
+        PixelImageMipChainBuilder<ReaderType, ValueType, scalingType> builder(
+            img, chain, filter, srgb, alphaChannelIndex, edgeMode);
+        builder.build();
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    struct PixelImageMakeMipChainFunc
+    {
+        PixelImageMipChain<ValueType, scalingType> *chain;
+        PixelImage_ResampleFilter filter;
+        bool srgb;
+        PixelImage_Coordinate alphaChannelIndex;
+        PixelImage_EdgeMode edgeMode;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &reader)
+        {
+            pixelImageMakeMipChain_kernel(reader, *chain, filter, srgb, alphaChannelIndex, edgeMode);
+        }
+    };
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageMipChain<ValueType, scalingType> *pixelImageMakeMipChain(
+        const PixelImageBase &img,
+        PixelImage_ResampleFilter filter,
+        bool srgb,
+        PixelImage_Coordinate alphaChannelIndex,
+        PixelImage_EdgeMode edgeMode)
+    {
+        PixelImageMipChain<ValueType, scalingType> *chain =
+            new PixelImageMipChain<ValueType, scalingType>();
+        chain->setBaseSize(img.getWidth(), img.getHeight(), img.getChannelCount());
+
+        PixelImageMakeMipChainFunc<ValueType, scalingType> func;
+        func.chain = chain;
+        func.filter = filter;
+        func.srgb = srgb;
+        func.alphaChannelIndex = alphaChannelIndex;
+        func.edgeMode = edgeMode;
+        pixelImageDispatchReader(img, func);
+
+        return chain;
+    }
+}
@@ -0,0 +1,294 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Pooled storage for PixelImage pixel data.
+
+// Image pipelines tend to make and throw away a lot of same-sized
+// temporaries. Every one of those is a trip through malloc, and for
+// big images, a fresh mapping from the OS that page faults on first
+// touch. With the pool turned on, freed pixel storage gets kept
+// around in size classes and handed back out to the next image that
+// fits, so the memory is already mapped and probably still in cache.
+//
+// Size classes are four steps per power of two (1.25, 1.5, 1.75, 2),
+// so a block is never more than 25% bigger than what was asked for.
+// Blocks are always allocated at their full class size, even with
+// the pool off, so anything can go into the pool when it gets freed.
+// The extra space never gets touched, so for big images it never
+// gets paged in either.
+//
+// The pool is off by default. It's shared between every thread and
+// every image type, and it's guarded by a mutex, which only gets
+// touched while the pool is on.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "../config.h"
+#include "../thread.h"
+
+#include <atomic>
+#include <vector>
+#include <new>
+#include <cstddef>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Set the most freed storage (in bytes) the pool will hang onto.
+    /// Zero (the default) turns the pool off and releases everything
+    /// in it.
+    void pixelImagePoolSetLimit(size_t maxBytes);
+
+    /// Get the current pool limit.
+    size_t pixelImagePoolGetLimit();
+
+    /// Release everything the pool is holding, without changing the
+    /// limit.
+    void pixelImagePoolTrim();
+
+    /// Pool usage counters, since the program started.
+    struct PixelImagePoolStats
+    {
+        /// Allocations that got a block out of the pool.
+        size_t hits;
+
+        /// Allocations that had to go to the system while the pool
+        /// was on.
+        size_t misses;
+
+        /// Bytes sitting in the pool right now.
+        size_t cachedBytes;
+    };
+
+    /// Get the pool usage counters.
+    PixelImagePoolStats pixelImagePoolGetStats();
+
+    /// Get storage for at least byteCount bytes. Contents are
+    /// undefined. Must be released with pixelImagePoolFree(), with
+    /// the same byteCount.
+    void *pixelImagePoolAllocate(size_t byteCount);
+
+    /// Release storage from pixelImagePoolAllocate(). Goes back into
+    /// the pool if it's on and has room, or to the system otherwise.
+    void pixelImagePoolFree(void *ptr, size_t byteCount);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Smallest size class. Everything smaller gets rounded up to it.
+    const size_t pixelImagePoolMinimumBlock = 64;
+
+    struct PixelImagePool
+    {
+        PixelImagePool()
+        {
+            limit = 0;
+            cachedBytes = 0;
+            hits = 0;
+            misses = 0;
+        }
+
+        // Only locks anything with EXPOP_ENABLE_THREADS.
+        void lock()
+        {
+          #if EXPOP_ENABLE_THREADS
+            mutex.lock();
+          #endif
+        }
+
+        void unlock()
+        {
+          #if EXPOP_ENABLE_THREADS
+            mutex.unlock();
+          #endif
+        }
+
+      #if EXPOP_ENABLE_THREADS
+        Threads::Mutex mutex;
+      #endif
+
+        std::atomic<size_t> limit;
+
+        // Everything below here is guarded by the mutex.
+        std::vector<std::vector<void*> > freeLists;
+        size_t cachedBytes;
+        size_t hits;
+        size_t misses;
+    };
+
+    inline PixelImagePool &pixelImagePoolGet()
+    {
+        // Never destroyed, so images that outlive static destruction
+        // can still give their storage back safely.
+        static PixelImagePool *pool = new PixelImagePool();
+        return *pool;
+    }
+
+    /// Size in bytes of a size class.
+    inline size_t pixelImagePoolGetClassSize(size_t sizeClass)
+    {
+        const size_t power = pixelImagePoolMinimumBlock << (sizeClass / 4);
+        return power + (power / 4) * (sizeClass % 4);
+    }
+
+    /// Smallest size class that can hold byteCount bytes.
+    inline size_t pixelImagePoolGetClassFor(size_t byteCount)
+    {
+        size_t sizeClass = 0;
+        size_t power = pixelImagePoolMinimumBlock;
+        while(power * 2 < byteCount) {
+            power *= 2;
+            sizeClass += 4;
+        }
+        while(pixelImagePoolGetClassSize(sizeClass) < byteCount) {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    /// Release everything in the pool. Pool must already be locked.
+    inline void pixelImagePoolTrim_locked(PixelImagePool &pool)
+    {
+        for(size_t i = 0; i < pool.freeLists.size(); i++) {
+            for(size_t k = 0; k < pool.freeLists[i].size(); k++) {
+                ::operator delete(pool.freeLists[i][k]);
+            }
+            pool.freeLists[i].clear();
+        }
+        pool.cachedBytes = 0;
+    }
+
+    inline void pixelImagePoolSetLimit(size_t maxBytes)
+    {
+        PixelImagePool &pool = pixelImagePoolGet();
+        pool.lock(); {
+            pool.limit = maxBytes;
+            if(!maxBytes) {
+                pixelImagePoolTrim_locked(pool);
+            }
+        } pool.unlock();
+    }
+
+    inline size_t pixelImagePoolGetLimit()
+    {
+        return pixelImagePoolGet().limit;
+    }
+
+    inline void pixelImagePoolTrim()
+    {
+        PixelImagePool &pool = pixelImagePoolGet();
+        pool.lock(); {
+            pixelImagePoolTrim_locked(pool);
+        } pool.unlock();
+    }
+
+    inline PixelImagePoolStats pixelImagePoolGetStats()
+    {
+        PixelImagePool &pool = pixelImagePoolGet();
+        PixelImagePoolStats stats;
+        pool.lock(); {
+            stats.hits = pool.hits;
+            stats.misses = pool.misses;
+            stats.cachedBytes = pool.cachedBytes;
+        } pool.unlock();
+        return stats;
+    }
+
+    inline void *pixelImagePoolAllocate(size_t byteCount)
+    {
+        PixelImagePool &pool = pixelImagePoolGet();
+        const size_t sizeClass = pixelImagePoolGetClassFor(byteCount);
+        void *ret = nullptr;
+
+        if(pool.limit) {
+            pool.lock(); {
+                if(sizeClass < pool.freeLists.size() && pool.freeLists[sizeClass].size()) {
+                    ret = pool.freeLists[sizeClass].back();
+                    pool.freeLists[sizeClass].pop_back();
+                    pool.cachedBytes -= pixelImagePoolGetClassSize(sizeClass);
+                    pool.hits++;
+                } else {
+                    pool.misses++;
+                }
+            } pool.unlock();
+        }
+
+        if(!ret) {
+            ret = ::operator new(pixelImagePoolGetClassSize(sizeClass));
+        }
+
+        return ret;
+    }
+
+    inline void pixelImagePoolFree(void *ptr, size_t byteCount)
+    {
+        if(!ptr) {
+            return;
+        }
+
+        PixelImagePool &pool = pixelImagePoolGet();
+
+        if(pool.limit) {
+
+            const size_t sizeClass = pixelImagePoolGetClassFor(byteCount);
+            const size_t classSize = pixelImagePoolGetClassSize(sizeClass);
+            bool kept = false;
+
+            pool.lock(); {
+                if(pool.cachedBytes + classSize <= pool.limit) {
+                    if(pool.freeLists.size() <= sizeClass) {
+                        pool.freeLists.resize(sizeClass + 1);
+                    }
+                    pool.freeLists[sizeClass].push_back(ptr);
+                    pool.cachedBytes += classSize;
+                    kept = true;
+                }
+            } pool.unlock();
+
+            if(kept) {
+                return;
+            }
+        }
+
+        ::operator delete(ptr);
+    }
+}
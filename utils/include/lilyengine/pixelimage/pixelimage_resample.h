@@ -0,0 +1,621 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Separable image resampling with a choice of filters.
+
+// Every output column and every output row gets its own list of
+// source pixels and weights, worked out once up front (so this is a
+// polyphase filter, even for ratios that aren't nice fractions).
+// Then it's a horizontal pass over each source row that's needed,
+// followed by a vertical pass over those results. Horizontally
+// resampled rows are kept in a small ring so each one only gets
+// computed once, and nothing the size of the whole image gets
+// allocated besides the output.
+//
+// When shrinking, the filter is stretched to cover the source pixels
+// that land in each output pixel, so there's no separate blur step
+// needed to avoid aliasing.
+//
+// With more than one thread, each thread takes chunks of output rows
+// and keeps its own ring. Source rows near the chunk boundaries get
+// resampled horizontally more than once, but every output row comes
+// out exactly the same as it would on one thread.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "pixelvalue.h"
+#include "pixelimagebase.h"
+#include "pixelimage.h"
+#include "pixelimage_access.h"
+#include "../simd.h"
+#include "../parallel.h"
+
+#include <vector>
+#include <cmath>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Filters for pixelImageResample().
+    enum PixelImage_ResampleFilter
+    {
+        /// Triangle filter, one pixel out on either side.
+        PixelImage_ResampleFilter_Bilinear,
+
+        /// Catmull-Rom cubic, two pixels out on either side.
+        PixelImage_ResampleFilter_Bicubic,
+
+        /// Lanczos with three lobes, three pixels out on either side.
+        PixelImage_ResampleFilter_Lanczos3,
+
+        /// Plain average of whatever area each output pixel covers,
+        /// including partial pixels.
+        PixelImage_ResampleFilter_Box,
+
+        /// Kaiser-windowed sinc (alpha = 4), three pixels out on
+        /// either side.
+        PixelImage_ResampleFilter_Kaiser
+    };
+
+    /// Source pixels and weights for every pixel along one axis of
+    /// the output.
+    struct PixelImageResampleTable
+    {
+        /// Number of taps for every output pixel. Some of them may
+        /// have zero weight.
+        size_t taps;
+
+        /// First source pixel for each output pixel, before the edge
+        /// mode is applied. Taps are consecutive from here.
+        std::vector<PixelImage_Coordinate> firstSource;
+
+        /// Source pixels for every tap, with the edge mode already
+        /// applied. outputSize * taps entries.
+        std::vector<PixelImage_Coordinate> sources;
+
+        /// Normalized weights for every tap. outputSize * taps
+        /// entries.
+        std::vector<float> weights;
+    };
+
+    /// Work out a resampling table for one axis. Taps that have zero
+    /// weight for every output pixel get trimmed off.
+    void pixelImageMakeResampleTable(
+        PixelImage_Dimension sourceSize,
+        PixelImage_Dimension outputSize,
+        PixelImage_ResampleFilter filter,
+        PixelImage_EdgeMode edgeMode,
+        PixelImageResampleTable &table);
+
+    /// Resample an image to a new size. Returns a new image that the
+    /// caller owns.
+    template<typename ValueType, ScalingType scalingType>
+    PixelImage<ValueType, scalingType> *pixelImageResample(
+        PixelImageBase &inputImage,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_ResampleFilter filter = PixelImage_ResampleFilter_Lanczos3,
+        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp,
+        size_t threadCount = 1);
+
+    /// pixelImageResample() into an image the caller already has,
+    /// which gets resized to width x height. No allocation happens
+    /// if it's already the right size. out can't be inputImage.
+    template<typename ValueType, ScalingType scalingType>
+    void pixelImageResampleInto(
+        const PixelImageBase &inputImage,
+        PixelImage<ValueType, scalingType> &out,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_ResampleFilter filter = PixelImage_ResampleFilter_Lanczos3,
+        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp,
+        size_t threadCount = 1);
+
+    /// Resample from any reader (see pixelimage_access.h) into an
+    /// image or typed writer that's already the output size, like a
+    /// PixelImageView of part of an image. A threadCount of 0 uses
+    /// every processor.
+    template<typename ReaderType, typename WriterType>
+    void pixelImageResample_kernel(
+        const ReaderType &inputImage,
+        WriterType &&out,
+        PixelImage_ResampleFilter filter,
+        PixelImage_EdgeMode edgeMode,
+        size_t threadCount = 1);
+
+    /// Resample output rows [yBegin, yEnd) from anything that can
+    /// produce source rows. rowSource(sourceY, dst) has to fill dst
+    /// with sourceWidth * channelCount floats for that row. The
+    /// tables come from pixelImageMakeResampleTable(), and
+    /// determine the source and output sizes.
+    template<typename RowSourceType, typename WriterType>
+    void pixelImageResampleRows(
+        RowSourceType &rowSource,
+        PixelImage_Dimension sourceWidth,
+        const PixelImageResampleTable &tableX,
+        const PixelImageResampleTable &tableY,
+        WriterType &&out,
+        PixelImage_Coordinate yBegin,
+        PixelImage_Coordinate yEnd);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    // ----------------------------------------------------------------------
+    // Filters and weight tables
+
+    /// How far out a filter goes, in pixels, before any stretching.
+    inline double pixelImageResampleFilterSupport(PixelImage_ResampleFilter filter)
+    {
+        switch(filter) {
+            case PixelImage_ResampleFilter_Bilinear:
+                return 1.0;
+            case PixelImage_ResampleFilter_Bicubic:
+                return 2.0;
+            case PixelImage_ResampleFilter_Box:
+                return 0.5;
+            default:
+                return 3.0;
+        }
+    }
+
+    inline double pixelImageResampleSinc(double x)
+    {
+        if(x == 0.0) {
+            return 1.0;
+        }
+        x *= 3.14159265358979323846;
+        return sin(x) / x;
+    }
+
+    /// Zeroth order modified Bessel function of the first kind, for
+    /// the Kaiser window.
+    inline double pixelImageResampleBessel0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        const double halfXSquared = x * x * 0.25;
+        for(int k = 1; k < 32; k++) {
+            term *= halfXSquared / double(k * k);
+            sum += term;
+            if(term < sum * 1e-12) {
+                break;
+            }
+        }
+        return sum;
+    }
+
+    /// Evaluate a filter at a distance (in pixels) from the center.
+    /// Not used for the box filter, which works on areas instead.
+    inline double pixelImageResampleFilterValue(
+        PixelImage_ResampleFilter filter,
+        double t)
+    {
+        t = fabs(t);
+
+        switch(filter) {
+
+            case PixelImage_ResampleFilter_Bilinear:
+                return t < 1.0 ? 1.0 - t : 0.0;
+
+            case PixelImage_ResampleFilter_Bicubic: {
+                // Catmull-Rom (Keys cubic with a = -0.5).
+                const double a = -0.5;
+                if(t < 1.0) {
+                    return ((a + 2.0) * t - (a + 3.0)) * t * t + 1.0;
+                } else if(t < 2.0) {
+                    return ((a * t - 5.0 * a) * t + 8.0 * a) * t - 4.0 * a;
+                }
+                return 0.0;
+            }
+
+            case PixelImage_ResampleFilter_Kaiser:
+                if(t < 3.0) {
+                    const double alpha = 4.0;
+                    const double r = t / 3.0;
+                    return pixelImageResampleSinc(t) *
+                        pixelImageResampleBessel0(alpha * sqrt(1.0 - r * r)) /
+                        pixelImageResampleBessel0(alpha);
+                }
+                return 0.0;
+
+            default:
+                if(t < 3.0) {
+                    return pixelImageResampleSinc(t) * pixelImageResampleSinc(t / 3.0);
+                }
+                return 0.0;
+        }
+    }
+
+    inline void pixelImageMakeResampleTable(
+        PixelImage_Dimension sourceSize,
+        PixelImage_Dimension outputSize,
+        PixelImage_ResampleFilter filter,
+        PixelImage_EdgeMode edgeMode,
+        PixelImageResampleTable &table)
+    {
+        const double scale = double(sourceSize) / double(outputSize);
+
+        // Stretch the filter out when shrinking so every source
+        // pixel contributes to something.
+        const double filterScale = scale > 1.0 ? scale : 1.0;
+        double support = pixelImageResampleFilterSupport(filter) * filterScale;
+
+        // Box weights come from how much of each source pixel is
+        // covered, so pixels half a source pixel further out count.
+        if(filter == PixelImage_ResampleFilter_Box) {
+            support += 0.5;
+        }
+
+        const PixelImage_Coordinate halfTaps = PixelImage_Coordinate(ceil(support));
+
+        table.taps = size_t(halfTaps) * 2;
+        table.firstSource.resize(outputSize);
+        table.sources.resize(size_t(outputSize) * table.taps);
+        table.weights.resize(size_t(outputSize) * table.taps);
+
+        for(PixelImage_Coordinate i = 0; i < outputSize; i++) {
+
+            // Center of this output pixel, in source pixel
+            // coordinates where source pixel s covers [s, s + 1).
+            const double center = (double(i) + 0.5) * scale - 0.5;
+            const PixelImage_Coordinate first =
+                PixelImage_Coordinate(floor(center)) - halfTaps + 1;
+
+            table.firstSource[i] = first;
+
+            PixelImage_Coordinate *sources = &table.sources[size_t(i) * table.taps];
+            float *weights = &table.weights[size_t(i) * table.taps];
+
+            double total = 0.0;
+            for(size_t k = 0; k < table.taps; k++) {
+
+                const PixelImage_Coordinate s = first + PixelImage_Coordinate(k);
+                double w = 0.0;
+
+                if(filter == PixelImage_ResampleFilter_Box) {
+                    // Overlap between the source pixel and a box one
+                    // output pixel wide.
+                    double low  = (double(s) - center - 0.5) / filterScale;
+                    double high = (double(s) - center + 0.5) / filterScale;
+                    if(low < -0.5) low = -0.5;
+                    if(high > 0.5) high = 0.5;
+                    w = high > low ? high - low : 0.0;
+                } else {
+                    w = pixelImageResampleFilterValue(filter, (double(s) - center) / filterScale);
+                }
+
+                sources[k] = pixelImageApplyEdgeMode(s, sourceSize, edgeMode);
+                weights[k] = float(w);
+                total += w;
+            }
+
+            if(total != 0.0) {
+                for(size_t k = 0; k < table.taps; k++) {
+                    weights[k] = float(weights[k] / total);
+                }
+            }
+        }
+
+        // Trim off taps at either end that never get used, so they
+        // don't cost anything in the passes.
+        size_t trimFront = table.taps;
+        size_t trimBack = table.taps;
+        for(PixelImage_Coordinate i = 0; i < outputSize; i++) {
+            const float *weights = &table.weights[size_t(i) * table.taps];
+            size_t front = 0;
+            while(front < table.taps && weights[front] == 0.0f) front++;
+            size_t back = 0;
+            while(back < table.taps - front && weights[table.taps - 1 - back] == 0.0f) back++;
+            if(front < trimFront) trimFront = front;
+            if(back < trimBack) trimBack = back;
+        }
+
+        if(trimFront + trimBack >= table.taps) {
+            // Nothing has any weight at all. Leave it alone.
+            return;
+        }
+
+        if(trimFront || trimBack) {
+
+            const size_t taps = table.taps - trimFront - trimBack;
+
+            for(PixelImage_Coordinate i = 0; i < outputSize; i++) {
+                table.firstSource[i] += PixelImage_Coordinate(trimFront);
+                for(size_t k = 0; k < taps; k++) {
+                    table.sources[size_t(i) * taps + k] = table.sources[size_t(i) * table.taps + trimFront + k];
+                    table.weights[size_t(i) * taps + k] = table.weights[size_t(i) * table.taps + trimFront + k];
+                }
+            }
+
+            table.taps = taps;
+            table.sources.resize(size_t(outputSize) * taps);
+            table.weights.resize(size_t(outputSize) * taps);
+        }
+    }
+
+    // ----------------------------------------------------------------------
+    // Passes
+
+    /// Horizontal pass over a single row of floats.
+    inline void pixelImageResampleRow(
+        const float *src,
+        float *dst,
+        size_t channelCount,
+        PixelImage_Dimension outputWidth,
+        const PixelImageResampleTable &table)
+    {
+        const size_t taps = table.taps;
+        const PixelImage_Coordinate *sources = &table.sources[0];
+        const float *weights = &table.weights[0];
+
+        if(channelCount == 4) {
+
+            // One pixel per SIMD register.
+            for(PixelImage_Coordinate x = 0; x < outputWidth; x++) {
+                SimdFloat4 acc = SimdFloat4::zero();
+                for(size_t k = 0; k < taps; k++) {
+                    acc = simdMulAdd(
+                        acc,
+                        SimdFloat4::load(src + size_t(sources[k]) * 4),
+                        SimdFloat4::splat(weights[k]));
+                }
+                acc.store(dst);
+                dst += 4;
+                sources += taps;
+                weights += taps;
+            }
+
+        } else {
+
+            for(PixelImage_Coordinate x = 0; x < outputWidth; x++) {
+                for(size_t c = 0; c < channelCount; c++) {
+                    float acc = 0.0f;
+                    for(size_t k = 0; k < taps; k++) {
+                        acc = acc + src[size_t(sources[k]) * channelCount + c] * weights[k];
+                    }
+                    *(dst++) = acc;
+                }
+                sources += taps;
+                weights += taps;
+            }
+        }
+    }
+
+    /// Vertical pass. out[j] = sum(rows[k][j] * weights[k]).
+    inline void pixelImageResampleColumns(
+        const float *const *rows,
+        float *out,
+        size_t count,
+        const float *weights,
+        size_t taps)
+    {
+        size_t j = 0;
+
+        for(; j + 4 <= count; j += 4) {
+            SimdFloat4 acc = SimdFloat4::zero();
+            for(size_t k = 0; k < taps; k++) {
+                acc = simdMulAdd(acc, SimdFloat4::load(rows[k] + j), SimdFloat4::splat(weights[k]));
+            }
+            acc.store(out + j);
+        }
+
+        for(; j < count; j++) {
+            float acc = 0.0f;
+            for(size_t k = 0; k < taps; k++) {
+                acc = acc + rows[k][j] * weights[k];
+            }
+            out[j] = acc;
+        }
+    }
+
+    template<typename RowSourceType, typename WriterType>
+    inline void pixelImageResampleRows(
+        RowSourceType &rowSource,
+        PixelImage_Dimension sourceWidth,
+        const PixelImageResampleTable &tableX,
+        const PixelImageResampleTable &tableY,
+        WriterType &&out,
+        PixelImage_Coordinate yBegin,
+        PixelImage_Coordinate yEnd)
+    {
+        const PixelImage_Dimension outputWidth = out.getWidth();
+        const size_t channelCount = out.getChannelCount();
+        const size_t rowFloats = size_t(outputWidth) * channelCount;
+        const size_t slotCount = tableY.taps;
+
+        // Ring of horizontally resampled rows. Slots are picked by
+        // the source row before the edge mode is applied, so every
+        // tap for one output row always lands in a different slot.
+        std::vector<float> slots(slotCount * rowFloats);
+        std::vector<PixelImage_Coordinate> slotKeys(slotCount);
+        std::vector<bool> slotValid(slotCount, false);
+        std::vector<const float*> rowPointers(slotCount);
+
+        std::vector<float> sourceRow(size_t(sourceWidth) * channelCount);
+        std::vector<float> outputRow(rowFloats);
+
+        for(PixelImage_Coordinate y = yBegin; y < yEnd; y++) {
+
+            const PixelImage_Coordinate first = tableY.firstSource[y];
+            const PixelImage_Coordinate *sources = &tableY.sources[size_t(y) * slotCount];
+
+            for(size_t k = 0; k < slotCount; k++) {
+
+                const PixelImage_Coordinate key = first + PixelImage_Coordinate(k);
+                PixelImage_Coordinate slot = key % PixelImage_Coordinate(slotCount);
+                if(slot < 0) slot += PixelImage_Coordinate(slotCount);
+
+                float *slotRow = &slots[size_t(slot) * rowFloats];
+
+                if(!slotValid[slot] || slotKeys[slot] != key) {
+
+                    rowSource(sources[k], &sourceRow[0]);
+                    pixelImageResampleRow(&sourceRow[0], slotRow, channelCount, outputWidth, tableX);
+
+                    slotKeys[slot] = key;
+                    slotValid[slot] = true;
+                }
+
+                rowPointers[k] = slotRow;
+            }
+
+            pixelImageResampleColumns(
+                &rowPointers[0], &outputRow[0], rowFloats,
+                &tableY.weights[size_t(y) * slotCount], slotCount);
+
+            auto *outRow = out.getRow(y);
+            for(size_t j = 0; j < rowFloats; j++) {
+                outRow[j].template setScaledValue<double>(outputRow[j]);
+            }
+        }
+    }
+
+    /// Row source for pixelImageResampleRows() that just reads rows
+    /// out of a reader.
+    template<typename ReaderType>
+    struct PixelImageReaderRowSource
+    {
+        const ReaderType *reader;
+
+        void operator()(PixelImage_Coordinate y, float *dst) const
+        {
+            const PixelImage_Dimension width = reader->getWidth();
+            const PixelImage_Dimension channelCount = reader->getChannelCount();
+            for(PixelImage_Coordinate x = 0; x < width; x++) {
+                for(PixelImage_Coordinate c = 0; c < channelCount; c++) {
+                    *(dst++) = float(reader->get(x, y, c));
+                }
+            }
+        }
+    };
+
+    template<typename ReaderType, typename WriterType>
+    inline void pixelImageResample_kernel(
+        const ReaderType &inputImage,
+        WriterType &&out,
+        PixelImage_ResampleFilter filter,
+        PixelImage_EdgeMode edgeMode,
+        size_t threadCount)
+    {
+        const PixelImage_Dimension sourceWidth = inputImage.getWidth();
+        const PixelImage_Dimension sourceHeight = inputImage.getHeight();
+        const PixelImage_Dimension outputWidth = out.getWidth();
+        const PixelImage_Dimension outputHeight = out.getHeight();
+
+        if(!sourceWidth || !sourceHeight || !outputWidth || !outputHeight || !out.getChannelCount()) {
+            return;
+        }
+
+        PixelImageResampleTable tableX;
+        PixelImageResampleTable tableY;
+        pixelImageMakeResampleTable(sourceWidth, outputWidth, filter, edgeMode, tableX);
+        pixelImageMakeResampleTable(sourceHeight, outputHeight, filter, edgeMode, tableY);
+
+        PixelImageReaderRowSource<ReaderType> rowSource;
+        rowSource.reader = &inputImage;
+
+        parallelForChunks(
+            outputHeight, parallelGetChunkSize(outputHeight, threadCount, 16), threadCount,
+            [&](size_t yBegin, size_t yEnd) {
+                PixelImageReaderRowSource<ReaderType> chunkSource = rowSource;
+                pixelImageResampleRows(
+                    chunkSource, sourceWidth, tableX, tableY, out,
+                    PixelImage_Coordinate(yBegin), PixelImage_Coordinate(yEnd));
+            });
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    struct PixelImageResampleFunc
+    {
+        PixelImage<ValueType, scalingType> *outputImage;
+        PixelImage_ResampleFilter filter;
+        PixelImage_EdgeMode edgeMode;
+        size_t threadCount;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &reader)
+        {
+            pixelImageResample_kernel(reader, *outputImage, filter, edgeMode, threadCount);
+        }
+    };
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImage<ValueType, scalingType> *pixelImageResample(
+        PixelImageBase &inputImage,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_ResampleFilter filter,
+        PixelImage_EdgeMode edgeMode,
+        size_t threadCount)
+    {
+        PixelImage<ValueType, scalingType> *out =
+            new PixelImage<ValueType, scalingType>(
+                width, height, inputImage.getChannelCount());
+
+        pixelImageResampleInto(
+            inputImage, *out, out->getWidth(), out->getHeight(),
+            filter, edgeMode, threadCount);
+
+        return out;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline void pixelImageResampleInto(
+        const PixelImageBase &inputImage,
+        PixelImage<ValueType, scalingType> &out,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_ResampleFilter filter,
+        PixelImage_EdgeMode edgeMode,
+        size_t threadCount)
+    {
+        out.setSizeAndChannels(width, height, inputImage.getChannelCount());
+
+        PixelImageResampleFunc<ValueType, scalingType> func;
+        func.outputImage = &out;
+        func.filter = filter;
+        func.edgeMode = edgeMode;
+        func.threadCount = threadCount;
+        pixelImageDispatchReader(inputImage, func);
+    }
+}
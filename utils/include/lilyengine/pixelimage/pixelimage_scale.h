@@ -40,6 +40,14 @@
 #include "pixelvalue.h"
 #include "pixelimagebase.h"
 #include "pixelimage.h"
+#include "pixelimage_access.h"
+#include "pixelimage_blur.h"
+#include "pixelimage_resample.h"
+#include "../parallel.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
 
 // ----------------------------------------------------------------------
 // Declarations and documentation
@@ -47,56 +55,229 @@
 
 namespace ExPop
 {
+    /// Scale an image to any size. Shrinking blurs, halves the size
+    /// until it's within 2x of the goal, and then does Lanczos
+    /// filtering for the rest. Growing just uses Lanczos. This all
+    /// happens a band of rows at a time, so none of the intermediate
+    /// steps ever exist at full size. Returns a new image that the
+    /// caller owns, or nullptr for one pixel wide or tall outputs.
+    ///
+    /// Work is split up between threadCount threads (0 for every
+    /// processor). The output doesn't depend on the thread count.
     template<typename ValueType, ScalingType scalingType = pixelValueGetDefaultScalingType<ValueType>()>
     PixelImage<ValueType, scalingType> *pixelImageScale(
         PixelImageBase &inputImage,
         PixelImage_Dimension width,
-        PixelImage_Dimension height);
+        PixelImage_Dimension height,
+        size_t threadCount = 1);
+
+    /// pixelImageScale() into an image the caller already has, which
+    /// gets resized to width x height. No allocation happens if it's
+    /// already the right size. Returns false (and leaves out alone)
+    /// for one pixel wide or tall outputs. out can't be inputImage.
+    template<typename ValueType, ScalingType scalingType>
+    bool pixelImageScaleInto(
+        const PixelImageBase &inputImage,
+        PixelImage<ValueType, scalingType> &out,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        size_t threadCount = 1);
+
+    /// Halve the size of an image on one axis (x if axis is false, y
+    /// if it's true) by averaging pairs of pixels. Returns a new
+    /// image that the caller owns.
+    template<typename ValueType, ScalingType scalingType>
+    PixelImage<ValueType, scalingType> *pixelImageHalfRes(
+        PixelImageBase &inputImage,
+        bool axis,
+        size_t threadCount = 1);
+
+    /// pixelImageHalfRes() into an image the caller already has,
+    /// which gets resized to fit. out can't be inputImage.
+    template<typename ValueType, ScalingType scalingType>
+    void pixelImageHalfResInto(
+        const PixelImageBase &inputImage,
+        PixelImage<ValueType, scalingType> &out,
+        bool axis,
+        size_t threadCount = 1);
+
+    /// pixelImageScale() from any reader (see pixelimage_access.h)
+    /// into an image or typed writer that's already the output size,
+    /// like a PixelImageView of part of an image.
+    template<typename ReaderType, typename WriterType>
+    void pixelImageScale_kernel(
+        const ReaderType &inputImage,
+        WriterType &&out,
+        size_t threadCount = 1);
 }
 
 // ----------------------------------------------------------------------
 // Implementation
 // ----------------------------------------------------------------------
 
+// Each operation here is split into a _kernel function, templated on
+// the reader type (see pixelimage_access.h), and a wrapper that takes
+// a PixelImageBase, allocates the output, and dispatches on the input
+// type once.
+//
+// Everything takes an optional thread count. Work gets split into
+// bands of output rows (see parallel.h), and every output row is
+// computed the same way no matter which thread gets it, so the
+// results don't change with the number of threads.
+
 namespace ExPop
 {
-    template<typename ValueType, ScalingType scalingType = pixelValueGetDefaultScalingType<ValueType>()>
-    inline PixelImage<ValueType, scalingType> *upScaleImageLinear(
-        const PixelImageBase &inputImage,
-        int width, int height,
-        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp)
+    // ----------------------------------------------------------------------
+    // Linear upscaling
+
+    /// One axis worth of a bilinear sample position.
+    struct PixelImageLinearTap
     {
-        PixelImage<ValueType, scalingType> *outputImage =
-            new PixelImage<ValueType, scalingType>(
-                width, height, inputImage.getChannelCount());
+        PixelImage_Coordinate c0;
+        PixelImage_Coordinate c1;
+
+        /// Nearest pixel with wrapping. Used for samples that land
+        /// exactly on a pixel.
+        PixelImage_Coordinate wrapped;
+
+        float fraction;
+    };
+
+    /// Work out the pixels and weight for a normalized coordinate,
+    /// the same way PixelImageBase::sampleWithHalfPixelOffset()
+    /// does.
+    inline PixelImageLinearTap pixelImageMakeLinearTap(
+        float normalized,
+        PixelImage_Dimension size,
+        PixelImage_EdgeMode edgeMode)
+    {
+        normalized -= 0.5f / float(size);
+        float pixel = normalized * float(size);
+
+        PixelImage_Coordinate i = PixelImage_Coordinate(floor(pixel));
+        double junk;
+
+        PixelImageLinearTap tap;
+        tap.fraction = modf(pixel, &junk);
+        tap.c0 = pixelImageApplyEdgeMode(i, size, edgeMode);
+        tap.c1 = pixelImageApplyEdgeMode(i + 1, size, edgeMode);
+        tap.wrapped = pixelImageApplyEdgeMode(i, size, PixelImage_EdgeMode_Wrap);
+        return tap;
+    }
+
+    template<typename ReaderType, typename WriterType>
+    inline void upScaleImageLinear_kernel(
+        const ReaderType &inputImage,
+        WriterType &&outputImage,
+        PixelImage_EdgeMode edgeMode,
+        size_t threadCount = 1)
+    {
+        const PixelImage_Dimension width = outputImage.getWidth();
+        const PixelImage_Dimension height = outputImage.getHeight();
+        const PixelImage_Dimension channelCount = outputImage.getChannelCount();
 
         float dstPixelSize_x = 1.0f / float(width);
         float dstPixelSize_y = 1.0f / float(height);
 
+        // Sample positions only depend on one axis each, so just
+        // work them out once per column and once per row.
+        std::vector<PixelImageLinearTap> columnTaps(width);
+        for(PixelImage_Coordinate x = 0; x < width; x++) {
+            columnTaps[x] = pixelImageMakeLinearTap(
+                float(x) * dstPixelSize_x + dstPixelSize_x * 0.5f,
+                inputImage.getWidth(), edgeMode);
+        }
+
+        std::vector<PixelImageLinearTap> rowTaps(height);
         for(PixelImage_Coordinate y = 0; y < height; y++) {
-            for(PixelImage_Coordinate x = 0; x < width; x++) {
-                for(PixelImage_Coordinate c = 0; c < inputImage.getChannelCount(); c++) {
+            rowTaps[y] = pixelImageMakeLinearTap(
+                float(y) * dstPixelSize_y + dstPixelSize_y * 0.5f,
+                inputImage.getHeight(), edgeMode);
+        }
+
+        parallelForChunks(
+            height, parallelGetChunkSize(height, threadCount, 8), threadCount,
+            [&](size_t yBegin, size_t yEnd) {
+
+                for(PixelImage_Coordinate y = yBegin; y < PixelImage_Coordinate(yEnd); y++) {
+
+                    const PixelImageLinearTap &ty = rowTaps[y];
+                    auto *outRow = outputImage.getRow(y);
 
-                    // Create normalized coordinates.
-                    float nx = float(x) * dstPixelSize_x + dstPixelSize_x * 0.5f;
-                    float ny = float(y) * dstPixelSize_y + dstPixelSize_y * 0.5f;
+                    for(PixelImage_Coordinate x = 0; x < width; x++) {
 
-                    double p = inputImage.sampleWithHalfPixelOffset(
-                        nx,
-                        ny,
-                        c,
-                        edgeMode);
+                        const PixelImageLinearTap &tx = columnTaps[x];
+                        auto *outPixel = outRow + x * channelCount;
 
-                    outputImage->setDouble(x, y, c, p);
+                        for(PixelImage_Coordinate c = 0; c < channelCount; c++) {
+
+                            double p;
+
+                            if(!tx.fraction && !ty.fraction) {
+
+                                // Lands right on a source pixel.
+                                p = inputImage.get(tx.wrapped, ty.wrapped, c);
+
+                            } else {
+
+                                double upperVal =
+                                    inputImage.get(tx.c0, ty.c0, c) * (1.0f - tx.fraction) +
+                                    inputImage.get(tx.c1, ty.c0, c) * tx.fraction;
+
+                                double lowerVal =
+                                    inputImage.get(tx.c0, ty.c1, c) * (1.0f - tx.fraction) +
+                                    inputImage.get(tx.c1, ty.c1, c) * tx.fraction;
+
+                                p = upperVal * (1.0f - ty.fraction) + lowerVal * ty.fraction;
+                            }
+
+                            outPixel[c].template setScaledValue<double>(p);
+                        }
+                    }
                 }
-            }
+            });
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    struct PixelImageUpScaleLinearFunc
+    {
+        PixelImage<ValueType, scalingType> *outputImage;
+        PixelImage_EdgeMode edgeMode;
+        size_t threadCount;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &reader)
+        {
+            upScaleImageLinear_kernel(reader, *outputImage, edgeMode, threadCount);
         }
+    };
+
+    template<typename ValueType, ScalingType scalingType = pixelValueGetDefaultScalingType<ValueType>()>
+    inline PixelImage<ValueType, scalingType> *upScaleImageLinear(
+        const PixelImageBase &inputImage,
+        int width, int height,
+        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp,
+        size_t threadCount = 1)
+    {
+        PixelImage<ValueType, scalingType> *outputImage =
+            new PixelImage<ValueType, scalingType>(
+                width, height, inputImage.getChannelCount());
+
+        PixelImageUpScaleLinearFunc<ValueType, scalingType> func;
+        func.outputImage = outputImage;
+        func.edgeMode = edgeMode;
+        func.threadCount = threadCount;
+        pixelImageDispatchReader(inputImage, func);
 
         return outputImage;
     }
 
+    // ----------------------------------------------------------------------
+    // Averaged downscaling
+
+    template<typename ReaderType>
     inline double getRowSectionAverage(
-        const PixelImageBase &img,
+        const ReaderType &img,
         PixelImage_Coordinate row,
         float colStart,
         float colEnd,
@@ -107,8 +288,8 @@ namespace ExPop
             float a0 = 1.0f - (colStart - floor(colStart));
             float a1 = 1.0f - (floor(colEnd) + 1.0f - colEnd);
             return (
-                img.getDouble(int(colStart), row, channel) * a0 +
-                img.getDouble(int(colEnd)+1, row, channel) * a1) * (1.0f / (a0 + a1));
+                pixelImageReadEdge(img, int(colStart), row, channel) * a0 +
+                pixelImageReadEdge(img, int(colEnd)+1, row, channel) * a1) * (1.0f / (a0 + a1));
         }
 
         // Handle the first fractional pixel and determine the actual
@@ -131,7 +312,7 @@ namespace ExPop
             // startAlpha = 1.0f - (colStart - realStart);
             startAlpha = 1.0f - (float(realStart) - colStart);
 
-            startPixel = img.getDouble(realStart - 1, row, channel);
+            startPixel = pixelImageReadEdge(img, realStart - 1, row, channel);
 
         }
 
@@ -152,14 +333,14 @@ namespace ExPop
             realEnd = int(floor(colEnd)) - 1; // Whole pixels end right before this one.
             endAlpha = colEnd - realEnd; // frac(), basically.
 
-            endPixel = img.getDouble(realEnd + 1, row, channel);
+            endPixel = pixelImageReadEdge(img, realEnd + 1, row, channel);
 
         }
 
         // Add up all the pixels in between.
         double outputPixel = 0.0;
         for(int i = realStart; i <= realEnd; i++) {
-            outputPixel = outputPixel + img.getDouble(i, row, channel);
+            outputPixel = outputPixel + pixelImageReadEdge(img, i, row, channel);
         }
         outputPixel = outputPixel + startPixel * startAlpha;
         outputPixel = outputPixel + endPixel * endAlpha;
@@ -170,10 +351,9 @@ namespace ExPop
         return outputPixel;
     }
 
-
-
+    template<typename ReaderType>
     inline double getSectionAverage(
-        const PixelImageBase &img,
+        const ReaderType &img,
         float rowStart,
         float rowEnd,
         float colStart,
@@ -254,33 +434,69 @@ namespace ExPop
         return outputPixel;
     }
 
+    template<typename ReaderType, typename WriterType>
+    inline void downScaleImageAveraged_kernel(
+        const ReaderType &inputImage,
+        WriterType &&outputImage,
+        size_t threadCount = 1)
+    {
+        const PixelImage_Dimension width = outputImage.getWidth();
+        const PixelImage_Dimension height = outputImage.getHeight();
+        const PixelImage_Dimension channelCount = outputImage.getChannelCount();
+
+        float xstep = float(inputImage.getWidth()) / float(width);
+        float ystep = float(inputImage.getHeight()) / float(height);
+
+        parallelForChunks(
+            height, parallelGetChunkSize(height, threadCount, 4), threadCount,
+            [&](size_t yBegin, size_t yEnd) {
+
+                for(PixelImage_Coordinate y = yBegin; y < PixelImage_Coordinate(yEnd); y++) {
+
+                    auto *outRow = outputImage.getRow(y);
+
+                    for(PixelImage_Coordinate x = 0; x < PixelImage_Coordinate(width); x++) {
+                        for(PixelImage_Coordinate channel = 0; channel < PixelImage_Coordinate(channelCount); channel++) {
+                            outRow[x * channelCount + channel].template setScaledValue<double>(
+                                getSectionAverage(
+                                    inputImage,
+                                    y * ystep, (y + 1) * ystep - 1,
+                                    x * xstep, (x + 1) * xstep - 1,
+                                    channel));
+                        }
+                    }
+                }
+            });
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    struct PixelImageDownScaleAveragedFunc
+    {
+        PixelImage<ValueType, scalingType> *outputImage;
+        size_t threadCount;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &reader)
+        {
+            downScaleImageAveraged_kernel(reader, *outputImage, threadCount);
+        }
+    };
+
     template<typename ValueType, ScalingType scalingType = pixelValueGetDefaultScalingType<ValueType>()>
     inline PixelImage<ValueType, scalingType> *downScaleImageAveraged(
         PixelImageBase &inputImage,
         PixelImage_Dimension width,
-        PixelImage_Dimension height)
+        PixelImage_Dimension height,
+        size_t threadCount = 1)
     {
         PixelImage<ValueType, scalingType> *outputImage =
             new PixelImage<ValueType, scalingType>(
                 width, height, inputImage.getChannelCount());
 
-        float xstep = float(inputImage.getWidth()) / float(width);
-        float ystep = float(inputImage.getHeight()) / float(height);
-
-        for(PixelImage_Coordinate y = 0; y < PixelImage_Coordinate(height); y++) {
-            for(PixelImage_Coordinate x = 0; x < PixelImage_Coordinate(width); x++) {
-                for(PixelImage_Coordinate channel = 0; channel < PixelImage_Coordinate(inputImage.getChannelCount()); channel++) {
-                    outputImage->setDouble(
-                        x, y,
-                        channel,
-                        getSectionAverage(
-                            inputImage,
-                            y * ystep, (y + 1) * ystep - 1,
-                            x * xstep, (x + 1) * xstep - 1,
-                            channel));
-                }
-            }
-        }
+        PixelImageDownScaleAveragedFunc<ValueType, scalingType> func;
+        func.outputImage = outputImage;
+        func.threadCount = threadCount;
+        pixelImageDispatchReader(inputImage, func);
 
         return outputImage;
     }
@@ -346,78 +562,104 @@ namespace ExPop
         return ret;
     }
 
-    // Lanczos filter stuff starts here.
-
-    inline float pixelImage_lanczosSinc(float x)
-    {
-        return sin(x) / x;
-    }
-
-    inline float pixelImage_lanczosFilter(float x, float a)
-    {
-        if(x == 0.0f) {
-            return 1.0f;
-        } else if(x >= -a && x <= a) {
-            return
-                pixelImage_lanczosSinc(3.14159f * x) *
-                pixelImage_lanczosSinc(3.14159f * x/a);
-        }
-        return 0.0f;
-    }
+    // ----------------------------------------------------------------------
+    // Lanczos
 
+    /// Lanczos-3 scaling. Same as pixelImageResample() with wrapped
+    /// edges, except it refuses to make anything one pixel wide or
+    /// tall.
     template<typename ValueType, ScalingType scalingType>
     inline PixelImage<ValueType, scalingType> *pixelImageScale_lanczos(
         PixelImageBase &inputImage,
         PixelImage_Dimension width,
-        PixelImage_Dimension height)
+        PixelImage_Dimension height,
+        size_t threadCount = 1)
     {
         if(width <= 1 || height <= 1) {
             return nullptr;
         }
 
-        PixelImage<ValueType, scalingType> *out =
-            new PixelImage<ValueType, scalingType>(
-                width, height, inputImage.getChannelCount());
+        return pixelImageResample<ValueType, scalingType>(
+            inputImage, width, height,
+            PixelImage_ResampleFilter_Lanczos3,
+            PixelImage_EdgeMode_Wrap,
+            threadCount);
+    }
+
+    // ----------------------------------------------------------------------
+    // Half-res
+
+    template<typename ReaderType, typename WriterType>
+    inline void pixelImageHalfRes_kernel(
+        const ReaderType &inputImage,
+        WriterType &&out,
+        bool axis,
+        size_t threadCount = 1)
+    {
+        const PixelImage_Dimension channelCount = out.getChannelCount();
 
-        const float a = 3.0f;
+        parallelForChunks(
+            out.getHeight(), parallelGetChunkSize(out.getHeight(), threadCount, 16), threadCount,
+            [&](size_t yBegin, size_t yEnd) {
 
-        for(PixelImage_Coordinate y = 0; y < out->getHeight(); y++) {
-            for(PixelImage_Coordinate x = 0; x < out->getWidth(); x++) {
-                for(PixelImage_Coordinate c = 0; c < out->getChannelCount(); c++) {
+                for(PixelImage_Coordinate y = yBegin; y < PixelImage_Coordinate(yEnd); y++) {
 
-                    float sx = (float(x) / float(out->getWidth())) * float(inputImage.getWidth());
-                    float sy = (float(y) / float(out->getHeight())) * float(inputImage.getHeight());
+                    auto *outRow = out.getRow(y);
 
-                    float sourceStartX = floor(sx) - a + 1;
-                    float sourceEndX = floor(sx) + a;
-                    float sourceStartY = floor(sy) - a + 1;
-                    float sourceEndY = floor(sy) + a;
-                    float currentVal = 0.0f;
-                    float maxVal = 0.0f;
+                    for(PixelImage_Coordinate x = 0; x < out.getWidth(); x++) {
 
-                    for(float sourceY = sourceStartY; sourceY <= sourceEndY; sourceY++) {
-                        for(float sourceX = sourceStartX; sourceX <= sourceEndX; sourceX++) {
+                        PixelImage_Coordinate srcX1 = axis ? x : x * 2;
+                        PixelImage_Coordinate srcY1 = axis ? y * 2 : y;
+                        PixelImage_Coordinate srcX2 = axis ? x : x * 2 + 1;
+                        PixelImage_Coordinate srcY2 = axis ? y * 2 + 1 : y;
 
-                            float lval =
-                                pixelImage_lanczosFilter(sx - sourceX, a) *
-                                pixelImage_lanczosFilter(sy - sourceY, a);
+                        // One pixel wide or tall inputs still get one
+                        // pixel out, so clamp the second tap.
+                        if(srcX2 >= PixelImage_Coordinate(inputImage.getWidth())) srcX2 = inputImage.getWidth() - 1;
+                        if(srcY2 >= PixelImage_Coordinate(inputImage.getHeight())) srcY2 = inputImage.getHeight() - 1;
 
-                            maxVal += lval;
-                            currentVal += inputImage.getDouble(sourceX, sourceY, c) * lval;
+                        for(PixelImage_Coordinate c = 0; c < channelCount; c++) {
+                            double avg =
+                                (inputImage.get(srcX1, srcY1, c) +
+                                    inputImage.get(srcX2, srcY2, c)) / 2.0f;
+                            outRow[x * channelCount + c].template setScaledValue<double>(avg);
                         }
                     }
-                    out->getData(x, y, c).setScaledValue(currentVal / maxVal);
                 }
-            }
-        }
-
-        return out;
+            });
     }
 
+    template<typename ValueType, ScalingType scalingType>
+    struct PixelImageHalfResFunc
+    {
+        PixelImage<ValueType, scalingType> *outputImage;
+        bool axis;
+        size_t threadCount;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &reader)
+        {
+            pixelImageHalfRes_kernel(reader, *outputImage, axis, threadCount);
+        }
+    };
+
     template<typename ValueType, ScalingType scalingType>
     inline PixelImage<ValueType, scalingType> *pixelImageHalfRes(
         PixelImageBase &inputImage,
-        bool axis)
+        bool axis,
+        size_t threadCount)
+    {
+        PixelImage<ValueType, scalingType> *ret = new PixelImage<ValueType, scalingType>();
+        pixelImageHalfResInto(inputImage, *ret, axis, threadCount);
+        return ret;
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline void pixelImageHalfResInto(
+        const PixelImageBase &inputImage,
+        PixelImage<ValueType, scalingType> &out,
+        bool axis,
+        size_t threadCount)
     {
         PixelImage_Dimension dims[2] = {
             inputImage.getWidth(),
@@ -429,181 +671,256 @@ namespace ExPop
             axis == true  ? (dims[1] / 2) : dims[1]
         };
 
-        PixelImage<ValueType, scalingType> *ret = new PixelImage<ValueType, scalingType>(
-            newDims[0], newDims[1], inputImage.getChannelCount());
-
-        for(PixelImage_Coordinate c = 0; c < inputImage.getChannelCount(); c++) {
-            for(PixelImage_Coordinate keepAxis = 0; keepAxis < newDims[!axis]; keepAxis++) {
-                for(PixelImage_Coordinate changeAxis = 0; changeAxis < newDims[axis]; changeAxis++) {
-
-                    PixelImage_Coordinate pos[2] = {
-                        axis == false ? changeAxis : keepAxis,
-                        axis == true  ? changeAxis : keepAxis
-                    };
-                    PixelImage_Coordinate srcPos1[2] = {
-                        axis == false ? changeAxis * 2 : keepAxis,
-                        axis == true  ? changeAxis * 2: keepAxis
-                    };
-                    PixelImage_Coordinate srcPos2[2] = {
-                        axis == false ? changeAxis * 2 + 1: keepAxis,
-                        axis == true  ? changeAxis * 2 + 1: keepAxis
-                    };
-
-                    double avg =
-                        (inputImage.getDouble(srcPos1[0], srcPos1[1], c) +
-                            inputImage.getDouble(srcPos1[0], srcPos2[1], c)) / 2.0f;
-                    ret->setDouble(pos[0], pos[1], c, avg);
-                }
-            }
-        }
-
-        return ret;
-    }
-
-    template<typename ValueType, ScalingType scalingType>
-    inline PixelImage<ValueType, scalingType> *pixelImageGaussianBlur(
-        PixelImageBase &img,
-        float radius_x,
-        float radius_y,
-        PixelImage_EdgeMode edgeMode = PixelImage_EdgeMode_Clamp)
-    {
-        size_t intRadius_x = size_t(radius_x) + 1;
-        size_t intRadius_y = size_t(radius_y) + 1;
-
-        PixelImage<ValueType, scalingType> *out =
-            new PixelImage<ValueType, scalingType>(
-                img.getWidth(),
-                img.getHeight(),
-                img.getChannelCount());
-
-        size_t diameter_x = intRadius_x * 2;
-        size_t diameter_y = intRadius_y * 2;
-
-        const float sigma = 1.0f;
+        // Same clamping the constructor does.
+        if(newDims[0] < 1) newDims[0] = 1;
+        if(newDims[1] < 1) newDims[1] = 1;
 
-        // Construct an appropriately-sized kernel.
-        float *gaussianKernel = new float[diameter_y * diameter_x];
-        float gaussianTotal = 0.0f;
-        for(size_t y = 0; y < diameter_y; y++) {
-            float ydelta = ((float(y) - float(intRadius_y)) / radius_y) * 2.0f;
-            float ysqr = ydelta * ydelta;
+        out.setSizeAndChannels(newDims[0], newDims[1], inputImage.getChannelCount());
 
-            for(size_t x = 0; x < diameter_x; x++) {
-                float xdelta = ((float(x) - float(intRadius_x)) / radius_x) * 2.0f;
-                float xsqr = xdelta * xdelta;
+        PixelImageHalfResFunc<ValueType, scalingType> func;
+        func.outputImage = &out;
+        func.axis = axis;
+        func.threadCount = threadCount;
+        pixelImageDispatchReader(inputImage, func);
+    }
 
-                gaussianKernel[x + y * diameter_x] =
-                    (1.0f / (2.0f * 3.14159 * sigma * sigma)) *
-                    powf(2.718281828459f, -(xsqr + ysqr) / (2.0f * sigma * sigma));
+    // ----------------------------------------------------------------------
+    // Scaling, with all of the above
 
-                gaussianTotal += gaussianKernel[x + y * diameter_x];
-            }
+    /// Reader for a band of rows out of another reader. Row 0 is
+    /// firstRow in the original, and rows past the top or bottom of
+    /// the original are clamped to the edge.
+    template<typename ReaderType>
+    struct PixelImageClampedBandReader
+    {
+        const ReaderType *reader;
+        PixelImage_Coordinate firstRow;
+        PixelImage_Dimension rowCount;
+
+        PixelImage_Dimension getWidth() const { return reader->getWidth(); }
+        PixelImage_Dimension getHeight() const { return rowCount; }
+        PixelImage_Dimension getChannelCount() const { return reader->getChannelCount(); }
+
+        double get(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Coordinate channel) const
+        {
+            return reader->get(
+                x,
+                pixelImageApplyEdgeMode(firstRow + y, reader->getHeight(), PixelImage_EdgeMode_Clamp),
+                channel);
         }
+    };
 
-        // Go through and normalize the whole kernel.
-        for(size_t y = 0; y < diameter_y; y++) {
-            for(size_t x = 0; x < diameter_x; x++) {
-                gaussianKernel[x + y * diameter_x] /= gaussianTotal;
-            }
+    template<typename ReaderType, typename WriterType>
+    inline void pixelImageScale_kernel(
+        const ReaderType &inputImage,
+        WriterType &&out,
+        size_t threadCount)
+    {
+        const PixelImage_Dimension sourceWidth = inputImage.getWidth();
+        const PixelImage_Dimension sourceHeight = inputImage.getHeight();
+        const PixelImage_Dimension width = out.getWidth();
+        const PixelImage_Dimension height = out.getHeight();
+        const size_t channelCount = inputImage.getChannelCount();
+
+        if(!sourceWidth || !sourceHeight || !width || !height || !channelCount) {
+            return;
         }
 
-        for(PixelImage_Coordinate y = 0; y < img.getHeight(); y++) {
-            for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
-                for(PixelImage_Coordinate c = 0; c < img.getChannelCount(); c++) {
-
-                    float dstPx = 0.0f;
+        // Blur with a radius dependent on the ratio between the
+        // original and desired sizes, on any axis that's shrinking.
+        const bool blur = width < sourceWidth || height < sourceHeight;
+        const float radiusX = width  < sourceWidth  ? (0.5f * float(sourceWidth)  / float(width))  : 1;
+        const float radiusY = height < sourceHeight ? (0.5f * float(sourceHeight) / float(height)) : 1;
+        const PixelImage_BlurMode blurMode =
+            pixelImageResolveBlurMode(radiusX, radiusY, PixelImage_BlurMode_Auto);
+        const PixelImage_Coordinate reachY = blur ? pixelImageGaussianBlurReach(radiusY, blurMode) : 0;
+
+        // Determine how far we can go by half-rezzing, on each axis
+        // separately. Halving n times is the same as averaging
+        // blocks of 2^n pixels.
+        PixelImage_Dimension halfResWidth = sourceWidth;
+        PixelImage_Dimension halfResHeight = sourceHeight;
+        PixelImage_Coordinate factorX = 1;
+        PixelImage_Coordinate factorY = 1;
+        while((halfResWidth >> 1) >= width) {
+            halfResWidth >>= 1;
+            factorX <<= 1;
+        }
+        while((halfResHeight >> 1) >= height) {
+            halfResHeight >>= 1;
+            factorY <<= 1;
+        }
 
-                    for(int ky = 0; ky < int(diameter_y); ky++) {
-                        for(int kx = 0; kx < int(diameter_x); kx++) {
+        // Do the final scaling with Lanczos filtering.
+        PixelImageResampleTable tableX;
+        PixelImageResampleTable tableY;
+        pixelImageMakeResampleTable(halfResWidth, width, PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Wrap, tableX);
+        pixelImageMakeResampleTable(halfResHeight, height, PixelImage_ResampleFilter_Lanczos3, PixelImage_EdgeMode_Wrap, tableY);
+
+        const size_t halfResRowFloats = size_t(halfResWidth) * channelCount;
+        const float halfResScale = 1.0f / float(factorX * factorY);
+
+        // Half-res rows get made in groups, each of which needs a
+        // blurred band of the source with reachY extra rows on either
+        // side. Groups are big enough that the extra rows aren't
+        // most of the work.
+        PixelImage_Coordinate groupRows = (reachY * 4 + factorY - 1) / factorY;
+        if(groupRows < 1) groupRows = 1;
+        const PixelImage_Dimension maxBandRows = groupRows * factorY + reachY * 2;
+
+        // Chunks of output rows don't depend on the thread count,
+        // because the box blur can round differently depending on
+        // where a band starts.
+        size_t chunkRows = size_t(height) / 16;
+        if(chunkRows < tableY.taps * 4) chunkRows = tableY.taps * 4;
+
+        parallelForChunks(
+            height, chunkRows, threadCount,
+            [&](size_t yBegin, size_t yEnd) {
+
+                // Every half-res row any output row in this chunk
+                // needs, in order.
+                std::vector<PixelImage_Coordinate> needed(
+                    tableY.sources.begin() + yBegin * tableY.taps,
+                    tableY.sources.begin() + yEnd * tableY.taps);
+                std::sort(needed.begin(), needed.end());
+                needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+
+                std::vector<float> halfResRows(needed.size() * halfResRowFloats);
+                PixelImage<float> band(sourceWidth, maxBandRows, channelCount);
+                std::vector<float> accumulator(halfResRowFloats);
+
+                PixelImageClampedBandReader<ReaderType> bandReader;
+                bandReader.reader = &inputImage;
+
+                size_t i = 0;
+                while(i < needed.size()) {
+
+                    // Next run of consecutive rows.
+                    size_t groupEnd = i + 1;
+                    while(groupEnd < needed.size() &&
+                        groupEnd - i < size_t(groupRows) &&
+                        needed[groupEnd] == needed[groupEnd - 1] + 1)
+                    {
+                        groupEnd++;
+                    }
 
-                            const float srcPx =
-                                img.getDouble(
-                                    x + (kx - intRadius_x),
-                                    y + (ky - intRadius_y),
-                                    c,
-                                    edgeMode);
+                    const PixelImage_Coordinate firstSourceRow = needed[i] * factorY - reachY;
+                    const PixelImage_Dimension bandRows = PixelImage_Dimension(groupEnd - i) * factorY + reachY * 2;
+
+                    // Blurred (or just converted) source rows.
+                    bandReader.firstRow = firstSourceRow;
+                    bandReader.rowCount = bandRows;
+                    if(blur) {
+                        pixelImageGaussianBlur_kernel(
+                            bandReader, band, radiusX, radiusY,
+                            PixelImage_EdgeMode_Clamp, blurMode, 1);
+                    } else {
+                        for(PixelImage_Coordinate y = 0; y < bandRows; y++) {
+                            PixelValue<float> *bandRow = band.getRow(y);
+                            for(PixelImage_Coordinate x = 0; x < sourceWidth; x++) {
+                                for(size_t c = 0; c < channelCount; c++) {
+                                    (bandRow++)->value = float(bandReader.get(x, y, c));
+                                }
+                            }
+                        }
+                    }
 
-                            const float &kernelPt =
-                                gaussianKernel[kx + ky * diameter_x];
+                    // Average blocks down to half-res rows.
+                    for(; i < groupEnd; i++) {
+
+                        std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+
+                        for(PixelImage_Coordinate r = 0; r < factorY; r++) {
+                            const PixelValue<float> *bandRow =
+                                band.getRow(needed[i] * factorY + r - firstSourceRow);
+                            float *acc = &accumulator[0];
+                            for(PixelImage_Coordinate x = 0; x < halfResWidth; x++) {
+                                for(PixelImage_Coordinate fx = 0; fx < factorX; fx++) {
+                                    for(size_t c = 0; c < channelCount; c++) {
+                                        acc[c] += bandRow[c].value;
+                                    }
+                                    bandRow += channelCount;
+                                }
+                                acc += channelCount;
+                            }
+                        }
 
-                            dstPx += srcPx * kernelPt;
+                        float *halfResRow = &halfResRows[i * halfResRowFloats];
+                        for(size_t j = 0; j < halfResRowFloats; j++) {
+                            halfResRow[j] = accumulator[j] * halfResScale;
                         }
                     }
-
-                    out->setDouble(x, y, c, dstPx);
                 }
-            }
-        }
 
-        delete[] gaussianKernel;
+                // Lanczos, pulling rows from what we just made.
+                auto rowSource = [&](PixelImage_Coordinate y, float *dst) {
+                    size_t index = std::lower_bound(needed.begin(), needed.end(), y) - needed.begin();
+                    memcpy(dst, &halfResRows[index * halfResRowFloats], sizeof(float) * halfResRowFloats);
+                };
 
-        return out;
+                pixelImageResampleRows(
+                    rowSource, halfResWidth, tableX, tableY, out,
+                    PixelImage_Coordinate(yBegin), PixelImage_Coordinate(yEnd));
+            });
     }
 
+    template<typename ValueType, ScalingType scalingType>
+    struct PixelImageScaleFunc
+    {
+        PixelImage<ValueType, scalingType> *outputImage;
+        size_t threadCount;
+
+        template<typename ReaderType>
+        void operator()(const ReaderType &reader)
+        {
+            pixelImageScale_kernel(reader, *outputImage, threadCount);
+        }
+    };
+
     template<typename ValueType, ScalingType scalingType>
     inline PixelImage<ValueType, scalingType> *pixelImageScale(
         PixelImageBase &inputImage,
         PixelImage_Dimension width,
-        PixelImage_Dimension height)
+        PixelImage_Dimension height,
+        size_t threadCount)
     {
-        PixelImageBase *img = &inputImage;
-        PixelImage<ValueType, scalingType> *blurredImg = nullptr;
-
-        // Apply a gaussian blur with a radius dependent on the ratio
-        // between the original and desired sizes.
-        if(width < img->getWidth() || height < img->getHeight()) {
-            blurredImg =
-                pixelImageGaussianBlur<ValueType, scalingType>(
-                    *img,
-                    width  < img->getWidth()  ? (0.5f * float(img->getWidth())  / float(width))  : 1,
-                    height < img->getHeight() ? (0.5f * float(img->getHeight()) / float(height)) : 1);
-            img = blurredImg;
+        if(width <= 1 || height <= 1) {
+            return nullptr;
         }
 
-        PixelImage_Dimension hrWidth = img->getWidth();
-        PixelImage_Dimension hrHeight = img->getHeight();
-
-        // Determine how far we can go by half-rezzing.
-        if(width < img->getWidth()) {
-            while((hrWidth >> 1) >= width) {
-                hrWidth >>= 1;
-            }
-            while((hrHeight >> 1) >= height) {
-                hrHeight >>= 1;
-            }
-        }
+        PixelImage<ValueType, scalingType> *out =
+            new PixelImage<ValueType, scalingType>(
+                width, height, inputImage.getChannelCount());
 
-        PixelImage<double> *tmp = new PixelImage<double>(*img);;
+        pixelImageScaleInto(inputImage, *out, width, height, threadCount);
 
-        // Half-rez on the x axis by averaging every pair of pixels,
-        // until we're within 2x of the goal size.
-        while(tmp->getWidth() > hrWidth) {
-            PixelImage<double> *tmp2 = nullptr;
-            tmp2 = pixelImageHalfRes<double, pixelValueGetDefaultScalingType<double>()>(*tmp, false);
-            delete tmp;
-            tmp = tmp2;
-        }
-        assert(tmp->getWidth() == hrWidth);
+        return out;
+    }
 
-        // Half-rez on the y axis by averaging every pair of pixels,
-        // until we're within 2x of the goal size.
-        while(tmp->getHeight() > hrHeight) {
-            PixelImage<double> *tmp2 = nullptr;
-            tmp2 = pixelImageHalfRes<double, pixelValueGetDefaultScalingType<double>()>(*tmp, true);
-            delete tmp;
-            tmp = tmp2;
+    template<typename ValueType, ScalingType scalingType>
+    inline bool pixelImageScaleInto(
+        const PixelImageBase &inputImage,
+        PixelImage<ValueType, scalingType> &out,
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        size_t threadCount)
+    {
+        if(width <= 1 || height <= 1) {
+            return false;
         }
-        assert(tmp->getHeight() == hrHeight);
 
-        // Do the final scaling with Lanczos filtering.
-        PixelImage<uint8_t> *scaled3 =
-            pixelImageScale_lanczos<ValueType, scalingType>(*tmp, width, height);
+        out.setSizeAndChannels(width, height, inputImage.getChannelCount());
 
-        delete tmp;
-        delete blurredImg;
+        PixelImageScaleFunc<ValueType, scalingType> func;
+        func.outputImage = &out;
+        func.threadCount = threadCount;
+        pixelImageDispatchReader(inputImage, func);
 
-        return scaled3;
+        return true;
     }
 
 }
-
@@ -30,6 +30,13 @@
 // -------------------------- END HEADER -------------------------------------
 
 // TGA support for arbitrary-format image class.
+//
+// The codec itself works on plain byte rows, so it can decode
+// straight into memory the caller already has (a PixelImage, a
+// texture upload buffer, whatever), or hand rows to a callback one
+// at a time. Nothing in the decoder or encoder allocates. The
+// pixelImageLoadTGA()/pixelImageSaveTGA() functions at the bottom
+// are the convenient versions that do.
 
 // ----------------------------------------------------------------------
 // Needed headers
@@ -41,6 +48,11 @@
 #include "pixelimage.h"
 
 #include "../filesystem.h"
+#include "../simd.h"
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
 
 // ----------------------------------------------------------------------
 // Declarations and documentation
@@ -48,10 +60,95 @@
 
 namespace ExPop
 {
+    /// Everything we need to know from a TGA header.
+    struct PixelImageTGAInfo
+    {
+        PixelImage_Dimension width;
+        PixelImage_Dimension height;
+
+        /// Channels in the file. 1 is grey, 2 is grey and alpha, 3 is
+        /// BGR, and 4 is BGRA.
+        PixelImage_Dimension channelCount;
+
+        bool rle;
+        bool topToBottom;
+        bool rightToLeft;
+
+        /// Where the pixel data starts, from the start of the file.
+        size_t dataOffset;
+    };
+
+    /// Read and check a TGA header. Only uncompressed and RLE
+    /// true-color (24 or 32 bit) and greyscale (8 or 16 bit) images
+    /// are supported. Returns false for anything else, or if the
+    /// buffer is too short to hold the header.
+    bool pixelImageReadTGAHeader(
+        const void *tgaData, size_t length,
+        PixelImageTGAInfo &info);
+
+    /// Decode a TGA into caller-provided memory. outChannelCount can
+    /// be 1 (grey), 2 (grey and alpha), 3 (RGB), or 4 (RGBA), and
+    /// doesn't have to match the file. Rows start rowStride bytes
+    /// apart, and the top row goes first. Returns false if the
+    /// header is bad or the data runs out, in which case the output
+    /// may be partly written.
+    bool pixelImageDecodeTGA(
+        const void *tgaData, size_t length,
+        uint8_t *out, PixelImage_Dimension outChannelCount, size_t rowStride);
+
+    /// Decode a TGA into an image that's already the same size as
+    /// the file. Any channel count from 1 to 4 works.
+    bool pixelImageDecodeTGA(
+        const void *tgaData, size_t length,
+        PixelImage<uint8_t> &img);
+
+    /// Decode a TGA one row at a time into rowBuffer (width *
+    /// outChannelCount bytes), calling rowFunc(y, rowBuffer) after
+    /// each one. Rows come in the order they're stored in the file,
+    /// which is usually bottom to top, and y is the row's position
+    /// in the image.
+    template<typename RowFuncType>
+    bool pixelImageDecodeTGARows(
+        const void *tgaData, size_t length,
+        PixelImage_Dimension outChannelCount, uint8_t *rowBuffer,
+        const RowFuncType &rowFunc);
+
+    /// How much scratch memory pixelImageEncodeTGA() needs.
+    size_t pixelImageGetTGAEncodeScratchSize(
+        PixelImage_Dimension width,
+        PixelImage_Dimension fileChannelCount);
+
+    /// Largest possible encoded size, header included, for
+    /// allocating a buffer ahead of time.
+    size_t pixelImageGetTGAMaxEncodedSize(
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Dimension fileChannelCount,
+        bool rle);
+
+    /// Encode a TGA a row at a time. rowSource(y) returns the row's
+    /// pixels, inChannelCount bytes each, in the same channel
+    /// layouts pixelImageDecodeTGA() uses. The file gets
+    /// fileChannelCount channels. output(data, length) gets called
+    /// with the header and then once per row, top to bottom. RLE
+    /// packets never cross rows. scratch must hold
+    /// pixelImageGetTGAEncodeScratchSize() bytes. Returns false for
+    /// sizes TGA can't store or unsupported channel counts.
+    template<typename RowSourceType, typename OutputFuncType>
+    bool pixelImageEncodeTGA(
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Dimension inChannelCount,
+        PixelImage_Dimension fileChannelCount,
+        bool rle,
+        uint8_t *scratch,
+        const RowSourceType &rowSource,
+        const OutputFuncType &output);
+
     PixelImage<uint8_t> *pixelImageLoadTGA(const void *tgaData, size_t tgaDataLength);
     PixelImage<uint8_t> *pixelImageLoadTGAFromFile(const std::string &filename);
-    uint8_t *pixelImageSaveTGA(const PixelImage<uint8_t> &img, size_t *length);
-    bool pixelImageSaveTGAToFile(const PixelImage<uint8_t> &img, const std::string &filename);
+    uint8_t *pixelImageSaveTGA(const PixelImage<uint8_t> &img, size_t *length, bool rle = false);
+    bool pixelImageSaveTGAToFile(const PixelImage<uint8_t> &img, const std::string &filename, bool rle = false);
 }
 
 // ----------------------------------------------------------------------
@@ -60,254 +157,480 @@ namespace ExPop
 
 namespace ExPop
 {
+    /// Convert a run of pixels between TGA channel layouts, swapping
+    /// red and blue on the way. The swap goes both ways, so this does
+    /// decoding and encoding. Greyscale expands to all three color
+    /// channels, and color gets turned into greyscale by taking
+    /// green, which sits in the same place in both orders. Missing
+    /// alpha is 255.
+    inline void pixelImageTGASwizzle(
+        const uint8_t *in, PixelImage_Dimension inChannelCount,
+        uint8_t *out, PixelImage_Dimension outChannelCount,
+        size_t count)
+    {
+        size_t i = 0;
 
-    // Move forward in the input stream.
-  #define EXPOP_LOADTGA2_INCPTR(x) if(size_t(p - (unsigned char*)tgaData + x) > length) { if(img) delete img; return nullptr; } p += x
+        if(inChannelCount == outChannelCount && inChannelCount <= 2) {
 
-    inline PixelImage<uint8_t> *pixelImageLoadTGA(const void *tgaData, size_t length)
-    {
-        PixelImage<uint8_t> *img = NULL;
+            memcpy(out, in, count * inChannelCount);
 
-        int idLength;
-        // int colorMapType;
-        int imageType;
+        } else if(inChannelCount == 4 && outChannelCount == 4) {
 
-        // Color map crap.
-        // int firstEntryIndex;
-        int colorMapLength;
-        int colorMapEntrySize;
+          #if EXPOP_SIMD_SSE2
 
-        // This is meaningless to me~
-        // int xOrigin;
-        // int yOrigin;
+            // Four pixels at a time, as 32-bit words. Keep the green
+            // and alpha bytes and swap the other two.
+            const __m128i greenAlpha = _mm_set1_epi32(int(0xff00ff00));
+            const __m128i lowByte = _mm_set1_epi32(0xff);
+            for(; i + 4 <= count; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(in + i * 4));
+                __m128i swapped = _mm_or_si128(
+                    _mm_and_si128(_mm_srli_epi32(v, 16), lowByte),
+                    _mm_slli_epi32(_mm_and_si128(v, lowByte), 16));
+                _mm_storeu_si128(
+                    (__m128i*)(out + i * 4),
+                    _mm_or_si128(_mm_and_si128(v, greenAlpha), swapped));
+            }
 
-        int width;
-        int height;
-        int depth;
-        int imageDescriptor;
+          #elif EXPOP_SIMD_NEON
 
-        unsigned char *p = (unsigned char*)tgaData;
+            for(; i + 16 <= count; i += 16) {
+                uint8x16x4_t v = vld4q_u8(in + i * 4);
+                uint8x16_t tmp = v.val[0];
+                v.val[0] = v.val[2];
+                v.val[2] = tmp;
+                vst4q_u8(out + i * 4, v);
+            }
 
-        // Buffer not even long enough for the header?
-        if(length < 18) {
-            return nullptr;
-        }
+          #endif
 
-        // Read in the header.
-        // FIXME: Endian issues will be here.
-        idLength          = *p; p++;
+            for(; i < count; i++) {
+                out[i * 4 + 0] = in[i * 4 + 2];
+                out[i * 4 + 1] = in[i * 4 + 1];
+                out[i * 4 + 2] = in[i * 4 + 0];
+                out[i * 4 + 3] = in[i * 4 + 3];
+            }
 
-        // colorMapType      = *p;
-        p++;
+        } else if(inChannelCount == 3 && outChannelCount == 3) {
 
-        imageType         = *p; p++;
+          #if EXPOP_SIMD_NEON
 
-        // firstEntryIndex   = *(unsigned short*)p;
-        p += 2;
+            for(; i + 16 <= count; i += 16) {
+                uint8x16x3_t v = vld3q_u8(in + i * 3);
+                uint8x16_t tmp = v.val[0];
+                v.val[0] = v.val[2];
+                v.val[2] = tmp;
+                vst3q_u8(out + i * 3, v);
+            }
 
-        colorMapLength    = *(unsigned short*)p; p += 2;
-        colorMapEntrySize = *p; p++;
+          #endif
 
-        // xOrigin           = *(unsigned short*)p;
-        p += 2;
+            for(; i < count; i++) {
+                out[i * 3 + 0] = in[i * 3 + 2];
+                out[i * 3 + 1] = in[i * 3 + 1];
+                out[i * 3 + 2] = in[i * 3 + 0];
+            }
 
-        // yOrigin           = *(unsigned short*)p;
-        p += 2;
+        } else if(inChannelCount == 3 && outChannelCount == 4) {
 
-        width             = *(unsigned short*)p; p += 2;
-        height            = *(unsigned short*)p; p += 2;
-        depth             = *p; p++;
-        imageDescriptor   = *p; p++;
+            for(; i < count; i++) {
+                out[i * 4 + 0] = in[i * 3 + 2];
+                out[i * 4 + 1] = in[i * 3 + 1];
+                out[i * 4 + 2] = in[i * 3 + 0];
+                out[i * 4 + 3] = 255;
+            }
 
-        if(!width || !height || !depth) {
-            return nullptr;
+        } else {
+
+            // Everything else goes through a full four-channel pixel.
+            for(; i < count; i++) {
+
+                const uint8_t *s = in + i * inChannelCount;
+                uint8_t *d = out + i * outChannelCount;
+                uint8_t rgba[4];
+
+                if(inChannelCount <= 2) {
+                    rgba[0] = rgba[1] = rgba[2] = s[0];
+                    rgba[3] = inChannelCount == 2 ? s[1] : 255;
+                } else {
+                    rgba[0] = s[2];
+                    rgba[1] = s[1];
+                    rgba[2] = s[0];
+                    rgba[3] = inChannelCount == 4 ? s[3] : 255;
+                }
+
+                if(outChannelCount <= 2) {
+                    d[0] = rgba[1];
+                    if(outChannelCount == 2) d[1] = rgba[3];
+                } else {
+                    for(PixelImage_Dimension c = 0; c < outChannelCount; c++) {
+                        d[c] = rgba[c];
+                    }
+                }
+            }
         }
+    }
 
-        // Reasonable width and height limit so a maliciously
-        // constructed one can't kill our address space.
-        if(width > 2048 || height > 2048) {
-            return nullptr;
+    inline bool pixelImageReadTGAHeader(
+        const void *tgaData, size_t length,
+        PixelImageTGAInfo &info)
+    {
+        const uint8_t *p = (const uint8_t*)tgaData;
+
+        // Buffer not even long enough for the header?
+        if(length < 18) {
+            return false;
         }
 
-        // Skip image descriptor.
-        EXPOP_LOADTGA2_INCPTR(idLength);
+        // Everything's little-endian.
+        const size_t idLength          = p[0];
+        const int imageType            = p[2];
+        const size_t colorMapLength    = p[5] | (p[6] << 8);
+        const size_t colorMapEntrySize = p[7];
+        const int depth                = p[16];
+        const int imageDescriptor      = p[17];
+
+        info.width  = p[12] | (p[13] << 8);
+        info.height = p[14] | (p[15] << 8);
 
-        // This loader only works with true-color images and greyscale
-        // right now. RLE and non-RLE are okay, though.
+        if(!info.width || !info.height) {
+            return false;
+        }
+
+        // Only true-color images and greyscale, RLE or not.
         switch(imageType) {
             case 2:  // Truecolor, uncompressed.
-            case 3:  // Greyscale, uncompressed.
             case 10: // Truecolor, RLE
+                if(depth != 24 && depth != 32) return false;
+                break;
+            case 3:  // Greyscale, uncompressed.
             case 11: // Greyscale, RLE
+                if(depth != 8 && depth != 16) return false;
                 break;
             default:
-                // Can't load this image. Not the right type.
-                return NULL;
+                return false;
         }
 
-        // TODO: Add colormap support?
+        info.channelCount = depth / 8;
+        info.rle = imageType >= 9;
+        info.topToBottom = (imageDescriptor & (1 << 5)) != 0;
+        info.rightToLeft = (imageDescriptor & (1 << 4)) != 0;
 
-        uint32_t colorMapSize;
-        if(colorMapEntrySize != 15) {
-            colorMapSize = (colorMapLength * colorMapEntrySize) / 8;
-        } else {
-            // If the color map entries are 15 bits each, we still have to
-            // read them as though they're 16 bits, and just ignore the
-            // last bit.
-            colorMapSize = (colorMapLength * 16) / 8;
+        // Skip the image ID and the color map. 15-bit color map
+        // entries still take up 16 bits.
+        const size_t colorMapSize = colorMapLength *
+            (colorMapEntrySize == 15 ? 16 : colorMapEntrySize) / 8;
+
+        info.dataOffset = 18 + idLength + colorMapSize;
+
+        return info.dataOffset <= length;
+    }
+
+    /// The decode loop. getRow(y) returns where to put row y, and
+    /// finishRow(y, row) gets called when it's done.
+    template<typename GetRowFuncType, typename FinishRowFuncType>
+    inline bool pixelImageDecodeTGA_kernel(
+        const void *tgaData, size_t length,
+        PixelImage_Dimension outChannelCount,
+        const GetRowFuncType &getRow,
+        const FinishRowFuncType &finishRow)
+    {
+        PixelImageTGAInfo info;
+        if(outChannelCount < 1 || outChannelCount > 4 ||
+            !pixelImageReadTGAHeader(tgaData, length, info))
+        {
+            return false;
         }
 
-        // Skip color map. Lalala
-        if(length < 18 + colorMapSize) return NULL;
-        p += colorMapSize;
+        const uint8_t *p = (const uint8_t*)tgaData + info.dataOffset;
+        const uint8_t *end = (const uint8_t*)tgaData + length;
+        const size_t inPixelSize = info.channelCount;
+        const size_t outPixelSize = outChannelCount;
+        const size_t width = info.width;
 
-        // Allocate the image.
-        img = new PixelImage<uint8_t>(width, height, 4);
+        // RLE packets can run from one row into the next, so this
+        // has to stick around between rows.
+        size_t packetLeft = 0;
+        bool packetIsRun = false;
 
-        size_t totalPx = width * height;
-        size_t index = 0;
+        for(PixelImage_Coordinate row = 0; row < info.height; row++) {
 
-        bool useRle = (imageType >= 9 && imageType <= 11);
-        bool flipVertically = !(imageDescriptor & (1 << 5));
+            const PixelImage_Coordinate y = info.topToBottom ? row : info.height - 1 - row;
+            uint8_t *out = getRow(y);
 
-        if(flipVertically) {
-            // If we're vertically flipped, then we need to start on the last row.
-            index = width * (height - 1);
-        }
+            if(!info.rle) {
 
-        while(index < totalPx && index != ~(size_t)0) {
-
-            int runLength = 1;
-            int rawLength = 1;
-
-            if(useRle) {
-                // Get the number of pixels this next thing represents.
-                runLength = (*p);
-                EXPOP_LOADTGA2_INCPTR(1);
-
-                // Figure out if it was actually a run length or a raw
-                // length. Note that the value read in is actually the
-                // number of bytes minus one, so we need to add one to
-                // whichever one of these it was.
-                if(runLength >= 128) {
-                    // Run length. Remove the first bit and add
-                    // 1. (Subtracting 127 does this.)
-                    runLength -= 127;
-                    rawLength = 1;
-                } else {
-                    // Raw length. Add one and swap run/raw.
-                    rawLength = runLength + 1;
-                    runLength = 1;
+                if(size_t(end - p) < width * inPixelSize) {
+                    return false;
                 }
-            }
+                pixelImageTGASwizzle(p, info.channelCount, out, outChannelCount, width);
+                p += width * inPixelSize;
 
-            while(rawLength) {
+            } else {
 
-                // Get the pixel value.
-                uint8_t dp[4];
+                size_t x = 0;
+                while(x < width) {
 
-                if(imageType == 10 || imageType == 2) {
+                    if(!packetLeft) {
 
-                    // True color
+                        // The top bit says whether it's a run or raw
+                        // pixels, and the rest is the pixel count
+                        // minus one.
+                        if(p >= end) {
+                            return false;
+                        }
+                        packetIsRun = (*p & 0x80) != 0;
+                        packetLeft = (*p & 0x7f) + 1;
+                        p++;
+
+                        if(packetIsRun) {
+                            if(size_t(end - p) < inPixelSize) {
+                                return false;
+                            }
+                            p += inPixelSize;
+                        }
+                    }
 
-                    if(depth == 32) {
+                    const size_t count = packetLeft < width - x ? packetLeft : width - x;
+                    uint8_t *outPixel = out + x * outPixelSize;
 
-                        // 32 bit BGRA.
+                    if(packetIsRun) {
 
-                        EXPOP_LOADTGA2_INCPTR(4);
-                        dp[0] = *(p - 2);
-                        dp[1] = *(p - 3);
-                        dp[2] = *(p - 4);
-                        dp[3] = *(p - 1);
+                        // The run's pixel is right behind p.
+                        pixelImageTGASwizzle(p - inPixelSize, info.channelCount, outPixel, outChannelCount, 1);
+                        for(size_t i = 1; i < count; i++) {
+                            memcpy(outPixel + i * outPixelSize, outPixel, outPixelSize);
+                        }
 
-                    } else if(depth == 24) {
+                    } else {
 
-                        // 24 bit BGR.
+                        if(size_t(end - p) < count * inPixelSize) {
+                            return false;
+                        }
+                        pixelImageTGASwizzle(p, info.channelCount, outPixel, outChannelCount, count);
+                        p += count * inPixelSize;
+                    }
 
-                        EXPOP_LOADTGA2_INCPTR(3);
-                        dp[0] = *(p - 1);
-                        dp[1] = *(p - 2);
-                        dp[2] = *(p - 3);
+                    x += count;
+                    packetLeft -= count;
+                }
+            }
 
-                        dp[3] = 255;
+            if(info.rightToLeft) {
+                for(size_t x = 0; x < width / 2; x++) {
+                    for(size_t c = 0; c < outPixelSize; c++) {
+                        std::swap(out[x * outPixelSize + c], out[(width - 1 - x) * outPixelSize + c]);
+                    }
+                }
+            }
 
-                    } else {
+            finishRow(y, out);
+        }
 
-                        // FIXME: 16 or 15 bits unsupported. Fail
-                        // more elegantly.
+        return true;
+    }
 
-                        // Uh...... 16 or 15 bit?
-                        dp[0] = 0xff;
-                        dp[1] = 0xff;
-                        dp[2] = 0xff;
-                        dp[3] = 0xff;
-                    }
+    inline bool pixelImageDecodeTGA(
+        const void *tgaData, size_t length,
+        uint8_t *out, PixelImage_Dimension outChannelCount, size_t rowStride)
+    {
+        return pixelImageDecodeTGA_kernel(
+            tgaData, length, outChannelCount,
+            [out, rowStride](PixelImage_Coordinate y) { return out + size_t(y) * rowStride; },
+            [](PixelImage_Coordinate, uint8_t*) {});
+    }
 
-                } else if(imageType == 3 || imageType == 11) {
+    inline bool pixelImageDecodeTGA(
+        const void *tgaData, size_t length,
+        PixelImage<uint8_t> &img)
+    {
+        PixelImageTGAInfo info;
+        if(!pixelImageReadTGAHeader(tgaData, length, info) ||
+            info.width != img.getWidth() || info.height != img.getHeight())
+        {
+            return false;
+        }
 
-                    // Greyscale
+        // PixelValue holds nothing but the value itself, so rows are
+        // plain bytes.
+        return pixelImageDecodeTGA(
+            tgaData, length,
+            reinterpret_cast<uint8_t*>(img.getRow(0)),
+            img.getChannelCount(), img.getRowStride());
+    }
 
-                    if(depth == 16) {
+    template<typename RowFuncType>
+    inline bool pixelImageDecodeTGARows(
+        const void *tgaData, size_t length,
+        PixelImage_Dimension outChannelCount, uint8_t *rowBuffer,
+        const RowFuncType &rowFunc)
+    {
+        return pixelImageDecodeTGA_kernel(
+            tgaData, length, outChannelCount,
+            [rowBuffer](PixelImage_Coordinate) { return rowBuffer; },
+            [&rowFunc](PixelImage_Coordinate y, uint8_t *row) { rowFunc(y, (const uint8_t*)row); });
+    }
 
-                        // Grey with alpha.
-                        EXPOP_LOADTGA2_INCPTR(2);
-                        dp[0] = dp[1] = dp[2] = *(p - 2);
-                        dp[3] = *(p - 1);
+    inline size_t pixelImageGetTGAEncodeScratchSize(
+        PixelImage_Dimension width,
+        PixelImage_Dimension fileChannelCount)
+    {
+        // One converted row, and the worst case for one RLE row:
+        // nothing but raw packets of 128 pixels.
+        return size_t(width) * fileChannelCount * 2 + (width + 127) / 128;
+    }
 
-                    } else if(depth == 8) {
+    inline size_t pixelImageGetTGAMaxEncodedSize(
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Dimension fileChannelCount,
+        bool rle)
+    {
+        size_t rowSize = size_t(width) * fileChannelCount;
+        if(rle) {
+            rowSize += (width + 127) / 128;
+        }
+        return 18 + rowSize * height;
+    }
 
-                        // Grey, no alpha.
-                        EXPOP_LOADTGA2_INCPTR(1);
-                        dp[0] = dp[1] = dp[2] = *(p - 1);
-                        dp[3] = 255;
+    /// RLE-encode one row of file-format pixels into out. Returns
+    /// the number of bytes written, which is never more than
+    /// width * pixelSize + (width + 127) / 128.
+    inline size_t pixelImageTGAEncodeRLERow(
+        const uint8_t *row, size_t width, size_t pixelSize,
+        uint8_t *out)
+    {
+        // A run of two single-byte pixels costs as much as two raw
+        // ones, and splitting a raw packet for it would cost an
+        // extra header, so greyscale runs need to be longer.
+        const size_t minRun = pixelSize == 1 ? 3 : 2;
+
+        auto runLength = [&](size_t x) {
+            size_t n = 1;
+            while(x + n < width && n < 128 &&
+                !memcmp(row + (x + n) * pixelSize, row + x * pixelSize, pixelSize))
+            {
+                n++;
+            }
+            return n;
+        };
 
-                    } else {
+        uint8_t *p = out;
+        size_t x = 0;
 
-                        // I don't know blah blah blah
-                        dp[0] = 0xff;
-                        dp[1] = 0xff;
-                        dp[2] = 0xff;
-                        dp[3] = 0xff;
+        while(x < width) {
 
-                    }
+            size_t run = runLength(x);
 
-                } else {
+            if(run >= minRun) {
 
-                    // FIXME: This image format is unsupported.
-                    // Maybe we should fail more elegantly.
+                *p++ = uint8_t(0x80 | (run - 1));
+                memcpy(p, row + x * pixelSize, pixelSize);
+                p += pixelSize;
+                x += run;
 
-                    // I don't even know what this is blah blah blah.
-                    dp[0] = 0xff;
-                    dp[1] = 0xff;
-                    dp[2] = 0xff;
-                    dp[3] = 0xff;
+            } else {
 
+                // Raw pixels up to the next run worth using.
+                size_t rawEnd = x + run;
+                while(rawEnd < width && rawEnd - x < 128) {
+                    run = runLength(rawEnd);
+                    if(run >= minRun) {
+                        break;
+                    }
+                    rawEnd += run;
+                }
+                if(rawEnd - x > 128) {
+                    rawEnd = x + 128;
                 }
 
-                // Set the pixels.
-                while(runLength) {
+                *p++ = uint8_t(rawEnd - x - 1);
+                memcpy(p, row + x * pixelSize, (rawEnd - x) * pixelSize);
+                p += (rawEnd - x) * pixelSize;
+                x = rawEnd;
+            }
+        }
 
-                    for(size_t i = 0; i < 4; i++) {
-                        img->getData(index % width, index / width, i).value = dp[i];
-                    }
+        return p - out;
+    }
 
-                    index++;
+    template<typename RowSourceType, typename OutputFuncType>
+    inline bool pixelImageEncodeTGA(
+        PixelImage_Dimension width,
+        PixelImage_Dimension height,
+        PixelImage_Dimension inChannelCount,
+        PixelImage_Dimension fileChannelCount,
+        bool rle,
+        uint8_t *scratch,
+        const RowSourceType &rowSource,
+        const OutputFuncType &output)
+    {
+        if(width <= 0 || height <= 0 || width > 0xffff || height > 0xffff ||
+            inChannelCount < 1 || inChannelCount > 4 ||
+            fileChannelCount < 1 || fileChannelCount > 4)
+        {
+            return false;
+        }
 
-                    if(flipVertically) {
-                        if(!(index % width)) {
-                            // Went past an edge.
-                            index -= width * 2;
-                        }
-                    }
+        // Header. Everything we don't set is zero.
+        uint8_t header[18] = { 0 };
+        header[2] = uint8_t((fileChannelCount <= 2 ? 3 : 2) + (rle ? 8 : 0));
+        header[12] = uint8_t(width & 0xff);
+        header[13] = uint8_t(width >> 8);
+        header[14] = uint8_t(height & 0xff);
+        header[15] = uint8_t(height >> 8);
+        header[16] = uint8_t(fileChannelCount * 8);
 
-                    runLength--;
-                }
+        // Top-to-bottom, and the number of alpha bits.
+        header[17] = uint8_t((1 << 5) | ((fileChannelCount == 2 || fileChannelCount == 4) ? 8 : 0));
+
+        output((const uint8_t*)header, size_t(18));
 
-                runLength = 1;
-                rawLength--;
+        const size_t rowSize = size_t(width) * fileChannelCount;
+        uint8_t *packed = scratch + rowSize;
+
+        for(PixelImage_Coordinate y = 0; y < height; y++) {
+
+            const uint8_t *row = rowSource(y);
+
+            // Swizzle into scratch space unless the row's already in
+            // the right format.
+            const uint8_t *fileRow = row;
+            if(inChannelCount != fileChannelCount || inChannelCount >= 3) {
+                pixelImageTGASwizzle(row, inChannelCount, scratch, fileChannelCount, width);
+                fileRow = scratch;
+            }
+
+            if(rle) {
+                output((const uint8_t*)packed, pixelImageTGAEncodeRLERow(fileRow, width, fileChannelCount, packed));
+            } else {
+                output(fileRow, rowSize);
             }
         }
 
+        return true;
+    }
+
+    inline PixelImage<uint8_t> *pixelImageLoadTGA(const void *tgaData, size_t length)
+    {
+        PixelImageTGAInfo info;
+        if(!pixelImageReadTGAHeader(tgaData, length, info)) {
+            return nullptr;
+        }
+
+        // Reasonable width and height limit so a maliciously
+        // constructed one can't kill our address space. Use
+        // pixelImageDecodeTGA() directly for bigger ones.
+        if(info.width > 2048 || info.height > 2048) {
+            return nullptr;
+        }
+
+        PixelImage<uint8_t> *img = new PixelImage<uint8_t>(info.width, info.height, 4);
+        if(!pixelImageDecodeTGA(tgaData, length, *img)) {
+            delete img;
+            return nullptr;
+        }
+
         return img;
     }
 
@@ -324,92 +647,53 @@ namespace ExPop
         return nullptr;
     }
 
-    // Move forward in our output stream.  There's no overflow check here
-    // because we allocate enough to begin with.  Uh.... in theory.
-  #define EXPOP_SAVETGA2_SKIPBYTES(x) { for(int i = x; i > 0; i--) { *p = 0; p++; } }
-
     inline uint8_t *pixelImageSaveTGA(
-        const PixelImage<uint8_t> &img, size_t *length)
+        const PixelImage<uint8_t> &img, size_t *length, bool rle)
     {
-        // This assumes we want a 32-bit, uncompressed, non-color-mapped
-        // TGA with alpha.
-
-        *length = 4 * img.getWidth() * img.getHeight() + 18;
-        uint8_t *out = new uint8_t[*length];
+        // Always a 32-bit, non-color-mapped TGA with alpha, whatever
+        // the image has. Anything past four channels gets dropped.
+        const PixelImage_Dimension channelCount = img.getChannelCount();
+        const PixelImage_Dimension inChannelCount = channelCount < 4 ? channelCount : 4;
+        std::vector<uint8_t> packedRow(channelCount > 4 ? img.getWidth() * 4 : 0);
+
+        uint8_t *out = new uint8_t[pixelImageGetTGAMaxEncodedSize(img.getWidth(), img.getHeight(), 4, rle)];
+        uint8_t *scratch = new uint8_t[pixelImageGetTGAEncodeScratchSize(img.getWidth(), 4)];
         uint8_t *p = out;
 
-        // We're going to skip through most of the header, except for the
-        // imageType, which must be 2 (RGBA, uncompressed).
-
-        EXPOP_SAVETGA2_SKIPBYTES(2);
-        // idLength
-        // colorMapType
-
-        *p = 2;	p++;  // imageType
-
-        EXPOP_SAVETGA2_SKIPBYTES(9);
-        // firstEntryIndex (2)
-        // colorMapLength (2)
-        // colorMapEntrySize
-        // xOrigin (2)
-        // yOrigin (2)
-
-        // Important stuff!
-
-        // FIXME: Endian issues will happen here with
-        // all the unsigned shorts.
-
-        // Width and height
-        *(unsigned short*)p = img.getWidth();  p += 2;
-        *(unsigned short*)p = img.getHeight(); p += 2;
-
-        // Depth
-        *p = 32; p++;
-
-        // Flip bit thing. We need this or the image pops out upside down.
-        *p = 1 << 5; p++;
-
-        // Write out the pixels.
-        for(PixelImage_Coordinate y = 0; y < img.getHeight(); y++) {
-            for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
-
-                // TGA stores stuff in BGRA.
-
-                if(img.getChannelCount() == 1) {
-
-                    // Greyscale, no alpha.
-                    *p = img.getData(x, y, 0).value; p++;
-                    *p = img.getData(x, y, 0).value; p++;
-                    *p = img.getData(x, y, 0).value; p++;
-                    *p = 255; p++;
-
-                } else if (img.getChannelCount() == 3) {
-
-                    // RGB, no alpha.
-                    *p = img.getData(x, y, 2).value; p++;
-                    *p = img.getData(x, y, 1).value; p++;
-                    *p = img.getData(x, y, 0).value; p++;
-                    *p = 255; p++;
+        bool ok = pixelImageEncodeTGA(
+            img.getWidth(), img.getHeight(), inChannelCount, 4, rle, scratch,
+            [&](PixelImage_Coordinate y) {
+                const uint8_t *row = reinterpret_cast<const uint8_t*>(img.getRow(y));
+                if(packedRow.empty()) {
+                    return row;
+                }
+                for(PixelImage_Coordinate x = 0; x < img.getWidth(); x++) {
+                    memcpy(&packedRow[x * 4], row + x * channelCount, 4);
+                }
+                return (const uint8_t*)&packedRow[0];
+            },
+            [&p](const uint8_t *data, size_t dataLength) { memcpy(p, data, dataLength); p += dataLength; });
 
-                } else {
+        delete[] scratch;
 
-                    // Assume RGBA.
-                    *p = img.getData(x, y, 2).value; p++;
-                    *p = img.getData(x, y, 1).value; p++;
-                    *p = img.getData(x, y, 0).value; p++;
-                    *p = img.getData(x, y, 3).value; p++;
-                }
-            }
+        if(!ok) {
+            delete[] out;
+            *length = 0;
+            return nullptr;
         }
 
+        *length = p - out;
         return out;
     }
 
     inline bool pixelImageSaveTGAToFile(
-        const PixelImage<uint8_t> &img, const std::string &filename)
+        const PixelImage<uint8_t> &img, const std::string &filename, bool rle)
     {
         size_t imgLen = 0;
-        uint8_t *data = pixelImageSaveTGA(img, &imgLen);
+        uint8_t *data = pixelImageSaveTGA(img, &imgLen, rle);
+        if(!data) {
+            return false;
+        }
 
         bool ret = (0 == ExPop::FileSystem::saveFile(filename, (char*)data, imgLen));
 
@@ -0,0 +1,384 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Non-owning views of a rectangle of pixels.
+
+// A view is just a pointer, a size, a channel count and a row stride,
+// over part of a PixelImage or over memory that belongs to someone
+// else entirely (a mapped texture, a decoder's buffer, and so on).
+// Views are PixelImageTypedReaders and PixelImageTypedWriters, so
+// anything that takes those (pixelImageGaussianBlur_kernel(),
+// pixelImageResample_kernel(), pixelImageScale_kernel(), the typed
+// pixelImageBlit()) can work on one region of an atlas in place,
+// without cropping it out into its own image first.
+//
+// Edges are the edges of the view. Blurring a view with
+// PixelImage_EdgeMode_Clamp gives the same results as cropping that
+// rectangle out and blurring the crop.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "pixelvalue.h"
+#include "pixelimagebase.h"
+#include "pixelimage.h"
+#include "pixelimage_access.h"
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Clip a rectangle to a width x height image. Leaves width or
+    /// height at zero if nothing is left.
+    void pixelImageClipRect(
+        PixelImage_Dimension imageWidth,
+        PixelImage_Dimension imageHeight,
+        PixelImage_Coordinate &x,
+        PixelImage_Coordinate &y,
+        PixelImage_Dimension &width,
+        PixelImage_Dimension &height);
+
+    /// Writable view of pixels that belong to something else. The
+    /// pixels have to outlive the view, and resizing a PixelImage
+    /// invalidates any views of it.
+    template<typename ValueType, ScalingType scalingType = pixelValueGetDefaultScalingType<ValueType>()>
+    class PixelImageView : public PixelImageTypedWriter<PixelValue<ValueType, scalingType> >
+    {
+    public:
+
+        typedef PixelValue<ValueType, scalingType> PixelValueType;
+
+        /// Empty view.
+        PixelImageView();
+
+        /// View of external memory. rowStride is the distance between
+        /// rows in values, or 0 for rows packed right after each
+        /// other.
+        PixelImageView(
+            ValueType *inData,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight,
+            PixelImage_Dimension inNumChannels,
+            size_t inRowStride = 0);
+
+        /// View of a whole image.
+        PixelImageView(PixelImage<ValueType, scalingType> &image);
+
+        /// View of a rectangle of an image, clipped to the image.
+        PixelImageView(
+            PixelImage<ValueType, scalingType> &image,
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight);
+
+        /// View of a rectangle of this view, clipped to this view.
+        PixelImageView getSubView(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight) const;
+
+        /// True if there are no pixels in the view.
+        bool isEmpty() const;
+
+    private:
+
+        PixelImageView(
+            PixelValueType *inData,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight,
+            PixelImage_Dimension inNumChannels,
+            size_t inRowStride);
+    };
+
+    /// Read-only version of PixelImageView, for const images and
+    /// const memory.
+    template<typename ValueType, ScalingType scalingType = pixelValueGetDefaultScalingType<ValueType>()>
+    class PixelImageConstView : public PixelImageTypedReader<PixelValue<ValueType, scalingType> >
+    {
+    public:
+
+        typedef PixelValue<ValueType, scalingType> PixelValueType;
+
+        /// Empty view.
+        PixelImageConstView();
+
+        /// View of external memory. rowStride is the distance between
+        /// rows in values, or 0 for rows packed right after each
+        /// other.
+        PixelImageConstView(
+            const ValueType *inData,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight,
+            PixelImage_Dimension inNumChannels,
+            size_t inRowStride = 0);
+
+        /// View of a whole image.
+        PixelImageConstView(const PixelImage<ValueType, scalingType> &image);
+
+        /// View of a rectangle of an image, clipped to the image.
+        PixelImageConstView(
+            const PixelImage<ValueType, scalingType> &image,
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight);
+
+        /// Read-only copy of a writable view.
+        PixelImageConstView(const PixelImageView<ValueType, scalingType> &view);
+
+        /// View of a rectangle of this view, clipped to this view.
+        PixelImageConstView getSubView(
+            PixelImage_Coordinate x,
+            PixelImage_Coordinate y,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight) const;
+
+        /// True if there are no pixels in the view.
+        bool isEmpty() const;
+
+    private:
+
+        PixelImageConstView(
+            const PixelValueType *inData,
+            PixelImage_Dimension inWidth,
+            PixelImage_Dimension inHeight,
+            PixelImage_Dimension inNumChannels,
+            size_t inRowStride);
+    };
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    inline void pixelImageClipRect(
+        PixelImage_Dimension imageWidth,
+        PixelImage_Dimension imageHeight,
+        PixelImage_Coordinate &x,
+        PixelImage_Coordinate &y,
+        PixelImage_Dimension &width,
+        PixelImage_Dimension &height)
+    {
+        PixelImage_Coordinate x1 = x + width;
+        PixelImage_Coordinate y1 = y + height;
+
+        if(x < 0) x = 0;
+        if(y < 0) y = 0;
+        if(x1 > imageWidth) x1 = imageWidth;
+        if(y1 > imageHeight) y1 = imageHeight;
+
+        width = x1 > x ? x1 - x : 0;
+        height = y1 > y ? y1 - y : 0;
+
+        // Keep empty rectangles from pointing past the end.
+        if(!width || !height) {
+            x = 0;
+            y = 0;
+            width = 0;
+            height = 0;
+        }
+    }
+
+    // PixelValue holds nothing but the value itself, so the raw
+    // memory constructors can just reinterpret the pointer.
+
+    // ----------------------------------------------------------------------
+    // PixelImageView
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageView<ValueType, scalingType>::PixelImageView() :
+        PixelImageTypedWriter<PixelValueType>(nullptr, 0, 0, 0, 0)
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageView<ValueType, scalingType>::PixelImageView(
+        PixelValueType *inData,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight,
+        PixelImage_Dimension inNumChannels,
+        size_t inRowStride) :
+        PixelImageTypedWriter<PixelValueType>(
+            inData, inWidth, inHeight, inNumChannels, inRowStride)
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageView<ValueType, scalingType>::PixelImageView(
+        ValueType *inData,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight,
+        PixelImage_Dimension inNumChannels,
+        size_t inRowStride) :
+        PixelImageTypedWriter<PixelValueType>(
+            reinterpret_cast<PixelValueType*>(inData),
+            inWidth, inHeight, inNumChannels,
+            inRowStride ? inRowStride : size_t(inWidth) * size_t(inNumChannels))
+    {
+        static_assert(sizeof(PixelValueType) == sizeof(ValueType), "PixelValue has to be the same size as its value.");
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageView<ValueType, scalingType>::PixelImageView(
+        PixelImage<ValueType, scalingType> &image) :
+        PixelImageTypedWriter<PixelValueType>(pixelImageMakeWriter(image))
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageView<ValueType, scalingType>::PixelImageView(
+        PixelImage<ValueType, scalingType> &image,
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight) :
+        PixelImageTypedWriter<PixelValueType>(PixelImageView(image).getSubView(x, y, inWidth, inHeight))
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageView<ValueType, scalingType> PixelImageView<ValueType, scalingType>::getSubView(
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight) const
+    {
+        pixelImageClipRect(this->width, this->height, x, y, inWidth, inHeight);
+        if(!inWidth) {
+            return PixelImageView(
+                static_cast<PixelValueType*>(nullptr), 0, 0, this->numChannels, 0);
+        }
+
+        return PixelImageView(
+            this->getRow(y) + size_t(x) * size_t(this->numChannels),
+            inWidth, inHeight, this->numChannels, this->rowStride);
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline bool PixelImageView<ValueType, scalingType>::isEmpty() const
+    {
+        return !this->width || !this->height;
+    }
+
+    // ----------------------------------------------------------------------
+    // PixelImageConstView
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageConstView<ValueType, scalingType>::PixelImageConstView() :
+        PixelImageTypedReader<PixelValueType>(nullptr, 0, 0, 0, 0)
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageConstView<ValueType, scalingType>::PixelImageConstView(
+        const PixelValueType *inData,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight,
+        PixelImage_Dimension inNumChannels,
+        size_t inRowStride) :
+        PixelImageTypedReader<PixelValueType>(
+            inData, inWidth, inHeight, inNumChannels, inRowStride)
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageConstView<ValueType, scalingType>::PixelImageConstView(
+        const ValueType *inData,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight,
+        PixelImage_Dimension inNumChannels,
+        size_t inRowStride) :
+        PixelImageTypedReader<PixelValueType>(
+            reinterpret_cast<const PixelValueType*>(inData),
+            inWidth, inHeight, inNumChannels,
+            inRowStride ? inRowStride : size_t(inWidth) * size_t(inNumChannels))
+    {
+        static_assert(sizeof(PixelValueType) == sizeof(ValueType), "PixelValue has to be the same size as its value.");
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageConstView<ValueType, scalingType>::PixelImageConstView(
+        const PixelImage<ValueType, scalingType> &image) :
+        PixelImageTypedReader<PixelValueType>(pixelImageMakeReader(image))
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageConstView<ValueType, scalingType>::PixelImageConstView(
+        const PixelImage<ValueType, scalingType> &image,
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight) :
+        PixelImageTypedReader<PixelValueType>(PixelImageConstView(image).getSubView(x, y, inWidth, inHeight))
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageConstView<ValueType, scalingType>::PixelImageConstView(
+        const PixelImageView<ValueType, scalingType> &view) :
+        PixelImageTypedReader<PixelValueType>(view)
+    {
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline PixelImageConstView<ValueType, scalingType> PixelImageConstView<ValueType, scalingType>::getSubView(
+        PixelImage_Coordinate x,
+        PixelImage_Coordinate y,
+        PixelImage_Dimension inWidth,
+        PixelImage_Dimension inHeight) const
+    {
+        pixelImageClipRect(this->width, this->height, x, y, inWidth, inHeight);
+        if(!inWidth) {
+            return PixelImageConstView(
+                static_cast<const PixelValueType*>(nullptr), 0, 0, this->numChannels, 0);
+        }
+
+        return PixelImageConstView(
+            this->getRow(y) + size_t(x) * size_t(this->numChannels),
+            inWidth, inHeight, this->numChannels, this->rowStride);
+    }
+
+    template<typename ValueType, ScalingType scalingType>
+    inline bool PixelImageConstView<ValueType, scalingType>::isEmpty() const
+    {
+        return !this->width || !this->height;
+    }
+}
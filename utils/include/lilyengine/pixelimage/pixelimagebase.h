@@ -268,23 +268,7 @@ namespace ExPop
             y * numChannels * width;
     }
 
-    inline PixelImageBase &PixelImageBase::operator=(const PixelImageBase &other)
-    {
-        setSizeAndChannels(
-            other.getWidth(),
-            other.getHeight(),
-            other.getChannelCount());
-
-        for(PixelImage_Coordinate y = 0; y < height; y++) {
-            for(PixelImage_Coordinate x = 0; x < width; x++) {
-                for(PixelImage_Coordinate c = 0; c < numChannels; c++) {
-                    setDouble(x, y, c, other.getDouble(x, y, c));
-                }
-            }
-        }
-
-        return *this;
-    }
+    // operator= is in pixelimage_convert.h.
 
     inline double PixelImageBase::sampleWithHalfPixelOffset(
         float x, float y,
@@ -0,0 +1,655 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Quaternions and dual quaternions, for rotations and rigid
+// transforms that need to be composed and interpolated a lot
+// (animation, mostly) without building and taking apart matrices
+// every frame. Both convert to and from the Matrix types.
+//
+// Rotations go the same way as makeRotationMatrix(), so
+// makeRotationQuaternion(axis, angle).toMatrix4x4() is the same
+// rotation as makeRotationMatrix(axis, angle), and q1 * q2 applies
+// q2 first, like matrices do.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include "matrix.h"
+#include "simd.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Quaternion, stored as x, y, z (vector part) then w (scalar
+    /// part).
+    template<typename T>
+    class Quaternion
+    {
+    public:
+
+        typedef Matrix<T, 3, 1> VectorType;
+
+        /// x, y, z, w.
+        T data[4];
+
+        /// Default constructor makes the identity rotation.
+        inline Quaternion(void);
+
+        /// Set each component.
+        inline Quaternion(T x, T y, T z, T w);
+
+        inline T &x(void);
+        inline T &y(void);
+        inline T &z(void);
+        inline T &w(void);
+
+        /// Hamilton product. The result applies other first, then
+        /// this.
+        inline Quaternion operator*(const Quaternion &other) const;
+
+        /// Component-wise add, for blending.
+        inline Quaternion operator+(const Quaternion &other) const;
+
+        /// Scale all four components.
+        inline Quaternion operator*(T s) const;
+
+        /// Negate all four components. Same rotation.
+        inline Quaternion operator-(void) const;
+
+        /// Four-component dot product.
+        inline T dot(const Quaternion &other) const;
+
+        inline T magnitude(void) const;
+
+        /// Scale to unit length. Only unit quaternions are rotations.
+        inline Quaternion normalize(void) const;
+
+        /// Negate the vector part. For unit quaternions this is the
+        /// inverse rotation.
+        inline Quaternion conjugate(void) const;
+
+        /// Inverse that also works for non-unit quaternions.
+        inline Quaternion inverse(void) const;
+
+        /// Rotate a vector. Must be a unit quaternion.
+        inline VectorType rotate(const VectorType &v) const;
+
+        /// Rotation matrix. Must be a unit quaternion.
+        inline Matrix<T, 3, 3> toMatrix3x3(void) const;
+
+        /// Rotation matrix with no translation. Must be a unit
+        /// quaternion.
+        inline Matrix<T, 4, 4> toMatrix4x4(void) const;
+    };
+
+    typedef Quaternion<float> FQuaternion;
+
+    /// Make a quaternion that rotates around a unit-length axis,
+    /// the same way makeRotationMatrix() does.
+    template<typename T>
+    inline Quaternion<T> makeRotationQuaternion(const Matrix<T, 3, 1> &axis, T angle);
+
+    /// Get the rotation out of a 3x3 matrix. The matrix has to be a
+    /// pure rotation (orthonormal, no scale or mirroring).
+    template<typename T>
+    inline Quaternion<T> makeQuaternionFromMatrix(const Matrix<T, 3, 3> &m);
+
+    /// Get the rotation out of the upper 3x3 of a 4x4 matrix.
+    /// Translation is ignored.
+    template<typename T>
+    inline Quaternion<T> makeQuaternionFromMatrix(const Matrix<T, 4, 4> &m);
+
+    /// Normalized linear interpolation across the shortest arc. Much
+    /// cheaper than slerp, and the difference in speed along the arc
+    /// is hard to notice for small steps, like frame-to-frame
+    /// animation.
+    template<typename T>
+    inline Quaternion<T> quaternionNlerp(const Quaternion<T> &a, const Quaternion<T> &b, T alpha);
+
+    /// Spherical linear interpolation across the shortest arc.
+    /// Constant angular speed.
+    template<typename T>
+    inline Quaternion<T> quaternionSlerp(const Quaternion<T> &a, const Quaternion<T> &b, T alpha);
+
+    /// Dual quaternion for a rigid transform (rotation then
+    /// translation, no scale). real holds the rotation, and dual
+    /// holds half the translation multiplied by the rotation.
+    template<typename T>
+    class DualQuaternion
+    {
+    public:
+
+        typedef Matrix<T, 3, 1> VectorType;
+
+        Quaternion<T> real;
+        Quaternion<T> dual;
+
+        /// Default constructor makes the identity transform.
+        inline DualQuaternion(void);
+
+        /// Rotate, then translate.
+        inline DualQuaternion(const Quaternion<T> &rotation, const VectorType &translation);
+
+        /// Compose two transforms. The result applies other first,
+        /// then this.
+        inline DualQuaternion operator*(const DualQuaternion &other) const;
+
+        /// Scale to a unit real part, which blended dual quaternions
+        /// need before they can be used.
+        inline DualQuaternion normalize(void) const;
+
+        /// Inverse transform. Must be normalized.
+        inline DualQuaternion inverse(void) const;
+
+        inline Quaternion<T> getRotation(void) const;
+
+        inline VectorType getTranslation(void) const;
+
+        /// Transform a point.
+        inline VectorType transformPoint(const VectorType &v) const;
+
+        /// Same transform as a matrix.
+        inline Matrix<T, 4, 4> toMatrix4x4(void) const;
+    };
+
+    typedef DualQuaternion<float> FDualQuaternion;
+
+    /// Get the transform out of a rigid 4x4 matrix (rotation and
+    /// translation only).
+    template<typename T>
+    inline DualQuaternion<T> makeDualQuaternionFromMatrix(const Matrix<T, 4, 4> &m);
+
+    /// Linear blend of dual quaternions for skinning. Each one gets
+    /// flipped to the same hemisphere as the first before it's added
+    /// in, and the result is normalized.
+    template<typename T>
+    inline DualQuaternion<T> dualQuaternionBlend(
+        const DualQuaternion<T> *transforms,
+        const T *weights,
+        size_t count);
+
+    /// Compute world transforms for a hierarchy, the same way
+    /// matrixBatchWorldTransforms() does: parents[i] is -1 for a root,
+    /// and every parent comes before its children.
+    inline void dualQuaternionBatchWorldTransforms(
+        const FDualQuaternion *local,
+        const int32_t *parents,
+        FDualQuaternion *world,
+        size_t count);
+
+    /// Skinning palette: palette[i] = world[i] * inverseBind[i].
+    inline void dualQuaternionBatchSkinningPalette(
+        const FDualQuaternion *world,
+        const FDualQuaternion *inverseBind,
+        FDualQuaternion *palette,
+        size_t count);
+
+    /// Skinning palette, converted to matrices for whatever wants
+    /// them that way.
+    inline void dualQuaternionBatchSkinningPalette(
+        const FDualQuaternion *world,
+        const FDualQuaternion *inverseBind,
+        FMatrix4x4 *palette,
+        size_t count);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    // ----------------------------------------------------------------------
+    // Quaternion
+
+    template<typename T>
+    inline Quaternion<T>::Quaternion(void)
+    {
+        data[0] = 0;
+        data[1] = 0;
+        data[2] = 0;
+        data[3] = 1;
+    }
+
+    template<typename T>
+    inline Quaternion<T>::Quaternion(T x, T y, T z, T w)
+    {
+        data[0] = x;
+        data[1] = y;
+        data[2] = z;
+        data[3] = w;
+    }
+
+    template<typename T>
+    inline T &Quaternion<T>::x(void)
+    {
+        return data[0];
+    }
+
+    template<typename T>
+    inline T &Quaternion<T>::y(void)
+    {
+        return data[1];
+    }
+
+    template<typename T>
+    inline T &Quaternion<T>::z(void)
+    {
+        return data[2];
+    }
+
+    template<typename T>
+    inline T &Quaternion<T>::w(void)
+    {
+        return data[3];
+    }
+
+    template<typename T>
+    inline Quaternion<T> Quaternion<T>::operator*(const Quaternion &other) const
+    {
+        // Written as four scaled, shuffled copies of other, summed in
+        // order, which is exactly what the SimdFloat4 version does.
+        const T *a = data;
+        const T *b = other.data;
+        return Quaternion(
+            ((a[3] * b[0] + a[0] * b[3]) + a[1] * b[2]) + a[2] * -b[1],
+            ((a[3] * b[1] + a[0] * -b[2]) + a[1] * b[3]) + a[2] * b[0],
+            ((a[3] * b[2] + a[0] * b[1]) + a[1] * -b[0]) + a[2] * b[3],
+            ((a[3] * b[3] + a[0] * -b[0]) + a[1] * -b[1]) + a[2] * -b[2]);
+    }
+
+    template<typename T>
+    inline Quaternion<T> Quaternion<T>::operator+(const Quaternion &other) const
+    {
+        return Quaternion(
+            data[0] + other.data[0],
+            data[1] + other.data[1],
+            data[2] + other.data[2],
+            data[3] + other.data[3]);
+    }
+
+    template<typename T>
+    inline Quaternion<T> Quaternion<T>::operator*(T s) const
+    {
+        return Quaternion(data[0] * s, data[1] * s, data[2] * s, data[3] * s);
+    }
+
+    template<typename T>
+    inline Quaternion<T> Quaternion<T>::operator-(void) const
+    {
+        return Quaternion(-data[0], -data[1], -data[2], -data[3]);
+    }
+
+    template<typename T>
+    inline T Quaternion<T>::dot(const Quaternion &other) const
+    {
+        return
+            data[0] * other.data[0] + data[1] * other.data[1] +
+            data[2] * other.data[2] + data[3] * other.data[3];
+    }
+
+    template<typename T>
+    inline T Quaternion<T>::magnitude(void) const
+    {
+        return std::sqrt(dot(*this));
+    }
+
+    template<typename T>
+    inline Quaternion<T> Quaternion<T>::normalize(void) const
+    {
+        T len = magnitude();
+        return Quaternion(data[0] / len, data[1] / len, data[2] / len, data[3] / len);
+    }
+
+    template<typename T>
+    inline Quaternion<T> Quaternion<T>::conjugate(void) const
+    {
+        return Quaternion(-data[0], -data[1], -data[2], data[3]);
+    }
+
+    template<typename T>
+    inline Quaternion<T> Quaternion<T>::inverse(void) const
+    {
+        T lenSquared = dot(*this);
+        return Quaternion(
+            -data[0] / lenSquared, -data[1] / lenSquared,
+            -data[2] / lenSquared, data[3] / lenSquared);
+    }
+
+    template<typename T>
+    inline typename Quaternion<T>::VectorType Quaternion<T>::rotate(const VectorType &v) const
+    {
+        // v + w * t + (q.xyz cross t), where t = 2 * (q.xyz cross v).
+        // Cheaper than two full quaternion products.
+        VectorType q(data[0], data[1], data[2]);
+        VectorType t = q.crossProduct(v) * T(2);
+        return v + t * data[3] + q.crossProduct(t);
+    }
+
+    template<typename T>
+    inline Matrix<T, 3, 3> Quaternion<T>::toMatrix3x3(void) const
+    {
+        const T x = data[0], y = data[1], z = data[2], w = data[3];
+        const T xx = x * x, yy = y * y, zz = z * z;
+        const T xy = x * y, xz = x * z, yz = y * z;
+        const T wx = w * x, wy = w * y, wz = w * z;
+
+        Matrix<T, 3, 3> m;
+        m(0, 0) = 1 - 2 * (yy + zz);
+        m(1, 0) = 2 * (xy + wz);
+        m(2, 0) = 2 * (xz - wy);
+        m(0, 1) = 2 * (xy - wz);
+        m(1, 1) = 1 - 2 * (xx + zz);
+        m(2, 1) = 2 * (yz + wx);
+        m(0, 2) = 2 * (xz + wy);
+        m(1, 2) = 2 * (yz - wx);
+        m(2, 2) = 1 - 2 * (xx + yy);
+        return m;
+    }
+
+    template<typename T>
+    inline Matrix<T, 4, 4> Quaternion<T>::toMatrix4x4(void) const
+    {
+        Matrix<T, 3, 3> rotation = toMatrix3x3();
+        return Matrix<T, 4, 4>(rotation.data, 3, 3);
+    }
+
+    template<typename T>
+    inline Quaternion<T> makeRotationQuaternion(const Matrix<T, 3, 1> &axis, T angle)
+    {
+        // makeRotationMatrix() turns the opposite way from the usual
+        // right-handed convention, so the half angle is negated to
+        // match it.
+        T halfAngle = -angle / 2;
+        T s = std::sin(halfAngle);
+        return Quaternion<T>(axis.data[0] * s, axis.data[1] * s, axis.data[2] * s, std::cos(halfAngle));
+    }
+
+    template<typename T>
+    inline Quaternion<T> makeQuaternionFromMatrix(const Matrix<T, 3, 3> &m)
+    {
+        // Work from whichever of w, x, y or z is biggest, so we never
+        // divide by something close to zero.
+        const T m00 = m.getConst(0, 0), m11 = m.getConst(1, 1), m22 = m.getConst(2, 2);
+        T trace = m00 + m11 + m22;
+
+        if(trace > 0) {
+            T s = std::sqrt(trace + 1) * 2;
+            return Quaternion<T>(
+                (m.getConst(2, 1) - m.getConst(1, 2)) / s,
+                (m.getConst(0, 2) - m.getConst(2, 0)) / s,
+                (m.getConst(1, 0) - m.getConst(0, 1)) / s,
+                s / 4);
+        } else if(m00 > m11 && m00 > m22) {
+            T s = std::sqrt(1 + m00 - m11 - m22) * 2;
+            return Quaternion<T>(
+                s / 4,
+                (m.getConst(0, 1) + m.getConst(1, 0)) / s,
+                (m.getConst(0, 2) + m.getConst(2, 0)) / s,
+                (m.getConst(2, 1) - m.getConst(1, 2)) / s);
+        } else if(m11 > m22) {
+            T s = std::sqrt(1 + m11 - m00 - m22) * 2;
+            return Quaternion<T>(
+                (m.getConst(0, 1) + m.getConst(1, 0)) / s,
+                s / 4,
+                (m.getConst(1, 2) + m.getConst(2, 1)) / s,
+                (m.getConst(0, 2) - m.getConst(2, 0)) / s);
+        } else {
+            T s = std::sqrt(1 + m22 - m00 - m11) * 2;
+            return Quaternion<T>(
+                (m.getConst(0, 2) + m.getConst(2, 0)) / s,
+                (m.getConst(1, 2) + m.getConst(2, 1)) / s,
+                s / 4,
+                (m.getConst(1, 0) - m.getConst(0, 1)) / s);
+        }
+    }
+
+    template<typename T>
+    inline Quaternion<T> makeQuaternionFromMatrix(const Matrix<T, 4, 4> &m)
+    {
+        return makeQuaternionFromMatrix(Matrix<T, 3, 3>(m.data, 4, 4));
+    }
+
+    template<typename T>
+    inline Quaternion<T> quaternionNlerp(const Quaternion<T> &a, const Quaternion<T> &b, T alpha)
+    {
+        // q and -q are the same rotation. Pick whichever one is
+        // closer to a, so we go the short way around.
+        Quaternion<T> target = a.dot(b) < 0 ? -b : b;
+        return (a * (1 - alpha) + target * alpha).normalize();
+    }
+
+    template<typename T>
+    inline Quaternion<T> quaternionSlerp(const Quaternion<T> &a, const Quaternion<T> &b, T alpha)
+    {
+        T cosTheta = a.dot(b);
+        Quaternion<T> target = b;
+        if(cosTheta < 0) {
+            cosTheta = -cosTheta;
+            target = -b;
+        }
+
+        // Nearly the same rotation. sin(theta) is too close to zero
+        // to divide by, and nlerp is just as good here anyway.
+        if(cosTheta > T(0.9995)) {
+            return (a * (1 - alpha) + target * alpha).normalize();
+        }
+
+        T theta = std::acos(cosTheta);
+        T sinTheta = std::sin(theta);
+        T wa = std::sin((1 - alpha) * theta) / sinTheta;
+        T wb = std::sin(alpha * theta) / sinTheta;
+        return a * wa + target * wb;
+    }
+
+    // ----------------------------------------------------------------------
+    // DualQuaternion
+
+    template<typename T>
+    inline DualQuaternion<T>::DualQuaternion(void) :
+        real(),
+        dual(0, 0, 0, 0)
+    {
+    }
+
+    template<typename T>
+    inline DualQuaternion<T>::DualQuaternion(const Quaternion<T> &rotation, const VectorType &translation) :
+        real(rotation),
+        dual(Quaternion<T>(translation.data[0], translation.data[1], translation.data[2], 0) * rotation * T(0.5))
+    {
+    }
+
+    template<typename T>
+    inline DualQuaternion<T> DualQuaternion<T>::operator*(const DualQuaternion &other) const
+    {
+        DualQuaternion out;
+        out.real = real * other.real;
+        out.dual = real * other.dual + dual * other.real;
+        return out;
+    }
+
+    template<typename T>
+    inline DualQuaternion<T> DualQuaternion<T>::normalize(void) const
+    {
+        T len = real.magnitude();
+        DualQuaternion out;
+        out.real = real * (1 / len);
+        out.dual = dual * (1 / len);
+        return out;
+    }
+
+    template<typename T>
+    inline DualQuaternion<T> DualQuaternion<T>::inverse(void) const
+    {
+        DualQuaternion out;
+        out.real = real.conjugate();
+        out.dual = dual.conjugate();
+        return out;
+    }
+
+    template<typename T>
+    inline Quaternion<T> DualQuaternion<T>::getRotation(void) const
+    {
+        return real;
+    }
+
+    template<typename T>
+    inline typename DualQuaternion<T>::VectorType DualQuaternion<T>::getTranslation(void) const
+    {
+        Quaternion<T> t = dual * real.conjugate();
+        return VectorType(t.data[0] * 2, t.data[1] * 2, t.data[2] * 2);
+    }
+
+    template<typename T>
+    inline typename DualQuaternion<T>::VectorType DualQuaternion<T>::transformPoint(const VectorType &v) const
+    {
+        return real.rotate(v) + getTranslation();
+    }
+
+    template<typename T>
+    inline Matrix<T, 4, 4> DualQuaternion<T>::toMatrix4x4(void) const
+    {
+        Matrix<T, 4, 4> m = real.toMatrix4x4();
+        VectorType t = getTranslation();
+        m(0, 3) = t.data[0];
+        m(1, 3) = t.data[1];
+        m(2, 3) = t.data[2];
+        return m;
+    }
+
+    template<typename T>
+    inline DualQuaternion<T> makeDualQuaternionFromMatrix(const Matrix<T, 4, 4> &m)
+    {
+        return DualQuaternion<T>(
+            makeQuaternionFromMatrix(m),
+            Matrix<T, 3, 1>(m.getConst(0, 3), m.getConst(1, 3), m.getConst(2, 3)));
+    }
+
+    template<typename T>
+    inline DualQuaternion<T> dualQuaternionBlend(
+        const DualQuaternion<T> *transforms,
+        const T *weights,
+        size_t count)
+    {
+        DualQuaternion<T> out;
+        out.real = Quaternion<T>(0, 0, 0, 0);
+        out.dual = Quaternion<T>(0, 0, 0, 0);
+        if(!count) {
+            return DualQuaternion<T>();
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            T w = weights[i];
+            if(transforms[i].real.dot(transforms[0].real) < 0) {
+                w = -w;
+            }
+            out.real = out.real + transforms[i].real * w;
+            out.dual = out.dual + transforms[i].dual * w;
+        }
+
+        return out.normalize();
+    }
+
+    // ----------------------------------------------------------------------
+    // SimdFloat4 versions
+
+    // operator*. Each lane of the result is the dot product of a with
+    // a shuffled, sign-flipped copy of b, so it's four scaled copies
+    // of b added together. Same order as the generic version.
+    template<>
+    inline FQuaternion FQuaternion::operator*(const FQuaternion &other) const
+    {
+        const SimdFloat4 b = SimdFloat4::load(other.data);
+        const SimdFloat4 bSwapPairs = simdSwapPairs(b);   // y x w z
+        const SimdFloat4 bSwapHalves = simdSwapHalves(b); // z w x y
+        const SimdFloat4 bReversed = simdSwapHalves(bSwapPairs); // w z y x
+
+        SimdFloat4 acc = SimdFloat4::splat(data[3]) * b;
+        acc = simdMulAdd(acc, SimdFloat4::splat(data[0]), bReversed * SimdFloat4::set(1.0f, -1.0f, 1.0f, -1.0f));
+        acc = simdMulAdd(acc, SimdFloat4::splat(data[1]), bSwapHalves * SimdFloat4::set(1.0f, 1.0f, -1.0f, -1.0f));
+        acc = simdMulAdd(acc, SimdFloat4::splat(data[2]), bSwapPairs * SimdFloat4::set(-1.0f, 1.0f, 1.0f, -1.0f));
+
+        FQuaternion out;
+        acc.store(out.data);
+        return out;
+    }
+
+    // ----------------------------------------------------------------------
+    // Batch functions
+
+    inline void dualQuaternionBatchWorldTransforms(
+        const FDualQuaternion *local,
+        const int32_t *parents,
+        FDualQuaternion *world,
+        size_t count)
+    {
+        for(size_t i = 0; i < count; i++) {
+            EXPOP_MATRIX_ASSERT(parents[i] < int64_t(i));
+            if(parents[i] < 0) {
+                world[i] = local[i];
+            } else {
+                world[i] = world[parents[i]] * local[i];
+            }
+        }
+    }
+
+    inline void dualQuaternionBatchSkinningPalette(
+        const FDualQuaternion *world,
+        const FDualQuaternion *inverseBind,
+        FDualQuaternion *palette,
+        size_t count)
+    {
+        for(size_t i = 0; i < count; i++) {
+            palette[i] = world[i] * inverseBind[i];
+        }
+    }
+
+    inline void dualQuaternionBatchSkinningPalette(
+        const FDualQuaternion *world,
+        const FDualQuaternion *inverseBind,
+        FMatrix4x4 *palette,
+        size_t count)
+    {
+        for(size_t i = 0; i < count; i++) {
+            palette[i] = (world[i] * inverseBind[i]).toMatrix4x4();
+        }
+    }
+}
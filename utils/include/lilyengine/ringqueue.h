@@ -0,0 +1,421 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Bounded lock-free ring queues for passing stuff between threads
+// without taking a mutex on every push and pop.
+//
+// SPSCRingQueue is for exactly one producer thread and exactly one
+// consumer thread (or a consumer side that's serialized some other
+// way, like by a mutex). MPMCRingQueue allows any number of each, at
+// the cost of a compare-and-swap per operation.
+//
+// Both of these are fixed-capacity. Capacity is rounded up to a power
+// of two so we can mask indices instead of doing a modulo. A push to
+// a full queue or a pop from an empty queue just returns false
+// immediately, and it's up to the caller to decide whether to spin,
+// sleep, or fall back to something slower.
+//
+// These don't depend on EXPOP_ENABLE_THREADS, because they only need
+// std::atomic and not the threading wrapper.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Size we pad things out to so that the producer side and the
+    /// consumer side don't fight over the same cache line.
+    const size_t ringQueueCacheLineSize = 64;
+
+    /// Round a capacity up to the next power of two (minimum of 2).
+    inline size_t ringQueueRoundCapacity(size_t capacity);
+
+    /// Bounded lock-free single-producer, single-consumer queue.
+    template<typename T>
+    class SPSCRingQueue
+    {
+    public:
+
+        /// Capacity will be rounded up to a power of two.
+        SPSCRingQueue(size_t capacity);
+        ~SPSCRingQueue(void);
+
+        /// Add something to the end of the queue. Returns false if
+        /// the queue is full. Producer thread only.
+        bool push(const T &value);
+        bool push(T &&value);
+
+        /// Take something off the front of the queue. Returns false
+        /// if the queue is empty. Consumer thread only.
+        bool pop(T &valueOut);
+
+        /// True if there's nothing in the queue. This is only a
+        /// snapshot, and may be out of date as soon as it returns.
+        bool empty(void) const;
+
+        /// Get the real (power of two) capacity.
+        size_t getCapacity(void) const;
+
+    private:
+
+        SPSCRingQueue(const SPSCRingQueue &other);
+        SPSCRingQueue &operator=(const SPSCRingQueue &other);
+
+        template<typename U>
+        bool pushInternal(U &&value);
+
+        char padding0[ringQueueCacheLineSize];
+
+        T *slots;
+        size_t mask;
+
+        char padding1[ringQueueCacheLineSize];
+
+        // Consumer-owned. Index of the next thing to pop.
+        std::atomic<size_t> head;
+
+        // Consumer's last look at the tail, so it doesn't have to
+        // touch the producer's cache line on every pop.
+        size_t cachedTail;
+
+        char padding2[ringQueueCacheLineSize];
+
+        // Producer-owned. Index of the next slot to push into.
+        std::atomic<size_t> tail;
+
+        // Producer's last look at the head.
+        size_t cachedHead;
+
+        char padding3[ringQueueCacheLineSize];
+    };
+
+    /// Bounded lock-free multi-producer, multi-consumer queue. Each
+    /// slot carries a sequence number that tells producers and
+    /// consumers whose turn it is, so nobody ever has to wait on a
+    /// lock, though a thread may have to retry if it loses a race for
+    /// the same slot.
+    template<typename T>
+    class MPMCRingQueue
+    {
+    public:
+
+        /// Capacity will be rounded up to a power of two.
+        MPMCRingQueue(size_t capacity);
+        ~MPMCRingQueue(void);
+
+        /// Add something to the end of the queue. Returns false if
+        /// the queue is full. Safe from any thread.
+        bool push(const T &value);
+        bool push(T &&value);
+
+        /// Take something off the front of the queue. Returns false
+        /// if the queue is empty. Safe from any thread.
+        bool pop(T &valueOut);
+
+        /// True if there's nothing in the queue. This is only a
+        /// snapshot, and may be out of date as soon as it returns.
+        bool empty(void) const;
+
+        /// Get the real (power of two) capacity.
+        size_t getCapacity(void) const;
+
+    private:
+
+        MPMCRingQueue(const MPMCRingQueue &other);
+        MPMCRingQueue &operator=(const MPMCRingQueue &other);
+
+        template<typename U>
+        bool pushInternal(U &&value);
+
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        char padding0[ringQueueCacheLineSize];
+
+        Slot *slots;
+        size_t mask;
+
+        char padding1[ringQueueCacheLineSize];
+
+        std::atomic<size_t> enqueuePosition;
+
+        char padding2[ringQueueCacheLineSize];
+
+        std::atomic<size_t> dequeuePosition;
+
+        char padding3[ringQueueCacheLineSize];
+    };
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    inline size_t ringQueueRoundCapacity(size_t capacity)
+    {
+        size_t ret = 2;
+        while(ret < capacity) {
+            ret <<= 1;
+        }
+        return ret;
+    }
+
+    // ----------------------------------------------------------------------
+    // SPSCRingQueue
+
+    template<typename T>
+    SPSCRingQueue<T>::SPSCRingQueue(size_t capacity) :
+        head(0),
+        tail(0)
+    {
+        size_t realCapacity = ringQueueRoundCapacity(capacity);
+        slots = new T[realCapacity];
+        mask = realCapacity - 1;
+        cachedTail = 0;
+        cachedHead = 0;
+    }
+
+    template<typename T>
+    SPSCRingQueue<T>::~SPSCRingQueue(void)
+    {
+        delete[] slots;
+    }
+
+    template<typename T>
+    template<typename U>
+    bool SPSCRingQueue<T>::pushInternal(U &&value)
+    {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+
+        // Only go and look at the real head if our cached one says
+        // we're full.
+        if(currentTail - cachedHead > mask) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if(currentTail - cachedHead > mask) {
+                return false;
+            }
+        }
+
+        slots[currentTail & mask] = std::forward<U>(value);
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename T>
+    bool SPSCRingQueue<T>::push(const T &value)
+    {
+        return pushInternal(value);
+    }
+
+    template<typename T>
+    bool SPSCRingQueue<T>::push(T &&value)
+    {
+        return pushInternal(std::move(value));
+    }
+
+    template<typename T>
+    bool SPSCRingQueue<T>::pop(T &valueOut)
+    {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+
+        if(currentHead == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if(currentHead == cachedTail) {
+                return false;
+            }
+        }
+
+        valueOut = std::move(slots[currentHead & mask]);
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename T>
+    bool SPSCRingQueue<T>::empty(void) const
+    {
+        return
+            head.load(std::memory_order_acquire) ==
+            tail.load(std::memory_order_acquire);
+    }
+
+    template<typename T>
+    size_t SPSCRingQueue<T>::getCapacity(void) const
+    {
+        return mask + 1;
+    }
+
+    // ----------------------------------------------------------------------
+    // MPMCRingQueue
+
+    template<typename T>
+    MPMCRingQueue<T>::MPMCRingQueue(size_t capacity) :
+        enqueuePosition(0),
+        dequeuePosition(0)
+    {
+        size_t realCapacity = ringQueueRoundCapacity(capacity);
+        slots = new Slot[realCapacity];
+        mask = realCapacity - 1;
+
+        // Each slot starts out ready to be written by the producer
+        // who gets its index.
+        for(size_t i = 0; i < realCapacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    template<typename T>
+    MPMCRingQueue<T>::~MPMCRingQueue(void)
+    {
+        delete[] slots;
+    }
+
+    template<typename T>
+    template<typename U>
+    bool MPMCRingQueue<T>::pushInternal(U &&value)
+    {
+        Slot *slot = NULL;
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+
+        while(true) {
+
+            slot = &slots[position & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = std::ptrdiff_t(sequence) - std::ptrdiff_t(position);
+
+            if(difference == 0) {
+
+                // Slot is free. Try to claim it.
+                if(enqueuePosition.compare_exchange_weak(
+                       position, position + 1,
+                       std::memory_order_relaxed)) {
+                    break;
+                }
+
+                // Somebody else got it. compare_exchange_weak already
+                // updated position, so just try again.
+
+            } else if(difference < 0) {
+
+                // Slot still has last lap's value in it. Full.
+                return false;
+
+            } else {
+
+                // Another producer got ahead of us.
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = std::forward<U>(value);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename T>
+    bool MPMCRingQueue<T>::push(const T &value)
+    {
+        return pushInternal(value);
+    }
+
+    template<typename T>
+    bool MPMCRingQueue<T>::push(T &&value)
+    {
+        return pushInternal(std::move(value));
+    }
+
+    template<typename T>
+    bool MPMCRingQueue<T>::pop(T &valueOut)
+    {
+        Slot *slot = NULL;
+        size_t position = dequeuePosition.load(std::memory_order_relaxed);
+
+        while(true) {
+
+            slot = &slots[position & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = std::ptrdiff_t(sequence) - std::ptrdiff_t(position + 1);
+
+            if(difference == 0) {
+
+                if(dequeuePosition.compare_exchange_weak(
+                       position, position + 1,
+                       std::memory_order_relaxed)) {
+                    break;
+                }
+
+            } else if(difference < 0) {
+
+                // Nothing written here yet. Empty.
+                return false;
+
+            } else {
+
+                position = dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        valueOut = std::move(slot->value);
+
+        // Mark the slot as free for whoever is one lap ahead of us.
+        slot->sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename T>
+    bool MPMCRingQueue<T>::empty(void) const
+    {
+        return
+            dequeuePosition.load(std::memory_order_acquire) >=
+            enqueuePosition.load(std::memory_order_acquire);
+    }
+
+    template<typename T>
+    size_t MPMCRingQueue<T>::getCapacity(void) const
+    {
+        return mask + 1;
+    }
+}
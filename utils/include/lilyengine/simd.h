@@ -0,0 +1,671 @@
+// ---------------------------------------------------------------------------
+//
+//   Lily Engine Utils
+//
+//   Copyright (c) 2012-2018 Kiri Jolly
+//     http://expiredpopsicle.com
+//     expiredpopsicle@gmail.com
+//
+// ---------------------------------------------------------------------------
+//
+//   This software is provided 'as-is', without any express or implied
+//   warranty. In no event will the authors be held liable for any
+//   damages arising from the use of this software.
+//
+//   Permission is granted to anyone to use this software for any
+//   purpose, including commercial applications, and to alter it and
+//   redistribute it freely, subject to the following restrictions:
+//
+//   1. The origin of this software must not be misrepresented; you must
+//      not claim that you wrote the original software. If you use this
+//      software in a product, an acknowledgment in the product
+//      documentation would be appreciated but is not required.
+//
+//   2. Altered source versions must be plainly marked as such, and must
+//      not be misrepresented as being the original software.
+//
+//   3. This notice may not be removed or altered from any source
+//      distribution.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Tiny wrapper around whatever 4-wide float SIMD the compiler is
+// targeting, so the heavier loops in here can be written once.
+//
+// We pick the instruction set at compile time: SSE2 on x86 (which
+// every x86-64 compiler assumes anyway), NEON on ARM, and plain
+// arrays everywhere else. There's no runtime CPU detection, since
+// everything here is header-only and we'd need per-function target
+// attributes to make that work across compilers. Define
+// EXPOP_SIMD_DISABLE to force the scalar version.
+//
+// Every operation does the same IEEE single-precision math on each
+// lane as the equivalent scalar code would, so the results don't
+// depend on which implementation got picked.
+
+// ----------------------------------------------------------------------
+// Needed headers
+// ----------------------------------------------------------------------
+
+#pragma once
+
+#if !defined(EXPOP_SIMD_DISABLE) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define EXPOP_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif !defined(EXPOP_SIMD_DISABLE) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define EXPOP_SIMD_NEON 1
+#include <arm_neon.h>
+#else
+#define EXPOP_SIMD_SCALAR 1
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// ----------------------------------------------------------------------
+// Declarations and documentation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+    /// Four floats, operated on together.
+    struct SimdFloat4
+    {
+      #if EXPOP_SIMD_SSE2
+        __m128 v;
+      #elif EXPOP_SIMD_NEON
+        float32x4_t v;
+      #else
+        float v[4];
+      #endif
+
+        /// Load four floats. No alignment requirement.
+        static SimdFloat4 load(const float *p);
+
+        /// Store four floats. No alignment requirement.
+        void store(float *p) const;
+
+        /// Load three floats, with zero in the last lane. Never
+        /// touches p[3].
+        static SimdFloat4 load3(const float *p);
+
+        /// Store the first three lanes. Never touches p[3].
+        void store3(float *p) const;
+
+        /// Set all four lanes to the same value.
+        static SimdFloat4 splat(float f);
+
+        /// All zeros.
+        static SimdFloat4 zero();
+
+        /// Set each lane.
+        static SimdFloat4 set(float x, float y, float z, float w);
+
+        /// Get a single lane. Slow. Don't use this in inner loops.
+        float getLane(int i) const;
+
+        /// Load four bytes, as floats from 0 to 255.
+        static SimdFloat4 loadBytes(const uint8_t *p);
+
+        /// Store four bytes. Each lane gets clamped to [0, 255] and
+        /// then truncated toward zero.
+        void storeBytes(uint8_t *p) const;
+    };
+
+    SimdFloat4 operator+(const SimdFloat4 &a, const SimdFloat4 &b);
+    SimdFloat4 operator-(const SimdFloat4 &a, const SimdFloat4 &b);
+    SimdFloat4 operator*(const SimdFloat4 &a, const SimdFloat4 &b);
+
+    /// Correctly rounded division on every lane. Much slower than
+    /// multiplying by a reciprocal, but it gives the exact same
+    /// result as scalar division.
+    SimdFloat4 operator/(const SimdFloat4 &a, const SimdFloat4 &b);
+
+    /// acc + a * b. This is a separate multiply and add, not a fused
+    /// one, so it rounds the same way the scalar code does.
+    SimdFloat4 simdMulAdd(const SimdFloat4 &acc, const SimdFloat4 &a, const SimdFloat4 &b);
+
+    SimdFloat4 simdMin(const SimdFloat4 &a, const SimdFloat4 &b);
+    SimdFloat4 simdMax(const SimdFloat4 &a, const SimdFloat4 &b);
+
+    /// Round toward zero. Only for values that fit in an int32_t.
+    SimdFloat4 simdTruncate(const SimdFloat4 &a);
+
+    /// Correctly rounded square root, same as std::sqrt on each lane.
+    SimdFloat4 simdSqrt(const SimdFloat4 &a);
+
+    /// Copy one lane into all four.
+    template<int lane>
+    SimdFloat4 simdSplatLane(const SimdFloat4 &a);
+
+    /// Transpose a 4x4 block held in four registers, so a gets the
+    /// first lane of each of them, b gets the second, and so on.
+    void simdTranspose(SimdFloat4 &a, SimdFloat4 &b, SimdFloat4 &c, SimdFloat4 &d);
+
+    /// Swap neighbouring lanes: (x, y, z, w) becomes (y, x, w, z).
+    SimdFloat4 simdSwapPairs(const SimdFloat4 &a);
+
+    /// Swap the low and high halves: (x, y, z, w) becomes (z, w, x, y).
+    SimdFloat4 simdSwapHalves(const SimdFloat4 &a);
+
+    /// Compare each lane, and pack the results into the low four
+    /// bits of an int: bit i is set if lane i of a is less than lane
+    /// i of b. NaNs compare false.
+    int simdLessThanMask(const SimdFloat4 &a, const SimdFloat4 &b);
+}
+
+// ----------------------------------------------------------------------
+// Implementation
+// ----------------------------------------------------------------------
+
+namespace ExPop
+{
+#if EXPOP_SIMD_SSE2
+
+    inline SimdFloat4 SimdFloat4::load(const float *p)
+    {
+        SimdFloat4 r;
+        r.v = _mm_loadu_ps(p);
+        return r;
+    }
+
+    inline void SimdFloat4::store(float *p) const
+    {
+        _mm_storeu_ps(p, v);
+    }
+
+    inline SimdFloat4 SimdFloat4::splat(float f)
+    {
+        SimdFloat4 r;
+        r.v = _mm_set1_ps(f);
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::zero()
+    {
+        SimdFloat4 r;
+        r.v = _mm_setzero_ps();
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::set(float x, float y, float z, float w)
+    {
+        SimdFloat4 r;
+        r.v = _mm_setr_ps(x, y, z, w);
+        return r;
+    }
+
+    inline SimdFloat4 operator+(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = _mm_add_ps(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 operator-(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = _mm_sub_ps(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 operator*(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = _mm_mul_ps(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 operator/(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = _mm_div_ps(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 simdMin(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = _mm_min_ps(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 simdMax(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = _mm_max_ps(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 simdTruncate(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+        return r;
+    }
+
+    inline SimdFloat4 simdSqrt(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = _mm_sqrt_ps(a.v);
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::loadBytes(const uint8_t *p)
+    {
+        int32_t word;
+        memcpy(&word, p, 4);
+        __m128i zero = _mm_setzero_si128();
+        __m128i i = _mm_cvtsi32_si128(word);
+        i = _mm_unpacklo_epi8(i, zero);
+        i = _mm_unpacklo_epi16(i, zero);
+        SimdFloat4 r;
+        r.v = _mm_cvtepi32_ps(i);
+        return r;
+    }
+
+    inline void SimdFloat4::storeBytes(uint8_t *p) const
+    {
+        __m128 clamped = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+        __m128i i = _mm_cvttps_epi32(clamped);
+        i = _mm_packs_epi32(i, i);
+        i = _mm_packus_epi16(i, i);
+        int32_t word = _mm_cvtsi128_si32(i);
+        memcpy(p, &word, 4);
+    }
+
+    template<int lane>
+    inline SimdFloat4 simdSplatLane(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(lane, lane, lane, lane));
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::load3(const float *p)
+    {
+        SimdFloat4 r;
+        r.v = _mm_movelh_ps(
+            _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(p)),
+            _mm_load_ss(p + 2));
+        return r;
+    }
+
+    inline void SimdFloat4::store3(float *p) const
+    {
+        _mm_storel_pi(reinterpret_cast<__m64*>(p), v);
+        _mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+    }
+
+    inline void simdTranspose(SimdFloat4 &a, SimdFloat4 &b, SimdFloat4 &c, SimdFloat4 &d)
+    {
+        _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+    }
+
+    inline SimdFloat4 simdSwapPairs(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1));
+        return r;
+    }
+
+    inline SimdFloat4 simdSwapHalves(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 0, 3, 2));
+        return r;
+    }
+
+    inline int simdLessThanMask(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v));
+    }
+
+#elif EXPOP_SIMD_NEON
+
+    inline SimdFloat4 SimdFloat4::load(const float *p)
+    {
+        SimdFloat4 r;
+        r.v = vld1q_f32(p);
+        return r;
+    }
+
+    inline void SimdFloat4::store(float *p) const
+    {
+        vst1q_f32(p, v);
+    }
+
+    inline SimdFloat4 SimdFloat4::splat(float f)
+    {
+        SimdFloat4 r;
+        r.v = vdupq_n_f32(f);
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::zero()
+    {
+        return splat(0.0f);
+    }
+
+    inline SimdFloat4 SimdFloat4::set(float x, float y, float z, float w)
+    {
+        float f[4] = { x, y, z, w };
+        return load(f);
+    }
+
+    inline SimdFloat4 operator+(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = vaddq_f32(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 operator-(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = vsubq_f32(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 operator*(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = vmulq_f32(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 operator/(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+      #if defined(__aarch64__) || defined(_M_ARM64)
+        r.v = vdivq_f32(a.v, b.v);
+      #else
+        // 32-bit NEON only has a reciprocal estimate, which doesn't
+        // round the same way.
+        float av[4], bv[4];
+        vst1q_f32(av, a.v);
+        vst1q_f32(bv, b.v);
+        for(int i = 0; i < 4; i++) av[i] /= bv[i];
+        r.v = vld1q_f32(av);
+      #endif
+        return r;
+    }
+
+    inline SimdFloat4 simdMin(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = vminq_f32(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 simdMax(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        r.v = vmaxq_f32(a.v, b.v);
+        return r;
+    }
+
+    inline SimdFloat4 simdTruncate(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = vcvtq_f32_s32(vcvtq_s32_f32(a.v));
+        return r;
+    }
+
+    inline SimdFloat4 simdSqrt(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+      #if defined(__aarch64__) || defined(_M_ARM64)
+        r.v = vsqrtq_f32(a.v);
+      #else
+        // Same problem as division. Only an estimate on 32-bit.
+        float av[4];
+        vst1q_f32(av, a.v);
+        for(int i = 0; i < 4; i++) av[i] = std::sqrt(av[i]);
+        r.v = vld1q_f32(av);
+      #endif
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::loadBytes(const uint8_t *p)
+    {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        uint16x8_t halves = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(word)));
+        SimdFloat4 r;
+        r.v = vcvtq_f32_u32(vmovl_u16(vget_low_u16(halves)));
+        return r;
+    }
+
+    inline void SimdFloat4::storeBytes(uint8_t *p) const
+    {
+        float32x4_t clamped = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(255.0f));
+        uint16x4_t halves = vmovn_u32(vcvtq_u32_f32(clamped));
+        uint8x8_t bytes = vmovn_u16(vcombine_u16(halves, halves));
+        uint32_t word = vget_lane_u32(vreinterpret_u32_u8(bytes), 0);
+        memcpy(p, &word, 4);
+    }
+
+    template<int lane>
+    inline SimdFloat4 simdSplatLane(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = vdupq_n_f32(vgetq_lane_f32(a.v, lane));
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::load3(const float *p)
+    {
+        SimdFloat4 r;
+        r.v = vcombine_f32(vld1_f32(p), vld1_lane_f32(p + 2, vdup_n_f32(0.0f), 0));
+        return r;
+    }
+
+    inline void SimdFloat4::store3(float *p) const
+    {
+        vst1_f32(p, vget_low_f32(v));
+        vst1q_lane_f32(p + 2, v, 2);
+    }
+
+    inline void simdTranspose(SimdFloat4 &a, SimdFloat4 &b, SimdFloat4 &c, SimdFloat4 &d)
+    {
+        // a0 b0 a2 b2, a1 b1 a3 b3, and the same for c and d.
+        float32x4x2_t ab = vtrnq_f32(a.v, b.v);
+        float32x4x2_t cd = vtrnq_f32(c.v, d.v);
+        a.v = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+        b.v = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+        c.v = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+        d.v = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+    }
+
+    inline SimdFloat4 simdSwapPairs(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = vrev64q_f32(a.v);
+        return r;
+    }
+
+    inline SimdFloat4 simdSwapHalves(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        r.v = vextq_f32(a.v, a.v, 2);
+        return r;
+    }
+
+    inline int simdLessThanMask(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        static const uint32_t bits[4] = { 1, 2, 4, 8 };
+        uint32x4_t masked = vandq_u32(vcltq_f32(a.v, b.v), vld1q_u32(bits));
+      #if defined(__aarch64__) || defined(_M_ARM64)
+        return int(vaddvq_u32(masked));
+      #else
+        uint32x2_t pairs = vorr_u32(vget_low_u32(masked), vget_high_u32(masked));
+        return int(vget_lane_u32(pairs, 0) | vget_lane_u32(pairs, 1));
+      #endif
+    }
+
+#else
+
+    inline SimdFloat4 SimdFloat4::load(const float *p)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = p[i];
+        return r;
+    }
+
+    inline void SimdFloat4::store(float *p) const
+    {
+        for(int i = 0; i < 4; i++) p[i] = v[i];
+    }
+
+    inline SimdFloat4 SimdFloat4::splat(float f)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = f;
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::zero()
+    {
+        return splat(0.0f);
+    }
+
+    inline SimdFloat4 SimdFloat4::set(float x, float y, float z, float w)
+    {
+        SimdFloat4 r;
+        r.v[0] = x; r.v[1] = y; r.v[2] = z; r.v[3] = w;
+        return r;
+    }
+
+    inline SimdFloat4 operator+(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = a.v[i] + b.v[i];
+        return r;
+    }
+
+    inline SimdFloat4 operator-(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = a.v[i] - b.v[i];
+        return r;
+    }
+
+    inline SimdFloat4 operator*(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i];
+        return r;
+    }
+
+    inline SimdFloat4 operator/(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = a.v[i] / b.v[i];
+        return r;
+    }
+
+    inline SimdFloat4 simdMin(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+        return r;
+    }
+
+    inline SimdFloat4 simdMax(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+        return r;
+    }
+
+    inline SimdFloat4 simdTruncate(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = float(int32_t(a.v[i]));
+        return r;
+    }
+
+    inline SimdFloat4 simdSqrt(const SimdFloat4 &a)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = std::sqrt(a.v[i]);
+        return r;
+    }
+
+    inline SimdFloat4 SimdFloat4::loadBytes(const uint8_t *p)
+    {
+        SimdFloat4 r;
+        for(int i = 0; i < 4; i++) r.v[i] = float(p[i]);
+        return r;
+    }
+
+    inline void SimdFloat4::storeBytes(uint8_t *p) const
+    {
+        for(int i = 0; i < 4; i++) {
+            float f = v[i] < 0.0f ? 0.0f : (v[i] > 255.0f ? 255.0f : v[i]);
+            p[i] = uint8_t(f);
+        }
+    }
+
+    template<int lane>
+    inline SimdFloat4 simdSplatLane(const SimdFloat4 &a)
+    {
+        return SimdFloat4::splat(a.v[lane]);
+    }
+
+    inline SimdFloat4 SimdFloat4::load3(const float *p)
+    {
+        return set(p[0], p[1], p[2], 0.0f);
+    }
+
+    inline void SimdFloat4::store3(float *p) const
+    {
+        for(int i = 0; i < 3; i++) p[i] = v[i];
+    }
+
+    inline void simdTranspose(SimdFloat4 &a, SimdFloat4 &b, SimdFloat4 &c, SimdFloat4 &d)
+    {
+        SimdFloat4 *rows[4] = { &a, &b, &c, &d };
+        for(int i = 0; i < 4; i++) {
+            for(int j = i + 1; j < 4; j++) {
+                float tmp = rows[i]->v[j];
+                rows[i]->v[j] = rows[j]->v[i];
+                rows[j]->v[i] = tmp;
+            }
+        }
+    }
+
+    inline SimdFloat4 simdSwapPairs(const SimdFloat4 &a)
+    {
+        return SimdFloat4::set(a.v[1], a.v[0], a.v[3], a.v[2]);
+    }
+
+    inline SimdFloat4 simdSwapHalves(const SimdFloat4 &a)
+    {
+        return SimdFloat4::set(a.v[2], a.v[3], a.v[0], a.v[1]);
+    }
+
+    inline int simdLessThanMask(const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        int mask = 0;
+        for(int i = 0; i < 4; i++) mask |= (a.v[i] < b.v[i]) << i;
+        return mask;
+    }
+
+#endif
+
+    inline float SimdFloat4::getLane(int i) const
+    {
+        float f[4];
+        store(f);
+        return f[i];
+    }
+
+    inline SimdFloat4 simdMulAdd(const SimdFloat4 &acc, const SimdFloat4 &a, const SimdFloat4 &b)
+    {
+        return acc + a * b;
+    }
+}
@@ -46,13 +46,20 @@
 #include "base64.h"
 #include "filesystem.h"
 #include "matrix.h"
+#include "matrixbatch.h"
+#include "quaternion.h"
+#include "frustum.h"
 #include "angle.h"
 #include "lilyparser.h"
 #include "lilyparserxml.h"
 #include "lilyparserjson.h"
 #include "assetloader.h"
+#include "ringqueue.h"
+#include "simd.h"
+#include "parallel.h"
 #include "preprocess.h"
 #include "cellarray.h"
+#include "chunkedcellarray.h"
 #include "expopsockets.h"
 #include "params.h"
 #include "params_advanced.h"
@@ -64,10 +71,16 @@
 
 #include "graphicalconsole/graphicalconsole.h"
 
+#include "pixelimage/pixelimage_pool.h"
 #include "pixelimage/pixelimage.h"
+#include "pixelimage/pixelimage_convert.h"
+#include "pixelimage/pixelimage_access.h"
+#include "pixelimage/pixelimage_view.h"
 #include "pixelimage/pixelimage_legacy.h"
 #include "pixelimage/pixelimage_scale.h"
+#include "pixelimage/pixelimage_mip.h"
 #include "pixelimage/pixelimage_tga.h"
+#include "pixelimage/pixelimage_bc.h"
 #include "pixelimage/pixelimage_blit.h"
 #include "pixelimage/pixelimage_stb.h"
 